@@ -70,9 +70,39 @@ namespace qi {
    */
   QI_API AnyReference decodeBinary(qi::BufferReader *buf, AnyReference gvp, DeserializeObjectCallback onObject=DeserializeObjectCallback(), StreamContext* ctx = 0);
 
+  /** Compute the number of bytes that encodeBinary writes in a buffer for \p gvp.
+   * The sub-buffers of raw values are not counted as they are not copied, nor
+   * are objects whose encoding depends on the connection. It visits the whole
+   * value: encodeBinary only reserves an estimate of this size.
+   */
+  QI_API std::size_t encodedBinarySize(const qi::AutoAnyReference &gvp);
+
+  namespace detail
+  {
+    QI_API BOOST_NORETURN void throwStaticDecodingError();
+
+    template <typename T>
+    AnyReference decodeBinary(qi::BufferReader *buf, T* value, DeserializeObjectCallback,
+                              StreamContext*, std::true_type)
+    {
+      if (!decodeStatic(*buf, *value))
+        throwStaticDecodingError();
+      return AnyReference::fromPtr(value);
+    }
+
+    template <typename T>
+    AnyReference decodeBinary(qi::BufferReader *buf, T* value, DeserializeObjectCallback onObject,
+                              StreamContext* ctx, std::false_type)
+    {
+      return qi::decodeBinary(buf, AnyReference::fromPtr(value), onObject, ctx);
+    }
+  }
+
+  /// Types known at compile time to have a fixed encoding are decoded without
+  /// the type visitors, see `detail::StaticBinaryCodec`.
   template <typename T>
   AnyReference decodeBinary(qi::BufferReader *buf, T* value, DeserializeObjectCallback onObject, StreamContext* ctx) {
-    return decodeBinary(buf, AnyReference::fromPtr(value), onObject, ctx);
+    return detail::decodeBinary(buf, value, onObject, ctx, detail::HasStaticBinaryCodec<T>{});
   }
 }
 
@@ -0,0 +1,113 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _QI_BINARYVIEW_HPP_
+#define _QI_BINARYVIEW_HPP_
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <qi/api.hpp>
+#include <qi/anyvalue.hpp>
+#include <qi/binarycodec.hpp>
+#include <qi/buffer.hpp>
+#include <qi/signature.hpp>
+
+namespace qi
+{
+  /// Read-only view of a value encoded by `encodeBinary`, that decodes it
+  /// lazily from the buffer holding it.
+  ///
+  /// Strings and raw data are exposed in place, and the elements of the
+  /// containers are only located when they are accessed: a value that is only
+  /// partially read is not decoded entirely. The views of the elements share
+  /// the buffer, which lives as long as one of them does.
+  ///
+  /// The accessors mirror the ones of `AnyReference`, and throw a
+  /// `std::runtime_error` if the signature of the view does not allow them or
+  /// if the data is ill-formed. Objects cannot be viewed, nor decoded.
+  class QI_API BinaryView
+  {
+  public:
+    using BufferPtr = boost::shared_ptr<const Buffer>;
+
+    /// Constructs an invalid view.
+    BinaryView();
+
+    /// Constructs a view of the value of signature `signature` encoded at
+    /// the beginning of `buffer`, which is moved in the view.
+    BinaryView(Buffer buffer, const Signature& signature);
+
+    /// Constructs a view of the value of signature `signature` encoded at
+    /// `offset` in `buffer`.
+    BinaryView(BufferPtr buffer, const Signature& signature, std::size_t offset = 0);
+
+    /// Returns false for the default constructed views, the content of a
+    /// void dynamic value and the content of an unset optional.
+    bool isValid() const;
+
+    const Signature& signature() const;
+    const BufferPtr& buffer() const;
+    std::size_t offset() const;
+
+    /// Number of elements of a list or a map, or number of fields of a tuple.
+    std::size_t size() const;
+
+    /// Element of a list, value of a map or field of a tuple at `index`.
+    /// Locating it skips the elements before it, unless the elements have a
+    /// fixed size.
+    BinaryView element(std::size_t index) const;
+    BinaryView operator[](std::size_t index) const { return element(index); }
+
+    /// Key of the element of a map at `index`.
+    BinaryView elementKey(std::size_t index) const;
+
+    /// Elements of a list or fields of a tuple, located in a single pass.
+    std::vector<BinaryView> elements() const;
+
+    /// Keys and values of a map, located in a single pass.
+    std::vector<std::pair<BinaryView, BinaryView>> mapElements() const;
+
+    /// Content of a dynamic value or of an optional. The view is invalid if
+    /// the dynamic value is void or if the optional is unset.
+    BinaryView content() const;
+
+    bool optionalHasValue() const;
+
+    /// Characters of a string, in the buffer.
+    std::pair<const char*, std::size_t> asString() const;
+
+    /// Data of a raw buffer, in the buffer.
+    std::pair<const char*, std::size_t> asRaw() const;
+
+    /// Decodes the value, in a value of the type of its signature.
+    AnyValue toValue() const;
+
+    /// Decodes the value in a `T`. It is decoded directly if the signature of
+    /// `T` is the one of the view, and converted otherwise.
+    template <typename T>
+    T to() const;
+
+  private:
+    BufferPtr _buffer;
+    Signature _signature;
+    std::size_t _offset;
+  };
+
+  template <typename T>
+  T BinaryView::to() const
+  {
+    if (!isValid() || typeOf<T>()->signature() != _signature)
+      return toValue().to<T>();
+    T value{};
+    BufferReader reader(*_buffer, _offset);
+    decodeBinary(&reader, &value);
+    return value;
+  }
+}
+
+#endif // _QI_BINARYVIEW_HPP_
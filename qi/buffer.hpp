@@ -170,6 +170,15 @@ namespace qi
      * \warning The return value is valid until the next non-const operation.
      */
     void* reserve(size_t size);
+    /**
+     * \brief Make room for bytes at the end of current buffer, without
+     * writing them.
+     * \param size number of bytes that can then be written without
+     * reallocating the data.
+     * \return true if succeed, false otherwise.
+     * If the data is reallocated, it grows by half of its capacity at least.
+     */
+    bool reserveCapacity(size_t size);
     /**
      * \brief Erase content of buffer and remove sub-buffers whithout clearing them.
      */
@@ -232,6 +241,13 @@ namespace qi
      * \param buf The buffer to copy.
      */
     explicit BufferReader(const Buffer& buf);
+    /**
+     * \brief Constructor of a reader at a position of the buffer.
+     * \param buf The buffer to read.
+     * \param position The offset of the first byte to read. The sub-buffers
+     * before it are skipped.
+     */
+    BufferReader(const Buffer& buf, size_t position);
     /// \brief Default destructor.
     ~BufferReader();
 
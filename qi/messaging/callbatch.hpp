@@ -0,0 +1,58 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _QIMESSAGING_CALLBATCH_HPP_
+#define _QIMESSAGING_CALLBATCH_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <boost/noncopyable.hpp>
+#include <qi/api.hpp>
+
+namespace qi
+{
+  class CallBatchPrivate;
+
+  /// While it lives, holds the remote calls made by the current thread, and
+  /// sends them when it is flushed or destroyed. The calls to the services
+  /// reached through the same socket are sent in one message if the remote end
+  /// supports it, and their replies come back together, but the future of
+  /// each call is set on its own. Batches can be nested: calls are held by the
+  /// innermost one.
+  ///
+  /// It saves the headers, the writes and the dispatches of bursts of small
+  /// calls. The calls are only sent when the batch is flushed: do not wait for
+  /// their futures before.
+  ///
+  /// Usage:
+  /// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  /// std::vector<qi::Future<int>> values;
+  /// {
+  ///   qi::CallBatch batch;
+  ///   for (const auto& name: names)
+  ///     values.push_back(service.property<int>(name));
+  /// }
+  /// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  class QI_API CallBatch : private boost::noncopyable
+  {
+  public:
+    CallBatch();
+    /// Flushes the batch.
+    ~CallBatch();
+
+    /// Sends the calls held so far. The futures of the calls that cannot be
+    /// sent are set in error.
+    void flush();
+
+    /// Count of calls held.
+    std::size_t size() const;
+
+  private:
+    std::unique_ptr<CallBatchPrivate> _p;
+  };
+}
+
+#endif // _QIMESSAGING_CALLBATCH_HPP_
@@ -0,0 +1,62 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _QIMESSAGING_CALLTIMEOUT_HPP_
+#define _QIMESSAGING_CALLTIMEOUT_HPP_
+
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <qi/api.hpp>
+#include <qi/clock.hpp>
+
+namespace qi
+{
+  /// While it lives, sets the timeout of the remote calls made by the current
+  /// thread. It takes precedence over the timeouts of the methods and over the
+  /// default timeout. Scopes can be nested.
+  ///
+  /// When a call times out, its future is set in error and the remote end is
+  /// asked to cancel it.
+  ///
+  /// Usage:
+  /// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  /// {
+  ///   qi::CallTimeoutScope timeout{qi::Seconds(2)};
+  ///   auto future = service.async<int>("compute", 42);
+  /// }
+  /// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  class QI_API CallTimeoutScope : private boost::noncopyable
+  {
+  public:
+    /// A zero timeout disables the timeout of the calls.
+    explicit CallTimeoutScope(Duration timeout);
+    ~CallTimeoutScope();
+
+  private:
+    boost::optional<Duration> _previous;
+  };
+
+  /// Sets the timeout of the remote calls to a method of a service, by names.
+  /// A zero timeout disables the timeout of the calls.
+  QI_API void setMethodCallTimeout(const std::string& service, const std::string& method,
+                                   Duration timeout);
+
+  /// Restores the default timeout for the remote calls to a method of a service.
+  QI_API void resetMethodCallTimeout(const std::string& service, const std::string& method);
+
+  /// Sets the timeout of the remote calls that have no other timeout. It is
+  /// initially read from the `QI_MESSAGE_TIMEOUT` environment variable, in
+  /// seconds. By default, and with a zero timeout, calls do not time out.
+  QI_API void setDefaultCallTimeout(Duration timeout);
+  QI_API Duration defaultCallTimeout();
+
+  /// Returns the timeout of a remote call to a method of a service made by the
+  /// current thread, or none if the call does not time out.
+  QI_API boost::optional<Duration> callTimeout(const std::string& service, const std::string& method);
+}
+
+#endif // _QIMESSAGING_CALLTIMEOUT_HPP_
@@ -302,6 +302,9 @@ namespace qi { namespace sock {
 ///         (ConstBufferSequence only constrained by the following)
 ///     && N::async_read(sslSocketLValue, mutable_bufs, transferHandler)
 ///     && N::async_read(sslSocketLValue.next_layer(), mutable_bufs, transferHandler)
+///     && bool b = N::read_ahead; (constant expression)
+///     && N::async_read_some(sslSocketLValue, mutable_bufs, transferHandler) if N::read_ahead
+///     && N::async_read_some(sslSocketLValue.next_layer(), mutable_bufs, transferHandler) if N::read_ahead
 ///     && N::async_write(sslSocketLValue, const_bufs, transferHandler)
 ///     && N::async_write(sslSocketLValue.next_layer(), const_bufs, transferHandler)
 /// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -8,6 +8,7 @@
 #include <qi/messaging/sock/option.hpp>
 #include <qi/messaging/sock/resolve.hpp>
 #include <qi/messaging/sock/common.hpp>
+#include <qi/messaging/sock/sslsession.hpp>
 #include <ka/src.hpp>
 #include <qi/url.hpp>
 #include <qi/future.hpp>
@@ -142,7 +143,9 @@ namespace qi { namespace sock {
   /// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   ///
   /// From a more technical point of view, the different connecting steps
-  /// are: URL resolving, socket connecting and SSL handshake if needed.
+  /// are: URL resolving, socket connecting and SSL handshake if needed. The
+  /// SSL handshake resumes the session of a previous connection to the same
+  /// URL if possible (see `prepareSslSessionResumption`).
   ///
   /// Network N,
   /// With NetSslSocket S:
@@ -187,6 +190,11 @@ namespace qi { namespace sock {
             return;
           }
           auto socket = createSocket<N>(ssl, makeSocket);
+          if (*ssl)
+          {
+            // Reconnections to the same URL do an abbreviated handshake.
+            prepareSslSessionResumption(*socket, url.str());
+          }
           connect<N>(socket, entry.value(), onComplete, ssl, side, tcpPingTimeout, setupStop);
         },
         setupStop
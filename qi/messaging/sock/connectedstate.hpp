@@ -3,6 +3,7 @@
 #define _QI_SOCK_CONNECTEDSTATE_HPP
 #include <memory>
 #include <utility>
+#include <vector>
 #include <boost/optional.hpp>
 #include <qi/atomic.hpp>
 #include <ka/functional.hpp>
@@ -142,7 +143,7 @@ namespace qi
         SyncConnectedResultPtr<N, S> _result;
         std::atomic<bool> _stopRequested;
         std::atomic<bool> _shuttingdown;
-        ReceiveMessageContinuous<N> _receiveMsg;
+        ReceiveMessage<N> _receiveMsg;
         SendMessageEnqueue<N, SocketPtr<S>> _sendMsg;
 
         Impl(const SocketPtr<S>& socket);
@@ -152,7 +153,14 @@ namespace qi
         void start(SslEnabled, size_t maxPayload, Proc onReceive, qi::int64_t messageHandlingTimeoutInMus);
 
         template<typename Msg, typename Proc>
-        void send(Msg&& msg, SslEnabled, Proc onSent);
+        bool send(Msg&& msg, SslEnabled, Proc onSent);
+
+        template<typename Proc>
+        bool sendAll(std::vector<Message> msgs, SslEnabled, Proc onSent);
+
+        /// Precondition: The message has been admitted by the send queue.
+        template<typename Msg, typename Proc>
+        void enqueue(Msg&& msg, SslEnabled, Proc onSent);
 
         void stop(Promise<void> disconnectedPromise)
         {
@@ -213,12 +221,38 @@ namespace qi
       /// If `onSent` returns false, the processing of enqueued messages stops.
       /// By default, we continue sending messages even if an error occurred.
       ///
+      /// Returns false if the message was refused by the send queue (see
+      /// `SendQueuePolicy`), in which case `onSent` is not called for it.
+      ///
       /// Procedure<bool (ErrorCode<N>, std::list<Message>::const_iterator)>
       template<typename Msg, typename Proc = ka::constant_function_t<bool>>
-      void send(Msg&& msg, SslEnabled ssl, const Proc& onSent = {true})
+      bool send(Msg&& msg, SslEnabled ssl, const Proc& onSent = {true})
       {
         return _impl->send(std::forward<Msg>(msg), ssl, onSent);
       }
+      /// Sends the messages in order, once the send queue admitted them all
+      /// at once. Returns false if they were refused, in which case none of
+      /// them is sent.
+      ///
+      /// Procedure<bool (ErrorCode<N>, std::list<Message>::const_iterator)>
+      template<typename Proc = ka::constant_function_t<bool>>
+      bool sendAll(std::vector<Message> msgs, SslEnabled ssl, const Proc& onSent = {true})
+      {
+        return _impl->sendAll(std::move(msgs), ssl, onSent);
+      }
+      void setSendQueueLimits(SendQueueLimits limits)
+      {
+        _impl->_sendMsg.setQueueLimits(limits);
+      }
+      SendQueueStats sendQueueStats() const
+      {
+        return _impl->_sendMsg.queueStats();
+      }
+      /// Set once the send queue is below its limits.
+      Future<void> sendQueueReady()
+      {
+        return _impl->_sendMsg.ready();
+      }
       Future<SyncConnectedResultPtr<N, S>> complete() const
       {
         return _impl->_completePromise->future();
@@ -320,7 +354,30 @@ namespace qi
 
     template<typename N, typename S>
     template<typename Msg, typename Proc>
-    void Connected<N, S>::Impl::send(Msg&& msg, SslEnabled ssl, Proc onSent)
+    bool Connected<N, S>::Impl::send(Msg&& msg, SslEnabled ssl, Proc onSent)
+    {
+      // The admission is done before stranding, so that the queue limits also
+      // account for the messages waiting for the strand.
+      if (!_sendMsg.admit(msg))
+        return false;
+      enqueue(std::forward<Msg>(msg), ssl, std::move(onSent));
+      return true;
+    }
+
+    template<typename N, typename S>
+    template<typename Proc>
+    bool Connected<N, S>::Impl::sendAll(std::vector<Message> msgs, SslEnabled ssl, Proc onSent)
+    {
+      if (!_sendMsg.admit(msgs))
+        return false;
+      for (auto& msg: msgs)
+        enqueue(std::move(msg), ssl, onSent);
+      return true;
+    }
+
+    template<typename N, typename S>
+    template<typename Msg, typename Proc>
+    void Connected<N, S>::Impl::enqueue(Msg&& msg, SslEnabled ssl, Proc onSent)
     {
       using SendMessage = decltype(_sendMsg);
       using ReadableMessage = typename SendMessage::ReadableMessage;
@@ -26,6 +26,8 @@ namespace qi { namespace sock {
     using error_code_type = boost::system::error_code;
     using io_service_type = boost::asio::io_service;
     using const_buffer_type = boost::asio::const_buffer;
+    /// Messages are received through a read-ahead buffer (see receive.hpp).
+    static constexpr bool read_ahead = true;
     static io_service_type& defaultIoService()
     {
       return *static_cast<io_service_type*>(getNetworkEventLoop()->nativeHandle());
@@ -48,6 +50,12 @@ namespace qi { namespace sock {
     {
       boost::asio::async_read(s, b, h);
     }
+    /// NetSslSocket S, MutableBufferSequence B, ReadHandler H
+    template<typename S, typename B, typename H>
+    static void async_read_some(S& s, const B& b, H h)
+    {
+      s.async_read_some(b, h);
+    }
     /// NetSslSocket S, ConstBufferSequence B, WriteHandler H
     template<typename S, typename B, typename H>
     static void async_write(S& s, const B& b, H h)
@@ -0,0 +1,280 @@
+#pragma once
+#ifndef _QI_SOCK_NETWORKASIOLOCAL_HPP
+#define _QI_SOCK_NETWORKASIOLOCAL_HPP
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/optional.hpp>
+#include <qi/messaging/sock/concept.hpp>
+#include <qi/messaging/sock/option.hpp>
+#include <qi/eventloop.hpp>
+#include <qi/url.hpp>
+
+/// @file
+/// Contains the implementation of the Network concept for boost::asio local
+/// (Unix-domain) stream sockets.
+///
+/// The socket addressed by the URL `unix:///path/to/socket` is bound to the
+/// filesystem path `/path/to/socket`.
+///
+/// There is no name resolution and no SSL on local sockets: the resolver
+/// immediately yields the endpoint designated by the URL, and the handshake
+/// completes immediately. SSL is therefore always disabled for this model.
+///
+/// See traits.hpp
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+namespace qi { namespace sock {
+
+  /// Model the `Network` concept for boost::asio local stream sockets.
+  struct NetworkAsioLocal
+  {
+    using protocol_type = boost::asio::local::stream_protocol;
+    using acceptor_type = protocol_type::acceptor;
+    using error_code_type = boost::system::error_code;
+    using io_service_type = boost::asio::io_service;
+    using const_buffer_type = boost::asio::const_buffer;
+    /// Messages are received through a read-ahead buffer (see receive.hpp).
+    static constexpr bool read_ahead = true;
+
+    /// Local sockets do not implement Nagle's algorithm: setting this option
+    /// is a no-op.
+    struct socket_option_no_delay_type
+    {
+      explicit socket_option_no_delay_type(bool) {}
+    };
+    using accept_option_reuse_address_type = acceptor_type::reuse_address;
+
+    /// Local sockets are not encrypted, but a context is still required to
+    /// construct a socket.
+    struct ssl_context_type
+    {
+      enum method {sslv23};
+      explicit ssl_context_type(method) {}
+      ssl_context_type(io_service_type&, method) {}
+    };
+    struct ssl_verify_mode_type
+    {
+    };
+
+    /// A local endpoint, designated by a filesystem path.
+    ///
+    /// It is also its own resolver entry and exposes an `address()` so that
+    /// the generic resolution code, which filters out IPv6 addresses, can be
+    /// reused as is.
+    struct endpoint_type : protocol_type::endpoint
+    {
+      struct address_type
+      {
+        std::string _path;
+        bool is_v6() const {return false;}
+        std::string to_string() const {return _path;}
+      };
+      endpoint_type() = default;
+      explicit endpoint_type(const std::string& path) : protocol_type::endpoint(path) {}
+      endpoint_type(const protocol_type::endpoint& ep) : protocol_type::endpoint(ep) {}
+      const endpoint_type& endpoint() const {return *this;}
+      address_type address() const {return address_type{path()};}
+    };
+
+    /// The lowest layer of a local socket: a plain local stream socket that
+    /// ignores the TCP options.
+    struct lowest_socket_type : protocol_type::socket
+    {
+      explicit lowest_socket_type(io_service_type& io) : protocol_type::socket(io) {}
+      using protocol_type::socket::set_option;
+      void set_option(socket_option_no_delay_type) {}
+    };
+
+    /// Stream over a local socket, with the interface of an SSL stream.
+    /// No encryption is ever performed.
+    class ssl_socket_type
+    {
+      io_service_type& _io;
+      lowest_socket_type _socket;
+    public:
+      enum class handshake_type
+      {
+        client,
+        server
+      };
+      using lowest_layer_type = lowest_socket_type;
+      using next_layer_type = lowest_socket_type;
+
+      ssl_socket_type(io_service_type& io, ssl_context_type&)
+        : _io(io)
+        , _socket(io)
+      {
+      }
+
+      io_service_type& get_io_service()
+      {
+        return _io;
+      }
+
+      void set_verify_mode(ssl_verify_mode_type)
+      {
+      }
+
+      /// There is nothing to negotiate: the handler is called asynchronously
+      /// with a success.
+      template<typename H>
+      void async_handshake(handshake_type, H h)
+      {
+        _io.post([=]() mutable {
+          h(error_code_type{});
+        });
+      }
+
+      lowest_layer_type& lowest_layer()
+      {
+        return _socket;
+      }
+
+      next_layer_type& next_layer()
+      {
+        return _socket;
+      }
+
+      template<typename T, typename U>
+      void async_read_some(const T& buffers, const U& handler)
+      {
+        _socket.async_read_some(buffers, handler);
+      }
+
+      template<typename T, typename U>
+      void async_write_some(const T& buffers, const U& handler)
+      {
+        _socket.async_write_some(buffers, handler);
+      }
+    };
+
+    /// Resolver that maps a URL onto the local endpoint named by its host part.
+    class resolver_type
+    {
+      io_service_type& _io;
+      std::shared_ptr<std::atomic<bool>> _canceled;
+    public:
+      struct query
+      {
+        enum flags {all_matching};
+        std::string _path;
+        query(const std::string& host, const std::string& /*service*/, flags = all_matching)
+          : _path(host)
+        {
+        }
+      };
+
+      /// Iterator over the results of a resolution: there is at most one entry.
+      class iterator
+      {
+        boost::optional<endpoint_type> _entry;
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = endpoint_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const endpoint_type*;
+        using reference = const endpoint_type&;
+
+        iterator() = default;
+        explicit iterator(const endpoint_type& e) : _entry(e) {}
+        reference operator*() const {return *_entry;}
+        pointer operator->() const {return &*_entry;}
+        iterator& operator++() {_entry = boost::none; return *this;}
+        iterator operator++(int) {auto it = *this; ++*this; return it;}
+        friend bool operator==(const iterator& a, const iterator& b)
+        {
+          return !a._entry && !b._entry;
+        }
+        friend bool operator!=(const iterator& a, const iterator& b)
+        {
+          return !(a == b);
+        }
+      };
+
+      explicit resolver_type(io_service_type& io)
+        : _io(io)
+        , _canceled(std::make_shared<std::atomic<bool>>(false))
+      {
+      }
+
+      io_service_type& get_io_service()
+      {
+        return _io;
+      }
+
+      /// Procedure<void (error_code_type, iterator)> H
+      template<typename H>
+      void async_resolve(const query& q, H h)
+      {
+        auto canceled = _canceled;
+        const auto path = q._path;
+        _io.post([=]() mutable {
+          if (canceled->load())
+          {
+            h(boost::asio::error::operation_aborted, iterator{});
+            return;
+          }
+          h(error_code_type{}, iterator{endpoint_type{path}});
+        });
+      }
+
+      void cancel()
+      {
+        _canceled->store(true);
+      }
+    };
+
+    static io_service_type& defaultIoService()
+    {
+      return *static_cast<io_service_type*>(getNetworkEventLoop()->nativeHandle());
+    }
+    static ssl_verify_mode_type sslVerifyNone()
+    {
+      return {};
+    }
+    template<typename T>
+    static auto buffer(T* data, std::size_t maxBytes) -> decltype(boost::asio::buffer(data, maxBytes))
+    {
+      return boost::asio::buffer(data, maxBytes);
+    }
+    /// The peer of a local socket is on the same host: a broken connection is
+    /// detected immediately by the kernel, so no keepalive is needed.
+    static void setSocketNativeOptions(protocol_type::socket::native_handle_type, int)
+    {
+    }
+
+    /// NetSslSocket S, MutableBufferSequence B, ReadHandler H
+    template<typename S, typename B, typename H>
+    static void async_read(S& s, const B& b, H h)
+    {
+      boost::asio::async_read(s, b, h);
+    }
+    /// NetSslSocket S, MutableBufferSequence B, ReadHandler H
+    template<typename S, typename B, typename H>
+    static void async_read_some(S& s, const B& b, H h)
+    {
+      s.async_read_some(b, h);
+    }
+    /// NetSslSocket S, ConstBufferSequence B, WriteHandler H
+    template<typename S, typename B, typename H>
+    static void async_write(S& s, const B& b, H h)
+    {
+      boost::asio::async_write(s, b, h);
+    }
+  };
+
+  /// The URL of a local endpoint.
+  /// SSL is not supported on local sockets, so the flag is ignored.
+  inline Url url(const boost::asio::local::stream_protocol::endpoint& ep, SslEnabled)
+  {
+    return Url{"unix://" + ep.path()};
+  }
+}} // namespace qi::sock
+
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+#endif // _QI_SOCK_NETWORKASIOLOCAL_HPP
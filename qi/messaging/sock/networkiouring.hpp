@@ -0,0 +1,255 @@
+#pragma once
+#ifndef _QI_SOCK_NETWORKIOURING_HPP
+#define _QI_SOCK_NETWORKIOURING_HPP
+#include <boost/predef.h>
+#include <qi/messaging/sock/networkasio.hpp>
+
+/// @file
+/// Contains an implementation of the Network concept whose socket reads and
+/// writes go through Linux io_uring.
+///
+/// Everything but the data transfers on plain TCP sockets is inherited from
+/// `NetworkAsio`: name resolution, connection, acceptation, and the TLS
+/// layer. The operations of all the sockets of an io_service are submitted
+/// to a single io_uring instance. Submissions done while the io_service runs
+/// handlers are gathered and issued with a single system call, and the
+/// completions are reaped in batches when the io_service is notified that
+/// some are available, so that a busy socket costs neither a readiness
+/// wake-up nor a system call per operation.
+///
+/// io_uring is only used if the `QI_NETWORK_IO_URING` environment variable
+/// is set to 1 and the kernel supports it; otherwise the operations are done
+/// by Boost.Asio.
+
+#if BOOST_OS_LINUX && !BOOST_OS_ANDROID && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <sys/syscall.h>
+#  ifdef __NR_io_uring_setup
+#   define QI_IO_URING 1
+#  endif
+# endif
+#endif
+#ifndef QI_IO_URING
+# define QI_IO_URING 0
+#endif
+
+#if QI_IO_URING
+
+#include <memory>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <qi/api.hpp>
+
+namespace qi { namespace sock {
+
+  namespace uring
+  {
+    /// A data transfer on a socket, submitted to the io_uring instance of an
+    /// io_service.
+    class QI_API Operation
+    {
+    public:
+      enum class Kind
+      {
+        Receive,
+        Send
+      };
+
+      Operation(Kind kind, boost::asio::ip::tcp::socket& socket);
+      virtual ~Operation();
+      Operation(const Operation&) = delete;
+      Operation& operator=(const Operation&) = delete;
+
+      /// Called by the io_service with the result of the system call: a count
+      /// of bytes or a negated `errno` value. Returns true if the operation
+      /// must be submitted again, for example to transfer the rest of the
+      /// data.
+      virtual bool complete(int result) = 0;
+
+      /// Returns true if the socket is still open on the descriptor the
+      /// operation was submitted on. Once it is closed, the descriptor may
+      /// belong to another connection and must not be used anymore.
+      bool socketOpen() const;
+
+      const Kind kind;
+      /// The socket outlives the operation, as the handler keeps it alive.
+      boost::asio::ip::tcp::socket& socket;
+      const int fd;
+      /// The message passed to the system call. Its I/O vectors are `iov`.
+      msghdr message;
+      std::vector<iovec> iov;
+
+    protected:
+      /// Removes `size` bytes from the beginning of the I/O vectors. Returns
+      /// the count of bytes left to transfer.
+      std::size_t consume(std::size_t size);
+    };
+
+    /// Returns true if the operations on the sockets of the io_service go
+    /// through io_uring.
+    QI_API bool enabled(boost::asio::io_service& io);
+
+    /// Submits the operation to the io_uring instance of the io_service. Its
+    /// completion is called by the io_service.
+    ///
+    /// Precondition: `enabled(io)`
+    QI_API void submit(boost::asio::io_service& io, std::unique_ptr<Operation> op);
+
+    /// Sets the I/O vectors of the operation from the buffers. Returns the
+    /// total count of bytes of the buffers.
+    ///
+    /// ConstBufferSequence or MutableBufferSequence B
+    template<typename B>
+    std::size_t assignBuffers(Operation& op, const B& buffers)
+    {
+      std::size_t total = 0;
+      for (auto it = buffers.begin(); it != buffers.end(); ++it)
+      {
+        const auto size = boost::asio::buffer_size(*it);
+        if (size == 0)
+          continue;
+        iovec v;
+        v.iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(*it));
+        v.iov_len = size;
+        op.iov.push_back(v);
+        total += size;
+      }
+      op.message.msg_iov = op.iov.data();
+      op.message.msg_iovlen = op.iov.size();
+      return total;
+    }
+
+    /// Converts the result of a failed system call to an error code.
+    inline boost::system::error_code toErrorCode(int result)
+    {
+      if (result == -ECANCELED)
+        return boost::asio::error::operation_aborted;
+      return { -result, boost::system::system_category() };
+    }
+
+    /// Transfers data and calls the handler once done. If `all` is true, the
+    /// operation is only done once all the data is transferred, otherwise it
+    /// is done after the first transfer.
+    ///
+    /// Procedure<void (boost::system::error_code, std::size_t)> H
+    template<typename H>
+    class TransferOperation : public Operation
+    {
+    public:
+      TransferOperation(Kind kind, boost::asio::ip::tcp::socket& socket, bool all, H handler)
+        : Operation(kind, socket)
+        , _all(all)
+        , _handler(std::move(handler))
+      {
+      }
+
+      bool complete(int result) override
+      {
+        if (result == -EINTR || result == -EAGAIN)
+          return true;
+        if (result < 0)
+        {
+          _handler(toErrorCode(result), _transferred);
+          return false;
+        }
+        if (result == 0 && kind == Kind::Receive)
+        {
+          _handler(boost::asio::error::eof, _transferred);
+          return false;
+        }
+        _transferred += static_cast<std::size_t>(result);
+        if (consume(static_cast<std::size_t>(result)) != 0 && _all)
+          return true;
+        _handler(boost::system::error_code{}, _transferred);
+        return false;
+      }
+
+    private:
+      bool _all;
+      std::size_t _transferred = 0;
+      H _handler;
+    };
+
+    /// Returns false if the transfer must be done by Boost.Asio.
+    ///
+    /// ConstBufferSequence or MutableBufferSequence B,
+    /// Procedure<void (boost::system::error_code, std::size_t)> H
+    template<typename B, typename H>
+    bool transfer(boost::asio::ip::tcp::socket& s, Operation::Kind kind, bool all,
+                  const B& buffers, H& handler)
+    {
+      auto& io = s.get_io_service();
+      if (!enabled(io) || !s.is_open())
+        return false;
+      std::unique_ptr<TransferOperation<H>> op{
+        new TransferOperation<H>(kind, s, all, handler)};
+      // Boost.Asio completes empty transfers immediately.
+      if (assignBuffers(*op, buffers) == 0)
+        return false;
+      submit(io, std::move(op));
+      return true;
+    }
+  } // namespace uring
+
+  /// Model the `Network` concept with io_uring for data transfers on TCP
+  /// sockets, and with Boost.Asio for anything else (see `NetworkAsio`).
+  struct NetworkIoUring : NetworkAsio
+  {
+    /// MutableBufferSequence B, ReadHandler H
+    template<typename B, typename H>
+    static void async_read(boost::asio::ip::tcp::socket& s, const B& b, H h)
+    {
+      if (!uring::transfer(s, uring::Operation::Kind::Receive, true, b, h))
+        NetworkAsio::async_read(s, b, h);
+    }
+    /// NetSslSocket S, MutableBufferSequence B, ReadHandler H
+    template<typename S, typename B, typename H>
+    static void async_read(S& s, const B& b, H h)
+    {
+      NetworkAsio::async_read(s, b, h);
+    }
+
+    /// MutableBufferSequence B, ReadHandler H
+    template<typename B, typename H>
+    static void async_read_some(boost::asio::ip::tcp::socket& s, const B& b, H h)
+    {
+      if (!uring::transfer(s, uring::Operation::Kind::Receive, false, b, h))
+        NetworkAsio::async_read_some(s, b, h);
+    }
+    /// NetSslSocket S, MutableBufferSequence B, ReadHandler H
+    template<typename S, typename B, typename H>
+    static void async_read_some(S& s, const B& b, H h)
+    {
+      NetworkAsio::async_read_some(s, b, h);
+    }
+
+    /// ConstBufferSequence B, WriteHandler H
+    template<typename B, typename H>
+    static void async_write(boost::asio::ip::tcp::socket& s, const B& b, H h)
+    {
+      if (!uring::transfer(s, uring::Operation::Kind::Send, true, b, h))
+        NetworkAsio::async_write(s, b, h);
+    }
+    /// NetSslSocket S, ConstBufferSequence B, WriteHandler H
+    template<typename S, typename B, typename H>
+    static void async_write(S& s, const B& b, H h)
+    {
+      NetworkAsio::async_write(s, b, h);
+    }
+  };
+
+  /// The network used by TCP message sockets.
+  using TcpNetwork = NetworkIoUring;
+}} // namespace qi::sock
+
+#else
+
+namespace qi { namespace sock {
+  /// The network used by TCP message sockets.
+  using TcpNetwork = NetworkAsio;
+}} // namespace qi::sock
+
+#endif // QI_IO_URING
+
+#endif // _QI_SOCK_NETWORKIOURING_HPP
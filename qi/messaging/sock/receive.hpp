@@ -13,6 +13,10 @@
 #include <ka/macroregular.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/optional.hpp>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
 
 /// @file
 /// Contains functions and types related to message reception on a socket.
@@ -125,6 +129,40 @@
 ///  implementing the `Trackable` 'interface'.
 ///
 ///
+/// ## Read-ahead
+///
+/// Receiving a message with `receiveMessage` costs at least two reads: one for
+/// the header and one for the payload. `ReceiveMessageBuffered` instead reads
+/// as much as available into a buffer and extracts from it every complete
+/// message, so that a burst of small messages is handled with a single read.
+/// The end of a payload that is not in the buffer is read directly into the
+/// message, so that large payloads are not copied twice:
+///
+/// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+///    async read some into buffer <-------------------------
+///             |                                            |
+///             v                                            |
+///     whole header in buffer? ----------------------------- no
+///             | yes
+///             v
+///  copy header, copy available payload
+///             |
+///             v
+///     whole payload in buffer? ---- no ---> async read rest of payload
+///             | yes                                  |
+///             v                                      |
+/// pass msg/error to upper layer* <-------------------
+///             |
+///       must continue? ---- yes ---> back to "whole header in buffer?"
+///             | no
+///             v
+///            stop
+/// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+///
+/// The connected state uses it for the Network models that can read partially
+/// from a socket (see `ReceiveMessage`).
+///
+///
 /// ## Data exchange through layers
 ///
 /// Finally, this is how data is exchanged through callbacks between the
@@ -262,12 +300,13 @@ namespace qi { namespace sock {
       if (header.magic != Message::Header::magicCookie)
       {
         qiLogWarning(logCategory()) << &(*socket) << ": Incorrect magic from "
-          << (*socket).lowest_layer().remote_endpoint().address().to_string()
+          << url((*socket).lowest_layer().remote_endpoint(), ssl).str()
           << " (expected " << Message::Header::magicCookie
           << ", got " << header.magic << ").";
         receiveErrorAndMaybeReceiveNext(fault<ErrorCode<N>>());
         return;
       }
+      msg.setTimestamp(SteadyClock::now());
       size_t payload = header.size;
       if (payload == 0u)
       {
@@ -283,10 +322,8 @@ namespace qi { namespace sock {
         receiveErrorAndMaybeReceiveNext(messageSize<ErrorCode<N>>());
         return;
       }
-      auto messageBuffer = msg.extractBuffer();
-      void* ptr = messageBuffer.reserve(payload);
+      void* ptr = ptrMsg->reservePayload(payload);
       auto buffer = N::buffer(ptr, payload);
-      msg.setBuffer(std::move(messageBuffer));
       auto readData = lifetimeTransfo([=](ErrorCode<N> error, std::size_t /*len*/) {
         onReadData<N>(error, socket, ptrMsg, ssl, maxPayload, onReceive, lifetimeTransfo, syncTransfo);
       });
@@ -399,9 +436,7 @@ namespace qi { namespace sock {
           if (onReceive(erc, m))
           {
             // Must continue.
-            auto dataBuffer = _msg.extractBuffer();
-            dataBuffer.clear();
-            _msg.setBuffer(std::move(dataBuffer));
+            _msg.clearBuffer();
             _msg.setRecipientUid(boost::none);
             return {&_msg}; // We reuse the message memory to receive the next message.
           }
@@ -451,6 +486,181 @@ namespace qi { namespace sock {
       destroy();
     }
   };
+
+  /// Size of the read-ahead buffer of `ReceiveMessageBuffered`, configurable
+  /// with the environment variable QI_RECEIVE_BUFFER_SIZE (in bytes).
+  std::size_t getReceiveBufferSizeFromEnv();
+
+  /// Receive continuously messages until told to stop, reading ahead as much
+  /// data as available.
+  ///
+  /// It has the same interface and the same behavior as
+  /// `ReceiveMessageContinuous`, but the socket is read with
+  /// `N::async_read_some` into a buffer, from which all the complete messages
+  /// are extracted before reading again. The part of a payload that is not in
+  /// the buffer is read directly into the message.
+  ///
+  /// Warning: The instance must remain alive until the handler is called (see
+  /// `ReceiveMessageContinuous`).
+  ///
+  /// Network N
+  template<typename N>
+  class ReceiveMessageBuffered
+  {
+    Message _msg;
+    std::vector<char> _readAhead;
+    std::size_t _begin = 0; // First byte not yet extracted.
+    std::size_t _end = 0; // Past the last byte read.
+
+    /// Informs the upper layer and returns true if it asks to continue.
+    template<typename Proc>
+    bool deliver(const ErrorCode<N>& erc, Proc& onReceive)
+    {
+      if (erc)
+      {
+        // The stream cannot be trusted anymore: if we continue, we restart
+        // from what comes next on the socket.
+        _begin = _end = 0;
+        return onReceive(erc, nullptr);
+      }
+      if (!onReceive(erc, &_msg))
+      {
+        return false;
+      }
+      // We reuse the message memory to receive the next message.
+      _msg.clearBuffer();
+      _msg.setRecipientUid(boost::none);
+      return true;
+    }
+
+    /// Extracts messages from the buffer until the upper layer asks to stop
+    /// or more data is needed.
+    template<typename S, typename Proc, typename F0, typename F1>
+    void extract(const S& socket, SslEnabled ssl, size_t maxPayload,
+        Proc& onReceive, F0 lifetimeTransfo, F1 syncTransfo)
+    {
+      while (_end - _begin >= sizeof(Message::Header))
+      {
+        auto& header = _msg.header();
+        std::memcpy(&header, _readAhead.data() + _begin, sizeof(Message::Header));
+        if (header.magic != Message::Header::magicCookie)
+        {
+          qiLogWarning(logCategory()) << &(*socket) << ": Incorrect magic from "
+            << url((*socket).lowest_layer().remote_endpoint(), ssl).str()
+            << " (expected " << Message::Header::magicCookie
+            << ", got " << header.magic << ").";
+          if (!deliver(fault<ErrorCode<N>>(), onReceive))
+            return;
+          continue;
+        }
+        const size_t payload = header.size;
+        if (payload > maxPayload)
+        {
+          qiLogWarning(logCategory()) << "Receiving message of size " << payload
+            << " above maximum configured payload size " << maxPayload <<
+               " (configure with environment variable QI_MAX_MESSAGE_PAYLOAD).";
+          if (!deliver(messageSize<ErrorCode<N>>(), onReceive))
+            return;
+          continue;
+        }
+        _begin += sizeof(Message::Header);
+        _msg.setTimestamp(SteadyClock::now());
+        if (payload > 0u)
+        {
+          auto ptr = static_cast<char*>(_msg.reservePayload(payload));
+          const auto available = std::min(payload, _end - _begin);
+          std::memcpy(ptr, _readAhead.data() + _begin, available);
+          _begin += available;
+          if (available < payload)
+          {
+            readPayloadEnd(socket, ssl, maxPayload, onReceive,
+              N::buffer(ptr + available, payload - available), lifetimeTransfo, syncTransfo);
+            return;
+          }
+        }
+        if (!deliver(success<ErrorCode<N>>(), onReceive))
+          return;
+      }
+      readSome(socket, ssl, maxPayload, onReceive, lifetimeTransfo, syncTransfo);
+    }
+
+    /// Reads as much data as available after what remains in the buffer.
+    template<typename S, typename Proc, typename F0, typename F1>
+    void readSome(const S& socket, SslEnabled ssl, size_t maxPayload,
+        Proc& onReceive, F0 lifetimeTransfo, F1 syncTransfo)
+    {
+      // Move the beginning of the next message to the front of the buffer.
+      std::copy(_readAhead.begin() + _begin, _readAhead.begin() + _end, _readAhead.begin());
+      _end -= _begin;
+      _begin = 0;
+      auto buffer = N::buffer(_readAhead.data() + _end, _readAhead.size() - _end);
+      auto onRead = syncTransfo(lifetimeTransfo([=](ErrorCode<N> erc, std::size_t len) mutable {
+        if (erc)
+        {
+          if (deliver(erc, onReceive))
+            readSome(socket, ssl, maxPayload, onReceive, lifetimeTransfo, syncTransfo);
+          return;
+        }
+        _end += len;
+        extract(socket, ssl, maxPayload, onReceive, lifetimeTransfo, syncTransfo);
+      }));
+      if (*ssl)
+      {
+        N::async_read_some(*socket, buffer, onRead);
+      }
+      else
+      {
+        N::async_read_some((*socket).next_layer(), buffer, onRead);
+      }
+    }
+
+    /// Reads the end of the current payload directly into the message.
+    template<typename S, typename Proc, typename B, typename F0, typename F1>
+    void readPayloadEnd(const S& socket, SslEnabled ssl, size_t maxPayload,
+        Proc& onReceive, const B& buffer, F0 lifetimeTransfo, F1 syncTransfo)
+    {
+      auto onRead = syncTransfo(lifetimeTransfo([=](ErrorCode<N> erc, std::size_t /*len*/) mutable {
+        if (deliver(erc, onReceive))
+          extract(socket, ssl, maxPayload, onReceive, lifetimeTransfo, syncTransfo);
+      }));
+      if (*ssl)
+      {
+        N::async_read(*socket, buffer, onRead);
+      }
+      else
+      {
+        N::async_read((*socket).next_layer(), buffer, onRead);
+      }
+    }
+
+  public:
+  // QuasiRegular:
+    ReceiveMessageBuffered()
+      : _readAhead(std::max(getReceiveBufferSizeFromEnv(), sizeof(Message::Header)))
+    {
+    }
+  // Procedure:
+    /// Mutable<SslSocket<N>> S,
+    /// Procedure<bool (ErrorCode<N>, Message*)> Proc,
+    /// Transformation<Procedure> F0,
+    /// Transformation<Procedure<void (Args...)>> F1
+    template<typename S, typename Proc, typename F0 = ka::id_transfo_t, typename F1 = ka::id_transfo_t>
+    void operator()(const S& socket, SslEnabled ssl, size_t maxPayload,
+        Proc onReceive, const F0& lifetimeTransfo = {}, const F1& syncTransfo = {})
+    {
+      _begin = _end = 0;
+      readSome(socket, ssl, maxPayload, onReceive, lifetimeTransfo, syncTransfo);
+    }
+  };
+
+  /// The type used by the connected state to receive messages on sockets of
+  /// Network N: messages are read ahead if the network supports partial reads
+  /// (`N::read_ahead`).
+  ///
+  /// Network N
+  template<typename N>
+  using ReceiveMessage = typename std::conditional<N::read_ahead,
+    ReceiveMessageBuffered<N>, ReceiveMessageContinuous<N>>::type;
 }} // namespace qi::sock
 
 #endif // _QI_SOCK_RECEIVE_HPP
@@ -1,9 +1,12 @@
 #pragma once
 #ifndef _QI_SOCK_SEND_HPP
 #define _QI_SOCK_SEND_HPP
+#include <algorithm>
 #include <atomic>
 #include <vector>
 #include <list>
+#include <iterator>
+#include <utility>
 #include <stdexcept>
 #include <sstream>
 #include <boost/thread/synchronized_value.hpp>
@@ -13,6 +16,7 @@
 #include <qi/messaging/sock/option.hpp>
 #include <qi/messaging/sock/error.hpp>
 #include <qi/messaging/sock/common.hpp>
+#include <qi/messaging/sock/sendqueue.hpp>
 #include <ka/src.hpp>
 #include <qi/trackable.hpp>
 #include <qi/future.hpp>
@@ -64,10 +68,15 @@
 /// The memory for the messages can be for example maintained by an instance of
 /// `SendMessageEnqueue`. As `sendMessage`, it implements a message
 /// send loop, but being an object it can have a state and takes leverage
-/// of this to maintain a message queue. It passes the first message of the queue to
-/// `sendMessage` and removes it from the queue when sending is done. In this
-/// case, `SendMessageEnqueue` effectively constitutes the upper layer of
-/// `sendMessage`.
+/// of this to maintain a message queue. It passes the first messages of the
+/// queue to `sendMessages`, which writes them at once, and removes them from
+/// the queue when sending is done. In this case, `SendMessageEnqueue`
+/// effectively constitutes the upper layer of `sendMessages`.
+///
+/// The queue can be bounded, in bytes and in count of messages, by
+/// `SendQueueLimits`. The upper layer asks whether a message fits before
+/// passing it (see `SendMessageEnqueue::admit`), and the `SendQueuePolicy`
+/// decides what happens if it does not.
 ///
 /// `SendMessageEnqueue` has itself an upper layer: it passes it the
 /// sent message though a callback. This callback returns a boolean to
@@ -80,13 +89,13 @@
 ///  SendMessageEnqueue start
 ///             |
 ///             v
-///   sendMessage(_msgQueue.begin()) <--
-///             | message sent          |
+///  sendMessages(first msgs of queue) <--
+///             | messages sent         |
 ///             v                       |
-/// pass msg/error to upper layer*      |
+/// pass each msg/error to upper layer* |
 ///             |                       |
 ///             v                       |
-///   remove msg from queue             |
+///   remove msgs from queue            |
 ///             |                       |
 ///       must continue? ---------------
 ///             | no         yes
@@ -105,25 +114,44 @@
 ///                         ^ | bool
 ///         (Error, IterMsg)| v
 /// Layer 1:         SendMessageEnqueue
-///                         ^ | optional<IterMsg>
-///         (Error, IterMsg)| v
-/// Layer 0:            sendMessage
+///                         ^ | optional<(IterMsg, Count)>
+///  (Error, IterMsg, Count)| v
+/// Layer 0:           sendMessages
 /// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 namespace qi { namespace sock {
 
-  /// Make network buffers for the given message.
+  /// Number of network buffers `appendBuffers` produces for the given message.
+  inline std::size_t bufferCount(const Message& msg)
+  {
+    return 2 + 2 * msg.buffer().subBuffers().size();
+  }
+
+  /// Returns true if the message can be dropped by the `DropOldestEvent`
+  /// send queue policy: it is an event, and not a fragment of one, as the
+  /// other fragments could not be rebuilt without it.
+  inline bool isDroppable(const Message& msg)
+  {
+    return msg.type() == Message::Type_Event && !(msg.flags() & Message::TypeFlag_Fragment);
+  }
+
+  /// Number of bytes written to the network for the given message.
+  inline std::size_t wireSize(const Message& msg)
+  {
+    return sizeof(Message::Header) + msg.buffer().totalSize();
+  }
+
+  /// Append to `buffers` the network buffers of the given message.
   ///
-  /// One buffer is for the header and the other one is for data.
+  /// One buffer is for the header and the others are for data.
   ///
   /// Network N
   template<typename N>
-  std::vector<ConstBuffer<N>> makeBuffers(const Message& msg)
+  void appendBuffers(std::vector<ConstBuffer<N>>& buffers, const Message& msg)
   {
     // header buffer
     ConstBuffer<N> headerBuffer = N::buffer(static_cast<const void*>(&msg.header()),
       sizeof(Message::Header));
-    std::vector<ConstBuffer<N>> buffers;
     const auto& msgBuffer = msg.buffer();
 
     // A buffer has a header and data.
@@ -139,7 +167,7 @@ namespace qi { namespace sock {
     // Memory layout for a buffer with 2 subbuffers:
     // (low address)                                                         (high address)
     // |header|buffer_part_0|size_subbuffer_0|buffer_part_1|size_subbuffer_1|buffer_part_2|
-    buffers.reserve(1 + 2 * msgBuffer.subBuffers().size() + 1);
+    buffers.reserve(buffers.size() + bufferCount(msg));
     buffers.push_back(headerBuffer);
 
     decltype(msgBuffer.size()) beginOffset = 0;
@@ -160,9 +188,38 @@ namespace qi { namespace sock {
     // end of main buffer
     buffers.push_back(N::buffer(
       static_cast<const char*>(msgBuffer.data()) + beginOffset, msgBuffer.size() - beginOffset));
+  }
+
+  /// Make network buffers for the given message.
+  ///
+  /// Network N
+  template<typename N>
+  std::vector<ConstBuffer<N>> makeBuffers(const Message& msg)
+  {
+    std::vector<ConstBuffer<N>> buffers;
+    appendBuffers<N>(buffers, msg);
     return buffers;
   }
 
+  /// Limits of the messages gathered in a single network write.
+  struct SendBatchLimits
+  {
+    /// Messages are added to a write as long as its total size does not exceed
+    /// this count of bytes. A single message bigger than that is still written
+    /// alone.
+    std::size_t maxBytes;
+    /// Maximum count of network buffers of a write. Each message uses at least
+    /// two of them (see `bufferCount`). It should not exceed the system limit
+    /// of a gathered write (`IOV_MAX`), otherwise the write is split by the
+    /// network layer.
+    std::size_t maxBuffers;
+  };
+
+  /// Limits of gathered writes, can be overriden by the
+  /// `QI_SEND_BATCH_MAX_BYTES` and `QI_SEND_BATCH_MAX_BUFFERS` environment
+  /// variables. Setting any of them to 0 disables gathering.
+  SendBatchLimits getSendBatchLimitsFromEnv();
+
   /// Send a message through the socket and call the handler when the operation
   /// is complete, successfully or not.
   ///
@@ -217,23 +274,81 @@ namespace qi { namespace sock {
     }
   }
 
+  /// Send consecutive messages in a single gathered write through the socket
+  /// and call the handler when the operation is complete, successfully or not.
+  ///
+  /// This is the same as `sendMessage`, except that `count` messages starting
+  /// at `itFirst` are written at once. The handler is passed the same range
+  /// and may return the range of the next messages to send.
+  ///
+  /// Precondition: The `count` messages starting at `itFirst` must be valid
+  ///   until the handler has been called.
+  ///
+  /// Network N,
+  /// Mutable<SslSocket<N>> S,
+  /// ForwardIterator<Message> I,
+  /// Procedure<Optional<std::pair<I, std::size_t>> (ErrorCode<N>, I, std::size_t)> Proc,
+  /// Transformation<Procedure> F0,
+  /// Transformation<Procedure<void (Args...)>> F1
+  template<typename N, typename S, typename I, typename Proc, typename F0 = ka::id_transfo_t, typename F1 = ka::id_transfo_t>
+  void sendMessages(const S& socket, I itFirst, std::size_t count, Proc onSent,
+      SslEnabled ssl, F0 lifetimeTransfo = {}, F1 syncTransfo = {})
+  {
+    std::vector<ConstBuffer<N>> buffers;
+    {
+      auto it = itFirst;
+      for (std::size_t i = 0; i < count; ++i, ++it)
+        appendBuffers<N>(buffers, *it);
+    }
+    auto writeCont = syncTransfo(lifetimeTransfo([=](ErrorCode<N> erc, size_t /*len*/) mutable {
+      if (auto optionalNext = onSent(erc, itFirst, count))
+      {
+        sendMessages<N>(socket, optionalNext->first, optionalNext->second, onSent, ssl,
+          lifetimeTransfo, syncTransfo);
+      }
+    }));
+    if (*ssl)
+    {
+      N::async_write(*socket, std::move(buffers), writeCont);
+    }
+    else
+    {
+      N::async_write((*socket).next_layer(), std::move(buffers), writeCont);
+    }
+  }
+
   /// Functor that sends messages through a socket.
   ///
   /// The role of this type is to provide a queue for messages.
   /// You can therefore ask to send a message before the current one has
   /// actually been sent. The message will simply be enqueued and sent ASAP.
-  /// The messages will be sent in a FIFO manner.
+  /// The queue is ordered by message priority (see `Message::priority`): a
+  /// message is enqueued after the messages of the same or higher priority,
+  /// but before the ones of lower priority that are not being written and
+  /// that it can overtake (see `Message::canOvertake`). The messages of a
+  /// given priority are therefore sent in a FIFO manner, and so are the
+  /// messages whose order matters.
   /// Sending messages is thread-safe.
   ///
-  /// The actual sending is done by `sendMessage`.
+  /// The actual sending is done by `sendMessages`: the messages waiting in the
+  /// queue when a write starts are gathered in a single network write, within
+  /// the given `SendBatchLimits`.
   ///
   /// When a message has been sent, a callback is called. This callback return
   /// a boolean to decide if the queue, if not empty, must continue to be processed.
+  /// It is still called once per message, in order, even if several messages
+  /// were written at once. The queue processing stops if any of these calls
+  /// returns false.
   ///
   /// If you decide to stop the queue processing and it contain some messages,
   /// the queue is not cleared. Next time you send a message, it will
   /// be enqueued and the queue processing will continue from where it had stopped.
   ///
+  /// The depth of the queue is bounded by the given `SendQueueLimits`, which
+  /// only apply to the messages passed to `admit` before being sent. The
+  /// depth is measured from the admission of a message to the end of its
+  /// write, and its metrics are available through `queueStats`.
+  ///
   /// Warning: The instance must remain alive until messages are sent.
   /// You can provide a procedure transformation (`lifetimeTransfo`) that will
   /// wrap any internal callback and handle the expired instance case.
@@ -248,14 +363,46 @@ namespace qi { namespace sock {
   {
     using ReadableMessage = std::list<Message>::const_iterator;
     SendMessageEnqueue()
-      : _sending{false}
+      : _limits(getSendBatchLimitsFromEnv())
+      , _queueLimits(getSendQueueLimitsFromEnv())
+      , _sending{false}
     {
     }
-    explicit SendMessageEnqueue(const S& socket)
+    explicit SendMessageEnqueue(const S& socket,
+                                SendBatchLimits limits = getSendBatchLimitsFromEnv(),
+                                SendQueueLimits queueLimits = getSendQueueLimitsFromEnv())
       : _socket(socket)
+      , _limits(limits)
+      , _queueLimits(queueLimits)
       , _sending{false}
     {
     }
+
+    /// Applies the queue limits and policy to the message, that is about to be
+    /// sent. Returns false if the message must not be sent, because it was
+    /// rejected or dropped. Otherwise, its place in the queue is reserved
+    /// and the message must be sent.
+    ///
+    /// With the `DropOldestEvent` policy, making room may drop messages
+    /// waiting in the queue: they are removed without being written nor
+    /// passed to the upper layer.
+    bool admit(const Message& msg);
+
+    /// Applies the queue limits and policy to the messages as to a single
+    /// message: either they are all admitted, or none is. The fragments of a
+    /// message are useless without the others, for example.
+    bool admit(const std::vector<Message>& msgs);
+
+    /// Returns a future that is set once the queue is below its limits. It is
+    /// set in error if the instance is destroyed before.
+    Future<void> ready();
+
+    /// Thread-safe.
+    SendQueueStats queueStats() const;
+
+    /// Thread-safe. Only affects the next admissions.
+    void setQueueLimits(SendQueueLimits limits);
+
   // Procedure:
     /// Message Msg,
     /// Procedure<bool (ErrorCode<N>, Readable<Message>)> Proc,
@@ -267,21 +414,236 @@ namespace qi { namespace sock {
     void operator()(Msg&&, SslEnabled, Proc onSent = Proc{true},
       const F0& lifetimeTransfo = F0{}, const F1& syncTransfo = F1{});
   private:
+    using Batch = std::pair<std::list<Message>::iterator, std::size_t>;
+
+    /// Returns the messages at the beginning of the queue that fit in a single
+    /// write. There is always at least one of them.
+    ///
+    /// Precondition: The queue is locked and not empty.
+    Batch nextBatch();
+
+    /// Returns where the message must be inserted.
+    ///
+    /// Precondition: The queue is locked.
+    std::list<Message>::iterator insertionPoint(const Message& msg);
+
+    // The following functions must be called while the queue is locked.
+
+    /// Returns true if `count` messages of the given total size can be added
+    /// to the queue without exceeding its limits. An empty queue accepts any
+    /// messages.
+    bool fits(std::size_t size, std::size_t count = 1) const;
+    bool isReady() const;
+    bool admit(std::size_t size, std::size_t count, bool droppable, const MessageAddress& address);
+    void addToStats(std::size_t size, std::size_t count = 1);
+    void removeFromStats(std::size_t size);
+    /// Drops the oldest event message that is not being written. Returns false
+    /// if there is none.
+    bool dropOldestEvent();
+    /// Returns the promises to set once the queue is unlocked.
+    std::vector<Promise<void>> takeReadyPromises();
+
     S _socket;
+    SendBatchLimits _limits;
+    SendQueueLimits _queueLimits;
+    SendQueueStats _queueStats;
+    /// Count of admitted messages that have not been passed to `operator()` yet.
+    std::size_t _reservedMessages = 0;
+    /// Count of messages at the beginning of the queue that are being written.
+    std::size_t _inFlight = 0;
+    std::vector<Promise<void>> _readyPromises;
     /// A list is used because we need the iterators not to be invalidated by
     /// insertions at begin or end, which is not the case with deque.
     /// See [23.3.3.4 deque modifiers].
     std::list<Message> _sendQueue;
     bool _sending;
-    std::mutex _sendMutex;
+    mutable std::mutex _sendMutex;
   };
 
+  template<typename N, typename S>
+  auto SendMessageEnqueue<N, S>::nextBatch() -> Batch
+  {
+    QI_ASSERT(!_sendQueue.empty());
+    auto it = _sendQueue.begin();
+    std::size_t count = 1;
+    std::size_t bytes = wireSize(*it);
+    std::size_t buffers = bufferCount(*it);
+    for (++it; it != _sendQueue.end(); ++it, ++count)
+    {
+      bytes += wireSize(*it);
+      buffers += bufferCount(*it);
+      if (bytes > _limits.maxBytes || buffers > _limits.maxBuffers)
+        break;
+    }
+    return { _sendQueue.begin(), count };
+  }
+
+  template<typename N, typename S>
+  auto SendMessageEnqueue<N, S>::insertionPoint(const Message& msg)
+    -> std::list<Message>::iterator
+  {
+    // The messages being written are not reordered. The search starts from
+    // the end because most messages have the lowest priority of the queue.
+    const auto first = std::next(_sendQueue.begin(), std::min(_inFlight, _sendQueue.size()));
+    auto pos = _sendQueue.end();
+    const auto priority = msg.priority();
+    while (pos != first && std::prev(pos)->priority() < priority && msg.canOvertake(*std::prev(pos)))
+      --pos;
+    return pos;
+  }
+
+  template<typename N, typename S>
+  bool SendMessageEnqueue<N, S>::fits(std::size_t size, std::size_t count) const
+  {
+    if (_queueStats.messages == 0)
+      return true;
+    return (_queueLimits.maxBytes == 0 || _queueStats.bytes + size <= _queueLimits.maxBytes)
+        && (_queueLimits.maxMessages == 0 || _queueStats.messages + count <= _queueLimits.maxMessages);
+  }
+
+  template<typename N, typename S>
+  bool SendMessageEnqueue<N, S>::isReady() const
+  {
+    return (_queueLimits.maxBytes == 0 || _queueStats.bytes < _queueLimits.maxBytes)
+        && (_queueLimits.maxMessages == 0 || _queueStats.messages < _queueLimits.maxMessages);
+  }
+
+  template<typename N, typename S>
+  void SendMessageEnqueue<N, S>::addToStats(std::size_t size, std::size_t count)
+  {
+    _queueStats.messages += count;
+    _queueStats.bytes += size;
+    _queueStats.peakMessages = std::max(_queueStats.peakMessages, _queueStats.messages);
+    _queueStats.peakBytes = std::max(_queueStats.peakBytes, _queueStats.bytes);
+  }
+
+  template<typename N, typename S>
+  void SendMessageEnqueue<N, S>::removeFromStats(std::size_t size)
+  {
+    QI_ASSERT(_queueStats.messages != 0 && _queueStats.bytes >= size);
+    --_queueStats.messages;
+    _queueStats.bytes -= size;
+  }
+
+  template<typename N, typename S>
+  bool SendMessageEnqueue<N, S>::dropOldestEvent()
+  {
+    // The messages being written must stay valid until their write is done.
+    const auto skipped = std::min(_inFlight, _sendQueue.size());
+    const auto it = std::find_if(std::next(_sendQueue.begin(), skipped), _sendQueue.end(),
+      [](const Message& msg) { return isDroppable(msg); });
+    if (it == _sendQueue.end())
+      return false;
+    qiLogVerbose(logCategory()) << _socket.get() << " Send queue full, dropping event "
+                                << it->address();
+    removeFromStats(wireSize(*it));
+    _sendQueue.erase(it);
+    ++_queueStats.dropped;
+    return true;
+  }
+
+  template<typename N, typename S>
+  std::vector<Promise<void>> SendMessageEnqueue<N, S>::takeReadyPromises()
+  {
+    std::vector<Promise<void>> promises;
+    if (!_readyPromises.empty() && isReady())
+      std::swap(promises, _readyPromises);
+    return promises;
+  }
+
+  template<typename N, typename S>
+  bool SendMessageEnqueue<N, S>::admit(const Message& msg)
+  {
+    std::lock_guard<std::mutex> lock{_sendMutex};
+    return admit(wireSize(msg), 1, isDroppable(msg), msg.address());
+  }
+
+  template<typename N, typename S>
+  bool SendMessageEnqueue<N, S>::admit(const std::vector<Message>& msgs)
+  {
+    if (msgs.empty())
+      return true;
+    std::size_t size = 0;
+    for (const auto& msg: msgs)
+      size += wireSize(msg);
+    // The fragments of an event are dropped together.
+    const bool droppable = msgs.front().type() == Message::Type_Event;
+    std::lock_guard<std::mutex> lock{_sendMutex};
+    return admit(size, msgs.size(), droppable, msgs.front().address());
+  }
+
+  template<typename N, typename S>
+  bool SendMessageEnqueue<N, S>::admit(std::size_t size, std::size_t count, bool droppable,
+                                       const MessageAddress& address)
+  {
+    if (!fits(size, count))
+    {
+      switch (_queueLimits.policy)
+      {
+        case SendQueuePolicy::Reject:
+          qiLogVerbose(logCategory()) << _socket.get() << " Send queue full, rejecting message "
+                                      << address;
+          ++_queueStats.rejected;
+          return false;
+        case SendQueuePolicy::DropOldestEvent:
+          while (!fits(size, count) && dropOldestEvent())
+          {
+          }
+          if (!fits(size, count) && droppable)
+          {
+            qiLogVerbose(logCategory()) << _socket.get() << " Send queue full, dropping event "
+                                        << address;
+            ++_queueStats.dropped;
+            return false;
+          }
+          break;
+        case SendQueuePolicy::Wait:
+          break;
+      }
+    }
+    addToStats(size, count);
+    _reservedMessages += count;
+    return true;
+  }
+
+  template<typename N, typename S>
+  Future<void> SendMessageEnqueue<N, S>::ready()
+  {
+    std::lock_guard<std::mutex> lock{_sendMutex};
+    if (isReady())
+      return futurize();
+    _readyPromises.emplace_back();
+    return _readyPromises.back().future();
+  }
+
+  template<typename N, typename S>
+  SendQueueStats SendMessageEnqueue<N, S>::queueStats() const
+  {
+    std::lock_guard<std::mutex> lock{_sendMutex};
+    return _queueStats;
+  }
+
+  template<typename N, typename S>
+  void SendMessageEnqueue<N, S>::setQueueLimits(SendQueueLimits limits)
+  {
+    std::vector<Promise<void>> readyPromises;
+    {
+      std::lock_guard<std::mutex> lock{_sendMutex};
+      _queueLimits = limits;
+      readyPromises = takeReadyPromises();
+    }
+    for (auto& promise: readyPromises)
+      promise.setValue(nullptr);
+  }
+
   // Lemma SendMessageEnqueue.0:
-  //  If a message is already being sent, the message is queued without
-  //  invalidating the one being sent.
+  //  If messages are already being sent, the message is queued without
+  //  invalidating the ones being sent.
   // Proof:
-  //  All messages are put in the send queue, including the one being sent.
+  //  All messages are put in the send queue, including the ones being sent.
   //  The send queue is a list so adding an element doesn't invalidate the other ones.
+  //  A message is inserted after the batch being sent, which has been
+  //  computed before, so it is not part of it.
   template<typename N, typename S>
   template<typename Msg, typename Proc, typename F0, typename F1>
   void SendMessageEnqueue<N, S>::operator()(Msg&& msg, SslEnabled ssl, Proc onSent,
@@ -289,79 +651,108 @@ namespace qi { namespace sock {
   {
     qiLogDebug(logCategory()) << _socket.get() << " SendMessageEnqueue()(" << msg.type() << ": " << msg.address() << ", ssl=" << *ssl << ")";
     using I = decltype(_sendQueue.begin());
-    I itMsg;
+    Batch batch;
     bool mustStartSendLoop = false;
     {
       std::lock_guard<std::mutex> lock{_sendMutex};
-      _sendQueue.emplace_back(std::forward<Msg>(msg));
-      itMsg = _sendQueue.begin();
+      const auto pos = insertionPoint(msg);
+      const auto it = _sendQueue.emplace(pos, std::forward<Msg>(msg));
+      // Admitted messages are already accounted for.
+      if (_reservedMessages != 0)
+        --_reservedMessages;
+      else
+        addToStats(wireSize(*it));
       // We've just added a message to the queue, so if we are not currently sending,
       // we must (re)start the send loop.
       if (!_sending)
       {
         _sending = true;
         mustStartSendLoop = true;
+        batch = nextBatch();
+        _inFlight = batch.second;
       }
     }
     if (mustStartSendLoop)
     {
       // Lemma SendMessageEnqueue.1:
-      //  When calling sendMessage, itMsg is still valid.
+      //  When calling sendMessages, the messages of the batch are still valid.
       // Proof:
       //  The send queue is a std::list, so inserting or erasing other elements
-      //  doesn't invalidate the iterator.
+      //  doesn't invalidate the iterators.
       //  Each thread adds a message to the send queue. But only one at a time
       //  can enter this branch (by tryRaiseAtomicFlag.0).
       //  Also, the sending flag is only modified while the queue is locked, so
       //  the scenario where a thread B adds a message to the queue, is suspended
       //  just before evaluating the condition of this branch, then the send loop
       //  thread A clears the queue, and then the thread B resumes, is correctly handled.
-      //  Moreover, this branch results in exactly one message being removed from
-      //  the send queue (by SendMessageEnqueue.2).
-      //  Therefore, at this point the number of messages in the send queue is
-      //  always at least 1.
+      //  Moreover, the batch is computed while the queue is locked and its
+      //  messages are only removed from the send queue once they are sent
+      //  (by SendMessageEnqueue.2).
 
       // Lemma SendMessageEnqueue.2:
-      //  eraseAndReturnNextMessage erases from the send queue the element pointed
-      //  by the given iterator, even if an exception is thrown.
-
-      // This callback will be called when a message has been sent, or an error
-      // occurred. It passes an iterator on the sent message to the upper layer,
-      // which in return decides whether sending of the enqueued messaged must
-      // continue. Then, the callback erase the message.
-      auto eraseAndReturnNextMessage =
-        [&, onSent](ErrorCode<N> erc, I itSent) mutable -> boost::optional<I> {
+      //  eraseAndReturnNextMessages erases from the send queue the elements of
+      //  the given batch, even if an exception is thrown.
+
+      // This callback will be called when a batch of messages has been sent,
+      // or an error occurred. It passes an iterator on each sent message to the
+      // upper layer, which in return decides whether sending of the enqueued
+      // messaged must continue. Then, the callback erases the messages.
+      auto eraseAndReturnNextMessages =
+        [&, onSent](ErrorCode<N> erc, I itFirst, std::size_t count) mutable -> boost::optional<Batch> {
           // It's ok to allow new sendings once the current one is complete.
           bool mustContinue = false;
-          boost::optional<I> itNext;
+          boost::optional<Batch> next;
           try
           {
             // A scoped is used to cope with potential exception thrown by onSent.
             auto scopedErase = ka::scoped([&] {
-              std::lock_guard<std::mutex> lock{_sendMutex};
-              _sendQueue.erase(itSent);
-              if (!mustContinue || _sendQueue.empty())
+              std::vector<Promise<void>> readyPromises;
               {
-                QI_ASSERT(_sending);
-                if (!_sending)
-                  qiLogWarning(logCategory()) << "SendMessageEnqueue: sending flag should be raised.";
-                _sending = false;
-                return;
+                std::lock_guard<std::mutex> lock{_sendMutex};
+                const auto itEnd = std::next(itFirst, count);
+                for (auto it = itFirst; it != itEnd; ++it)
+                  removeFromStats(wireSize(*it));
+                _sendQueue.erase(itFirst, itEnd);
+                readyPromises = takeReadyPromises();
+                if (!mustContinue || _sendQueue.empty())
+                {
+                  QI_ASSERT(_sending);
+                  if (!_sending)
+                    qiLogWarning(logCategory()) << "SendMessageEnqueue: sending flag should be raised.";
+                  _sending = false;
+                  _inFlight = 0;
+                }
+                else
+                {
+                  next = nextBatch();
+                  _inFlight = next->second;
+                }
               }
-              itNext = _sendQueue.begin();
+              // Producers waiting for room are resumed outside of the lock,
+              // as they typically send messages.
+              for (auto& promise: readyPromises)
+                promise.setValue(nullptr);
             });
-            mustContinue = onSent(erc, itSent);
+            mustContinue = true;
+            auto it = itFirst;
+            for (std::size_t i = 0; i < count; ++i, ++it)
+            {
+              // Reset first, so that the queue processing stops if onSent throws.
+              const bool cont = mustContinue;
+              mustContinue = false;
+              mustContinue = onSent(erc, ReadableMessage{it}) && cont;
+            }
           }
           catch (const std::exception& e)
           {
             qiLogError(logCategory()) << "Error in post-send phase: " << e.what();
             throw;
           }
-          return itNext;
+          return next;
         };
 
-      sendMessage<N>(_socket, itMsg, std::move(eraseAndReturnNextMessage), ssl,
-        lifetimeTransfo, syncTransfo);
+      sendMessages<N>(_socket, batch.first, batch.second, std::move(eraseAndReturnNextMessages),
+        ssl, lifetimeTransfo, syncTransfo);
     }
   }
 
@@ -0,0 +1,66 @@
+#pragma once
+#ifndef _QI_SOCK_SENDQUEUE_HPP
+#define _QI_SOCK_SENDQUEUE_HPP
+#include <cstddef>
+#include <cstdint>
+
+/// @file
+/// Contains the types describing the limits and the state of the queue of
+/// messages waiting to be sent on a socket.
+
+namespace qi { namespace sock {
+
+  /// What to do with a message that does not fit in a full send queue.
+  enum class SendQueuePolicy
+  {
+    /// The message is refused: sending it fails.
+    Reject,
+    /// The oldest event messages (`Message::Type_Event`) waiting in the queue
+    /// are dropped to make room, except fragments of events. If that is not
+    /// enough, an event message is dropped itself while other messages are
+    /// queued anyway.
+    DropOldestEvent,
+    /// The message is queued anyway. Producers are expected to wait for the
+    /// queue to be ready again (see `SendMessageEnqueue::ready`) before sending
+    /// more messages.
+    Wait
+  };
+
+  /// Limits of the messages waiting to be sent on a socket, including the ones
+  /// being written. A limit of 0 means no limit.
+  struct SendQueueLimits
+  {
+    std::size_t maxBytes;
+    std::size_t maxMessages;
+    SendQueuePolicy policy;
+
+    bool unlimited() const
+    {
+      return maxBytes == 0 && maxMessages == 0;
+    }
+  };
+
+  /// The limits of the send queue, can be set by the `QI_SEND_QUEUE_MAX_BYTES`
+  /// and `QI_SEND_QUEUE_MAX_MESSAGES` environment variables. The policy is set
+  /// by `QI_SEND_QUEUE_POLICY`, whose value is `reject`, `drop-oldest-event`
+  /// or `wait` (the default). By default the queue is unlimited.
+  SendQueueLimits getSendQueueLimitsFromEnv();
+
+  /// Metrics of a send queue.
+  struct SendQueueStats
+  {
+    /// Current depth of the queue.
+    std::size_t messages = 0;
+    std::size_t bytes = 0;
+    /// Highest depth reached by the queue.
+    std::size_t peakMessages = 0;
+    std::size_t peakBytes = 0;
+    /// Count of messages refused with the `Reject` policy.
+    std::uint64_t rejected = 0;
+    /// Count of messages dropped with the `DropOldestEvent` policy.
+    std::uint64_t dropped = 0;
+  };
+
+}} // namespace qi::sock
+
+#endif // _QI_SOCK_SENDQUEUE_HPP
@@ -0,0 +1,227 @@
+#pragma once
+#ifndef _QI_SOCK_SSLSESSION_HPP
+#define _QI_SOCK_SSLSESSION_HPP
+#include <cstddef>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <boost/asio/ssl.hpp>
+#include <boost/shared_ptr.hpp>
+
+/// @file
+/// Contains the resumption of SSL sessions by clients.
+///
+/// A full SSL handshake is expensive, both in latency and in CPU. When a
+/// client reconnects to an endpoint it was connected to, it can instead offer
+/// the session of its previous connection, which the server can accept to do
+/// an abbreviated handshake. The sessions received by clients are kept in a
+/// bounded process-wide cache, keyed by the URL of the endpoint.
+///
+/// Only the sockets that are OpenSSL streams take part in session resumption.
+
+namespace qi { namespace sock {
+
+  using SslSessionPtr = boost::shared_ptr<SSL_SESSION>;
+
+  /// Takes ownership of the session.
+  inline SslSessionPtr makeSslSessionPtr(SSL_SESSION* session)
+  {
+    return session ? SslSessionPtr(session, &SSL_SESSION_free) : SslSessionPtr{};
+  }
+
+  /// A bounded cache of SSL sessions. When the cache is full, the least
+  /// recently used session is evicted. A capacity of 0 disables the cache.
+  ///
+  /// Thread-safe.
+  class SslSessionCache
+  {
+  public:
+    explicit SslSessionCache(std::size_t capacity)
+      : _capacity(capacity)
+    {
+    }
+
+    SslSessionPtr get(const std::string& key)
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      const auto it = _index.find(key);
+      if (it == _index.end())
+        return {};
+      _entries.splice(_entries.begin(), _entries, it->second);
+      return it->second->second;
+    }
+
+    void set(const std::string& key, SslSessionPtr session)
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      if (_capacity == 0)
+        return;
+      const auto it = _index.find(key);
+      if (it != _index.end())
+      {
+        it->second->second = std::move(session);
+        _entries.splice(_entries.begin(), _entries, it->second);
+        return;
+      }
+      _entries.emplace_front(key, std::move(session));
+      _index[key] = _entries.begin();
+      trim();
+    }
+
+    void remove(const std::string& key)
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      const auto it = _index.find(key);
+      if (it == _index.end())
+        return;
+      _entries.erase(it->second);
+      _index.erase(it);
+    }
+
+    void clear()
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _entries.clear();
+      _index.clear();
+    }
+
+    std::size_t size() const
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      return _entries.size();
+    }
+
+    std::size_t capacity() const
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      return _capacity;
+    }
+
+    void setCapacity(std::size_t capacity)
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _capacity = capacity;
+      trim();
+    }
+
+  private:
+    // Most recently used first.
+    using Entries = std::list<std::pair<std::string, SslSessionPtr>>;
+
+    void trim()
+    {
+      while (_entries.size() > _capacity)
+      {
+        _index.erase(_entries.back().first);
+        _entries.pop_back();
+      }
+    }
+
+    mutable std::mutex _mutex;
+    std::size_t _capacity;
+    Entries _entries;
+    std::map<std::string, Entries::iterator> _index;
+  };
+
+  /// Capacity of the client SSL session cache, configurable with the
+  /// environment variable QI_SSL_SESSION_CACHE_SIZE. A value of 0 disables
+  /// session resumption by clients.
+  std::size_t getSslSessionCacheSizeFromEnv();
+
+  /// The cache of the sessions received by clients of the process.
+  SslSessionCache& sslSessionCache();
+
+  /// Lets the clients of a server using this context resume their sessions,
+  /// with session ids kept by the context and with session tickets. The
+  /// ticket key is generated by OpenSSL, unless it is read from the file
+  /// named by the environment variable QI_SSL_TICKET_KEY_FILE, so that the
+  /// servers sharing the file accept each other's tickets.
+  void setupSslSessionResumption(SSL_CTX* context);
+
+  namespace detail
+  {
+    /// Index of the key of the session of an SSL connection, in the
+    /// application data of the connection.
+    inline int sslSessionKeyIndex()
+    {
+      static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr,
+        [](void*, void* key, CRYPTO_EX_DATA*, int, long, void*) {
+          delete static_cast<std::string*>(key);
+        });
+      return index;
+    }
+
+    /// Called by OpenSSL when a session is received. With TLS 1.3, this
+    /// happens after the handshake, and possibly several times.
+    inline int onNewSslSession(SSL* ssl, SSL_SESSION* session)
+    {
+      const auto key = static_cast<const std::string*>(SSL_get_ex_data(ssl, sslSessionKeyIndex()));
+      if (!key)
+        return 0;
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
+      // The session of a connection that is not shut down cleanly is made
+      // non-resumable when the connection is freed: we keep a copy.
+      if (auto copy = makeSslSessionPtr(SSL_SESSION_dup(session)))
+      {
+        sslSessionCache().set(*key, std::move(copy));
+      }
+      return 0;
+#else
+      // Sessions cannot be copied before OpenSSL 1.1.1: the session itself is
+      // kept, and returning 1 gives us its reference.
+      sslSessionCache().set(*key, makeSslSessionPtr(session));
+      return 1;
+#endif
+    }
+  } // namespace detail
+
+  /// Prepares a client socket before its handshake: it offers the session
+  /// cached for `key` if any, and the sessions it receives are cached for
+  /// `key`.
+  ///
+  /// This overload is for sockets that do not support session resumption.
+  ///
+  /// NetSslSocket S
+  template<typename S>
+  void prepareSslSessionResumption(S&, const std::string& /*key*/)
+  {
+  }
+
+  template<typename T>
+  void prepareSslSessionResumption(boost::asio::ssl::stream<T>& socket, const std::string& key)
+  {
+    auto& cache = sslSessionCache();
+    if (cache.capacity() == 0)
+      return;
+    SSL* ssl = socket.native_handle();
+    SSL_CTX* context = SSL_get_SSL_CTX(ssl);
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(context, &detail::onNewSslSession);
+    const auto keyIndex = detail::sslSessionKeyIndex();
+    delete static_cast<std::string*>(SSL_get_ex_data(ssl, keyIndex));
+    SSL_set_ex_data(ssl, keyIndex, new std::string(key));
+    if (auto session = cache.get(key))
+    {
+      SSL_set_session(ssl, session.get());
+    }
+  }
+
+  /// Returns true if the handshake of the socket resumed a session.
+  ///
+  /// NetSslSocket S
+  template<typename S>
+  bool sslSessionReused(S&)
+  {
+    return false;
+  }
+
+  template<typename T>
+  bool sslSessionReused(boost::asio::ssl::stream<T>& socket)
+  {
+    return SSL_session_reused(socket.native_handle()) == 1;
+  }
+}} // namespace qi::sock
+
+#endif // _QI_SOCK_SSLSESSION_HPP
@@ -0,0 +1,551 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _QITYPE_DETAIL_STATICBINARYCODEC_HXX_
+#define _QITYPE_DETAIL_STATICBINARYCODEC_HXX_
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <boost/optional.hpp>
+#include <qi/api.hpp>
+#include <qi/buffer.hpp>
+
+namespace qi
+{
+  class TypeInterface;
+
+  namespace detail
+  {
+    /// Binary encoding of the values whose type is known at compile time,
+    /// without the type visitors. It produces the same bytes as the visitors.
+    ///
+    /// `StaticBinaryCodec<T>::enabled` is true if every part of `T` has a
+    /// fixed encoding: booleans, integers, floating points, strings, raw
+    /// buffers, and the lists, sets, maps, pairs, optionals and structs
+    /// (declared with `QI_TYPE_STRUCT`) of such types. Dynamic values and
+    /// objects are left to the visitors. Then `encode` appends the value to a
+    /// buffer and `decode` reads it into an existing value, they both return
+    /// false on failure. `size` returns the number of bytes `encode` appends.
+    template <typename T, typename Enable = void>
+    struct StaticBinaryCodec
+    {
+      static const bool enabled = false;
+    };
+
+    template <typename T>
+    using HasStaticBinaryCodec = std::integral_constant<bool, StaticBinaryCodec<T>::enabled>;
+
+    template <typename T>
+    bool encodeStatic(Buffer& out, const T& value, std::true_type)
+    {
+      return StaticBinaryCodec<T>::encode(out, value);
+    }
+
+    template <typename T>
+    bool encodeStatic(Buffer&, const T&, std::false_type)
+    {
+      return false;
+    }
+
+    template <typename T>
+    bool encodeStatic(Buffer& out, const T& value)
+    {
+      return encodeStatic(out, value, HasStaticBinaryCodec<T>{});
+    }
+
+    template <typename T>
+    std::size_t encodedStaticSize(const T& value, std::true_type)
+    {
+      return StaticBinaryCodec<T>::size(value);
+    }
+
+    template <typename T>
+    std::size_t encodedStaticSize(const T&, std::false_type)
+    {
+      return 0;
+    }
+
+    template <typename T>
+    std::size_t encodedStaticSize(const T& value)
+    {
+      return encodedStaticSize(value, HasStaticBinaryCodec<T>{});
+    }
+
+    template <typename T>
+    bool decodeStatic(BufferReader& in, T& value, std::true_type)
+    {
+      return StaticBinaryCodec<T>::decode(in, value);
+    }
+
+    template <typename T>
+    bool decodeStatic(BufferReader&, T&, std::false_type)
+    {
+      return false;
+    }
+
+    template <typename T>
+    bool decodeStatic(BufferReader& in, T& value)
+    {
+      return decodeStatic(in, value, HasStaticBinaryCodec<T>{});
+    }
+
+    inline bool encodeStaticSize(Buffer& out, std::size_t size)
+    {
+      const auto size32 = static_cast<std::uint32_t>(size);
+      return size32 == size && out.write(&size32, sizeof(size32));
+    }
+
+    inline bool decodeStaticSize(BufferReader& in, std::uint32_t& size)
+    {
+      return in.read(&size, sizeof(size)) == sizeof(size);
+    }
+
+    template <typename T>
+    struct IsStaticBinaryScalar
+      : std::integral_constant<bool,
+                               std::is_same<T, typename std::remove_cv<T>::type>::value
+                               && ((std::is_integral<T>::value
+                                    && !std::is_same<T, bool>::value
+                                    && !std::is_same<T, wchar_t>::value
+                                    && !std::is_same<T, char16_t>::value
+                                    && !std::is_same<T, char32_t>::value)
+                                   || std::is_same<T, float>::value
+                                   || std::is_same<T, double>::value)>
+    {
+    };
+
+    // Integers and floating points are sent as they are in memory.
+    template <typename T>
+    struct StaticBinaryCodec<T, typename std::enable_if<IsStaticBinaryScalar<T>::value>::type>
+    {
+      static const bool enabled = true;
+
+      static bool encode(Buffer& out, const T& value)
+      {
+        return out.write(&value, sizeof(T));
+      }
+
+      static std::size_t size(const T&)
+      {
+        return sizeof(T);
+      }
+
+      static bool decode(BufferReader& in, T& value)
+      {
+        return in.read(&value, sizeof(T)) == sizeof(T);
+      }
+    };
+
+    template <>
+    struct StaticBinaryCodec<bool>
+    {
+      static const bool enabled = true;
+
+      static bool encode(Buffer& out, const bool& value)
+      {
+        const unsigned char byte = value ? 1 : 0;
+        return out.write(&byte, 1);
+      }
+
+      static std::size_t size(const bool&)
+      {
+        return 1;
+      }
+
+      static bool decode(BufferReader& in, bool& value)
+      {
+        unsigned char byte = 0;
+        if (in.read(&byte, 1) != 1)
+          return false;
+        value = byte != 0;
+        return true;
+      }
+    };
+
+    template <>
+    struct StaticBinaryCodec<std::string>
+    {
+      static const bool enabled = true;
+
+      static bool encode(Buffer& out, const std::string& value)
+      {
+        return encodeStaticSize(out, value.size())
+            && (value.empty() || out.write(value.data(), value.size()));
+      }
+
+      static std::size_t size(const std::string& value)
+      {
+        return sizeof(std::uint32_t) + value.size();
+      }
+
+      static bool decode(BufferReader& in, std::string& value)
+      {
+        std::uint32_t size = 0;
+        if (!decodeStaticSize(in, size))
+          return false;
+        value.clear();
+        if (!size)
+          return true;
+        const auto data = static_cast<const char*>(in.read(size));
+        if (!data)
+          return false;
+        value.assign(data, size);
+        return true;
+      }
+    };
+
+    template <>
+    struct StaticBinaryCodec<Buffer>
+    {
+      static const bool enabled = true;
+
+      static bool encode(Buffer& out, const Buffer& value)
+      {
+        out.addSubBuffer(value);
+        return true;
+      }
+
+      // Only the size of the sub-buffer is written in the buffer.
+      static std::size_t size(const Buffer&)
+      {
+        return sizeof(std::uint32_t);
+      }
+
+      static bool decode(BufferReader& in, Buffer& value)
+      {
+        if (in.hasSubBuffer())
+        {
+          value = in.subBuffer();
+          return true;
+        }
+        std::uint32_t size = 0;
+        if (!decodeStaticSize(in, size))
+          return false;
+        const auto data = in.read(size);
+        if (!data)
+          return false;
+        value.clear();
+        return value.write(data, size);
+      }
+    };
+
+    /// Lists and sets.
+    template <typename C>
+    struct StaticBinaryListCodec
+    {
+      using Element = typename C::value_type;
+      static const bool enabled = StaticBinaryCodec<Element>::enabled;
+
+      static bool encode(Buffer& out, const C& value)
+      {
+        if (!encodeStaticSize(out, value.size()))
+          return false;
+        for (const auto& element: value)
+        {
+          if (!encodeStatic(out, element))
+            return false;
+        }
+        return true;
+      }
+
+      static std::size_t size(const C& value)
+      {
+        std::size_t size = sizeof(std::uint32_t);
+        for (const auto& element: value)
+          size += encodedStaticSize(element);
+        return size;
+      }
+
+      static bool decode(BufferReader& in, C& value)
+      {
+        std::uint32_t size = 0;
+        if (!decodeStaticSize(in, size))
+          return false;
+        value.clear();
+        for (std::uint32_t i = 0; i < size; ++i)
+        {
+          Element element{};
+          if (!decodeStatic(in, element))
+            return false;
+          value.insert(value.end(), std::move(element));
+        }
+        return true;
+      }
+    };
+
+    // std::vector<bool> has no type interface.
+    template <typename T, typename A>
+    struct StaticBinaryCodec<std::vector<T, A>,
+                             typename std::enable_if<!std::is_same<T, bool>::value
+                                                     && !IsStaticBinaryScalar<T>::value>::type>
+      : StaticBinaryListCodec<std::vector<T, A>>
+    {
+    };
+
+    // The elements of a vector of scalars are sent as they are in memory, so
+    // they are copied at once.
+    template <typename T, typename A>
+    struct StaticBinaryCodec<std::vector<T, A>,
+                             typename std::enable_if<IsStaticBinaryScalar<T>::value>::type>
+    {
+      static const bool enabled = true;
+
+      static bool encode(Buffer& out, const std::vector<T, A>& value)
+      {
+        return encodeStaticSize(out, value.size())
+            && (value.empty() || out.write(value.data(), value.size() * sizeof(T)));
+      }
+
+      static std::size_t size(const std::vector<T, A>& value)
+      {
+        return sizeof(std::uint32_t) + value.size() * sizeof(T);
+      }
+
+      static bool decode(BufferReader& in, std::vector<T, A>& value)
+      {
+        std::uint32_t size = 0;
+        if (!decodeStaticSize(in, size))
+          return false;
+        value.clear();
+        if (!size)
+          return true;
+        // The data may not be aligned for T.
+        const auto data = in.read(static_cast<std::size_t>(size) * sizeof(T));
+        if (!data)
+          return false;
+        value.resize(size);
+        std::memcpy(value.data(), data, static_cast<std::size_t>(size) * sizeof(T));
+        return true;
+      }
+    };
+
+    template <typename T, typename A>
+    struct StaticBinaryCodec<std::list<T, A>> : StaticBinaryListCodec<std::list<T, A>>
+    {
+    };
+
+    template <typename T, typename C, typename A>
+    struct StaticBinaryCodec<std::set<T, C, A>> : StaticBinaryListCodec<std::set<T, C, A>>
+    {
+    };
+
+    template <typename K, typename V, typename C, typename A>
+    struct StaticBinaryCodec<std::map<K, V, C, A>>
+    {
+      static const bool enabled = StaticBinaryCodec<K>::enabled && StaticBinaryCodec<V>::enabled;
+
+      static bool encode(Buffer& out, const std::map<K, V, C, A>& value)
+      {
+        if (!encodeStaticSize(out, value.size()))
+          return false;
+        for (const auto& element: value)
+        {
+          if (!encodeStatic(out, element.first) || !encodeStatic(out, element.second))
+            return false;
+        }
+        return true;
+      }
+
+      static std::size_t size(const std::map<K, V, C, A>& value)
+      {
+        std::size_t size = sizeof(std::uint32_t);
+        for (const auto& element: value)
+          size += encodedStaticSize(element.first) + encodedStaticSize(element.second);
+        return size;
+      }
+
+      // As the visitors do, a duplicate key replaces the previous value.
+      static bool decode(BufferReader& in, std::map<K, V, C, A>& value)
+      {
+        std::uint32_t size = 0;
+        if (!decodeStaticSize(in, size))
+          return false;
+        value.clear();
+        for (std::uint32_t i = 0; i < size; ++i)
+        {
+          K key{};
+          V element{};
+          if (!decodeStatic(in, key) || !decodeStatic(in, element))
+            return false;
+          value[std::move(key)] = std::move(element);
+        }
+        return true;
+      }
+    };
+
+    template <typename F, typename S>
+    struct StaticBinaryCodec<std::pair<F, S>>
+    {
+      static const bool enabled = StaticBinaryCodec<F>::enabled && StaticBinaryCodec<S>::enabled;
+
+      static bool encode(Buffer& out, const std::pair<F, S>& value)
+      {
+        return encodeStatic(out, value.first) && encodeStatic(out, value.second);
+      }
+
+      static std::size_t size(const std::pair<F, S>& value)
+      {
+        return encodedStaticSize(value.first) + encodedStaticSize(value.second);
+      }
+
+      static bool decode(BufferReader& in, std::pair<F, S>& value)
+      {
+        return decodeStatic(in, value.first) && decodeStatic(in, value.second);
+      }
+    };
+
+    template <typename T>
+    struct StaticBinaryCodec<boost::optional<T>>
+    {
+      static const bool enabled = StaticBinaryCodec<T>::enabled;
+
+      static bool encode(Buffer& out, const boost::optional<T>& value)
+      {
+        return StaticBinaryCodec<bool>::encode(out, static_cast<bool>(value))
+            && (!value || encodeStatic(out, *value));
+      }
+
+      static std::size_t size(const boost::optional<T>& value)
+      {
+        return 1 + (value ? encodedStaticSize(*value) : 0);
+      }
+
+      static bool decode(BufferReader& in, boost::optional<T>& value)
+      {
+        bool hasValue = false;
+        if (!StaticBinaryCodec<bool>::decode(in, hasValue))
+          return false;
+        if (!hasValue)
+        {
+          value = boost::none;
+          return true;
+        }
+        T element{};
+        if (!decodeStatic(in, element))
+          return false;
+        value = std::move(element);
+        return true;
+      }
+    };
+
+    /// `T`, made dependent on `Enable` to delay the lookups in the codecs of
+    /// the structs.
+    template <typename T, typename Enable>
+    struct StaticBinaryDependentType
+    {
+      using type = T;
+    };
+
+    /// Type-erased functions of a static codec, to be found from a type
+    /// interface.
+    struct StaticBinaryCodecFunctions
+    {
+      bool (*encode)(Buffer& out, const void* value);
+      bool (*decode)(BufferReader& in, void* value);
+      std::size_t (*size)(const void* value);
+    };
+
+    /// Sets the static codec of the values of the type. It is used by
+    /// `encodeBinary` and `decodeBinary` instead of the type visitors.
+    QI_API void registerStaticBinaryCodec(TypeInterface* type, StaticBinaryCodecFunctions functions);
+
+    /// Returns the static codec of the values of the type, with null functions
+    /// if it has none.
+    QI_API StaticBinaryCodecFunctions staticBinaryCodec(TypeInterface* type);
+
+    template <typename T>
+    bool encodeStaticErased(Buffer& out, const void* value)
+    {
+      return StaticBinaryCodec<T>::encode(out, *static_cast<const T*>(value));
+    }
+
+    template <typename T>
+    bool decodeStaticErased(BufferReader& in, void* value)
+    {
+      return StaticBinaryCodec<T>::decode(in, *static_cast<T*>(value));
+    }
+
+    template <typename T>
+    std::size_t encodedStaticSizeErased(const void* value)
+    {
+      return StaticBinaryCodec<T>::size(*static_cast<const T*>(value));
+    }
+
+    template <typename T>
+    void registerStaticBinaryCodec(TypeInterface* type, std::true_type)
+    {
+      registerStaticBinaryCodec(type, StaticBinaryCodecFunctions{&encodeStaticErased<T>,
+                                                                 &decodeStaticErased<T>,
+                                                                 &encodedStaticSizeErased<T>});
+    }
+
+    template <typename T>
+    void registerStaticBinaryCodec(TypeInterface*, std::false_type)
+    {
+    }
+
+    /// Registers the static codec of `T` for its type interface, if `T` has one.
+    template <typename T>
+    void registerStaticBinaryCodec(TypeInterface* type)
+    {
+      registerStaticBinaryCodec<T>(type, HasStaticBinaryCodec<T>{});
+    }
+  } // namespace detail
+} // namespace qi
+
+#define __QI_STATIC_BINARY_CODEC_OF(field) \
+  ::qi::detail::StaticBinaryCodec<typename ::std::decay<decltype(::std::declval<Struct&>().field)>::type>
+#define __QI_STATIC_BINARY_CODEC_ENABLED(_, what, field) \
+  && __QI_STATIC_BINARY_CODEC_OF(field)::enabled
+#define __QI_STATIC_BINARY_CODEC_ENCODE(_, what, field) \
+  && ::qi::detail::encodeStatic(out, value.field)
+#define __QI_STATIC_BINARY_CODEC_DECODE(_, what, field) \
+  && ::qi::detail::decodeStatic(in, value.field)
+#define __QI_STATIC_BINARY_CODEC_SIZE(_, what, field) \
+  + ::qi::detail::encodedStaticSize(value.field)
+
+/// Defines the static codec of a struct declared with `QI_TYPE_STRUCT`: its
+/// fields one after the other, as a tuple. It is a partial specialization so
+/// that the codecs of the fields are only looked up when it is used, after
+/// the fields types are declared to the type system.
+#define __QI_TYPE_STRUCT_STATIC_BINARY_CODEC(name, ...)                                     \
+  namespace qi                                                                             \
+  {                                                                                        \
+    namespace detail                                                                       \
+    {                                                                                      \
+      template <typename Enable>                                                           \
+      struct StaticBinaryCodec<name, Enable>                                               \
+      {                                                                                    \
+        using Struct = typename StaticBinaryDependentType<name, Enable>::type;             \
+        static const bool enabled =                                                        \
+          true QI_VAARGS_APPLY(__QI_STATIC_BINARY_CODEC_ENABLED, _, __VA_ARGS__);          \
+                                                                                           \
+        static bool encode(::qi::Buffer& out, const Struct& value)                         \
+        {                                                                                  \
+          return true QI_VAARGS_APPLY(__QI_STATIC_BINARY_CODEC_ENCODE, _, __VA_ARGS__);    \
+        }                                                                                  \
+                                                                                           \
+        static bool decode(::qi::BufferReader& in, Struct& value)                          \
+        {                                                                                  \
+          return true QI_VAARGS_APPLY(__QI_STATIC_BINARY_CODEC_DECODE, _, __VA_ARGS__);    \
+        }                                                                                  \
+                                                                                           \
+        static ::std::size_t size(const Struct& value)                                     \
+        {                                                                                  \
+          return 0 QI_VAARGS_APPLY(__QI_STATIC_BINARY_CODEC_SIZE, _, __VA_ARGS__);         \
+        }                                                                                  \
+      };                                                                                   \
+    }                                                                                      \
+  }
+
+#endif  // _QITYPE_DETAIL_STATICBINARYCODEC_HXX_
@@ -395,7 +395,8 @@ friend class qi::TypeImpl<name>;
  */
 #define QI_TYPE_STRUCT(name, ...) \
   QI_TYPE_STRUCT_DECLARE(name) \
-  __QI_TYPE_STRUCT_IMPLEMENT(name, inline, /**/, __VA_ARGS__)
+  __QI_TYPE_STRUCT_IMPLEMENT(name, inline, /**/, __VA_ARGS__) \
+  __QI_TYPE_STRUCT_STATIC_BINARY_CODEC(name, __VA_ARGS__)
 
 /** Similar to QI_TYPE_STRUCT, but evaluates 'onSet' after writting to an instance.
  * The instance is accessible through the variable 'ptr'.
@@ -440,10 +441,11 @@ friend class qi::TypeImpl<name>;
  * unit. To ensure this, the simplest option is to use this macro from a .cpp
  * source file. It should *not* be used in a header.
  */
-#define QI_TYPE_STRUCT_REGISTER(name, ...) \
-namespace _qi_ {                           \
-    QI_TYPE_STRUCT(name, __VA_ARGS__)      \
-}                                          \
+#define QI_TYPE_STRUCT_REGISTER(name, ...)                  \
+namespace _qi_ {                                            \
+    QI_TYPE_STRUCT_DECLARE(name)                            \
+    __QI_TYPE_STRUCT_IMPLEMENT(name, inline, /**/, __VA_ARGS__) \
+}                                                           \
 QI_TYPE_REGISTER_CUSTOM(name, _qi_::qi::TypeImpl<name>)
 
 /** Similar to QI_TYPE_STRUCT_AGREGATE_CONSTRUCTOR,
@@ -14,6 +14,7 @@
 #include <vector>
 #include <list>
 #include <qi/type/detail/bindtype.hxx>
+#include <qi/type/detail/staticbinarycodec.hxx>
 #include <boost/thread/mutex.hpp>
 #include <boost/mpl/for_each.hpp>
 #include <boost/mpl/transform_view.hpp>
@@ -45,6 +46,7 @@ namespace qi  {
     {
       qiLogDebug("qitype.typeof") << "first typeOf request for unregistered type " << typeid(T).name();
       tgt = new TypeImpl<T>();
+      registerStaticBinaryCodec<T>(tgt);
     }
 
     template<typename T>
@@ -30,6 +30,11 @@ namespace qi {
    *    <li>- *empty string*</li>
    *  </ul>
    *
+   *  Local (Unix-domain) sockets are designated by the `unix` protocol, the
+   *  host being the path of the socket: `unix:///tmp/qi.sock`. The whole path
+   *  is the host, even if it contains colons, and such urls never have a
+   *  port: the default ports and `setPort` are ignored.
+   *
    *  @note This class is copyable.
    */
   class QI_API Url
@@ -93,6 +98,7 @@ namespace qi {
 
     /**
      *  @return True if the protocol, host and port have been set.
+     *  For the `unix` protocol, the port is not required.
      */
     bool isValid() const;
 
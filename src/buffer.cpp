@@ -7,6 +7,7 @@
 #include <qi/buffer.hpp>
 #include <qi/log.hpp>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <stdexcept>
@@ -128,17 +129,20 @@ namespace qi
 
   bool BufferPrivate::resize(size_t neededSize)
   {
-    neededSize += BLOCK; // Should be enough in most cases;
+    return reserve(neededSize + BLOCK); // Should be enough in most cases;
+  }
 
-    qiLogDebug() << "Resizing buffer from " << available << " to " << neededSize;
+  bool BufferPrivate::reserve(size_t capacity)
+  {
+    qiLogDebug() << "Resizing buffer from " << available << " to " << capacity;
     unsigned char *newBigdata;
 
-    newBigdata = static_cast<unsigned char *>(realloc(_bigdata, neededSize));
+    newBigdata = static_cast<unsigned char *>(realloc(_bigdata, capacity));
     if (newBigdata == NULL)
       return false;
     if (!_bigdata && used > 0)
       ::memcpy(newBigdata, _data, used);
-    available = neededSize;
+    available = capacity;
     _bigdata = newBigdata; // Don't worry, realloc free previous buffer if needed
     return true;
   }
@@ -250,6 +254,15 @@ namespace qi
     return p;
   }
 
+  bool Buffer::reserveCapacity(size_t size)
+  {
+    if (_p->used + size <= _p->available)
+      return true;
+    // Grows geometrically, so that reserving small sizes repeatedly does not
+    // reallocate each time.
+    return _p->reserve(std::max(_p->used + size, _p->available + _p->available / 2));
+  }
+
   void Buffer::clear()
   {
     _p->used = 0;
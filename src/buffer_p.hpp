@@ -29,6 +29,8 @@ namespace qi
     unsigned char* data();
     const unsigned char* data() const;
     bool            resize(size_t size = 0x100000);
+    // Reallocates the data to hold exactly `capacity` bytes.
+    bool            reserve(size_t capacity);
     boost::optional<size_t> indexOfSubBuffer(size_t offset) const;
     friend bool operator==(const BufferPrivate& a, const BufferPrivate& b);
 
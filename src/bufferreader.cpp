@@ -16,6 +16,16 @@ namespace qi {
   {
   }
 
+  BufferReader::BufferReader(const Buffer& buffer, size_t position)
+  : _buffer(&buffer)
+  , _cursor(position)
+  , _subCursor(0)
+  {
+    const auto& subBuffers = _buffer->subBuffers();
+    while (_subCursor < subBuffers.size() && subBuffers[_subCursor].first < position)
+      ++_subCursor;
+  }
+
   BufferReader::~BufferReader()
   {
   }
@@ -0,0 +1,230 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include "batch.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <boost/lexical_cast.hpp>
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+qiLogCategory("qimessaging.batch");
+
+namespace qi
+{
+  namespace batch
+  {
+    namespace
+    {
+      const unsigned int defaultReplyDelayMs = 10;
+      const std::size_t countPrefix = sizeof(std::uint32_t);
+      const std::uint8_t innerForbiddenFlags =
+          Message::TypeFlag_Batch | Message::TypeFlag_Fragment | Message::TypeFlag_Compressed;
+
+      // Appends the payload as it is sent to the network: the sub-buffers are
+      // inlined after their size.
+      void writePayload(Buffer& out, const Buffer& payload)
+      {
+        const auto data = static_cast<const char*>(payload.data());
+        std::size_t begin = 0;
+        for (const auto& sub: payload.subBuffers())
+        {
+          const auto end = sub.first + sizeof(Buffer::size_type);
+          out.write(data + begin, end - begin);
+          begin = end;
+          out.write(sub.second.data(), sub.second.size());
+        }
+        out.write(data + begin, payload.size() - begin);
+      }
+
+      bool isReply(const Message& msg)
+      {
+        return msg.type() == Message::Type_Reply || msg.type() == Message::Type_Error
+            || msg.type() == Message::Type_Canceled;
+      }
+    }
+
+    Message pack(const std::vector<Message>& messages)
+    {
+      QI_ASSERT_FALSE(messages.empty());
+      Message batch;
+      batch.setType(messages.front().type());
+      batch.setFlags(Message::TypeFlag_Batch);
+      batch.setService(messages.front().service());
+      batch.setObject(messages.front().object());
+      batch.setPriority(messages.front().priority());
+
+      Buffer buffer;
+      std::size_t size = countPrefix;
+      for (const auto& msg: messages)
+        size += sizeof(Message::Header) + msg.buffer().totalSize();
+      buffer.reserve(size);
+      buffer.clear();
+
+      char prefix[countPrefix];
+      const auto count = messages.size();
+      for (std::size_t i = 0; i < countPrefix; ++i)
+        prefix[i] = static_cast<char>((count >> (8 * i)) & 0xff);
+      buffer.write(prefix, countPrefix);
+      for (const auto& msg: messages)
+      {
+        QI_ASSERT_FALSE(msg.flags() & innerForbiddenFlags);
+        auto header = msg.header();
+        header.size = static_cast<std::uint32_t>(msg.buffer().totalSize());
+        buffer.write(&header, sizeof(header));
+        writePayload(buffer, msg.buffer());
+      }
+      batch.setBuffer(std::move(buffer));
+      return batch;
+    }
+
+    boost::optional<std::vector<Message>> unpack(const Message& batch)
+    {
+      const auto& buffer = batch.buffer();
+      if (!buffer.subBuffers().empty() || buffer.size() < countPrefix)
+        return {};
+      const auto data = static_cast<const unsigned char*>(buffer.data());
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < countPrefix; ++i)
+        count |= static_cast<std::size_t>(data[i]) << (8 * i);
+
+      std::vector<Message> messages;
+      std::size_t offset = countPrefix;
+      const auto size = buffer.size();
+      // Each message takes at least a header.
+      if (count > (size - offset) / sizeof(Message::Header))
+        return {};
+      messages.reserve(count);
+      for (std::size_t i = 0; i < count; ++i)
+      {
+        Message msg;
+        auto& header = msg.header();
+        std::memcpy(&header, data + offset, sizeof(header));
+        offset += sizeof(header);
+        if (header.magic != Message::Header::magicCookie || header.size > size - offset
+            || (header.flags & innerForbiddenFlags))
+          return {};
+        Buffer payload;
+        payload.write(data + offset, header.size);
+        offset += header.size;
+        msg.setBuffer(std::move(payload));
+        msg.setTimestamp(batch.timestamp());
+        messages.push_back(std::move(msg));
+      }
+      if (offset != size)
+        return {};
+      return messages;
+    }
+
+    ReplyCollector::Group ReplyCollector::expect(const std::vector<Message>& messages)
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      const auto group = _nextGroup++;
+      auto& replies = _groups[group];
+      replies.expected = 0;
+      for (const auto& msg: messages)
+      {
+        if (msg.type() != Message::Type_Call)
+          continue;
+        if (_groupOfCall.emplace(msg.id(), group).second)
+          ++replies.expected;
+      }
+      _pendingCount.store(_groupOfCall.size());
+      if (replies.expected == 0)
+        _groups.erase(group);
+      else
+        replies.messages.reserve(replies.expected);
+      return group;
+    }
+
+    bool ReplyCollector::collect(Message& reply, std::vector<Message>& complete)
+    {
+      if (_pendingCount.load(std::memory_order_relaxed) == 0 || !isReply(reply))
+        return false;
+      std::lock_guard<std::mutex> lock{_mutex};
+      const auto call = _groupOfCall.find(reply.id());
+      if (call == _groupOfCall.end())
+        return false;
+      const auto group = _groups.find(call->second);
+      _groupOfCall.erase(call);
+      _pendingCount.store(_groupOfCall.size());
+      if (group == _groups.end())
+        return false;
+      auto& replies = group->second;
+      replies.messages.push_back(std::move(reply));
+      ++_heldCount;
+      if (replies.messages.size() == replies.expected)
+      {
+        _heldCount -= replies.messages.size();
+        complete = std::move(replies.messages);
+        _groups.erase(group);
+      }
+      return true;
+    }
+
+    std::vector<Message> ReplyCollector::release(Group group)
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      const auto it = _groups.find(group);
+      if (it == _groups.end())
+        return {};
+      auto messages = std::move(it->second.messages);
+      _groups.erase(it);
+      _heldCount -= messages.size();
+      // The calls that did not reply yet keep an entry in _groupOfCall until
+      // they do: their reply is then sent on its own.
+      return messages;
+    }
+
+    std::vector<Message> ReplyCollector::releaseBefore(const Message& msg)
+    {
+      if (_heldCount.load(std::memory_order_relaxed) == 0 || isReply(msg))
+        return {};
+      std::lock_guard<std::mutex> lock{_mutex};
+      std::vector<Message> messages;
+      for (auto it = _groups.begin(); it != _groups.end();)
+      {
+        auto& held = it->second.messages;
+        if (held.empty())
+        {
+          ++it;
+          continue;
+        }
+        std::move(held.begin(), held.end(), std::back_inserter(messages));
+        it = _groups.erase(it);
+      }
+      _heldCount.store(0);
+      return messages;
+    }
+
+    std::size_t ReplyCollector::pendingCount() const
+    {
+      return _pendingCount.load();
+    }
+
+    Duration replyDelayFromEnv()
+    {
+      static const Duration delay = [] {
+        const auto env = os::getenv("QI_MESSAGE_BATCH_REPLY_DELAY");
+        if (!env.empty())
+        {
+          try
+          {
+            return Duration(MilliSeconds(boost::lexical_cast<unsigned int>(env)));
+          }
+          catch (const boost::bad_lexical_cast&)
+          {
+            qiLogWarning() << "Invalid value of QI_MESSAGE_BATCH_REPLY_DELAY: '" << env
+                           << "', using " << defaultReplyDelayMs << " ms.";
+          }
+        }
+        return Duration(MilliSeconds(defaultReplyDelayMs));
+      }();
+      return delay;
+    }
+  } // namespace batch
+} // namespace qi
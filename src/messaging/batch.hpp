@@ -0,0 +1,102 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_BATCH_HPP_
+#define _SRC_BATCH_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <boost/optional.hpp>
+#include <qi/api.hpp>
+#include <qi/clock.hpp>
+#include "message.hpp"
+
+/// @file
+/// Contains the batching of messages.
+///
+/// A batch message carries several messages in its payload, so that they take
+/// one header, one write and one read on the network. It has the
+/// `Message::TypeFlag_Batch` flag and the type of the messages it carries:
+/// calls, or replies to calls (replies, errors and cancellations). Its
+/// payload starts with the count of messages, as a 32 bits little-endian
+/// integer, followed by each message as it is sent on its own: its header and
+/// its payload.
+///
+/// A batch of calls is answered by batches of replies: the replies to the calls
+/// of a batch are gathered until they are all there, or until a delay expires.
+
+namespace qi
+{
+  namespace batch
+  {
+    /// Returns a batch message that carries the messages. They must be of the
+    /// same kind (calls or replies), and must not be batches, fragments or
+    /// compressed.
+    QI_API Message pack(const std::vector<Message>& messages);
+
+    /// Returns the messages carried by a batch message, or none if its payload
+    /// is ill-formed.
+    QI_API boost::optional<std::vector<Message>> unpack(const Message& batch);
+
+    /// Gathers the replies to the calls of the batches received by a socket.
+    ///
+    /// Thread-safe.
+    class QI_API ReplyCollector
+    {
+    public:
+      using Group = std::uint64_t;
+
+      /// Starts gathering the replies to the calls among the messages, and
+      /// returns the group they are gathered in.
+      Group expect(const std::vector<Message>& messages);
+
+      /// If the message replies to a call of a group, takes it and returns
+      /// true. Once the group has all its replies, they are moved to
+      /// `complete` and the group is forgotten.
+      bool collect(Message& reply, std::vector<Message>& complete);
+
+      /// Forgets the group, and returns the replies gathered so far. The next
+      /// replies to its calls are not collected.
+      std::vector<Message> release(Group group);
+
+      /// If the message is not a reply, forgets the groups that gathered
+      /// replies and returns these replies: they must be sent before the
+      /// message, which must not overtake them.
+      std::vector<Message> releaseBefore(const Message& msg);
+
+      /// Count of calls whose reply is awaited.
+      std::size_t pendingCount() const;
+
+    private:
+      struct Replies
+      {
+        std::size_t expected;
+        std::vector<Message> messages;
+      };
+
+      mutable std::mutex _mutex;
+      // Size of _groupOfCall, to skip the lock when no reply is awaited.
+      std::atomic<std::size_t> _pendingCount{0};
+      // Count of the replies gathered in _groups, to skip the lock when none
+      // is held.
+      std::atomic<std::size_t> _heldCount{0};
+      Group _nextGroup = 0;
+      std::unordered_map<unsigned int, Group> _groupOfCall;
+      std::unordered_map<Group, Replies> _groups;
+    };
+
+    /// Longest time the replies to the calls of a batch are kept to be sent
+    /// together, can be overriden by the `QI_MESSAGE_BATCH_REPLY_DELAY`
+    /// environment variable (in milliseconds). Replies that come later are
+    /// sent on their own.
+    QI_API Duration replyDelayFromEnv();
+  } // namespace batch
+} // namespace qi
+
+#endif // _SRC_BATCH_HPP_
@@ -8,6 +8,7 @@
 #include <qi/anyobject.hpp>
 #include <qi/type/objecttypebuilder.hpp>
 #include "boundobject.hpp"
+#include "src/type/serializationplan.hpp"
 
 qiLogCategory("qimessaging.boundobject");
 
@@ -85,7 +86,6 @@ namespace qi {
   struct ServiceBoundObject::CancelableKit
   {
     ServiceBoundObject::CancelableMap map;
-    boost::mutex                      guard;
   };
 
   ServiceBoundObject::ServiceBoundObject(unsigned int serviceId, unsigned int objectId,
@@ -369,8 +369,7 @@ namespace qi {
         AtomicIntPtr cancelRequested = boost::make_shared<Atomic<int> >(0);
         {
           qiLogDebug() << this << " Registering future for " << socket.get() << ", message:" << msg.id();
-          boost::mutex::scoped_lock futlock(_cancelables->guard);
-          _cancelables->map[socket][msg.id()] = std::make_pair(fut, cancelRequested);
+          _cancelables->map.set(CancelableKey(socket, msg.id()), CancelableCall(fut, cancelRequested));
         }
         Signature retSig;
         const MetaMethod* mm = obj.metaObject().method(funcId);
@@ -417,24 +416,15 @@ namespace qi {
   void ServiceBoundObject::cancelCall(MessageSocketPtr socket, const Message& cancelMessage, MessageId origMsgId)
   {
     qiLogDebug() << "Canceling call: " << origMsgId << " on client " << socket.get();
-    std::pair<Future<AnyReference>, AtomicIntPtr > fut;
+    CancelableCall fut;
     {
-      boost::mutex::scoped_lock lock(_cancelables->guard);
-      CancelableMap& cancelableCalls = _cancelables->map;
-      CancelableMap::iterator it = cancelableCalls.find(socket);
-      if (it == cancelableCalls.end())
+      auto recorded = _cancelables->map.find(CancelableKey(socket, origMsgId));
+      if (!recorded)
       {
-        qiLogDebug() << "Socket " << socket.get() << " not recorded";
+        qiLogDebug() << "No recorded future for message " << origMsgId << " on client " << socket.get();
         return;
       }
-      FutureMap::iterator futIt = it->second.find(origMsgId);
-
-      if (futIt == it->second.end())
-      {
-        qiLogDebug() << "No recorded future for message " << origMsgId;
-        return;
-      }
-      fut = futIt->second;
+      fut = std::move(*recorded);
     }
 
     // We count the number or requested cancels.
@@ -490,10 +480,9 @@ namespace qi {
     // Disconnect event links set for this client.
     if (_onSocketDisconnectedCallback)
       _onSocketDisconnectedCallback(client, error);
-    {
-      boost::mutex::scoped_lock lock(_cancelables->guard);
-      _cancelables->map.erase(client);
-    }
+    _cancelables->map.eraseIf([&](const CancelableKey& key, const CancelableCall&) {
+      return key.first == client;
+    });
     BySocketServiceSignalLinks::iterator it = _links.find(client);
     if (it != _links.end())
     {
@@ -558,20 +547,7 @@ namespace qi {
     if (!kitPtr)
       return;
 
-    boost::mutex::scoped_lock lock(kitPtr->guard);
-    CancelableMap& cancelableCalls = kitPtr->map;
-    CancelableMap::iterator it = cancelableCalls.find(sock);
-
-    if (it != cancelableCalls.end())
-    {
-      FutureMap::iterator futIt = it->second.find(id);
-      if (futIt != it->second.end())
-      {
-        it->second.erase(futIt);
-        if (it->second.size() == 0)
-          cancelableCalls.erase(it);
-      }
-    }
+    kitPtr->map.erase(CancelableKey(sock, id));
   }
 
   // if 'val' is a qi::Object<> its ownership will be given to the 'host' object
@@ -586,7 +562,7 @@ namespace qi {
     // go on with original expected signature.
     if (forcedSignature.isValid() && socket->remoteCapability("MessageFlags", false))
     {
-      auto conv = val.convert(TypeInterface::fromSignature(forcedSignature));
+      auto conv = val.convert(detail::typeOfSignature(forcedSignature));
       qiLogDebug("qimessaging.serverresult")
           << "Converting to forced signature " << forcedSignature.toString()
           << ", data=" << val.type()->infoString() << ", advertised=" << targetSignature.toString()
@@ -18,6 +18,7 @@
 #include <qi/strand.hpp>
 
 #include "objecthost.hpp"
+#include "pendingcalltable.hpp"
 
 using AtomicBoolptr = boost::shared_ptr<qi::Atomic<bool>>;
 using AtomicIntPtr = boost::shared_ptr<qi::Atomic<int>>;
@@ -131,8 +132,18 @@ namespace qi {
     void cancelCall(MessageSocketPtr origSocket, const Message& cancelMessage, MessageId origMsgId);
 
   private:
-    using FutureMap = std::map<MessageId, std::pair<Future<AnyReference>, AtomicIntPtr>>;
-    using CancelableMap = std::map<MessageSocketPtr, FutureMap>;
+    using CancelableCall = std::pair<Future<AnyReference>, AtomicIntPtr>;
+    using CancelableKey = std::pair<MessageSocketPtr, MessageId>;
+    struct CancelableKeyHash
+    {
+      std::size_t operator()(const CancelableKey& key) const
+      {
+        // Consecutive calls of a client have consecutive ids: add them to a
+        // mix of the socket, so that they spread over the table.
+        return key.second + std::hash<MessageSocket*>()(key.first.get()) * 0x9E3779B1u;
+      }
+    };
+    using CancelableMap = PendingCallTable<CancelableKey, CancelableCall, CancelableKeyHash>;
     struct CancelableKit;
     using CancelableKitPtr = boost::shared_ptr<CancelableKit>;
     CancelableKitPtr _cancelables;
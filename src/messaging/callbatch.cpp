@@ -0,0 +1,133 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include "callbatch_p.hpp"
+
+#include <boost/thread/tss.hpp>
+#include <qi/log.hpp>
+
+qiLogCategory("qimessaging.callbatch");
+
+namespace qi
+{
+  namespace
+  {
+    // The batches are owned by their CallBatch, not by the thread.
+    void keepBatch(CallBatchPrivate*)
+    {
+    }
+
+    boost::thread_specific_ptr<CallBatchPrivate>& currentBatch()
+    {
+      static boost::thread_specific_ptr<CallBatchPrivate> batch(&keepBatch);
+      return batch;
+    }
+
+    void failCalls(CallBatchPrivate::Calls& calls, const std::string& error)
+    {
+      for (auto& call: calls)
+      {
+        if (call.onFailure)
+          call.onFailure(error);
+      }
+    }
+  }
+
+  void CallBatchPrivate::add(const MessageSocketPtr& socket, Message msg, OnFailure onFailure)
+  {
+    auto it = _calls.begin();
+    while (it != _calls.end() && it->first != socket)
+      ++it;
+    if (it == _calls.end())
+      it = _calls.insert(it, std::make_pair(socket, Calls{}));
+    it->second.push_back(Call{std::move(msg), std::move(onFailure)});
+  }
+
+  void CallBatchPrivate::flush()
+  {
+    auto calls = std::move(_calls);
+    _calls.clear();
+    for (auto& socketCalls: calls)
+    {
+      const auto& socket = socketCalls.first;
+      auto& socketCallList = socketCalls.second;
+      if (!socket->isConnected())
+      {
+        failCalls(socketCallList, "Network error while sending a batch of calls. Socket is not connected.");
+        continue;
+      }
+      if (socketCallList.size() == 1
+          || !socket->sharedCapability<bool>(capabilityname::messageBatch, false))
+      {
+        for (auto& call: socketCallList)
+        {
+          if (!socket->send(std::move(call.msg)) && call.onFailure)
+            call.onFailure("Network error while sending a call.");
+        }
+        continue;
+      }
+      std::vector<Message> messages;
+      messages.reserve(socketCallList.size());
+      for (auto& call: socketCallList)
+        messages.push_back(std::move(call.msg));
+      qiLogDebug() << "Sending a batch of " << messages.size() << " calls";
+      if (!socket->sendBatch(std::move(messages)))
+      {
+        qiLogVerbose() << "Failed to send a batch of " << socketCallList.size() << " calls";
+        failCalls(socketCallList, "Network error while sending a batch of calls.");
+      }
+    }
+  }
+
+  std::size_t CallBatchPrivate::size() const
+  {
+    std::size_t count = 0;
+    for (const auto& socketCalls: _calls)
+      count += socketCalls.second.size();
+    return count;
+  }
+
+  CallBatch::CallBatch()
+    : _p(new CallBatchPrivate)
+  {
+    auto& current = currentBatch();
+    _p->previous = current.get();
+    current.reset(_p.get());
+  }
+
+  CallBatch::~CallBatch()
+  {
+    currentBatch().reset(_p->previous);
+    flush();
+  }
+
+  void CallBatch::flush()
+  {
+    _p->flush();
+  }
+
+  std::size_t CallBatch::size() const
+  {
+    return _p->size();
+  }
+
+  namespace detail
+  {
+    bool callBatchActive()
+    {
+      return currentBatch().get() != nullptr;
+    }
+
+    bool batchCall(const MessageSocketPtr& socket, Message& msg,
+                   CallBatchPrivate::OnFailure onFailure)
+    {
+      const auto batch = currentBatch().get();
+      if (!batch)
+        return false;
+      batch->add(socket, std::move(msg), std::move(onFailure));
+      return true;
+    }
+  }
+}
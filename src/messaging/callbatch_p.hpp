@@ -0,0 +1,56 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_CALLBATCH_P_HPP_
+#define _SRC_CALLBATCH_P_HPP_
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/function.hpp>
+#include <qi/messaging/callbatch.hpp>
+#include "message.hpp"
+#include "messagesocket.hpp"
+
+namespace qi
+{
+  class CallBatchPrivate
+  {
+  public:
+    using OnFailure = boost::function<void(const std::string&)>;
+
+    struct Call
+    {
+      Message msg;
+      OnFailure onFailure;
+    };
+    using Calls = std::vector<Call>;
+
+    void add(const MessageSocketPtr& socket, Message msg, OnFailure onFailure);
+    void flush();
+    std::size_t size() const;
+
+    CallBatchPrivate* previous = nullptr;
+
+  private:
+    // There are few sockets in a batch: a linear search is enough.
+    std::vector<std::pair<MessageSocketPtr, Calls>> _calls;
+  };
+
+  namespace detail
+  {
+    /// Returns true if a `CallBatch` lives on the current thread.
+    bool callBatchActive();
+
+    /// If a `CallBatch` lives on the current thread, moves the call to it and
+    /// returns true. `onFailure` is then called with the error if the call
+    /// cannot be sent when the batch is flushed.
+    bool batchCall(const MessageSocketPtr& socket, Message& msg,
+                   CallBatchPrivate::OnFailure onFailure);
+  }
+}
+
+#endif // _SRC_CALLBATCH_P_HPP_
@@ -0,0 +1,137 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <qi/messaging/calltimeout.hpp>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/tss.hpp>
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+qiLogCategory("qimessaging.calltimeout");
+
+namespace qi
+{
+  namespace
+  {
+    using MethodKey = std::pair<std::string, std::string>;
+
+    struct CallTimeouts
+    {
+      std::mutex mutex;
+      Duration defaultTimeout;
+      std::map<MethodKey, Duration> methods;
+      // True if there is any timeout, to skip the lookup otherwise.
+      std::atomic<bool> any{false};
+
+      void update()
+      {
+        any.store(defaultTimeout > Duration::zero() || !methods.empty());
+      }
+
+      CallTimeouts()
+        : defaultTimeout(Duration::zero())
+      {
+        const auto env = os::getenv("QI_MESSAGE_TIMEOUT");
+        if (env.empty())
+          return;
+        try
+        {
+          defaultTimeout = Seconds(boost::lexical_cast<Seconds::rep>(env));
+          update();
+        }
+        catch (const boost::bad_lexical_cast&)
+        {
+          qiLogWarning() << "Invalid value of QI_MESSAGE_TIMEOUT: '" << env
+                         << "', calls do not time out.";
+        }
+      }
+    };
+
+    CallTimeouts& callTimeouts()
+    {
+      static CallTimeouts timeouts;
+      return timeouts;
+    }
+
+    boost::thread_specific_ptr<Duration>& scopeTimeout()
+    {
+      static boost::thread_specific_ptr<Duration> timeout;
+      return timeout;
+    }
+
+    boost::optional<Duration> nonZero(Duration timeout)
+    {
+      if (timeout <= Duration::zero())
+        return {};
+      return timeout;
+    }
+  }
+
+  CallTimeoutScope::CallTimeoutScope(Duration timeout)
+  {
+    auto& current = scopeTimeout();
+    if (current.get())
+      _previous = *current;
+    current.reset(new Duration(timeout));
+  }
+
+  CallTimeoutScope::~CallTimeoutScope()
+  {
+    auto& current = scopeTimeout();
+    if (_previous)
+      current.reset(new Duration(*_previous));
+    else
+      current.reset();
+  }
+
+  void setMethodCallTimeout(const std::string& service, const std::string& method,
+                            Duration timeout)
+  {
+    auto& timeouts = callTimeouts();
+    std::lock_guard<std::mutex> lock{timeouts.mutex};
+    timeouts.methods[MethodKey(service, method)] = timeout;
+    timeouts.update();
+  }
+
+  void resetMethodCallTimeout(const std::string& service, const std::string& method)
+  {
+    auto& timeouts = callTimeouts();
+    std::lock_guard<std::mutex> lock{timeouts.mutex};
+    timeouts.methods.erase(MethodKey(service, method));
+    timeouts.update();
+  }
+
+  void setDefaultCallTimeout(Duration timeout)
+  {
+    auto& timeouts = callTimeouts();
+    std::lock_guard<std::mutex> lock{timeouts.mutex};
+    timeouts.defaultTimeout = timeout;
+    timeouts.update();
+  }
+
+  Duration defaultCallTimeout()
+  {
+    auto& timeouts = callTimeouts();
+    std::lock_guard<std::mutex> lock{timeouts.mutex};
+    return timeouts.defaultTimeout;
+  }
+
+  boost::optional<Duration> callTimeout(const std::string& service, const std::string& method)
+  {
+    if (const auto scoped = scopeTimeout().get())
+      return nonZero(*scoped);
+    auto& timeouts = callTimeouts();
+    if (!timeouts.any.load())
+      return {};
+    std::lock_guard<std::mutex> lock{timeouts.mutex};
+    const auto it = timeouts.methods.find(MethodKey(service, method));
+    return nonZero(it != timeouts.methods.end() ? it->second : timeouts.defaultTimeout);
+  }
+}
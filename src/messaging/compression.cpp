@@ -0,0 +1,323 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include "compression.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+qiLogCategory("qimessaging.compression");
+
+namespace qi
+{
+  namespace compression
+  {
+    namespace
+    {
+      // Compressing costs a pass over the payload, that is lost for the
+      // payloads that are already compressed: it is disabled by default.
+      const std::size_t defaultThreshold = 0;
+
+      // Constants of the LZ4 block format.
+      const std::size_t minMatch = 4;
+      const std::size_t lastLiterals = 5;
+      const std::size_t matchFindLimit = 12;
+      const std::size_t maxOffset = 65535;
+      const unsigned int runMask = 15;
+
+      const unsigned int hashLog = 14;
+      const std::size_t sizePrefix = sizeof(std::uint32_t);
+
+      std::uint32_t read32(const unsigned char* p)
+      {
+        std::uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+      }
+
+      std::uint32_t hash(std::uint32_t sequence)
+      {
+        return (sequence * 2654435761u) >> (32 - hashLog);
+      }
+
+      // Writes a length in the extra bytes following a token.
+      unsigned char* writeLength(unsigned char* op, std::size_t length)
+      {
+        for (; length >= 255; length -= 255)
+          *op++ = 255;
+        *op++ = static_cast<unsigned char>(length);
+        return op;
+      }
+
+      // Reads the extra bytes of a length. Returns false on a truncated input.
+      bool readLength(const unsigned char*& ip, const unsigned char* iend, std::size_t& length)
+      {
+        unsigned char b;
+        do
+        {
+          if (ip == iend)
+            return false;
+          b = *ip++;
+          length += b;
+        } while (b == 255);
+        return true;
+      }
+
+      // Upper bound of the bytes needed to encode the given lengths.
+      std::size_t sequenceBound(std::size_t literals, std::size_t match)
+      {
+        return 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1;
+      }
+
+      // Returns a pointer to the wire form of the payload of the message, that
+      // is the main buffer with the sub-buffers inserted after their size. The
+      // storage is only used if the payload has sub-buffers.
+      const char* wireForm(const Buffer& buffer, std::vector<char>& storage)
+      {
+        if (buffer.subBuffers().empty())
+          return static_cast<const char*>(buffer.data());
+        storage.reserve(buffer.totalSize());
+        const char* data = static_cast<const char*>(buffer.data());
+        std::size_t beginOffset = 0;
+        for (const auto& sub: buffer.subBuffers())
+        {
+          const auto endOffset = sub.first + sizeof(Buffer::size_type);
+          storage.insert(storage.end(), data + beginOffset, data + endOffset);
+          beginOffset = endOffset;
+          const char* subData = static_cast<const char*>(sub.second.data());
+          storage.insert(storage.end(), subData, subData + sub.second.size());
+        }
+        storage.insert(storage.end(), data + beginOffset, data + buffer.size());
+        return storage.data();
+      }
+    }
+
+    std::size_t compressBlock(const char* src, std::size_t size, char* dst, std::size_t capacity)
+    {
+      const auto base = reinterpret_cast<const unsigned char*>(src);
+      const auto end = base + size;
+      auto op = reinterpret_cast<unsigned char*>(dst);
+      const auto oend = op + capacity;
+      auto anchor = base;
+
+      if (size > matchFindLimit)
+      {
+        const auto matchLimit = end - lastLiterals;
+        const auto mflimit = end - matchFindLimit;
+        std::vector<std::uint32_t> table(std::size_t(1) << hashLog, 0);
+        auto ip = base;
+        // Incompressible data is skipped faster and faster, until a match is
+        // found.
+        unsigned int attempts = 0;
+        while (ip < mflimit)
+        {
+          const auto h = hash(read32(ip));
+          auto ref = base + table[h];
+          table[h] = static_cast<std::uint32_t>(ip - base);
+          if (ref >= ip || static_cast<std::size_t>(ip - ref) > maxOffset || read32(ref) != read32(ip))
+          {
+            ip += 1 + (attempts++ >> 6);
+            continue;
+          }
+          attempts = 0;
+
+          while (ip > anchor && ref > base && ip[-1] == ref[-1])
+          {
+            --ip;
+            --ref;
+          }
+          auto matchEnd = ip + minMatch;
+          auto refEnd = ref + minMatch;
+          while (matchEnd < matchLimit && *matchEnd == *refEnd)
+          {
+            ++matchEnd;
+            ++refEnd;
+          }
+
+          const std::size_t literals = ip - anchor;
+          const std::size_t match = (matchEnd - ip) - minMatch;
+          if (sequenceBound(literals, match) > static_cast<std::size_t>(oend - op))
+            return 0;
+          auto token = op++;
+          if (literals >= runMask)
+          {
+            *token = runMask << 4;
+            op = writeLength(op, literals - runMask);
+          }
+          else
+            *token = static_cast<unsigned char>(literals << 4);
+          std::memcpy(op, anchor, literals);
+          op += literals;
+          const auto offset = static_cast<std::size_t>(ip - ref);
+          *op++ = static_cast<unsigned char>(offset & 0xff);
+          *op++ = static_cast<unsigned char>(offset >> 8);
+          if (match >= runMask)
+          {
+            *token |= runMask;
+            op = writeLength(op, match - runMask);
+          }
+          else
+            *token |= static_cast<unsigned char>(match);
+
+          ip = matchEnd;
+          anchor = ip;
+        }
+      }
+
+      const std::size_t literals = end - anchor;
+      if (1 + literals / 255 + 1 + literals > static_cast<std::size_t>(oend - op))
+        return 0;
+      if (literals >= runMask)
+      {
+        *op++ = runMask << 4;
+        op = writeLength(op, literals - runMask);
+      }
+      else
+        *op++ = static_cast<unsigned char>(literals << 4);
+      if (literals != 0)
+        std::memcpy(op, anchor, literals);
+      op += literals;
+      return op - reinterpret_cast<unsigned char*>(dst);
+    }
+
+    bool decompressBlock(const char* src, std::size_t size, char* dst, std::size_t dstSize)
+    {
+      auto ip = reinterpret_cast<const unsigned char*>(src);
+      const auto iend = ip + size;
+      const auto obase = reinterpret_cast<unsigned char*>(dst);
+      auto op = obase;
+      const auto oend = op + dstSize;
+      while (true)
+      {
+        if (ip == iend)
+          return false;
+        const unsigned int token = *ip++;
+
+        std::size_t literals = token >> 4;
+        if (literals == runMask && !readLength(ip, iend, literals))
+          return false;
+        if (literals > static_cast<std::size_t>(iend - ip)
+            || literals > static_cast<std::size_t>(oend - op))
+          return false;
+        if (literals != 0)
+          std::memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        // The last sequence only has literals.
+        if (ip == iend)
+          return op == oend;
+
+        if (iend - ip < 2)
+          return false;
+        const std::size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<std::size_t>(op - obase))
+          return false;
+        std::size_t match = token & runMask;
+        if (match == runMask && !readLength(ip, iend, match))
+          return false;
+        match += minMatch;
+        if (match > static_cast<std::size_t>(oend - op))
+          return false;
+        const unsigned char* ref = op - offset;
+        if (offset >= match)
+        {
+          std::memcpy(op, ref, match);
+          op += match;
+        }
+        else
+        {
+          // Overlapping copy: the match repeats the last `offset` bytes.
+          for (std::size_t i = 0; i < match; ++i)
+            *op++ = *ref++;
+        }
+      }
+    }
+
+    bool compressPayload(Message& msg, std::size_t threshold)
+    {
+      const auto& buffer = msg.buffer();
+      const auto size = buffer.totalSize();
+      if (threshold == 0 || size < threshold || size <= sizePrefix
+          || (msg.flags() & Message::TypeFlag_Compressed))
+        return false;
+
+      std::vector<char> storage;
+      const char* payload = wireForm(buffer, storage);
+      // The compressed payload is only kept if it is smaller than the original.
+      std::vector<char> compressed(size - 1);
+      const auto compressedSize = compressBlock(payload, size, compressed.data() + sizePrefix,
+                                                compressed.size() - sizePrefix);
+      if (compressedSize == 0)
+        return false;
+
+      const auto originalSize = static_cast<std::uint32_t>(size);
+      for (std::size_t i = 0; i < sizePrefix; ++i)
+        compressed[i] = static_cast<char>((originalSize >> (8 * i)) & 0xff);
+      Buffer result;
+      result.write(compressed.data(), sizePrefix + compressedSize);
+      msg.setBuffer(std::move(result));
+      msg.addFlags(Message::TypeFlag_Compressed);
+      return true;
+    }
+
+    bool decompressPayload(Message& msg, std::size_t maxPayload)
+    {
+      if (!(msg.flags() & Message::TypeFlag_Compressed))
+        return true;
+      const auto& buffer = msg.buffer();
+      if (buffer.size() < sizePrefix || !buffer.subBuffers().empty())
+      {
+        qiLogWarning() << "Ill-formed compressed message " << msg.id();
+        return false;
+      }
+      const auto data = static_cast<const unsigned char*>(buffer.data());
+      std::size_t originalSize = 0;
+      for (std::size_t i = 0; i < sizePrefix; ++i)
+        originalSize |= static_cast<std::size_t>(data[i]) << (8 * i);
+      if (originalSize > maxPayload)
+      {
+        qiLogWarning() << "Decompressed size of message " << msg.id() << " (" << originalSize
+                       << " bytes) exceeds the maximum payload size (" << maxPayload << " bytes)";
+        return false;
+      }
+
+      Buffer result;
+      auto dst = static_cast<char*>(result.reserve(originalSize));
+      if (!decompressBlock(reinterpret_cast<const char*>(data) + sizePrefix,
+                           buffer.size() - sizePrefix, dst, originalSize))
+      {
+        qiLogWarning() << "Corrupted compressed message " << msg.id();
+        return false;
+      }
+      msg.setBuffer(std::move(result));
+      msg.setFlags(msg.flags() & ~Message::TypeFlag_Compressed);
+      return true;
+    }
+
+    std::size_t thresholdFromEnv()
+    {
+      static const std::size_t threshold = [] {
+        const std::string env = qi::os::getenv("QI_MESSAGE_COMPRESSION_THRESHOLD");
+        if (env.empty())
+          return defaultThreshold;
+        try
+        {
+          return boost::lexical_cast<std::size_t>(env);
+        }
+        catch (const boost::bad_lexical_cast&)
+        {
+          qiLogWarning() << "Invalid QI_MESSAGE_COMPRESSION_THRESHOLD value: " << env;
+          return defaultThreshold;
+        }
+      }();
+      return threshold;
+    }
+  } // namespace compression
+} // namespace qi
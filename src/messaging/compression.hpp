@@ -0,0 +1,62 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_COMPRESSION_HPP_
+#define _SRC_COMPRESSION_HPP_
+
+#include <cstddef>
+#include <qi/api.hpp>
+#include "message.hpp"
+
+/// @file
+/// Contains the compression of message payloads.
+///
+/// The codec is a byte-oriented LZ77 variant using the LZ4 block format: it
+/// has no entropy coding stage, so that compressing and decompressing cost
+/// little more than a copy of the data. It mostly pays off for payloads with
+/// repeated structure, such as lists of structures or of similar numbers.
+///
+/// A compressed payload is the size of the original payload, as a 32 bits
+/// little-endian integer, followed by the compressed block. The message has
+/// the `Message::TypeFlag_Compressed` flag set, and its header size is the
+/// size of the compressed payload.
+
+namespace qi
+{
+  namespace compression
+  {
+    /// Compresses `size` bytes from `src` to `dst`, and returns the count of
+    /// bytes written. Returns 0 if the compressed data would not fit in
+    /// `capacity` bytes.
+    QI_API std::size_t compressBlock(const char* src, std::size_t size,
+                                     char* dst, std::size_t capacity);
+
+    /// Decompresses `size` bytes from `src` to `dst`, that must exactly be
+    /// filled by the `dstSize` decompressed bytes. Returns false if the
+    /// compressed data is invalid, in which case the content of `dst` is
+    /// undetermined.
+    QI_API bool decompressBlock(const char* src, std::size_t size,
+                                char* dst, std::size_t dstSize);
+
+    /// Compresses the payload of the message if it is at least `threshold`
+    /// bytes long and if its compressed form is smaller. Returns true if the
+    /// message was compressed. A threshold of 0 disables the compression.
+    QI_API bool compressPayload(Message& msg, std::size_t threshold);
+
+    /// Decompresses the payload of the message if it is compressed. Returns
+    /// false if the payload is invalid or if its decompressed size exceeds
+    /// `maxPayload`.
+    QI_API bool decompressPayload(Message& msg, std::size_t maxPayload);
+
+    /// Minimal size of a payload to compress it, can be overriden by the
+    /// `QI_MESSAGE_COMPRESSION_THRESHOLD` environment variable (in bytes).
+    /// A value of 0, the default, disables the compression of sent messages:
+    /// the messages received compressed are still decompressed.
+    QI_API std::size_t thresholdFromEnv();
+  } // namespace compression
+} // namespace qi
+
+#endif // _SRC_COMPRESSION_HPP_
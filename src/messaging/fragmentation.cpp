@@ -0,0 +1,206 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include "fragmentation.hpp"
+
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+qiLogCategory("qimessaging.fragmentation");
+
+namespace qi
+{
+  namespace fragmentation
+  {
+    namespace
+    {
+      const std::size_t defaultFragmentSize = 256 * 1024;
+      const std::size_t sizePrefix = sizeof(std::uint32_t);
+
+      using Segment = std::pair<const char*, std::size_t>;
+
+      // Returns the memory segments of the wire form of the payload, that is
+      // the main buffer with the sub-buffers inserted after their size.
+      std::vector<Segment> wireSegments(const Buffer& buffer)
+      {
+        std::vector<Segment> segments;
+        const char* data = static_cast<const char*>(buffer.data());
+        std::size_t beginOffset = 0;
+        for (const auto& sub: buffer.subBuffers())
+        {
+          const auto endOffset = sub.first + sizeof(Buffer::size_type);
+          segments.emplace_back(data + beginOffset, endOffset - beginOffset);
+          beginOffset = endOffset;
+          segments.emplace_back(static_cast<const char*>(sub.second.data()), sub.second.size());
+        }
+        segments.emplace_back(data + beginOffset, buffer.size() - beginOffset);
+        return segments;
+      }
+    }
+
+    std::vector<Message> split(const Message& msg, std::size_t fragmentSize)
+    {
+      const auto totalSize = msg.buffer().totalSize();
+      std::vector<Message> fragments;
+      if (fragmentSize == 0 || totalSize <= fragmentSize)
+        return fragments;
+
+      fragments.reserve((totalSize + fragmentSize - 1) / fragmentSize);
+      const auto segments = wireSegments(msg.buffer());
+      auto segment = segments.begin();
+      std::size_t segmentOffset = 0;
+      std::size_t remaining = totalSize;
+      while (remaining != 0)
+      {
+        Buffer buffer;
+        if (fragments.empty())
+        {
+          char prefix[sizePrefix];
+          for (std::size_t i = 0; i < sizePrefix; ++i)
+            prefix[i] = static_cast<char>((totalSize >> (8 * i)) & 0xff);
+          buffer.write(prefix, sizePrefix);
+        }
+        auto fragmentRemaining = std::min(fragmentSize, remaining);
+        remaining -= fragmentRemaining;
+        while (fragmentRemaining != 0)
+        {
+          const auto size = std::min(segment->second - segmentOffset, fragmentRemaining);
+          buffer.write(segment->first + segmentOffset, size);
+          fragmentRemaining -= size;
+          segmentOffset += size;
+          if (segmentOffset == segment->second)
+          {
+            ++segment;
+            segmentOffset = 0;
+          }
+        }
+
+        Message fragment(msg.type(), msg.address());
+        fragment.header().version = msg.header().version;
+        fragment.setFlags(msg.flags() | Message::TypeFlag_Fragment);
+        fragment.setBuffer(std::move(buffer));
+        fragment.setPriority(Message::Priority_Bulk);
+        fragments.push_back(std::move(fragment));
+      }
+      return fragments;
+    }
+
+    Reassembler::Reassembler(std::size_t maxPayload, std::size_t maxPending)
+      : _maxPayload(maxPayload)
+      , _maxPending(maxPending)
+    {
+    }
+
+    Reassembler::Status Reassembler::add(Message& msg)
+    {
+      if (!(msg.flags() & Message::TypeFlag_Fragment))
+        return Status::Complete;
+
+      const auto& buffer = msg.buffer();
+      if (!buffer.subBuffers().empty())
+      {
+        qiLogWarning() << "Ill-formed fragment of message " << msg.id();
+        return Status::Invalid;
+      }
+      auto data = static_cast<const char*>(buffer.data());
+      auto size = buffer.size();
+      const Key key{msg.header().type, msg.id()};
+
+      std::lock_guard<std::mutex> lock{_mutex};
+      auto it = _partials.find(key);
+      if (it == _partials.end())
+      {
+        // First fragment: it starts with the size of the whole payload.
+        if (size < sizePrefix)
+        {
+          qiLogWarning() << "Ill-formed first fragment of message " << msg.id();
+          return Status::Invalid;
+        }
+        const auto bytes = reinterpret_cast<const unsigned char*>(data);
+        std::size_t expectedSize = 0;
+        for (std::size_t i = 0; i < sizePrefix; ++i)
+          expectedSize |= static_cast<std::size_t>(bytes[i]) << (8 * i);
+        if (expectedSize > _maxPayload)
+        {
+          qiLogWarning() << "Size of fragmented message " << msg.id() << " (" << expectedSize
+                         << " bytes) exceeds the maximum payload size (" << _maxPayload << " bytes)";
+          return Status::Invalid;
+        }
+        Message whole(msg.type(), msg.address());
+        whole.header().version = msg.header().version;
+        whole.setFlags(msg.flags() & ~Message::TypeFlag_Fragment);
+        whole.setTimestamp(msg.timestamp());
+        it = _partials.emplace(key, Partial{std::move(whole), Buffer{}, expectedSize}).first;
+        data += sizePrefix;
+        size -= sizePrefix;
+      }
+
+      auto& partial = it->second;
+      const auto received = partial.payload.size();
+      if (received + size > partial.expectedSize || _pendingBytes + size > _maxPending)
+      {
+        qiLogWarning() << "Fragmented message " << msg.id() << " exceeds its size or the "
+                       << "maximum pending size (" << _maxPending << " bytes)";
+        _pendingBytes -= received;
+        _partials.erase(it);
+        return Status::Invalid;
+      }
+      // The payload grows geometrically up to its expected size, instead of
+      // by a block at each fragment.
+      if (!partial.payload.reserveCapacity(
+              std::min(partial.expectedSize - received, std::max(size, received))))
+      {
+        qiLogWarning() << "Cannot allocate the payload of fragmented message " << msg.id();
+        _pendingBytes -= received;
+        _partials.erase(it);
+        return Status::Invalid;
+      }
+      partial.payload.write(data, size);
+      _pendingBytes += size;
+      if (received + size < partial.expectedSize)
+        return Status::Incomplete;
+
+      _pendingBytes -= partial.expectedSize;
+      msg = std::move(partial.msg);
+      msg.setBuffer(std::move(partial.payload));
+      _partials.erase(it);
+      return Status::Complete;
+    }
+
+    void Reassembler::clear()
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _partials.clear();
+      _pendingBytes = 0;
+    }
+
+    std::size_t Reassembler::pendingBytes() const
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      return _pendingBytes;
+    }
+
+    std::size_t fragmentSizeFromEnv()
+    {
+      static const std::size_t fragmentSize = [] {
+        const std::string env = qi::os::getenv("QI_MESSAGE_FRAGMENT_SIZE");
+        if (env.empty())
+          return defaultFragmentSize;
+        try
+        {
+          return boost::lexical_cast<std::size_t>(env);
+        }
+        catch (const boost::bad_lexical_cast&)
+        {
+          qiLogWarning() << "Invalid QI_MESSAGE_FRAGMENT_SIZE value: " << env;
+          return defaultFragmentSize;
+        }
+      }();
+      return fragmentSize;
+    }
+  } // namespace fragmentation
+} // namespace qi
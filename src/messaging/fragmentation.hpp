@@ -0,0 +1,103 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_FRAGMENTATION_HPP_
+#define _SRC_FRAGMENTATION_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <qi/api.hpp>
+#include "message.hpp"
+
+/// @file
+/// Contains the fragmentation of large messages.
+///
+/// A message whose payload is bigger than the fragment size is sent as a
+/// sequence of fragments, so that other messages can be written between them
+/// instead of waiting for the whole payload to be written.
+///
+/// Each fragment has the header of the original message, with the
+/// `Message::TypeFlag_Fragment` flag added, and a part of its payload. The
+/// payload of the first fragment starts with the size of the whole payload, as
+/// a 32 bits little-endian integer. The fragments of a message are sent in
+/// order, but may be interleaved with other messages, including fragments of
+/// other messages. A fragmented message is identified by its type and its id.
+
+namespace qi
+{
+  namespace fragmentation
+  {
+    /// Splits the message into fragments whose payload is at most
+    /// `fragmentSize` bytes long (plus the size prefix for the first one).
+    /// Returns no fragment if the payload is not bigger than `fragmentSize`,
+    /// or if `fragmentSize` is 0.
+    ///
+    /// The fragments have the bulk priority, see `Message::Priority`.
+    QI_API std::vector<Message> split(const Message& msg, std::size_t fragmentSize);
+
+    /// Rebuilds messages from their fragments.
+    ///
+    /// Fragmented messages are rebuilt as their fragments arrive: memory is
+    /// allocated as the payload grows, not upfront.
+    ///
+    /// Thread-safe.
+    class QI_API Reassembler
+    {
+    public:
+      enum class Status
+      {
+        /// The message is complete: it was not a fragment, or it was the last
+        /// fragment of a message.
+        Complete,
+        /// The message is a fragment of a message that is not complete yet.
+        Incomplete,
+        /// The fragment is ill-formed or exceeds the limits.
+        Invalid,
+      };
+
+      /// A message must not be bigger than `maxPayload`, and the messages being
+      /// rebuilt must not hold more than `maxPending` bytes together.
+      Reassembler(std::size_t maxPayload, std::size_t maxPending);
+
+      /// If the message is a fragment, adds it to the message it is part of.
+      /// If the message is then complete, `msg` is set to it.
+      Status add(Message& msg);
+
+      /// Forgets the messages being rebuilt.
+      void clear();
+
+      /// Count of payload bytes of the messages being rebuilt.
+      std::size_t pendingBytes() const;
+
+    private:
+      struct Partial
+      {
+        Message msg;
+        Buffer payload;
+        std::size_t expectedSize;
+      };
+      using Key = std::pair<std::uint8_t, std::uint32_t>;
+
+      const std::size_t _maxPayload;
+      const std::size_t _maxPending;
+      mutable std::mutex _mutex;
+      std::map<Key, Partial> _partials;
+      std::size_t _pendingBytes = 0;
+    };
+
+    /// Size of the payload of fragments, can be overriden by the
+    /// `QI_MESSAGE_FRAGMENT_SIZE` environment variable (in bytes). Messages
+    /// with a bigger payload are fragmented. A value of 0 disables the
+    /// fragmentation of sent messages.
+    QI_API std::size_t fragmentSizeFromEnv();
+  } // namespace fragmentation
+} // namespace qi
+
+#endif // _SRC_FRAGMENTATION_HPP_
@@ -19,6 +19,7 @@
 #include <qi/binarycodec.hpp>
 
 #include "boundobject.hpp"
+#include "src/type/serializationplan.hpp"
 #include "remoteobject_p.hpp"
 
 qiLogCategory("qimessaging.message");
@@ -315,7 +316,7 @@ namespace qi
   AnyReference Message::value(const qi::Signature& signature,
                               const qi::MessageSocketPtr& socket) const
   {
-    qi::TypeInterface* type = qi::TypeInterface::fromSignature(signature);
+    qi::TypeInterface* type = detail::typeOfSignature(signature);
     if (!type) {
       qiLogError() <<"fromBuffer: unknown type " << signature.toString();
       throw std::runtime_error("Could not construct type for " + signature.toString());
@@ -340,10 +341,10 @@ namespace qi
       return;
     }
 
-    Signature effective = value.type()->signature();
-    if (effective != sig)
+    const auto plan = detail::serializationPlan(value.type(), sig);
+    if (plan.convert)
     {
-      TypeInterface* ti = TypeInterface::fromSignature(sig);
+      TypeInterface* ti = plan.target;
       if (!ti)
         qiLogWarning() << "setValue(): cannot construct type for signature " << sig.toString();
       auto conv = value.convert(ti);
@@ -352,7 +353,7 @@ namespace qi
         ss << "Setvalue(): failed to convert effective value "
            << value.type()->signature().toString()
            << " to expected type "
-           << sig.toString() << '(' << ti->infoString() << ')';
+           << sig.toString() << '(' << (ti ? ti->infoString() : std::string("unknown")) << ')';
         qiLogWarning() << ss.str();
         setType(qi::Message::Type_Error);
         setError(ss.str());
@@ -378,61 +379,55 @@ namespace qi
   //convert args then call setValues
   void Message::setValues(const std::vector<qi::AnyReference>& in, const qi::Signature& expectedSignature,
                           boost::weak_ptr<ObjectHost> context, StreamContext* streamContext) {
-    qi::Signature argsSig = qi::makeTupleSignature(in, false);
-    if (expectedSignature == argsSig) {
+    using Kind = detail::ArgumentsSerializationPlan::Kind;
+    const auto plan = detail::argumentsSerializationPlan(in, expectedSignature);
+    switch (plan->kind)
+    {
+    case Kind::AsIs:
       setValues(in, context, streamContext);
       return;
-    }
-    if (expectedSignature == "m")
-    {
-      /* We need to send a dynamic containing the value tuple to push the
-       * signature. This wraps correctly without copying the data.
-       */
-      std::vector<qi::TypeInterface*> types;
-      std::vector<void*> values;
-      types.resize(in.size());
-      values.resize(in.size());
-      for (unsigned i=0; i<in.size(); ++i)
+    case Kind::Dynamic:
       {
-        types[i] = in[i].type();
-        values[i] = in[i].rawValue();
+        /* We need to send a dynamic containing the value tuple to push the
+         * signature. This wraps correctly without copying the data.
+         */
+        std::vector<qi::TypeInterface*> types;
+        std::vector<void*> values;
+        types.resize(in.size());
+        values.resize(in.size());
+        for (unsigned i=0; i<in.size(); ++i)
+        {
+          types[i] = in[i].type();
+          values[i] = in[i].rawValue();
+        }
+        AnyReference tuple = makeGenericTuplePtr(types, values);
+        AnyValue val(tuple, false, false);
+        encodeBinary(AnyReference::from(val),
+                     boost::bind(serializeObject, _1, context, streamContext), streamContext);
+        return;
       }
-      AnyReference tuple = makeGenericTuplePtr(types, values);
-      AnyValue val(tuple, false, false);
-      encodeBinary(AnyReference::from(val),
-                   boost::bind(serializeObject, _1, context, streamContext), streamContext);
-      return;
+    case Kind::Error:
+      throw std::runtime_error(plan->error);
+    case Kind::Convert:
+      break;
     }
-    /* This check does not makes sense for this transport layer who does not care,
-     * But it checks a general rule that is true for all the messages we use and
-     * it can help catch many mistakes.
-     */
-    if (expectedSignature.type() != Signature::Type_Tuple)
-      throw std::runtime_error("Expected a tuple, got " + expectedSignature.toString());
-    AnyReferenceVector nargs(in);
-    SignatureVector src = argsSig.children();
-    SignatureVector dst = expectedSignature.children();
-    if (src.size() != dst.size())
-      throw std::runtime_error("remote call: signature size mismatch");
-    SignatureVector::iterator its = src.begin(), itd = dst.begin();
 
+    AnyReferenceVector nargs(in);
     boost::container::small_vector<detail::UniqueAnyReference, detail::maxAnyFunctionArgsCountHint>
       uniqueArgs;
     uniqueArgs.reserve(nargs.size());
-    for (unsigned i = 0; i< nargs.size(); ++i, ++its, ++itd)
+    for (unsigned i = 0; i< nargs.size(); ++i)
     {
-      if (*its != *itd)
+      ::qi::TypeInterface* target = plan->targets[i];
+      if (target)
       {
-        ::qi::TypeInterface* target = ::qi::TypeInterface::fromSignature(*itd);
-        if (!target)
-          throw std::runtime_error("remote call: Failed to obtain a type from signature " +
-                                   (*itd).toString());
         auto c = nargs[i].convert(target);
         if (!c->type())
         {
           throw std::runtime_error(
               _QI_LOG_FORMAT("remote call: failed to convert argument %s from %s to %s", i,
-                             (*its).toString(), (*itd).toString()));
+                             nargs[i].signature().toString(),
+                             expectedSignature.children()[i].toString()));
         }
         nargs[i] = *c;
         uniqueArgs.emplace_back(std::move(c));
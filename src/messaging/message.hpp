@@ -12,6 +12,7 @@
 #include <qi/anyvalue.hpp>
 #include <qi/anyobject.hpp>
 #include <qi/buffer.hpp>
+#include <qi/clock.hpp>
 #include <qi/binarycodec.hpp>
 #include <qi/anyfunction.hpp>
 #include <qi/types.hpp>
@@ -163,6 +164,32 @@ namespace qi {
      * NOT IMPLEMENTED
      */
     static const unsigned int TypeFlag_ReturnType = 2;
+    /* If flag is set, the payload is compressed (see compression.hpp).
+     * Only set if the remote end advertised the MessageCompression capability.
+     */
+    static const unsigned int TypeFlag_Compressed = 4;
+    /* If flag is set, the message is a fragment of a larger message (see
+     * fragmentation.hpp). Only set if the remote end advertised the
+     * MessageFragmentation capability.
+     */
+    static const unsigned int TypeFlag_Fragment = 8;
+    /* If flag is set, the payload is a sequence of messages (see batch.hpp).
+     * Only set if the remote end advertised the MessageBatch capability.
+     */
+    static const unsigned int TypeFlag_Batch = 16;
+
+    /// Priority class of a message in the send queue of a socket: messages of
+    /// a higher class are written first, messages of the same class are
+    /// written in order. The priority is local, it is not sent.
+    enum Priority
+    {
+      Priority_Bulk   = 0,
+      Priority_Normal = 1,
+      Priority_High   = 2,
+    };
+    /// Replies and errors up to this payload size are given a high priority by
+    /// default.
+    static const std::size_t smallReplySize = 4096;
 
     QI_API static const char* typeToString(Type t);
     QI_API static const char* actionToString(unsigned int action, unsigned int service);
@@ -286,6 +313,23 @@ namespace qi {
       return extracted;
     }
 
+    /// Empties the payload, keeping the memory of the buffer.
+    void clearBuffer()
+    {
+      _buffer.clear();
+      _header.size = 0;
+    }
+
+    /// Appends `size` bytes to be written in place to the payload, whose
+    /// memory is returned. The memory of the buffer is reused, instead of
+    /// moving the buffer out and back in.
+    void* reservePayload(std::size_t size)
+    {
+      void* ptr = _buffer.reserve(size);
+      _header.size = static_cast<qi::uint32_t>(_buffer.totalSize());
+      return ptr;
+    }
+
     void setError(const std::string &error)
     {
       QI_ASSERT(type() == Type_Error && "called setError on a non Type_Error message");
@@ -341,11 +385,74 @@ namespace qi {
     boost::optional<ObjectUid> recipientUid() const { return _recipientUid; }
     void setRecipientUid(const boost::optional<ObjectUid>& id) { _recipientUid = id; }
 
+    /// If no priority was set, small replies and errors, and the
+    /// notifications of canceled calls have a high priority, any other
+    /// message has a normal one. Control messages (capabilities and
+    /// cancellations) keep the priority of the calls: they must stay ordered
+    /// with them, see `canOvertake`.
+    Priority priority() const
+    {
+      if (_priority)
+        return *_priority;
+      switch (type())
+      {
+        case Type_Canceled:
+          return Priority_High;
+        case Type_Reply:
+        case Type_Error:
+          return _buffer.totalSize() <= smallReplySize ? Priority_High : Priority_Normal;
+        default:
+          return Priority_Normal;
+      }
+    }
+
+    /// Returns true if the message can be sent before `queued`, that was
+    /// queued before it, without changing the meaning of the stream:
+    /// - capabilities are never reordered, as they change how the messages
+    ///   that follow them are handled;
+    /// - the replies to distinct calls are independent;
+    /// - a reply does not overtake an event, that may have been emitted
+    ///   before the call returned;
+    /// - otherwise, the messages of an object keep their order, so that for
+    ///   example a cancellation does not overtake the call it targets.
+    bool canOvertake(const Message& queued) const
+    {
+      if (type() == Type_Capability || queued.type() == Type_Capability)
+        return false;
+      const bool isReply = isReplyType(type());
+      if (isReply && isReplyType(queued.type()))
+        return id() != queued.id();
+      if (isReply && queued.type() == Type_Event)
+        return false;
+      return service() != queued.service() || object() != queued.object();
+    }
+    void setPriority(Priority priority) { _priority = priority; }
+
+    /// Local time of the message, used to measure its latency: the time it was
+    /// passed to a socket to be sent, or the time its header was received.
+    /// It is not sent. The default time means that it is not set.
+    SteadyClock::time_point timestamp() const { return _timestamp; }
+    void setTimestamp(SteadyClock::time_point timestamp) { _timestamp = timestamp; }
+
+    /// Time after which the call fails locally and is canceled on the remote
+    /// end, if it has no reply yet. It is not sent. None means that the call
+    /// does not time out.
+    const boost::optional<Duration>& callTimeout() const { return _callTimeout; }
+    void setCallTimeout(boost::optional<Duration> timeout) { _callTimeout = timeout; }
+
   private:
     Buffer _buffer;
     std::string signature;
     Header _header;
     boost::optional<ObjectUid> _recipientUid;
+    boost::optional<Priority> _priority;
+    SteadyClock::time_point _timestamp;
+    boost::optional<Duration> _callTimeout;
+
+    static bool isReplyType(Type t)
+    {
+      return t == Type_Reply || t == Type_Error || t == Type_Canceled;
+    }
 
     void encodeBinary(const qi::AutoAnyReference& ref,
                       SerializeObjectCallback onObject,
@@ -0,0 +1,193 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include "messagecapture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+qiLogCategory("qimessaging.messagecapture");
+
+namespace qi
+{
+  namespace
+  {
+    const char magic[8] = {'Q', 'I', 'M', 'S', 'G', 'C', 'A', 'P'};
+
+    template<typename T>
+    void writeValue(std::ostream& out, const T& value)
+    {
+      out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template<typename T>
+    bool readValue(std::istream& in, T& value)
+    {
+      return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+    }
+
+    // Writes the payload as it is sent to the network: the sub-buffers are
+    // inlined after their size (see `sock::appendBuffers`).
+    void writePayload(std::ostream& out, const Buffer& buffer)
+    {
+      const auto data = static_cast<const char*>(buffer.data());
+      std::size_t begin = 0;
+      for (const auto& sub: buffer.subBuffers())
+      {
+        const auto end = sub.first + sizeof(Buffer::size_type);
+        out.write(data + begin, end - begin);
+        begin = end;
+        out.write(static_cast<const char*>(sub.second.data()), sub.second.size());
+      }
+      out.write(data + begin, buffer.size() - begin);
+    }
+
+    struct GlobalCapture
+    {
+      std::mutex mutex;
+      boost::shared_ptr<MessageCapture> capture;
+      std::atomic<bool> enabled{false};
+
+      GlobalCapture()
+      {
+        const auto path = os::getenv("QI_MESSAGE_CAPTURE");
+        if (path.empty())
+          return;
+        try
+        {
+          capture = boost::make_shared<MessageCapture>(path);
+          enabled.store(true);
+          qiLogInfo() << "Capturing messages to " << path;
+        }
+        catch (const std::exception& e)
+        {
+          qiLogWarning() << "Cannot capture messages (QI_MESSAGE_CAPTURE): " << e.what();
+        }
+      }
+    };
+
+    GlobalCapture& globalCapture()
+    {
+      static GlobalCapture global;
+      return global;
+    }
+  }
+
+  MessageCapture::MessageCapture(const std::string& path)
+    : _out(path, std::ios::binary | std::ios::trunc)
+    , _start(SteadyClock::now())
+    , _recordCount(0)
+  {
+    if (!_out)
+      throw std::runtime_error("cannot open the capture file " + path);
+    _out.write(magic, sizeof(magic));
+    const std::uint32_t fileVersion = version;
+    writeValue(_out, fileVersion);
+  }
+
+  void MessageCapture::record(std::uint32_t stream, Direction direction, const Message& msg)
+  {
+    const auto time = static_cast<std::uint64_t>(
+      boost::chrono::duration_cast<NanoSeconds>(SteadyClock::now() - _start).count());
+    std::lock_guard<std::mutex> lock{_mutex};
+    writeValue(_out, time);
+    writeValue(_out, stream);
+    writeValue(_out, static_cast<std::uint8_t>(direction));
+    writeValue(_out, msg.header());
+    writePayload(_out, msg.buffer());
+    ++_recordCount;
+  }
+
+  void MessageCapture::flush()
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _out.flush();
+  }
+
+  std::uint64_t MessageCapture::recordCount() const
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _recordCount;
+  }
+
+  MessageCaptureReader::MessageCaptureReader(const std::string& path)
+    : _in(path, std::ios::binary)
+    , _fileSize(0)
+  {
+    if (!_in)
+      throw std::runtime_error("cannot open the capture file " + path);
+    _in.seekg(0, std::ios::end);
+    _fileSize = static_cast<std::uint64_t>(std::max(std::streamoff{_in.tellg()}, std::streamoff{0}));
+    _in.seekg(0, std::ios::beg);
+    char fileMagic[sizeof(magic)];
+    std::uint32_t fileVersion = 0;
+    if (!_in.read(fileMagic, sizeof(fileMagic)) || std::memcmp(fileMagic, magic, sizeof(magic)) != 0)
+      throw std::runtime_error(path + " is not a capture file");
+    if (!readValue(_in, fileVersion) || fileVersion != MessageCapture::version)
+      throw std::runtime_error("unsupported version of the capture file " + path);
+  }
+
+  boost::optional<MessageCapture::Record> MessageCaptureReader::next()
+  {
+    std::uint64_t time = 0;
+    if (!readValue(_in, time))
+    {
+      if (_in.gcount() == 0)
+        return {};
+      throw std::runtime_error("truncated capture record");
+    }
+    std::uint32_t stream = 0;
+    std::uint8_t direction = 0;
+    MessageCapture::Record record{NanoSeconds(time), 0, MessageCapture::Direction::Sent, Message{}};
+    auto& header = record.message.header();
+    if (!readValue(_in, stream) || !readValue(_in, direction) || !readValue(_in, header))
+      throw std::runtime_error("truncated capture record");
+    // The size comes from the file: it is checked before allocating the
+    // payload, so that a corrupted record cannot exhaust the memory.
+    const auto position = std::streamoff{_in.tellg()};
+    if (position < 0 || header.size > _fileSize - static_cast<std::uint64_t>(position))
+      throw std::runtime_error("truncated capture record");
+    std::vector<char> payload(header.size);
+    if (!payload.empty() && !_in.read(payload.data(), payload.size()))
+      throw std::runtime_error("truncated capture record");
+    Buffer buffer;
+    buffer.write(payload.data(), payload.size());
+    record.message.setBuffer(std::move(buffer));
+    record.stream = stream;
+    record.direction = static_cast<MessageCapture::Direction>(direction);
+    return record;
+  }
+
+  boost::shared_ptr<MessageCapture> messageCapture()
+  {
+    auto& global = globalCapture();
+    std::lock_guard<std::mutex> lock{global.mutex};
+    return global.capture;
+  }
+
+  void setMessageCapture(boost::shared_ptr<MessageCapture> capture)
+  {
+    auto& global = globalCapture();
+    std::lock_guard<std::mutex> lock{global.mutex};
+    global.enabled.store(capture != nullptr);
+    global.capture = std::move(capture);
+  }
+
+  bool messageCaptureEnabled()
+  {
+    return globalCapture().enabled.load(std::memory_order_relaxed);
+  }
+
+  std::uint32_t newMessageCaptureStream()
+  {
+    static std::atomic<std::uint32_t> stream{0};
+    return ++stream;
+  }
+}
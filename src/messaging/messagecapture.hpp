@@ -0,0 +1,111 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_MESSAGECAPTURE_HPP_
+#define _SRC_MESSAGECAPTURE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <qi/api.hpp>
+#include <qi/clock.hpp>
+#include "message.hpp"
+
+/// @file
+/// Contains the capture of the messages sent and received by the sockets, to
+/// replay real traffic later.
+///
+/// A capture file starts with the 8 bytes "QIMSGCAP" and a 32 bits version.
+/// Each record then contains, in native byte order:
+/// - the time of the record since the start of the capture, in nanoseconds
+///   (64 bits),
+/// - the stream of the record, that identifies the socket (32 bits),
+/// - the direction of the message (8 bits, see `MessageCapture::Direction`),
+/// - the header of the message, as sent to the network,
+/// - the payload of the message with its sub-buffers inlined, as sent to the
+///   network (`header.size` bytes).
+///
+/// Messages are recorded before their compression and fragmentation when they
+/// are sent and after their reassembly and decompression when they are
+/// received.
+
+namespace qi
+{
+  class QI_API MessageCapture
+  {
+  public:
+    enum class Direction : std::uint8_t
+    {
+      Sent = 0,
+      Received = 1,
+    };
+
+    struct Record
+    {
+      Duration time;
+      std::uint32_t stream;
+      Direction direction;
+      Message message;
+    };
+
+    static const std::uint32_t version = 1;
+
+    /// Creates the file, or truncates it if it exists.
+    /// Throws a `std::runtime_error` if the file cannot be opened.
+    explicit MessageCapture(const std::string& path);
+
+    void record(std::uint32_t stream, Direction direction, const Message& msg);
+    void flush();
+
+    std::uint64_t recordCount() const;
+
+  private:
+    mutable std::mutex _mutex;
+    std::ofstream _out;
+    SteadyClock::time_point _start;
+    std::uint64_t _recordCount;
+  };
+
+  /// Reads the records of a capture file in order.
+  class QI_API MessageCaptureReader
+  {
+  public:
+    /// Throws a `std::runtime_error` if the file cannot be opened or is not
+    /// a capture of a supported version.
+    explicit MessageCaptureReader(const std::string& path);
+
+    /// Returns the next record, or none at the end of the file. Throws a
+    /// `std::runtime_error` if the record is truncated, or if its payload is
+    /// larger than the rest of the file.
+    boost::optional<MessageCapture::Record> next();
+
+  private:
+    std::ifstream _in;
+    std::uint64_t _fileSize;
+  };
+
+  /// The capture of the messages of all the sockets of the process, if any.
+  /// It is initially opened on the file given by the `QI_MESSAGE_CAPTURE`
+  /// environment variable.
+  QI_API boost::shared_ptr<MessageCapture> messageCapture();
+
+  /// Replaces the capture of the messages of all the sockets. A null capture
+  /// stops capturing.
+  QI_API void setMessageCapture(boost::shared_ptr<MessageCapture> capture);
+
+  /// Returns true if messages are being captured. It is cheaper than
+  /// `messageCapture()` and meant to be checked first on each message.
+  QI_API bool messageCaptureEnabled();
+
+  /// Returns a new identifier of stream, for a socket to record its messages.
+  QI_API std::uint32_t newMessageCaptureStream();
+}
+
+#endif // _SRC_MESSAGECAPTURE_HPP_
@@ -3,90 +3,119 @@
 **  See COPYING for the license
 */
 #include "messagedispatcher.hpp"
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <qi/eventloop.hpp>
 
 qiLogCategory("qimessaging.messagedispatcher");
 
 namespace qi {
 
-#if 0
-  //Needed for handling message Timeout
-  static int _gst()
+  namespace
   {
-    static const std::string st = qi::os::getenv("QI_MESSAGE_TIMEOUT");
-    if (st != "")
-    {
-      return atoi(st.c_str());
-    }
-    else
-    {
-      // Default timeout in NAOqi 1
-      return 5 * 60;
-    }
+    // Resolution of the timeouts of the calls.
+    const Duration callTimeoutResolution = MilliSeconds(10);
   }
 
-  static inline unsigned int getSocketTimeout()
+  const unsigned int MessageDispatcher::ALL_OBJECTS = -1;
+
+  MessageDispatcher::MessageSentShard::MessageSentShard()
+    : deadlines(callTimeoutResolution)
   {
-    static int _socket_timeout = _gst();
-    return _socket_timeout;
   }
-#endif
-
-  const unsigned int MessageDispatcher::ALL_OBJECTS = -1;
 
   MessageDispatcher::MessageDispatcher(ExecutionContext* execContext)
     : _execContext{ execContext }
+    , _signalMap{ boost::make_shared<const SignalMap>() }
+    , _timedCallCount{ 0 }
+    , _callTimeoutTimerArmed{ false }
   {
   }
 
-  void MessageDispatcher::dispatch(const qi::Message& msg) {
-    //remove the address from the messageSent map
-    if (msg.type() == qi::Message::Type_Reply)
+  MessageDispatcher::~MessageDispatcher()
+  {
+    destroy();
+  }
+
+  MessageDispatcher::SignalMapPtr MessageDispatcher::signalMap() const
+  {
+    return boost::atomic_load(&_signalMap);
+  }
+
+  MessageDispatcher::MessageSentShard& MessageDispatcher::messageSentShard(unsigned int id)
+  {
+    return _messageSent[id % messageSentShardCount];
+  }
+
+  void MessageDispatcher::eraseMessageSent(unsigned int id)
+  {
+    auto& shard = messageSentShard(id);
+    boost::mutex::scoped_lock sl(shard.mutex);
+    if (shard.messages.erase(id) == 0)
     {
-      boost::mutex::scoped_lock sl(_messageSentMutex);
-      MessageSentMap::iterator it;
-      it = _messageSent.find(msg.id());
-      if (it != _messageSent.end())
-        _messageSent.erase(it);
-      else
-        qiLogDebug() << "Message " << msg.id() <<  " is not in the messageSent map";
+      qiLogDebug() << "Message " << id <<  " is not in the messageSent map";
+      return;
     }
+    if (shard.deadlines.remove(id))
+      --_timedCallCount;
+  }
+
+  void MessageDispatcher::received(const qi::Message& msg)
+  {
+    //remove the address from the messageSent map
+    if (msg.type() == qi::Message::Type_Reply
+        || msg.type() == qi::Message::Type_Error
+        || msg.type() == qi::Message::Type_Canceled)
+      eraseMessageSent(msg.id());
+  }
+
+  void MessageDispatcher::dispatch(const qi::Message& msg) {
+    received(msg);
 
     {
+      // The snapshot keeps the signals alive while they are invoked, even if
+      // they are removed from the routing table meanwhile.
+      const SignalMapPtr signals = signalMap();
       boost::shared_ptr<OnMessageSignal> sig[2];
-      bool hit = false;
-      {
-        boost::recursive_mutex::scoped_lock sl(_signalMapMutex);
-        SignalMap::iterator it;
-        it = _signalMap.find(Target(msg.service(), msg.object()));
-        if (it != _signalMap.end())
-        {
-          hit = true;
-          sig[0] = it->second;
-        }
-        it = _signalMap.find(Target(msg.service(), ALL_OBJECTS));
-        if (it != _signalMap.end())
-        {
-          hit = true;
-          sig[1] = it->second;
-        }
-      }
+      SignalMap::const_iterator it;
+      it = signals->find(Target(msg.service(), msg.object()));
+      if (it != signals->end())
+        sig[0] = it->second;
+      it = signals->find(Target(msg.service(), ALL_OBJECTS));
+      if (it != signals->end())
+        sig[1] = it->second;
       if (sig[0])
         (*sig[0])(msg);
       if (sig[1])
         (*sig[1])(msg);
-      if (!hit) // FIXME: that should probably never happen, raise log level
+      if (!sig[0] && !sig[1]) // FIXME: that should probably never happen, raise log level
         qiLogDebug() << "No listener for service " << msg.service();
     }
   }
 
   qi::SignalLink
   MessageDispatcher::messagePendingConnect(unsigned int serviceId, unsigned int objectId, boost::function<void (const qi::Message&)> fun) {
-    boost::recursive_mutex::scoped_lock sl(_signalMapMutex);
-    boost::shared_ptr<OnMessageSignal> &sig = _signalMap[Target(serviceId, objectId)];
-    if (!sig)
-      sig.reset(new OnMessageSignal(_execContext));
-    sig->setCallType(MetaCallType_Direct);
-    return sig->connect(fun);
+    boost::shared_ptr<OnMessageSignal> sig;
+    {
+      boost::mutex::scoped_lock sl(_signalMapMutex);
+      const SignalMapPtr signals = signalMap();
+      const auto it = signals->find(Target(serviceId, objectId));
+      if (it != signals->end())
+      {
+        sig = it->second;
+      }
+      else
+      {
+        sig = boost::make_shared<OnMessageSignal>(_execContext);
+        sig->setCallType(MetaCallType_Direct);
+        auto newSignals = boost::make_shared<SignalMap>(*signals);
+        newSignals->emplace(Target(serviceId, objectId), sig);
+        boost::atomic_store(&_signalMap, SignalMapPtr(std::move(newSignals)));
+      }
+      // Connecting under the lock prevents a concurrent disconnection from
+      // removing the signal before it has a subscriber.
+      return sig->connect(fun);
+    }
   }
 
   void MessageDispatcher::messagePendingDisconnect(unsigned int serviceId, unsigned int objectId, qi::SignalLink linkId)
@@ -96,23 +125,25 @@ namespace qi {
     // handlers to finish before returning.
     boost::shared_ptr<OnMessageSignal> sig;
     {
-      boost::recursive_mutex::scoped_lock sl(_signalMapMutex);
-      SignalMap::iterator it;
-      it = _signalMap.find(Target(serviceId, objectId));
-      if (it != _signalMap.end())
-        sig = it->second;
-      else
+      const SignalMapPtr signals = signalMap();
+      const auto it = signals->find(Target(serviceId, objectId));
+      if (it == signals->end())
         return;
+      sig = it->second;
     }
     sig->disconnectAsync(linkId);
     if (!sig->hasSubscribers())
     {
       // We need to re-acquire lock and check emptyness when locked
-       boost::recursive_mutex::scoped_lock sl(_signalMapMutex);
-       SignalMap::iterator it;
-       it = _signalMap.find(Target(serviceId, objectId));
-       if (it != _signalMap.end() && !it->second->hasSubscribers())
-         _signalMap.erase(it);
+      boost::mutex::scoped_lock sl(_signalMapMutex);
+      const SignalMapPtr signals = signalMap();
+      const auto it = signals->find(Target(serviceId, objectId));
+      if (it != signals->end() && !it->second->hasSubscribers())
+      {
+        auto newSignals = boost::make_shared<SignalMap>(*signals);
+        newSignals->erase(Target(serviceId, objectId));
+        boost::atomic_store(&_signalMap, SignalMapPtr(std::move(newSignals)));
+      }
     }
   }
 
@@ -120,40 +151,129 @@ namespace qi {
   {
     //we are deleting the Socket and want to timeout all pending request
     //or the cleanup timer ask us to remove pending request that timed out
-    while (true)
+    // Calls may be sent while the errors are dispatched, by their handlers
+    // for instance: the shards are emptied until none of them has a call.
+    bool cleaned = true;
+    while (cleaned)
     {
-      MessageAddress ma;
+      cleaned = false;
+      for (auto& shard: _messageSent)
       {
-        boost::mutex::scoped_lock l(_messageSentMutex);
-        MessageSentMap::iterator it = _messageSent.begin();
-        if (it == _messageSent.end())
-          break;
-        ma = it->second;
-        _messageSent.erase(it);
+        MessageSentMap messages;
+        {
+          boost::mutex::scoped_lock l(shard.mutex);
+          if (shard.messages.empty())
+            continue;
+          std::swap(messages, shard.messages);
+          _timedCallCount -= shard.deadlines.size();
+          shard.deadlines = TimerWheel(callTimeoutResolution);
+        }
+        cleaned = true;
+        for (const auto& sent: messages)
+        {
+          //generate an error message for the caller.
+          qi::Message msg(qi::Message::Type_Error, sent.second);
+          msg.setError("Endpoint disconnected, message dropped.");
+          dispatch(msg);
+        }
       }
-      //generate an error message for the caller.
-      qi::Message msg(qi::Message::Type_Error, ma);
-      msg.setError("Endpoint disconnected, message dropped.");
-      dispatch(msg);
     }
   }
 
+  std::size_t MessageDispatcher::pendingMessageCount() const
+  {
+    std::size_t count = 0;
+    for (const auto& shard: _messageSent)
+    {
+      boost::mutex::scoped_lock l(shard.mutex);
+      count += shard.messages.size();
+    }
+    return count;
+  }
+
   void MessageDispatcher::sent(const qi::Message& msg) {
     //store Call id, we can use them later to notify the client
-    //if the call did not succeed. (network disconnection, message lost)
+    //if the call did not succeed. (network disconnection, message lost, timeout)
     if (msg.type() == qi::Message::Type_Call)
     {
-      boost::mutex::scoped_lock l(_messageSentMutex);
-      MessageSentMap::iterator it = _messageSent.find(msg.id());
-      if (it != _messageSent.end()) {
-        qiLogInfo() << "Message ID conflict. A message with the same Id is already in flight" << msg.id();
-        return;
+      auto& shard = messageSentShard(msg.id());
+      {
+        boost::mutex::scoped_lock l(shard.mutex);
+        if (!shard.messages.emplace(msg.id(), msg.address()).second) {
+          qiLogInfo() << "Message ID conflict. A message with the same Id is already in flight" << msg.id();
+          return;
+        }
+        if (!msg.callTimeout())
+          return;
+        shard.deadlines.add(msg.id(), SteadyClock::now() + *msg.callTimeout());
+        ++_timedCallCount;
       }
-      _messageSent[msg.id()] = msg.address();
+      armCallTimeoutTimer();
     }
     return;
   }
 
+  void MessageDispatcher::sendFailed(const qi::Message& msg)
+  {
+    if (msg.type() == qi::Message::Type_Call)
+      eraseMessageSent(msg.id());
+  }
+
+  void MessageDispatcher::expireCalls(SteadyClock::time_point now)
+  {
+    std::vector<MessageAddress> expired;
+    for (auto& shard: _messageSent)
+    {
+      boost::mutex::scoped_lock l(shard.mutex);
+      if (shard.deadlines.empty())
+        continue;
+      for (const auto id: shard.deadlines.advance(now))
+      {
+        --_timedCallCount;
+        const auto it = shard.messages.find(static_cast<unsigned int>(id));
+        if (it == shard.messages.end())
+          continue;
+        expired.push_back(it->second);
+        shard.messages.erase(it);
+      }
+    }
 
+    for (const auto& address: expired)
+    {
+      qiLogVerbose() << "Call " << address << " timed out.";
+      //generate an error message for the caller.
+      qi::Message msg(qi::Message::Type_Error, address);
+      msg.setError("Call timed out.");
+      dispatch(msg);
+
+      boost::mutex::scoped_lock l(_callTimeoutHandlerMutex);
+      if (_callTimeoutHandler)
+        _callTimeoutHandler(address);
+    }
+  }
+
+  void MessageDispatcher::setCallTimeoutHandler(CallTimeoutHandler handler)
+  {
+    boost::mutex::scoped_lock l(_callTimeoutHandlerMutex);
+    _callTimeoutHandler = std::move(handler);
+  }
+
+  void MessageDispatcher::armCallTimeoutTimer()
+  {
+    if (_callTimeoutTimerArmed.exchange(true))
+      return;
+    ExecutionContext* context = _execContext ? _execContext : getEventLoop();
+    context->asyncDelay(trackSilent([this] { onCallTimeoutTimer(); }, this),
+                        callTimeoutResolution);
+  }
+
+  void MessageDispatcher::onCallTimeoutTimer()
+  {
+    expireCalls();
+    _callTimeoutTimerArmed.store(false);
+    // Calls sent meanwhile may have seen the timer armed.
+    if (_timedCallCount.load() > 0)
+      armCallTimeoutTimer();
+  }
 
 }
@@ -9,8 +9,13 @@
 
 #include <qi/anyobject.hpp>
 #include <qi/signal.hpp>
+#include <qi/trackable.hpp>
+#include <array>
+#include <atomic>
+#include <unordered_map>
 #include <boost/thread/mutex.hpp>
 #include "message.hpp"
+#include "timerwheel.hpp"
 
 namespace qi {
 
@@ -21,21 +26,49 @@ namespace qi {
    * Receive message from a TransportSocket and send them on the appropriate
    * signal, based on the serviceId of the message.
    *
-   * This class generate an error message for all pending message that have timed out.
-   * at the moment it only generate message if the socket have been disconnected.
+   * This class generate an error message for all pending message that have timed out,
+   * or when the socket have been disconnected.
    *
-   * TODO: handle timeout on request taking too long to complete
+   * Dispatching never waits for the registration of the listeners: the signals
+   * are looked up in an immutable snapshot of the routing table, that the
+   * registrations replace (copy on write). The messages sent are tracked in
+   * a table split in shards by message id, so that concurrent calls on a
+   * socket seldom contend on the same lock.
+   *
+   * The deadlines of the calls that have a timeout (see `Message::callTimeout`)
+   * are kept in a timer wheel per shard, that a single periodic task advances
+   * while there are such calls. A call that times out gets a local error
+   * message, and the call timeout handler is invoked for it.
    */
-  class MessageDispatcher {
+  class MessageDispatcher : public Trackable<MessageDispatcher> {
   public:
     MessageDispatcher(ExecutionContext* execContext = nullptr);
+    ~MessageDispatcher();
 
     //internal: called by Socket to tell the class that we sent a message
     void sent(const qi::Message& msg);
+    //internal: called by Socket when a message it was told about could not be sent
+    void sendFailed(const qi::Message& msg);
     //internal: called by Socket to tell the class a message have been receive
     void dispatch(const qi::Message& msg);
+    //internal: called by Socket to tell the class a message have been received
+    //and dispatched without this class
+    void received(const qi::Message& msg);
     void cleanPendingMessages();
 
+    /// Generates an error message for the pending calls whose deadline is
+    /// before `now`. It is done periodically while there are such calls.
+    void expireCalls(SteadyClock::time_point now = SteadyClock::now());
+
+    using CallTimeoutHandler = boost::function<void (const MessageAddress&)>;
+    /// Sets the procedure invoked for each call that times out, after its error
+    /// message is dispatched. Once this function returns, the previous handler
+    /// is not running and will not be invoked anymore.
+    void setCallTimeoutHandler(CallTimeoutHandler handler);
+
+    /// Number of calls sent whose reply has not been dispatched yet.
+    std::size_t pendingMessageCount() const;
+
     static const unsigned int ALL_OBJECTS;
     qi::SignalLink messagePendingConnect(unsigned int serviceId, unsigned int objectId, boost::function<void (const qi::Message&)> fun);
     void           messagePendingDisconnect(unsigned int serviceId, unsigned int objectId, qi::SignalLink linkId);
@@ -45,14 +78,42 @@ namespace qi {
     using OnMessageSignal = Signal<const qi::Message&>;
     // use shared-ptr on signal so that we may hold it without holding the map lock
     using SignalMap = std::map<Target, boost::shared_ptr<OnMessageSignal> >;
-    using MessageSentMap = std::map<unsigned int, MessageAddress>;
+    using SignalMapPtr = boost::shared_ptr<const SignalMap>;
+
+    /// Current snapshot of the routing table.
+    SignalMapPtr signalMap() const;
+
+  private:
+    using MessageSentMap = std::unordered_map<unsigned int, MessageAddress>;
+
+    static const std::size_t messageSentShardCount = 16;
+    struct MessageSentShard
+    {
+      MessageSentShard();
+
+      MessageSentMap messages;
+      // Deadlines of the messages that have a timeout, by id.
+      TimerWheel deadlines;
+      mutable boost::mutex mutex;
+    };
+
+    MessageSentShard& messageSentShard(unsigned int id);
+    void eraseMessageSent(unsigned int id);
+    void armCallTimeoutTimer();
+    void onCallTimeoutTimer();
 
     ExecutionContext*      _execContext;
-    SignalMap              _signalMap;
-    boost::recursive_mutex _signalMapMutex;
+    // Snapshot of the routing table, loaded and replaced atomically.
+    SignalMapPtr           _signalMap;
+    // Serializes the writers of the routing table only.
+    boost::mutex           _signalMapMutex;
+
+    std::array<MessageSentShard, messageSentShardCount> _messageSent;
 
-    MessageSentMap         _messageSent;
-    boost::mutex           _messageSentMutex;
+    std::atomic<std::size_t> _timedCallCount;
+    std::atomic<bool>        _callTimeoutTimerArmed;
+    boost::mutex             _callTimeoutHandlerMutex;
+    CallTimeoutHandler       _callTimeoutHandler;
   };
 
 }
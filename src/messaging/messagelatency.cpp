@@ -0,0 +1,269 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include "messagelatency.hpp"
+
+#include <algorithm>
+#include <ostream>
+#include <qi/os.hpp>
+
+namespace qi
+{
+  namespace
+  {
+    std::size_t bucketIndex(std::uint64_t us)
+    {
+      std::size_t index = 0;
+      while (us != 0 && index + 1 < LatencyHistogram::bucketCount)
+      {
+        us >>= 1;
+        ++index;
+      }
+      return index;
+    }
+
+    std::atomic<bool>& latencyEnabledFlag()
+    {
+      static std::atomic<bool> enabled{os::getenv("QI_MESSAGE_LATENCY") == "1"};
+      return enabled;
+    }
+
+    bool isReply(const Message& msg)
+    {
+      return msg.type() == Message::Type_Reply || msg.type() == Message::Type_Error
+          || msg.type() == Message::Type_Canceled;
+    }
+
+    // Returns the time the call was registered and forgets it, or the
+    // default time if it is unknown.
+    SteadyClock::time_point takeCall(std::unordered_map<std::uint32_t, SteadyClock::time_point>& calls,
+                                     std::uint32_t id)
+    {
+      const auto it = calls.find(id);
+      if (it == calls.end())
+        return {};
+      const auto time = it->second;
+      calls.erase(it);
+      return time;
+    }
+
+    void addCall(std::unordered_map<std::uint32_t, SteadyClock::time_point>& calls,
+                 std::uint32_t id, SteadyClock::time_point time)
+    {
+      // Calls whose reply never comes are forgotten when there are too many.
+      if (calls.size() >= MessageLatencyTracker::maxPendingCalls)
+        calls.clear();
+      calls[id] = time;
+    }
+  }
+
+  const char* latencyStageName(LatencyStage stage)
+  {
+    switch (stage)
+    {
+      case LatencyStage::Send:      return "Send";
+      case LatencyStage::Receive:   return "Receive";
+      case LatencyStage::Callee:    return "Callee";
+      case LatencyStage::RoundTrip: return "RoundTrip";
+    }
+    return "Unknown";
+  }
+
+  double LatencyHistogram::Snapshot::meanUs() const
+  {
+    return count == 0 ? 0. : static_cast<double>(sumUs) / count;
+  }
+
+  std::uint64_t LatencyHistogram::Snapshot::percentileUs(double percentile) const
+  {
+    if (count == 0)
+      return 0;
+    const auto rank = static_cast<std::uint64_t>(std::max(1., percentile / 100. * count + 0.5));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < bucketCount; ++i)
+    {
+      seen += buckets[i];
+      if (seen >= rank)
+        return std::min(std::uint64_t{1} << i, maxUs);
+    }
+    return maxUs;
+  }
+
+  LatencyHistogram::LatencyHistogram()
+  {
+    reset();
+  }
+
+  void LatencyHistogram::record(Duration duration)
+  {
+    const auto us = static_cast<std::uint64_t>(
+      std::max(boost::chrono::duration_cast<MicroSeconds>(duration).count(), MicroSeconds::rep{0}));
+    _buckets[bucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sumUs.fetch_add(us, std::memory_order_relaxed);
+    auto max = _maxUs.load(std::memory_order_relaxed);
+    while (us > max && !_maxUs.compare_exchange_weak(max, us, std::memory_order_relaxed))
+    {
+    }
+  }
+
+  LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+  {
+    Snapshot snapshot;
+    for (std::size_t i = 0; i < bucketCount; ++i)
+      snapshot.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+    snapshot.count = _count.load(std::memory_order_relaxed);
+    snapshot.sumUs = _sumUs.load(std::memory_order_relaxed);
+    snapshot.maxUs = _maxUs.load(std::memory_order_relaxed);
+    return snapshot;
+  }
+
+  void LatencyHistogram::reset()
+  {
+    for (auto& bucket: _buckets)
+      bucket.store(0, std::memory_order_relaxed);
+    _count.store(0, std::memory_order_relaxed);
+    _sumUs.store(0, std::memory_order_relaxed);
+    _maxUs.store(0, std::memory_order_relaxed);
+  }
+
+  void MessageLatency::record(LatencyStage stage, Duration duration)
+  {
+    _stages[static_cast<std::size_t>(stage)].record(duration);
+  }
+
+  LatencyHistogram::Snapshot MessageLatency::snapshot(LatencyStage stage) const
+  {
+    return _stages[static_cast<std::size_t>(stage)].snapshot();
+  }
+
+  void MessageLatency::reset()
+  {
+    for (auto& stage: _stages)
+      stage.reset();
+  }
+
+  void MessageLatencyTracker::onSend(Message& msg)
+  {
+    const auto now = SteadyClock::now();
+    msg.setTimestamp(now);
+    SteadyClock::time_point dispatched;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      if (msg.type() == Message::Type_Call)
+        addCall(_sentCalls, msg.id(), now);
+      else if (isReply(msg))
+        dispatched = takeCall(_dispatchedCalls, msg.id());
+    }
+    if (dispatched != SteadyClock::time_point{})
+      record(msg, LatencyStage::Callee, now - dispatched);
+  }
+
+  void MessageLatencyTracker::onSent(const Message& msg)
+  {
+    if (msg.timestamp() != SteadyClock::time_point{})
+      record(msg, LatencyStage::Send, SteadyClock::now() - msg.timestamp());
+  }
+
+  void MessageLatencyTracker::onDispatch(const Message& msg)
+  {
+    const auto now = SteadyClock::now();
+    const auto received = msg.timestamp();
+    if (received != SteadyClock::time_point{})
+      record(msg, LatencyStage::Receive, now - received);
+    SteadyClock::time_point sent;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      if (msg.type() == Message::Type_Call)
+        addCall(_dispatchedCalls, msg.id(), now);
+      else if (isReply(msg))
+        sent = takeCall(_sentCalls, msg.id());
+    }
+    if (sent != SteadyClock::time_point{})
+      record(msg, LatencyStage::RoundTrip, (received != SteadyClock::time_point{} ? received : now) - sent);
+  }
+
+  void MessageLatencyTracker::record(const Message& msg, LatencyStage stage, Duration duration)
+  {
+    _latency.record(stage, duration);
+    messageLatencyRegistry().record({msg.service(), msg.object(), msg.action()}, stage, duration);
+  }
+
+  void MessageLatencyRegistry::record(const MethodKey& key, LatencyStage stage, Duration duration)
+  {
+    {
+      boost::shared_lock<boost::shared_mutex> lock{_mutex};
+      const auto it = _methods.find(key);
+      if (it != _methods.end())
+      {
+        it->second->record(stage, duration);
+        return;
+      }
+    }
+    boost::unique_lock<boost::shared_mutex> lock{_mutex};
+    auto& latency = _methods[key];
+    if (!latency)
+      latency.reset(new MessageLatency);
+    latency->record(stage, duration);
+  }
+
+  std::map<MessageLatencyRegistry::MethodKey, MessageLatencyRegistry::Snapshot>
+  MessageLatencyRegistry::snapshot() const
+  {
+    std::map<MethodKey, Snapshot> result;
+    boost::shared_lock<boost::shared_mutex> lock{_mutex};
+    for (const auto& method: _methods)
+    {
+      auto& snapshot = result[method.first];
+      for (std::size_t i = 0; i < latencyStageCount; ++i)
+        snapshot[i] = method.second->snapshot(static_cast<LatencyStage>(i));
+    }
+    return result;
+  }
+
+  void MessageLatencyRegistry::reset()
+  {
+    boost::unique_lock<boost::shared_mutex> lock{_mutex};
+    _methods.clear();
+  }
+
+  void MessageLatencyRegistry::exportText(std::ostream& out) const
+  {
+    for (const auto& method: snapshot())
+    {
+      for (std::size_t i = 0; i < latencyStageCount; ++i)
+      {
+        const auto& stage = method.second[i];
+        if (stage.count == 0)
+          continue;
+        out << "service=" << method.first.service
+            << " object=" << method.first.object
+            << " action=" << method.first.action
+            << " stage=" << latencyStageName(static_cast<LatencyStage>(i))
+            << " count=" << stage.count
+            << " mean=" << stage.meanUs()
+            << " p50=" << stage.percentileUs(50)
+            << " p99=" << stage.percentileUs(99)
+            << " max=" << stage.maxUs << '\n';
+      }
+    }
+  }
+
+  MessageLatencyRegistry& messageLatencyRegistry()
+  {
+    static MessageLatencyRegistry registry;
+    return registry;
+  }
+
+  bool messageLatencyEnabled()
+  {
+    return latencyEnabledFlag().load(std::memory_order_relaxed);
+  }
+
+  void setMessageLatencyEnabled(bool enabled)
+  {
+    latencyEnabledFlag().store(enabled, std::memory_order_relaxed);
+  }
+}
@@ -0,0 +1,194 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_MESSAGELATENCY_HPP_
+#define _SRC_MESSAGELATENCY_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <boost/thread/shared_mutex.hpp>
+#include <qi/api.hpp>
+#include <qi/clock.hpp>
+#include "message.hpp"
+
+/// @file
+/// Contains the measurement of the latency of messages.
+///
+/// The path of a message is split in stages, whose durations are aggregated
+/// in histograms, per socket and per method (for all the sockets of the
+/// process):
+///
+/// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+///  caller socket                                   callee socket
+///  send(call) ----------- Send -------> written
+///    |                                  header received --- Receive ---> dispatch
+///    |                                                                      |
+///  RoundTrip                                                              Callee
+///    |                                                                      |
+///  dispatch <- Receive - header received <-- Send -- written <-- send(reply)
+/// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+///
+/// The measurement is disabled by default, see `messageLatencyEnabled`.
+
+namespace qi
+{
+  enum class LatencyStage
+  {
+    /// From the message being passed to the socket to its write completion:
+    /// time spent in the send queue and being written.
+    Send,
+    /// From the reception of the message header to the dispatch of the
+    /// message: time spent reading the payload and rebuilding the message.
+    Receive,
+    /// From the dispatch of a call to the sending of its reply: time spent
+    /// in the callee, including its queueing.
+    Callee,
+    /// From the sending of a call to the reception of the header of its reply.
+    RoundTrip,
+  };
+  const std::size_t latencyStageCount = 4;
+
+  QI_API const char* latencyStageName(LatencyStage stage);
+
+  /// Histogram of durations, with logarithmic buckets: the bucket `i` counts
+  /// the durations below 2^i microseconds that are not counted by a lower
+  /// bucket. The last bucket also counts the longer durations.
+  ///
+  /// Lock-free.
+  class QI_API LatencyHistogram
+  {
+  public:
+    static const std::size_t bucketCount = 32;
+
+    struct QI_API Snapshot
+    {
+      std::array<std::uint64_t, bucketCount> buckets{};
+      std::uint64_t count = 0;
+      std::uint64_t sumUs = 0;
+      std::uint64_t maxUs = 0;
+
+      double meanUs() const;
+      /// Upper bound of the bucket containing the given percentile (between 0
+      /// and 100), in microseconds.
+      std::uint64_t percentileUs(double percentile) const;
+    };
+
+    LatencyHistogram();
+
+    void record(Duration duration);
+    Snapshot snapshot() const;
+    void reset();
+
+  private:
+    std::array<std::atomic<std::uint64_t>, bucketCount> _buckets;
+    std::atomic<std::uint64_t> _count;
+    std::atomic<std::uint64_t> _sumUs;
+    std::atomic<std::uint64_t> _maxUs;
+  };
+
+  /// Histograms of the stages of the path of messages.
+  class QI_API MessageLatency
+  {
+  public:
+    void record(LatencyStage stage, Duration duration);
+    LatencyHistogram::Snapshot snapshot(LatencyStage stage) const;
+    void reset();
+
+  private:
+    std::array<LatencyHistogram, latencyStageCount> _stages;
+  };
+
+  /// Measures the latency of the messages of a socket. The durations are
+  /// recorded in the histograms of the socket and of the methods, see
+  /// `messageLatencyRegistry`.
+  ///
+  /// Thread-safe.
+  class QI_API MessageLatencyTracker
+  {
+  public:
+    /// Call the functions below only if `messageLatencyEnabled`.
+
+    /// The message is passed to the socket to be sent: it is given a
+    /// timestamp. It ends the `Callee` stage of a reply.
+    void onSend(Message& msg);
+
+    /// The message has been written.
+    void onSent(const Message& msg);
+
+    /// The message is dispatched. It ends the `RoundTrip` stage of a reply.
+    void onDispatch(const Message& msg);
+
+    const MessageLatency& latency() const { return _latency; }
+
+    /// Count of calls whose reply is not known yet, that are tracked at most.
+    static const std::size_t maxPendingCalls = 64 * 1024;
+
+  private:
+    void record(const Message& msg, LatencyStage stage, Duration duration);
+
+    MessageLatency _latency;
+    std::mutex _mutex;
+    // Calls sent through the socket, by id.
+    std::unordered_map<std::uint32_t, SteadyClock::time_point> _sentCalls;
+    // Calls received through the socket and dispatched, by id.
+    std::unordered_map<std::uint32_t, SteadyClock::time_point> _dispatchedCalls;
+  };
+
+  /// Histograms of the stages of the messages of the process, per method.
+  ///
+  /// Thread-safe.
+  class QI_API MessageLatencyRegistry
+  {
+  public:
+    struct MethodKey
+    {
+      unsigned int service;
+      unsigned int object;
+      unsigned int action;
+
+      friend bool operator<(const MethodKey& a, const MethodKey& b)
+      {
+        return std::tie(a.service, a.object, a.action) < std::tie(b.service, b.object, b.action);
+      }
+    };
+    using Snapshot = std::array<LatencyHistogram::Snapshot, latencyStageCount>;
+
+    void record(const MethodKey& key, LatencyStage stage, Duration duration);
+    std::map<MethodKey, Snapshot> snapshot() const;
+    void reset();
+
+    /// Writes a line per method and stage, with the count of messages and the
+    /// mean, median, 99th percentile and maximum durations (in microseconds).
+    /// The percentiles are bounds of power-of-two buckets, capped by the
+    /// maximum:
+    /// `service=1 object=1 action=100 stage=Callee count=12 mean=35.5 p50=32 p99=97 max=97`
+    void exportText(std::ostream& out) const;
+
+  private:
+    mutable boost::shared_mutex _mutex;
+    std::map<MethodKey, std::unique_ptr<MessageLatency>> _methods;
+  };
+
+  /// The registry of the process.
+  QI_API MessageLatencyRegistry& messageLatencyRegistry();
+
+  /// Whether the latency of messages is measured. It is disabled by default,
+  /// and can be enabled by setting the `QI_MESSAGE_LATENCY` environment
+  /// variable to 1.
+  QI_API bool messageLatencyEnabled();
+  QI_API void setMessageLatencyEnabled(bool enabled);
+}
+
+#endif // _SRC_MESSAGELATENCY_HPP_
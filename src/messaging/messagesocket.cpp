@@ -2,6 +2,7 @@
 #include <qi/messaging/sock/option.hpp>
 #include "messagesocket.hpp"
 #include "tcpmessagesocket.hpp"
+#include "batch.hpp"
 
 // Disable "'this': used in base member initializer list"
 #if BOOST_COMP_MSVC
@@ -27,6 +28,12 @@ namespace qi
 
   MessageSocketPtr makeMessageSocket(const std::string &protocol, qi::EventLoop *eventLoop)
   {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    if (protocol == "unix")
+    {
+      return boost::make_shared<LocalMessageSocket>(*asIoServicePtr(eventLoop));
+    }
+#endif
     return makeTcpMessageSocket(protocol, eventLoop);
   }
 
@@ -48,11 +55,73 @@ namespace qi
     }
   }
 
-  bool MessageSocket::send(Message msg)
+  bool MessageSocket::prepareToSend(Message& msg)
   {
     extendDirectMessageRoutageCapability(*this, msg);
     qiLogDebug() << "Sending " << msg;
-    return sendImpl(msg);
+    capture(MessageCapture::Direction::Sent, msg);
+    // Only the calls that have a timeout are tracked: the others fail when
+    // the socket is disconnected.
+    const bool timed = msg.type() == Message::Type_Call && msg.callTimeout();
+    if (timed)
+      _dispatcher.sent(msg);
+    return timed;
+  }
+
+  bool MessageSocket::send(Message msg)
+  {
+    const bool timed = prepareToSend(msg);
+    if (messageLatencyEnabled())
+      _latency->onSend(msg);
+    if (!sendImpl(msg))
+    {
+      if (timed)
+        _dispatcher.sendFailed(msg);
+      return false;
+    }
+    return true;
+  }
+
+  bool MessageSocket::sendBatch(std::vector<Message> msgs)
+  {
+    if (msgs.empty())
+      return true;
+    if (msgs.size() == 1 || !sharedCapability<bool>(capabilityname::messageBatch, false))
+    {
+      bool sent = true;
+      for (auto& msg: msgs)
+        sent = send(std::move(msg)) && sent;
+      return sent;
+    }
+
+    bool timed = false;
+    for (auto& msg: msgs)
+      timed = prepareToSend(msg) || timed;
+    auto batch = batch::pack(msgs);
+    if (messageLatencyEnabled())
+      _latency->onSend(batch);
+    if (!sendImpl(std::move(batch)))
+    {
+      if (timed)
+      {
+        for (const auto& msg: msgs)
+          _dispatcher.sendFailed(msg);
+      }
+      return false;
+    }
+    return true;
+  }
+
+  void MessageSocket::cancelTimedOutCall(const MessageAddress& address)
+  {
+    if (!isConnected() || !sharedCapability<bool>(capabilityname::remoteCancelableCalls, false))
+      return;
+    Message cancelMessage;
+    cancelMessage.setService(address.serviceId);
+    cancelMessage.setType(Message::Type_Cancel);
+    cancelMessage.setValue(AnyReference::from(address.messageId), "I");
+    cancelMessage.setObject(address.objectId);
+    send(std::move(cancelMessage));
   }
 
 }
@@ -6,16 +6,21 @@
 # include <boost/noncopyable.hpp>
 # include <boost/variant.hpp>
 # include <boost/optional.hpp>
+# include <boost/make_shared.hpp>
 # include <qi/future.hpp>
 # include "message.hpp"
 # include <qi/url.hpp>
 # include <qi/eventloop.hpp>
 # include <qi/signal.hpp>
 # include <qi/binarycodec.hpp>
+# include <atomic>
 # include <string>
 # include "messagedispatcher.hpp"
 # include "streamcontext.hpp"
 # include "directdispatch.hpp"
+# include "messagelatency.hpp"
+# include "messagecapture.hpp"
+# include <qi/messaging/sock/sendqueue.hpp>
 
 namespace qi {
   namespace detail {
@@ -63,6 +68,7 @@ namespace qi
       , disconnected{ &_signalsStrand }
       , messageReady{ &_signalsStrand }
       , socketEvent{ &_signalsStrand }
+      , _latency{ boost::make_shared<MessageLatencyTracker>() }
     {
       connected.setCallType(MetaCallType_Direct);
       disconnected.setCallType(MetaCallType_Direct);
@@ -75,6 +81,11 @@ namespace qi
 
     bool send(qi::Message msg);
 
+    /// Sends the calls, or the replies, in one batch message if the remote end
+    /// supports it, and one by one otherwise. Returns false if any of them
+    /// could not be sent: with a batch, none of them is sent then.
+    bool sendBatch(std::vector<qi::Message> msgs);
+
     /// Start reading if is not already reading.
     /// Must be called once if the socket is obtained through TransportServer::newConnection()
     virtual bool  ensureReading() = 0;
@@ -86,6 +97,28 @@ namespace qi
 
     bool isConnected() const;
 
+    /// Tells the socket that the remote end is authenticated. Batch messages
+    /// are only accepted from an authenticated remote end.
+    void setAuthenticated() { _authenticated.store(true); }
+    bool isAuthenticated() const { return _authenticated.load(); }
+
+    /// Bounds the queue of messages waiting to be sent. Messages that do not
+    /// fit are handled according to the policy of the limits: `send` returns
+    /// false for the messages that are rejected or dropped.
+    virtual void setSendQueueLimits(const sock::SendQueueLimits& limits) = 0;
+
+    /// Metrics of the queue of messages waiting to be sent.
+    virtual sock::SendQueueStats sendQueueStats() const = 0;
+
+    /// Returns a future that is set once the queue of messages waiting to be
+    /// sent is below its limits. Producers use it to slow down with the `Wait`
+    /// policy.
+    virtual qi::Future<void> sendQueueReady() = 0;
+
+    /// Latencies of the messages sent and received through this socket. They
+    /// are only measured while `messageLatencyEnabled()` is true.
+    const MessageLatency& latency() const { return _latency->latency(); }
+
     static const unsigned int ALL_OBJECTS = (unsigned int)-1;
 
     qi::SignalLink messagePendingConnect(unsigned int serviceId, unsigned int objectId, boost::function<void (const qi::Message&)> fun) {
@@ -114,6 +147,31 @@ namespace qi
     using SocketEventData = boost::variant<std::string, qi::Message>;
     // C4251
     qi::Signal<SocketEventData>  socketEvent;
+
+  protected:
+    /// Does what sending a message requires before it is handed to
+    /// `sendImpl`. Returns true if the message is a call tracked for its
+    /// timeout.
+    bool prepareToSend(qi::Message& msg);
+
+    /// Asks the remote end to cancel a call that timed out, if it supports it.
+    /// It must only be called while the socket is fully constructed, as it
+    /// sends a message.
+    void cancelTimedOutCall(const qi::MessageAddress& address);
+
+    /// Records the message in the capture of the process, if messages are
+    /// captured.
+    void capture(MessageCapture::Direction direction, const qi::Message& msg)
+    {
+      if (!messageCaptureEnabled())
+        return;
+      if (auto capture = messageCapture())
+        capture->record(_captureStream, direction, msg);
+    }
+
+    boost::shared_ptr<MessageLatencyTracker> _latency;
+    const std::uint32_t _captureStream = newMessageCaptureStream();
+    std::atomic<bool> _authenticated{false};
   };
 
   using MessageSocketPtr = boost::shared_ptr<MessageSocket>;
@@ -0,0 +1,444 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <qi/messaging/sock/networkiouring.hpp>
+
+#if QI_IO_URING
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <unordered_set>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/version.hpp>
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+qiLogCategory("qimessaging.iouring");
+
+namespace qi { namespace sock { namespace uring {
+
+  namespace
+  {
+    const unsigned int ringEntries = 4096;
+
+    int ioUringSetup(unsigned int entries, io_uring_params* params)
+    {
+      return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int ioUringEnter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+    {
+      return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags,
+                                        nullptr, 0));
+    }
+
+    int ioUringRegister(int fd, unsigned int opcode, const void* arg, unsigned int count)
+    {
+      return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+    }
+
+    template<typename T>
+    std::atomic<T>& atomicAt(void* base, std::size_t offset)
+    {
+      return *reinterpret_cast<std::atomic<T>*>(static_cast<char*>(base) + offset);
+    }
+
+    bool enabledFromEnv()
+    {
+      static const bool enabled = qi::os::getenv("QI_NETWORK_IO_URING") == "1";
+      return enabled;
+    }
+
+    /// The shared rings of an io_uring instance.
+    ///
+    /// Submissions must be synchronized by the caller. Completions must be
+    /// reaped by one thread at a time.
+    class Ring
+    {
+    public:
+      /// Returns null if io_uring is not usable.
+      static std::unique_ptr<Ring> create(unsigned int entries)
+      {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        const int fd = ioUringSetup(entries, &params);
+        if (fd < 0)
+        {
+          qiLogVerbose() << "io_uring is not available: " << std::strerror(errno);
+          return {};
+        }
+        std::unique_ptr<Ring> ring{new Ring(fd, params)};
+        // Without fast poll, a read on a socket with no data would fail
+        // instead of waiting for the data.
+        if (!(params.features & IORING_FEAT_FAST_POLL) || !ring->map())
+        {
+          qiLogVerbose() << "io_uring does not support the required features.";
+          return {};
+        }
+        return ring;
+      }
+
+      ~Ring()
+      {
+        if (_sqes)
+          ::munmap(_sqes, _params.sq_entries * sizeof(io_uring_sqe));
+        if (_cqRing && _cqRing != _sqRing)
+          ::munmap(_cqRing, _cqRingSize);
+        if (_sqRing)
+          ::munmap(_sqRing, _sqRingSize);
+        ::close(_fd);
+      }
+
+      int fd() const { return _fd; }
+
+      /// Returns false if the submission queue is full.
+      bool push(Operation* op)
+      {
+        auto& head = atomicAt<unsigned int>(_sqRing, _params.sq_off.head);
+        auto& tail = atomicAt<unsigned int>(_sqRing, _params.sq_off.tail);
+        const unsigned int t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == _params.sq_entries)
+          return false;
+        const unsigned int index = t & _sqMask;
+        io_uring_sqe& sqe = _sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = (op->kind == Operation::Kind::Receive) ? IORING_OP_RECVMSG : IORING_OP_SENDMSG;
+        sqe.fd = op->fd;
+        sqe.addr = reinterpret_cast<std::uint64_t>(&op->message);
+        sqe.len = 1;
+        sqe.msg_flags = MSG_NOSIGNAL;
+        sqe.user_data = reinterpret_cast<std::uint64_t>(op);
+        _sqArray[index] = index;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+      }
+
+      /// Returns the count of submitted entries, or a negated `errno` value.
+      int submit(unsigned int count)
+      {
+        const int result = ioUringEnter(_fd, count, 0, 0);
+        return result < 0 ? -errno : result;
+      }
+
+      /// Procedure<void (Operation*, int)> F
+      template<typename F>
+      void reap(F f)
+      {
+        auto& head = atomicAt<unsigned int>(_cqRing, _params.cq_off.head);
+        auto& tail = atomicAt<unsigned int>(_cqRing, _params.cq_off.tail);
+        unsigned int h = head.load(std::memory_order_relaxed);
+        const unsigned int t = tail.load(std::memory_order_acquire);
+        for (; h != t; ++h)
+        {
+          const io_uring_cqe& cqe = _cqes[h & _cqMask];
+          f(reinterpret_cast<Operation*>(cqe.user_data), cqe.res);
+        }
+        head.store(h, std::memory_order_release);
+      }
+
+    private:
+      Ring(int fd, const io_uring_params& params)
+        : _fd(fd)
+        , _params(params)
+      {
+      }
+
+      bool map()
+      {
+        _sqRingSize = _params.sq_off.array + _params.sq_entries * sizeof(unsigned int);
+        _cqRingSize = _params.cq_off.cqes + _params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMap = (_params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap)
+          _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+
+        _sqRing = mapRegion(_sqRingSize, IORING_OFF_SQ_RING);
+        if (!_sqRing)
+          return false;
+        _cqRing = singleMap ? _sqRing : mapRegion(_cqRingSize, IORING_OFF_CQ_RING);
+        if (!_cqRing)
+          return false;
+        _sqes = static_cast<io_uring_sqe*>(
+            mapRegion(_params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+        if (!_sqes)
+          return false;
+
+        _sqMask = *reinterpret_cast<unsigned int*>(static_cast<char*>(_sqRing) + _params.sq_off.ring_mask);
+        _sqArray = reinterpret_cast<unsigned int*>(static_cast<char*>(_sqRing) + _params.sq_off.array);
+        _cqMask = *reinterpret_cast<unsigned int*>(static_cast<char*>(_cqRing) + _params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(_cqRing) + _params.cq_off.cqes);
+        return true;
+      }
+
+      void* mapRegion(std::size_t size, off_t offset)
+      {
+        void* address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               _fd, offset);
+        return address == MAP_FAILED ? nullptr : address;
+      }
+
+      int _fd;
+      io_uring_params _params;
+      void* _sqRing = nullptr;
+      void* _cqRing = nullptr;
+      std::size_t _sqRingSize = 0;
+      std::size_t _cqRingSize = 0;
+      io_uring_sqe* _sqes = nullptr;
+      unsigned int* _sqArray = nullptr;
+      unsigned int _sqMask = 0;
+      io_uring_cqe* _cqes = nullptr;
+      unsigned int _cqMask = 0;
+    };
+
+    /// The io_uring instance of an io_service.
+    ///
+    /// Operations are pushed in the submission queue as they come, and a
+    /// single system call submits all of those pushed before it is run by the
+    /// io_service. The ring signals completions on an eventfd that the
+    /// io_service waits on, so that completions are reaped in batches by the
+    /// io_service threads.
+    class Service : public boost::asio::io_service::service
+    {
+    public:
+      static boost::asio::io_service::id id;
+
+      explicit Service(boost::asio::io_service& io)
+        : boost::asio::io_service::service(io)
+        , _io(io)
+        , _eventDescriptor(io)
+      {
+        if (!enabledFromEnv())
+          return;
+        auto ring = Ring::create(ringEntries);
+        if (!ring)
+          return;
+        const int eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (eventFd < 0)
+          return;
+        if (ioUringRegister(ring->fd(), IORING_REGISTER_EVENTFD, &eventFd, 1) < 0)
+        {
+          ::close(eventFd);
+          return;
+        }
+        boost::system::error_code erc;
+        _eventDescriptor.assign(eventFd, erc);
+        if (erc)
+        {
+          ::close(eventFd);
+          return;
+        }
+        _ring = std::move(ring);
+        qiLogVerbose() << "Socket operations go through io_uring.";
+      }
+
+      ~Service()
+      {
+        destroyOperations();
+      }
+
+      bool enabled() const
+      {
+        return _ring != nullptr;
+      }
+
+      void submit(std::unique_ptr<Operation> op)
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_ring->push(op.get()))
+        {
+          // The submission queue is full of operations not yet submitted.
+          submitPending();
+          if (!_ring->push(op.get()))
+          {
+            qiLogError() << "Cannot submit a socket operation to io_uring.";
+            std::shared_ptr<Operation> failed(op.release());
+            _io.post([failed] { failed->complete(-EBUSY); });
+            return;
+          }
+        }
+        _inFlight.insert(op.release());
+        ++_pending;
+        // Waiting for completions only while there are operations in flight
+        // lets the io_service run out of work.
+        if (!_waiting)
+        {
+          _waiting = true;
+          waitCompletions();
+        }
+        if (!_flushPosted)
+        {
+          _flushPosted = true;
+          _io.post([this] { flush(); });
+        }
+      }
+
+    private:
+#if BOOST_VERSION >= 106600
+      void shutdown() override
+#else
+      void shutdown_service() override
+#endif
+      {
+        boost::system::error_code erc;
+        _eventDescriptor.close(erc);
+        destroyOperations();
+      }
+
+      void destroyOperations()
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // Closing the ring cancels the operations, so that the kernel does not
+        // use their buffers anymore.
+        _ring.reset();
+        for (auto op: _inFlight)
+          delete op;
+        _inFlight.clear();
+      }
+
+      // Precondition: `_mutex` is locked.
+      void submitPending()
+      {
+        if (_pending == 0 || !_ring)
+          return;
+        const int result = _ring->submit(_pending);
+        if (result < 0)
+        {
+          if (result != -EAGAIN && result != -EBUSY && result != -EINTR)
+            qiLogWarning() << "io_uring submission failed: " << std::strerror(-result);
+          return;
+        }
+        _pending -= static_cast<unsigned int>(result);
+      }
+
+      void flush()
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _flushPosted = false;
+        submitPending();
+        if (_pending != 0 && _ring)
+        {
+          // Try again once some completions have been reaped.
+          _flushPosted = true;
+          _io.post([this] { flush(); });
+        }
+      }
+
+      // Precondition: `_mutex` is locked.
+      void waitCompletions()
+      {
+        _eventDescriptor.async_read_some(boost::asio::null_buffers(),
+          [this](const boost::system::error_code& erc, std::size_t) {
+            if (erc)
+              return;
+            onCompletions();
+          });
+      }
+
+      void onCompletions()
+      {
+        std::uint64_t counter;
+        // The counter is only read to reset it: the completions are in the ring.
+        static_cast<void>(::read(_eventDescriptor.native_handle(), &counter, sizeof(counter)));
+
+        std::vector<std::pair<Operation*, int>> completions;
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          if (!_ring)
+            return;
+          _ring->reap([&](Operation* op, int result) {
+            _inFlight.erase(op);
+            completions.emplace_back(op, result);
+          });
+          // Other completions may be reaped by another thread while these ones
+          // are run.
+          if (_inFlight.empty())
+            _waiting = false;
+          else
+            waitCompletions();
+        }
+
+        for (auto& c: completions)
+        {
+          std::unique_ptr<Operation> op(c.first);
+          if (!op->complete(c.second))
+            continue;
+          // The socket may have been closed since the operation was submitted,
+          // and its descriptor reused by another connection.
+          if (!op->socketOpen())
+          {
+            op->complete(-ECANCELED);
+            continue;
+          }
+          submit(std::move(op));
+        }
+      }
+
+      boost::asio::io_service& _io;
+      boost::asio::posix::stream_descriptor _eventDescriptor;
+      std::mutex _mutex;
+      std::unique_ptr<Ring> _ring;
+      std::unordered_set<Operation*> _inFlight;
+      unsigned int _pending = 0;
+      bool _flushPosted = false;
+      bool _waiting = false;
+    };
+
+    boost::asio::io_service::id Service::id;
+  } // namespace
+
+  Operation::Operation(Kind kind, boost::asio::ip::tcp::socket& socket)
+    : kind(kind)
+    , socket(socket)
+    , fd(socket.native_handle())
+  {
+    std::memset(&message, 0, sizeof(message));
+  }
+
+  Operation::~Operation() = default;
+
+  bool Operation::socketOpen() const
+  {
+    return socket.is_open() && socket.native_handle() == fd;
+  }
+
+  std::size_t Operation::consume(std::size_t size)
+  {
+    std::size_t first = 0;
+    while (first < iov.size() && size >= iov[first].iov_len)
+    {
+      size -= iov[first].iov_len;
+      ++first;
+    }
+    iov.erase(iov.begin(), iov.begin() + first);
+    if (!iov.empty())
+    {
+      iov.front().iov_base = static_cast<char*>(iov.front().iov_base) + size;
+      iov.front().iov_len -= size;
+    }
+    message.msg_iov = iov.data();
+    message.msg_iovlen = iov.size();
+    std::size_t left = 0;
+    for (const auto& v: iov)
+      left += v.iov_len;
+    return left;
+  }
+
+  bool enabled(boost::asio::io_service& io)
+  {
+    return enabledFromEnv() && boost::asio::use_service<Service>(io).enabled();
+  }
+
+  void submit(boost::asio::io_service& io, std::unique_ptr<Operation> op)
+  {
+    boost::asio::use_service<Service>(io).submit(std::move(op));
+  }
+}}} // namespace qi::sock::uring
+
+#endif // QI_IO_URING
@@ -0,0 +1,64 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include "objectdispatchqueues.hpp"
+
+#include <boost/make_shared.hpp>
+#include <qi/log.hpp>
+
+qiLogCategory("qimessaging.objectdispatchqueues");
+
+namespace qi
+{
+  ObjectDispatchQueues::ObjectDispatchQueues(ExecutionContext& context)
+    : _context(context)
+    , _joined(false)
+  {
+  }
+
+  ObjectDispatchQueues::~ObjectDispatchQueues()
+  {
+    join();
+  }
+
+  void ObjectDispatchQueues::post(unsigned int service, boost::function<void()> handler)
+  {
+    StrandPtr queue;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      if (_joined)
+      {
+        qiLogDebug() << "Dropping a message for service " << service << ": the queues are joined.";
+        return;
+      }
+      auto& slot = _queues[service];
+      if (!slot)
+        slot = boost::make_shared<Strand>(_context);
+      queue = slot;
+    }
+    queue->post(std::move(handler));
+  }
+
+  void ObjectDispatchQueues::join()
+  {
+    boost::container::flat_map<unsigned int, StrandPtr> queues;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _joined = true;
+      queues.swap(_queues);
+    }
+    for (auto& queue: queues)
+    {
+      if (const auto error = queue.second->join(std::nothrow))
+        qiLogWarning() << "Error while joining the queue of service " << queue.first << ": " << *error;
+    }
+  }
+
+  std::size_t ObjectDispatchQueues::size() const
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    return _queues.size();
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_OBJECTDISPATCHQUEUES_HPP_
+#define _SRC_OBJECTDISPATCHQUEUES_HPP_
+
+#include <boost/container/flat_map.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <qi/api.hpp>
+#include <qi/eventloop.hpp>
+#include <qi/strand.hpp>
+
+namespace qi
+{
+  /// Queues of the messages that a server receives from a socket, one per
+  /// service they are sent to.
+  ///
+  /// The messages sent to a service are handled in the order they were
+  /// received, on a strand of the execution context. The messages sent to
+  /// different services are handled in parallel: they neither wait for each
+  /// other nor hold the network thread that received them.
+  ///
+  /// This class is thread-safe.
+  class QI_API ObjectDispatchQueues
+  {
+  public:
+    explicit ObjectDispatchQueues(ExecutionContext& context = *getEventLoop());
+    ~ObjectDispatchQueues();
+
+    ObjectDispatchQueues(const ObjectDispatchQueues&) = delete;
+    ObjectDispatchQueues& operator=(const ObjectDispatchQueues&) = delete;
+
+    /// Schedules the handler on the queue of the service.
+    /// Once the queues are joined, the handler is dropped.
+    void post(unsigned int service, boost::function<void()> handler);
+
+    /// Drops the handlers that are not running yet, and waits for the running
+    /// ones to finish, unless it is called from one of them.
+    void join();
+
+    /// Count of services that received messages.
+    std::size_t size() const;
+
+  private:
+    using StrandPtr = boost::shared_ptr<Strand>;
+
+    ExecutionContext& _context;
+    mutable boost::mutex _mutex;
+    bool _joined;
+    boost::container::flat_map<unsigned int, StrandPtr> _queues;
+  };
+}
+
+#endif // _SRC_OBJECTDISPATCHQUEUES_HPP_
@@ -0,0 +1,272 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_PENDINGCALLTABLE_HPP_
+#define _SRC_PENDINGCALLTABLE_HPP_
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <boost/optional.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace qi
+{
+  /// Concurrent table of the calls in progress, keyed by message id.
+  ///
+  /// The table is split in `shardCount` shards, chosen by the low bits of the
+  /// hash of the key, each one with its own lock. Inside a shard, entries are
+  /// kept in a flat array with open addressing (linear probing, and backward
+  /// shift on erasure, so there are no tombstones). Message ids are
+  /// consecutive and short-lived, so with the identity hash they spread evenly
+  /// over the shards and mostly land in their own slot, like in a slab: an
+  /// insertion, a lookup or an erasure touches one slot under a lock that is
+  /// held for a few instructions and that is shared with a sixteenth of the
+  /// calls only.
+  ///
+  /// The arrays grow when they are half full, and never shrink: the slots are
+  /// reused by the next calls. Values are moved out of the table before they
+  /// are destroyed, so that their destructor never runs under a lock.
+  template <typename Key, typename T, typename Hash = std::hash<Key>>
+  class PendingCallTable
+  {
+  public:
+    static const std::size_t shardBits = 4;
+    static const std::size_t shardCount = std::size_t{1} << shardBits;
+
+    PendingCallTable() = default;
+    PendingCallTable(const PendingCallTable&) = delete;
+    PendingCallTable& operator=(const PendingCallTable&) = delete;
+
+    /// Adds the value if the key is not in the table yet.
+    /// Returns false, without changing the table, otherwise.
+    bool insert(const Key& key, T value)
+    {
+      const auto hash = Hash()(key);
+      auto& shard = shardOf(hash);
+      boost::mutex::scoped_lock lock(shard.mutex);
+      if (shard.find(hash, key) != Shard::npos)
+        return false;
+      shard.insert(Entry{hash, key, std::move(value)});
+      return true;
+    }
+
+    /// Adds the value, replacing the one of the key if any.
+    void set(const Key& key, T value)
+    {
+      const auto hash = Hash()(key);
+      auto& shard = shardOf(hash);
+      boost::optional<T> previous;
+      boost::mutex::scoped_lock lock(shard.mutex);
+      const auto index = shard.find(hash, key);
+      if (index == Shard::npos)
+      {
+        shard.insert(Entry{hash, key, std::move(value)});
+        return;
+      }
+      previous = std::move(shard.slots[index]->value);
+      shard.slots[index]->value = std::move(value);
+      lock.unlock();
+    }
+
+    /// Returns a copy of the value of the key, if any.
+    boost::optional<T> find(const Key& key) const
+    {
+      const auto hash = Hash()(key);
+      const auto& shard = shardOf(hash);
+      boost::mutex::scoped_lock lock(shard.mutex);
+      const auto index = shard.find(hash, key);
+      if (index == Shard::npos)
+        return {};
+      return shard.slots[index]->value;
+    }
+
+    /// Removes the key from the table and returns its value, if any.
+    boost::optional<T> take(const Key& key)
+    {
+      const auto hash = Hash()(key);
+      auto& shard = shardOf(hash);
+      boost::mutex::scoped_lock lock(shard.mutex);
+      const auto index = shard.find(hash, key);
+      if (index == Shard::npos)
+        return {};
+      return shard.erase(index);
+    }
+
+    /// Removes the key from the table. Returns false if it was not in it.
+    bool erase(const Key& key)
+    {
+      return static_cast<bool>(take(key));
+    }
+
+    /// Removes the entries for which `pred(key, value)` is true, and returns
+    /// their count. It goes through the whole table.
+    template <typename Pred>
+    std::size_t eraseIf(Pred pred)
+    {
+      std::size_t count = 0;
+      for (auto& shard: _shards)
+      {
+        std::vector<boost::optional<T>> erased;
+        boost::mutex::scoped_lock lock(shard.mutex);
+        std::size_t index = 0;
+        while (index < shard.slots.size())
+        {
+          // Erasing shifts the next entries back, possibly to this slot.
+          auto& slot = shard.slots[index];
+          if (slot && pred(static_cast<const Key&>(slot->key), static_cast<const T&>(slot->value)))
+            erased.push_back(shard.erase(index));
+          else
+            ++index;
+        }
+        lock.unlock();
+        count += erased.size();
+      }
+      return count;
+    }
+
+    /// Removes all the entries from the table and returns them.
+    std::vector<std::pair<Key, T>> takeAll()
+    {
+      std::vector<std::pair<Key, T>> entries;
+      for (auto& shard: _shards)
+      {
+        std::vector<Slot> slots;
+        {
+          boost::mutex::scoped_lock lock(shard.mutex);
+          slots.swap(shard.slots);
+          shard.count = 0;
+        }
+        for (auto& slot: slots)
+        {
+          if (slot)
+            entries.emplace_back(std::move(slot->key), std::move(slot->value));
+        }
+      }
+      return entries;
+    }
+
+    std::size_t size() const
+    {
+      std::size_t count = 0;
+      for (const auto& shard: _shards)
+      {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        count += shard.count;
+      }
+      return count;
+    }
+
+    bool empty() const { return size() == 0; }
+
+  private:
+    struct Entry
+    {
+      std::size_t hash;
+      Key key;
+      T value;
+    };
+    using Slot = boost::optional<Entry>;
+
+    struct Shard
+    {
+      static const std::size_t npos = static_cast<std::size_t>(-1);
+      static const std::size_t initialCapacity = 16;
+
+      std::size_t home(std::size_t hash) const
+      {
+        return (hash >> shardBits) & (slots.size() - 1);
+      }
+
+      std::size_t find(std::size_t hash, const Key& key) const
+      {
+        if (slots.empty())
+          return npos;
+        const auto mask = slots.size() - 1;
+        for (auto index = home(hash); slots[index]; index = (index + 1) & mask)
+        {
+          if (slots[index]->hash == hash && slots[index]->key == key)
+            return index;
+        }
+        return npos;
+      }
+
+      // The key must not be in the shard.
+      void insert(Entry entry)
+      {
+        if ((count + 1) * 2 > slots.size())
+          grow();
+        place(std::move(entry));
+        ++count;
+      }
+
+      void place(Entry entry)
+      {
+        const auto mask = slots.size() - 1;
+        auto index = home(entry.hash);
+        while (slots[index])
+          index = (index + 1) & mask;
+        slots[index] = std::move(entry);
+      }
+
+      void grow()
+      {
+        std::vector<Slot> previous(slots.empty() ? std::size_t{initialCapacity} : slots.size() * 2);
+        previous.swap(slots);
+        for (auto& slot: previous)
+        {
+          if (slot)
+            place(std::move(*slot));
+        }
+      }
+
+      boost::optional<T> erase(std::size_t index)
+      {
+        boost::optional<T> value = std::move(slots[index]->value);
+        slots[index] = boost::none;
+        --count;
+
+        // Move back the next entries of the probe sequence that would not be
+        // found anymore with this slot empty.
+        const auto mask = slots.size() - 1;
+        auto hole = index;
+        for (auto next = (hole + 1) & mask; slots[next]; next = (next + 1) & mask)
+        {
+          const auto wanted = home(slots[next]->hash);
+          // The entry stays if its home is cyclically in (hole, next].
+          const bool stays = hole <= next ? (hole < wanted && wanted <= next)
+                                          : (hole < wanted || wanted <= next);
+          if (stays)
+            continue;
+          slots[hole] = std::move(slots[next]);
+          slots[next] = boost::none;
+          hole = next;
+        }
+        return value;
+      }
+
+      mutable boost::mutex mutex;
+      std::vector<Slot> slots;
+      std::size_t count = 0;
+    };
+
+    Shard& shardOf(std::size_t hash)
+    {
+      return _shards[hash & (shardCount - 1)];
+    }
+
+    const Shard& shardOf(std::size_t hash) const
+    {
+      return _shards[hash & (shardCount - 1)];
+    }
+
+    std::array<Shard, shardCount> _shards;
+  };
+}
+
+#endif // _SRC_PENDINGCALLTABLE_HPP_
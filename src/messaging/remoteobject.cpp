@@ -10,6 +10,8 @@
 #endif
 
 #include "remoteobject_p.hpp"
+#include <qi/messaging/calltimeout.hpp>
+#include "callbatch_p.hpp"
 #include "message.hpp"
 #include "messagesocket.hpp"
 #include <qi/log.hpp>
@@ -221,15 +223,14 @@ namespace qi {
 
     qi::Promise<AnyReference> promise;
     {
-      auto syncPromises = _promises.synchronize();
-      auto it = syncPromises->find(msg.id());
-      if (it != syncPromises->end()) {
-        promise = (*syncPromises)[msg.id()];
-        syncPromises->erase(it);
+      auto pending = _promises.take(msg.id());
+      if (pending) {
+        promise = std::move(*pending);
         qiLogDebug() << "[RemoteObject{"<< this << " | " << remoteObjectUid() << "}]"
           << "Handling promise id:" << msg.id() << " WHEN RECEIVED THIS MESSAGE : " << msg;
       } else  {
-        qiLogError() << "[RemoteObject{"<< this << " | " << remoteObjectUid() << "}]"
+        // For example the reply of a call that timed out.
+        qiLogVerbose() << "[RemoteObject{"<< this << " | " << remoteObjectUid() << "}]"
           << "no promise found for req id:" << msg;
         return;
       }
@@ -333,11 +334,9 @@ namespace qi {
         return makeFutureError<AnyReference>("Socket is not connected");
       }
 
-      auto syncPromises = _promises.synchronize();
       qiLogDebug() << "[RemoteObject{"<< this << " | " << remoteObjectUid() << "}]"
         << " : Adding promise for message :" << msg;
-      auto result = syncPromises->insert(std::make_pair(msg.id(), out));
-      if (!result.second)
+      if (!_promises.insert(msg.id(), out))
       {
         qiLogError() << "[RemoteObject{"<< this << " | " << remoteObjectUid() << "}]"
           << "There is already a pending promise with id " << msg.id();
@@ -366,12 +365,25 @@ namespace qi {
     msg.setObject(_object);
     msg.setFunction(method);
     msg.setRecipientUid(_self.uid());
+    msg.setCallTimeout(callTimeout(_serviceName, mm->name()));
 
     qiLogDebug() << "[RemoteObject{" << this << " | " << remoteObjectUid() << "}]"
       << " READY TO SEND CALL :" << msg;
 
     //error will come back as a error message
     const auto msgId = msg.id();
+    // In a CallBatch, the call is sent when the batch is flushed.
+    if (detail::callBatchActive() && sock->isConnected())
+    {
+      detail::batchCall(sock, msg, trackSilent([this, msgId, out](const std::string& error) {
+        if (!_promises.erase(msgId))
+          return;
+        auto promise = out;
+        promise.setError(error);
+      }, this));
+      out.setOnCancel(qi::bind(&RemoteObject::onFutureCancelled, this, msgId));
+      return out.future();
+    }
     if (!sock->isConnected() || !sock->send(std::move(msg))) {
       qi::MetaMethod*   meth = metaObject().method(method);
       std::stringstream ss;
@@ -392,7 +404,7 @@ namespace qi {
       out.setError(ss.str());
       qiLogDebug() << "[RemoteObject{"<< this << " | " << remoteObjectUid() << "}]"
         << "Removing promise id:" << msgId;
-      _promises->erase(msgId);
+      _promises.erase(msgId);
     }
     else
       out.setOnCancel(qi::bind(&RemoteObject::onFutureCancelled, this, msgId));
@@ -610,14 +622,8 @@ namespace qi {
         if (!fromSignal)
           socket->disconnected.disconnectAsync(_linkDisconnected);
     }
-    auto promises = [&] {
-      auto syncPromises = _promises.synchronize();
-      auto promises = std::move(*syncPromises);
-      syncPromises->clear();
-      return promises;
-    }();
     // Nobody should be able to add anything to promises at this point.
-    for (auto& pair: promises)
+    for (auto& pair: _promises.takeAll())
     {
       qiLogVerbose() << "Reporting error for request " << pair.first << "(" << reason << ")";
       pair.second.setError(reason);
@@ -14,6 +14,7 @@
 
 #include "messagedispatcher.hpp"
 #include "objecthost.hpp"
+#include "pendingcalltable.hpp"
 
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/synchronized_value.hpp>
@@ -53,6 +54,10 @@ namespace qi {
     // Set fromSignal if close is invoked from disconnect signal callback
     void close(const std::string& reason, bool fromSignal = false);
     unsigned int service() const { return _service; }
+    /// Name of the service, used to find the timeout of the calls to its
+    /// methods (see `qi::setMethodCallTimeout`). It must be set before the
+    /// first call.
+    void setServiceName(const std::string& name) { _serviceName = name; }
     unsigned int object() const { return _object; }
 
     AnyObject owner() const { return _owner.lock(); }
@@ -85,8 +90,9 @@ namespace qi {
 
     boost::synchronized_value<MessageSocketPtr>     _socket;
     unsigned int                                    _service;
+    std::string                                     _serviceName;
     unsigned int                                    _object;
-    boost::synchronized_value<std::map<int, qi::Promise<AnyReference>>> _promises;
+    PendingCallTable<unsigned int, qi::Promise<AnyReference>> _promises;
     qi::SignalLink                                  _linkMessageDispatcher;
     qi::SignalLink                                  _linkDisconnected;
     qi::AnyObject                                   _self;
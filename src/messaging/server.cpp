@@ -9,6 +9,7 @@
 #include "objectregistrar.hpp"
 #include <qi/os.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/make_shared.hpp>
 #include <exception>
 #include "servicedirectoryclient.hpp"
 #include "authprovider_p.hpp"
@@ -17,8 +18,18 @@ qiLogCategory("qimessaging.server");
 
 namespace qi {
 
+  namespace
+  {
+    bool parallelDispatchEnabled()
+    {
+      static const bool enabled = os::getenv("QI_SERVER_PARALLEL_DISPATCH") == "1";
+      return enabled;
+    }
+  }
+
   Server::Server(bool enforceAuth)
-    : _enforceAuth(enforceAuth)
+    : _boundObjectsIndex(boost::make_shared<const BoundAnyObjectMap>())
+    , _enforceAuth(enforceAuth)
     , _dying(false)
     , _defaultCallType(qi::MetaCallType_Queued)
   {
@@ -142,9 +153,15 @@ namespace qi {
   {
     QI_ASSERT_TRUE(obj);
     _boundObjects[id] = obj;
+    publishBoundObjects();
     registerServiceForAllSocketsMessageReception(*obj);
   }
 
+  void Server::publishBoundObjects()
+  {
+    boost::atomic_store(&_boundObjectsIndex, boost::make_shared<const BoundAnyObjectMap>(_boundObjects));
+  }
+
   bool Server::removeObject(unsigned int idx)
   {
     BoundAnyObject removedObject;
@@ -157,6 +174,7 @@ namespace qi {
       }
       removedObject = it->second;
       _boundObjects.erase(idx);
+      publishBoundObjects();
       unregisterServiceForAllSocketsMessageReception(*removedObject);
     }
     removedObject.reset();
@@ -180,7 +198,14 @@ namespace qi {
     }
   } // server_private
 
-  void Server::connectMessageReady(const MessageSocketPtr& socket)
+  boost::shared_ptr<ObjectDispatchQueues> Server::makeDispatchQueues() const
+  {
+    if (!parallelDispatchEnabled())
+      return {};
+    return boost::make_shared<ObjectDispatchQueues>();
+  }
+
+  boost::shared_ptr<ObjectDispatchQueues> Server::connectMessageReady(const MessageSocketPtr& socket)
   {
     boost::recursive_mutex::scoped_lock sl(_socketsMutex);
     auto& subscriber = _subscribers[socket];
@@ -189,12 +214,15 @@ namespace qi {
            "Connecting a signal that already exists.");
 
     registerAllServicesForMessageReception(socket);
+    socket->setAuthenticated();
 
+    const auto queues = subscriber.queues = makeDispatchQueues();
     subscriber.messageReady = socket->messageReady.connect(
         track([=](const Message& msg) {
           if(!detail::canBeDirectlyDispatched(msg, *socket)) // Skip dispatching if it will be handled by the direct dispatching system.
-            onMessageReady(msg, socket);
+            onMessageReady(msg, socket, queues);
         }, this));
+    return queues;
   }
 
   void Server::onTransportServerNewConnection(MessageSocketPtr socket, bool startReading)
@@ -240,8 +268,10 @@ namespace qi {
     {
       QI_ASSERT(subscriber.messageReady == qi::SignalBase::invalidSignalLink &&
              "Connecting a signal that already exists.");
+      socket->setAuthenticated();
+      const auto queues = subscriber.queues = makeDispatchQueues();
       subscriber.messageReady = socket->messageReady.connect(
-          track([=](const Message& msg) { onMessageReady(msg, socket); }, this));
+          track([=](const Message& msg) { onMessageReady(msg, socket, queues); }, this));
     }
   }
 
@@ -385,19 +415,18 @@ namespace qi {
     socket->messageReady.disconnect(*signalLink);
     server_private::sendCapabilities(socket);
 
-    connectMessageReady(socket);
-    onMessageReady(msg, socket);
+    const auto queues = connectMessageReady(socket);
+    onMessageReady(msg, socket, queues);
   }
 
 
-  void Server::onMessageReady(const qi::Message &msg, MessageSocketPtr socket) {
+  void Server::onMessageReady(const qi::Message &msg, MessageSocketPtr socket,
+                              const boost::shared_ptr<ObjectDispatchQueues>& queues) {
     qi::BoundAnyObject obj;
     {
-      boost::mutex::scoped_lock sl(_boundObjectsMutex);
-      BoundAnyObjectMap::iterator it;
-
-      it = _boundObjects.find(msg.service());
-      if (it == _boundObjects.end())
+      const auto boundObjects = boost::atomic_load(&_boundObjectsIndex);
+      const auto it = boundObjects->find(msg.service());
+      if (it == boundObjects->end())
       {
         // The message could be addressed to a bound object, inside a
         // remoteobject host, or to a remoteobject, using the same socket.
@@ -419,13 +448,20 @@ namespace qi {
       }
       obj = it->second;
     }
-    // We were called from the thread pool: synchronous call is ok
-    //qi::getEventLoop()->post(boost::bind<void>(&BoundObject::onMessage, obj, msg, socket));
+    if (queues)
+    {
+      // Free the network thread, and let the other services of this socket
+      // proceed while this one handles the message.
+      queues->post(msg.service(), [obj, msg, socket] { obj->onMessage(msg, socket); });
+      return;
+    }
     obj->onMessage(msg, socket);
   } // TODO: heap-use-after-free: memory freed here, in ~shared_ptr, probably the local BoundAnyObject obj;
 
   void Server::disconnectSignals(const MessageSocketPtr& socket, const SocketSubscriber& subscriber)
   {
+    if (subscriber.queues)
+      subscriber.queues->join();
     socket->connected.disconnectAllAsync();
     socket->disconnected.disconnectAsync(subscriber.disconnected);
     socket->messageReady.disconnectAsync(subscriber.messageReady);
@@ -479,11 +515,38 @@ namespace qi {
       {
         return;
       }
+    }
 
-      BoundAnyObjectMap::iterator it;
+    // Take the socket out, to disconnect it outside the locks: the handlers
+    // of its dispatch queues that are still running may call the server.
+    auto socketLocal = [&]()
+    {
+      boost::recursive_mutex::scoped_lock sl(_socketsMutex);
+      auto it = _subscribers.find(socket);
+      if (it == _subscribers.end())
+        return std::pair<MessageSocketPtr, SocketSubscriber>{};
+      auto local = std::move(*it);
+      _subscribers.erase(it);
+      return local;
+    }();
+    if (!socketLocal.first)
+    {
+      // The server was closed meanwhile, which disconnected the socket.
+      return;
+    }
+
+    // The messages still queued are dropped: the bound objects must not
+    // handle any message from this socket once they have been told it is
+    // disconnected.
+    if (socketLocal.second.queues)
+      socketLocal.second.queues->join();
+
+    {
+      boost::mutex::scoped_lock l(_stateMutex);
+      if (!_dying)
       {
         boost::mutex::scoped_lock sl(_boundObjectsMutex);
-        for (it = _boundObjects.begin(); it != _boundObjects.end(); ++it) {
+        for (auto it = _boundObjects.begin(); it != _boundObjects.end(); ++it) {
           BoundAnyObject o = it->second;
           try
           {
@@ -495,23 +558,9 @@ namespace qi {
           }
         }
       }
-
-      {
-        // Lock the mutex, erase the socket, and disconnect it outside the lock.
-        auto socketLocal = [&]()
-        {
-          boost::recursive_mutex::scoped_lock sl(_socketsMutex);
-          auto it = _subscribers.find(socket);
-          QI_ASSERT(it != _subscribers.end());
-          auto local = std::move(*it);
-          _subscribers.erase(it);
-          return local;
-        }();
-
-        if (socketLocal.first)
-          disconnectSignals(socketLocal.first, socketLocal.second);
-      }
     }
+
+    disconnectSignals(socketLocal.first, socketLocal.second);
   }
 
   qi::UrlVector Server::endpoints() const {
@@ -12,6 +12,7 @@
 #include <boost/container/flat_map.hpp>
 #include "boundobject.hpp"
 #include "authprovider_p.hpp"
+#include "objectdispatchqueues.hpp"
 
 namespace qi {
 
@@ -20,6 +21,11 @@ namespace qi {
    *
    * Support a special kind of objects: (SocketObject, that are aware of Socket)
    *
+   * The messages a socket receives are handled on the network thread that
+   * received them, unless QI_SERVER_PARALLEL_DISPATCH is set to 1, in which
+   * case they are handed to their bound object on a queue per service (see
+   * ObjectDispatchQueues).
+   *
    * Thread-safety warning: do not call listen and addSocketObject at the same time.
    *
    */
@@ -52,7 +58,8 @@ namespace qi {
 
     //TransportSocket
     void onSocketDisconnected(MessageSocketPtr socket, std::string error);
-    void onMessageReady(const qi::Message &msg, MessageSocketPtr socket);
+    void onMessageReady(const qi::Message &msg, MessageSocketPtr socket,
+                        const boost::shared_ptr<ObjectDispatchQueues>& queues = {});
     void onMessageReadyNotAuthenticated(const qi::Message& msg, MessageSocketPtr socket, AuthProviderPtr authProvider,
                                         boost::shared_ptr<bool> first, boost::shared_ptr<SignalLink> signalLink);
     void handleNotAuthMsgAuthEnabled(const qi::Message& msg, MessageSocketPtr socket, AuthProviderPtr authProvider,
@@ -72,9 +79,14 @@ namespace qi {
     //bool: true if it's a socketobject
     using BoundAnyObjectMap = boost::container::flat_map<unsigned int, BoundAnyObject>;
 
+    using BoundAnyObjectMapPtr = boost::shared_ptr<const BoundAnyObjectMap>;
+
     //ObjectList
     BoundAnyObjectMap                   _boundObjects;
     boost::mutex                        _boundObjectsMutex;
+    // Snapshot of _boundObjects, loaded and replaced atomically, so that
+    // incoming messages find their service without locking.
+    BoundAnyObjectMapPtr                _boundObjectsIndex;
 
     boost::mutex                        _stateMutex;
     AuthProviderFactoryPtr              _authProviderFactory;
@@ -89,12 +101,15 @@ namespace qi {
     {
       qi::SignalLink disconnected = qi::SignalBase::invalidSignalLink;
       qi::SignalLink messageReady = qi::SignalBase::invalidSignalLink;
+      boost::shared_ptr<ObjectDispatchQueues> queues;
     };
     boost::container::flat_map<MessageSocketPtr, SocketSubscriber> _subscribers;
 
     boost::recursive_mutex              _socketsMutex;
 
-    void connectMessageReady(const MessageSocketPtr& socket);
+    boost::shared_ptr<ObjectDispatchQueues> connectMessageReady(const MessageSocketPtr& socket);
+    boost::shared_ptr<ObjectDispatchQueues> makeDispatchQueues() const;
+    void publishBoundObjects();
     void disconnectSignals(const MessageSocketPtr& socket, const SocketSubscriber& subscriber);
 
     void registerAllServicesForMessageReception(const MessageSocketPtr&);
@@ -270,7 +270,10 @@ namespace qi {
     if (authData[AuthProvider::State_Key].to<unsigned int>() == AuthProvider::State_Done)
     {
       if (socket)
+      {
+        socket->setAuthenticated();
         socket->socketEvent.disconnect(_stateData.sdSocketSocketEventSignalLink);
+      }
       qi::Future<void> future = _remoteObject->fetchMetaObject();
       future.connect(track(
         boost::bind(&ServiceDirectoryClient::onMetaObjectFetched, this, socket, _1, prom), this));
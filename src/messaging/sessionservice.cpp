@@ -221,6 +221,7 @@ namespace qi {
         session_service_private::sendCapabilities(socket);
         qi::Future<void> metaObjFut;
         sr->remoteObject = new qi::RemoteObject(sr->serviceId, socket);
+        sr->remoteObject->setServiceName(sr->name);
 
         // TODO 40203: check if it's possible that the following future is never set.
         metaObjFut = sr->remoteObject->fetchMetaObject();
@@ -253,10 +254,12 @@ namespace qi {
     }
     if (authData[AuthProvider::State_Key].to<unsigned int>() == AuthProvider::State_Done)
     {
+      socket->setAuthenticated();
       qi::Future<void> metaObjFut;
       if (old)
         socket->socketEvent.disconnectAsync(*old);
       sr->remoteObject = new qi::RemoteObject(sr->serviceId, socket);
+      sr->remoteObject->setServiceName(sr->name);
       //ask the remoteObject to fetch the metaObject
       metaObjFut = sr->remoteObject->fetchMetaObject();
       qiLogVerbose() << "Fetching metaobject (2) for requestId = " << requestId;
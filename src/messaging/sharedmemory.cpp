@@ -0,0 +1,966 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include "sharedmemory.hpp"
+
+#include <qi/log.hpp>
+#include <qi/macro.hpp>
+#include <qi/os.hpp>
+
+#if QI_SHARED_MEMORY_TRANSPORT
+# include <algorithm>
+# include <climits>
+# include <cstring>
+# include <iterator>
+# include <random>
+# include <sstream>
+# include <stdexcept>
+# include <fcntl.h>
+# include <linux/futex.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# include <boost/lexical_cast.hpp>
+# include <qi/messaging/sock/networkasio.hpp>
+# include <qi/messaging/sock/send.hpp>
+#endif
+
+qiLogCategory("qimessaging.sharedmemory");
+
+namespace qi
+{
+  namespace shm
+  {
+#if QI_SHARED_MEMORY_TRANSPORT
+    namespace
+    {
+      const std::uint32_t segmentMagic = 0x71697368; // "qish"
+      const std::uint32_t segmentVersion = 1;
+      const std::size_t defaultRingCapacity = 4 * 1024 * 1024;
+      const std::size_t minRingCapacity = 64 * 1024;
+      const std::chrono::milliseconds pollPeriod{100};
+      const char segmentPrefix[] = "/qi-shm-";
+
+      // Number of checks before sleeping when waiting on a ring. Messages are
+      // often sent in bursts, so that the next one is likely to arrive while
+      // spinning.
+      const int spinCount = 4000;
+
+      struct SegmentHeader
+      {
+        std::atomic<std::uint32_t> magic;
+        std::uint32_t version;
+        std::uint64_t ringCapacity;
+      };
+
+      const std::size_t controlOffset = 64;
+      static_assert(sizeof(SegmentHeader) <= controlOffset, "SegmentHeader is too large");
+
+      std::size_t dataOffset()
+      {
+        return controlOffset + 2 * sizeof(RingControl);
+      }
+
+      std::size_t segmentSize(std::size_t ringCapacity)
+      {
+        return dataOffset() + 2 * ringCapacity;
+      }
+
+      bool isPowerOfTwo(std::size_t n)
+      {
+        return n != 0 && (n & (n - 1)) == 0;
+      }
+
+      // The futex words are shared between processes: the private flag must
+      // not be used.
+      void futexWait(std::atomic<std::uint32_t>& word, std::uint32_t expected,
+                     std::chrono::milliseconds timeout)
+      {
+        const auto ms = timeout.count();
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(ms / 1000);
+        ts.tv_nsec = static_cast<long>((ms % 1000) * 1000000);
+        ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT,
+                  expected, &ts, nullptr, 0);
+      }
+
+      void futexWakeAll(std::atomic<std::uint32_t>& word)
+      {
+        ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE,
+                  INT_MAX, nullptr, nullptr, 0);
+      }
+
+      inline void cpuRelax()
+      {
+#if defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+      }
+
+      std::string uniqueSegmentName()
+      {
+        static std::atomic<unsigned int> counter{0};
+        std::random_device random;
+        std::ostringstream ss;
+        ss << segmentPrefix << qi::os::getpid() << '-' << counter++ << '-' << std::hex << random();
+        return ss.str();
+      }
+
+      // Segment names are given by the remote end: only the ones `create`
+      // could have generated are accepted.
+      bool isSegmentName(const std::string& name)
+      {
+        const std::string prefix = segmentPrefix;
+        return name.size() > prefix.size()
+            && name.compare(0, prefix.size(), prefix) == 0
+            && name.find('/', prefix.size()) == std::string::npos;
+      }
+
+      void closeControl(RingControl& control)
+      {
+        control.closed.store(1, std::memory_order_seq_cst);
+        control.dataSeq.fetch_add(1, std::memory_order_seq_cst);
+        control.spaceSeq.fetch_add(1, std::memory_order_seq_cst);
+        futexWakeAll(control.dataSeq);
+        futexWakeAll(control.spaceSeq);
+      }
+
+      std::runtime_error systemError(const std::string& what, const std::string& name)
+      {
+        return std::runtime_error(what + " '" + name + "': " + std::strerror(errno));
+      }
+    }
+
+#endif // QI_SHARED_MEMORY_TRANSPORT
+
+    bool enabledFromEnv()
+    {
+#if QI_SHARED_MEMORY_TRANSPORT
+      static const bool enabled = qi::os::getenv("QI_SHARED_MEMORY_TRANSPORT") == "1";
+      return enabled;
+#else
+      return false;
+#endif
+    }
+
+#if QI_SHARED_MEMORY_TRANSPORT
+    std::size_t ringCapacityFromEnv()
+    {
+      std::size_t capacity = defaultRingCapacity;
+      const std::string env = qi::os::getenv("QI_SHARED_MEMORY_RING_SIZE");
+      if (!env.empty())
+      {
+        try
+        {
+          capacity = boost::lexical_cast<std::size_t>(env);
+        }
+        catch (const boost::bad_lexical_cast&)
+        {
+          qiLogWarning() << "Invalid QI_SHARED_MEMORY_RING_SIZE value: " << env;
+        }
+      }
+      std::size_t rounded = minRingCapacity;
+      while (rounded < capacity)
+        rounded <<= 1;
+      return rounded;
+    }
+
+    Ring::Ring(RingControl* control, char* data, std::size_t capacity)
+      : _control(control)
+      , _data(data)
+      , _capacity(capacity)
+      , _corrupted(false)
+    {
+      QI_ASSERT_TRUE(isPowerOfTwo(capacity));
+    }
+
+    boost::optional<std::size_t> Ring::used(std::uint64_t head, std::uint64_t tail) const
+    {
+      const auto count = head - tail;
+      if (count <= _capacity)
+        return static_cast<std::size_t>(count);
+      if (!_corrupted.exchange(true))
+      {
+        qiLogWarning() << "Inconsistent shared memory ring positions (head " << head
+                       << ", tail " << tail << "), closing it.";
+        closeControl(*_control);
+      }
+      return {};
+    }
+
+    std::size_t Ring::readable() const
+    {
+      const auto count = used(_control->head.load(std::memory_order_acquire),
+                              _control->tail.load(std::memory_order_relaxed));
+      return count ? *count : 0;
+    }
+
+    std::size_t Ring::writable() const
+    {
+      const auto count = used(_control->head.load(std::memory_order_relaxed),
+                              _control->tail.load(std::memory_order_acquire));
+      return count ? _capacity - *count : 0;
+    }
+
+    std::size_t Ring::write(const void* data, std::size_t size)
+    {
+      const auto head = _control->head.load(std::memory_order_relaxed);
+      const auto tail = _control->tail.load(std::memory_order_acquire);
+      const auto usedCount = used(head, tail);
+      if (!usedCount)
+        return 0;
+      const std::size_t count = std::min(size, _capacity - *usedCount);
+      if (count == 0)
+        return 0;
+      const std::size_t offset = static_cast<std::size_t>(head) & (_capacity - 1);
+      const std::size_t first = std::min(count, _capacity - offset);
+      std::memcpy(_data + offset, data, first);
+      std::memcpy(_data, static_cast<const char*>(data) + first, count - first);
+      // The store of the head must be ordered before the load of the waiting
+      // flag, hence the sequential consistency (see `waitReadable`).
+      _control->head.store(head + count, std::memory_order_seq_cst);
+      _control->dataSeq.fetch_add(1, std::memory_order_seq_cst);
+      if (_control->readerWaiting.load(std::memory_order_seq_cst))
+        futexWakeAll(_control->dataSeq);
+      return count;
+    }
+
+    std::size_t Ring::read(void* data, std::size_t size)
+    {
+      const auto tail = _control->tail.load(std::memory_order_relaxed);
+      const auto head = _control->head.load(std::memory_order_acquire);
+      const auto usedCount = used(head, tail);
+      if (!usedCount)
+        return 0;
+      const std::size_t count = std::min(size, *usedCount);
+      if (count == 0)
+        return 0;
+      const std::size_t offset = static_cast<std::size_t>(tail) & (_capacity - 1);
+      const std::size_t first = std::min(count, _capacity - offset);
+      std::memcpy(data, _data + offset, first);
+      std::memcpy(static_cast<char*>(data) + first, _data, count - first);
+      _control->tail.store(tail + count, std::memory_order_seq_cst);
+      _control->spaceSeq.fetch_add(1, std::memory_order_seq_cst);
+      if (_control->writerWaiting.load(std::memory_order_seq_cst))
+        futexWakeAll(_control->spaceSeq);
+      return count;
+    }
+
+    bool Ring::waitReadable(std::chrono::milliseconds timeout)
+    {
+      for (int i = 0; i < spinCount; ++i)
+      {
+        if (readable() > 0)
+          return true;
+        if (isClosed())
+          return false;
+        cpuRelax();
+      }
+      // Announce that we are going to sleep, then check again: either the
+      // writer sees the flag and wakes us up, or we see its data.
+      _control->readerWaiting.store(1, std::memory_order_seq_cst);
+      const auto seq = _control->dataSeq.load(std::memory_order_seq_cst);
+      if (readable() == 0 && !isClosed())
+        futexWait(_control->dataSeq, seq, timeout);
+      _control->readerWaiting.store(0, std::memory_order_relaxed);
+      return readable() > 0;
+    }
+
+    bool Ring::waitWritable(std::size_t size, std::chrono::milliseconds timeout)
+    {
+      size = std::min(size, _capacity);
+      for (int i = 0; i < spinCount; ++i)
+      {
+        if (writable() >= size)
+          return true;
+        if (isClosed())
+          return false;
+        cpuRelax();
+      }
+      _control->writerWaiting.store(1, std::memory_order_seq_cst);
+      const auto seq = _control->spaceSeq.load(std::memory_order_seq_cst);
+      if (writable() < size && !isClosed())
+        futexWait(_control->spaceSeq, seq, timeout);
+      _control->writerWaiting.store(0, std::memory_order_relaxed);
+      return writable() >= size;
+    }
+
+    void Ring::close()
+    {
+      closeControl(*_control);
+    }
+
+    bool Ring::isClosed() const
+    {
+      return _control->closed.load(std::memory_order_acquire) != 0;
+    }
+
+    Segment::Segment(std::string name, void* address, std::size_t size, bool owner)
+      : _name(std::move(name))
+      , _address(address)
+      , _size(size)
+      , _linked(owner)
+    {
+      auto base = static_cast<char*>(_address);
+      const auto header = reinterpret_cast<SegmentHeader*>(base);
+      const auto controls = reinterpret_cast<RingControl*>(base + controlOffset);
+      const auto capacity = static_cast<std::size_t>(header->ringCapacity);
+      const auto data = base + dataOffset();
+      _clientToServer.reset(new Ring(&controls[0], data, capacity));
+      _serverToClient.reset(new Ring(&controls[1], data + capacity, capacity));
+    }
+
+    std::unique_ptr<Segment> Segment::create(std::size_t ringCapacity)
+    {
+      if (!isPowerOfTwo(ringCapacity))
+        throw std::runtime_error("ring capacity must be a power of two");
+      const std::string name = uniqueSegmentName();
+      const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+      if (fd < 0)
+        throw systemError("cannot create shared memory segment", name);
+      const std::size_t size = segmentSize(ringCapacity);
+      void* address = MAP_FAILED;
+      if (::ftruncate(fd, static_cast<off_t>(size)) == 0)
+        address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (address == MAP_FAILED)
+      {
+        const auto error = systemError("cannot map shared memory segment", name);
+        ::close(fd);
+        ::shm_unlink(name.c_str());
+        throw error;
+      }
+      ::close(fd);
+
+      // The memory is zeroed by `ftruncate`, we still construct the objects
+      // it holds.
+      auto base = static_cast<char*>(address);
+      auto header = new (base) SegmentHeader();
+      header->version = segmentVersion;
+      header->ringCapacity = ringCapacity;
+      new (base + controlOffset) RingControl();
+      new (base + controlOffset + sizeof(RingControl)) RingControl();
+      header->magic.store(segmentMagic, std::memory_order_release);
+      return std::unique_ptr<Segment>(new Segment(name, address, size, true));
+    }
+
+    std::unique_ptr<Segment> Segment::open(const std::string& name)
+    {
+      if (!isSegmentName(name))
+        throw std::runtime_error("'" + name + "' is not a shared memory segment name");
+      const int fd = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0600);
+      if (fd < 0)
+        throw systemError("cannot open shared memory segment", name);
+      struct stat st;
+      if (::fstat(fd, &st) != 0)
+      {
+        const auto error = systemError("cannot stat shared memory segment", name);
+        ::close(fd);
+        throw error;
+      }
+      // Another user could otherwise make the process read its messages or
+      // write in the segment of the connection.
+      if (st.st_uid != ::geteuid() || (st.st_mode & (S_IRWXG | S_IRWXO)) != 0)
+      {
+        ::close(fd);
+        throw std::runtime_error("shared memory segment '" + name + "' is not owned by the user");
+      }
+      const auto size = static_cast<std::size_t>(st.st_size);
+      if (size < dataOffset())
+      {
+        ::close(fd);
+        throw std::runtime_error("shared memory segment '" + name + "' is too small");
+      }
+      void* address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (address == MAP_FAILED)
+      {
+        const auto error = systemError("cannot map shared memory segment", name);
+        ::close(fd);
+        throw error;
+      }
+      ::close(fd);
+
+      const auto header = static_cast<SegmentHeader*>(address);
+      const auto capacity = static_cast<std::size_t>(header->ringCapacity);
+      if (header->magic.load(std::memory_order_acquire) != segmentMagic
+          || header->version != segmentVersion
+          || !isPowerOfTwo(capacity)
+          || segmentSize(capacity) != size)
+      {
+        ::munmap(address, size);
+        throw std::runtime_error("shared memory segment '" + name + "' is invalid");
+      }
+      return std::unique_ptr<Segment>(new Segment(name, address, size, false));
+    }
+
+    Segment::~Segment()
+    {
+      unlink();
+      ::munmap(_address, _size);
+    }
+
+    void Segment::unlink()
+    {
+      if (_linked)
+      {
+        ::shm_unlink(_name.c_str());
+        _linked = false;
+      }
+    }
+
+    Ring& Segment::outgoing(Side side)
+    {
+      return side == Side::Client ? *_clientToServer : *_serverToClient;
+    }
+
+    Ring& Segment::incoming(Side side)
+    {
+      return side == Side::Client ? *_serverToClient : *_clientToServer;
+    }
+
+    Channel::Channel(std::unique_ptr<Segment> segment, Side side,
+                     sock::SendQueueLimits limits, SentHandler onSent)
+      : _segment(std::move(segment))
+      , _out(_segment->outgoing(side))
+      , _in(_segment->incoming(side))
+      , _closed(false)
+      , _writing(false)
+      , _queueLimits(limits)
+      , _onSent(std::move(onSent))
+    {
+    }
+
+    Channel::~Channel()
+    {
+      close();
+    }
+
+    bool Channel::send(const Message& msg)
+    {
+      boost::mutex::scoped_lock lock(_sendMutex);
+      if (_closed || _out.isClosed())
+        return false;
+      const auto size = sock::wireSize(msg);
+      // Writing directly is only possible if it does not overtake queued
+      // messages and cannot block.
+      if (_sendQueue.empty() && _out.writable() >= size)
+      {
+        if (!writeAll(msg))
+          return false;
+        if (_onSent)
+          _onSent(msg);
+        return true;
+      }
+      if (!admit(msg, size))
+        return false;
+      // Same ordering as the send queue of a socket, the message being written
+      // staying at the front.
+      const auto first = _writing ? std::next(_sendQueue.begin()) : _sendQueue.begin();
+      const auto priority = msg.priority();
+      auto pos = _sendQueue.end();
+      while (pos != first && std::prev(pos)->priority() < priority && msg.canOvertake(*std::prev(pos)))
+        --pos;
+      _sendQueue.insert(pos, msg);
+      if (!_writer.joinable())
+      {
+        auto self = shared_from_this();
+        _writer = boost::thread([self]{ self->writeLoop(); });
+      }
+      _sendCondition.notify_one();
+      return true;
+    }
+
+    bool Channel::fits(std::size_t size) const
+    {
+      if (_queueStats.messages == 0)
+        return true;
+      return (_queueLimits.maxBytes == 0 || _queueStats.bytes + size <= _queueLimits.maxBytes)
+          && (_queueLimits.maxMessages == 0 || _queueStats.messages < _queueLimits.maxMessages);
+    }
+
+    bool Channel::isReady() const
+    {
+      return (_queueLimits.maxBytes == 0 || _queueStats.bytes < _queueLimits.maxBytes)
+          && (_queueLimits.maxMessages == 0 || _queueStats.messages < _queueLimits.maxMessages);
+    }
+
+    bool Channel::admit(const Message& msg, std::size_t size)
+    {
+      if (!fits(size))
+      {
+        switch (_queueLimits.policy)
+        {
+          case sock::SendQueuePolicy::Reject:
+            qiLogVerbose() << "Shared memory send queue full, rejecting message " << msg.address();
+            ++_queueStats.rejected;
+            return false;
+          case sock::SendQueuePolicy::DropOldestEvent:
+            while (!fits(size) && dropOldestEvent())
+            {
+            }
+            if (!fits(size) && sock::isDroppable(msg))
+            {
+              qiLogVerbose() << "Shared memory send queue full, dropping event " << msg.address();
+              ++_queueStats.dropped;
+              return false;
+            }
+            break;
+          case sock::SendQueuePolicy::Wait:
+            break;
+        }
+      }
+      ++_queueStats.messages;
+      _queueStats.bytes += size;
+      _queueStats.peakMessages = std::max(_queueStats.peakMessages, _queueStats.messages);
+      _queueStats.peakBytes = std::max(_queueStats.peakBytes, _queueStats.bytes);
+      return true;
+    }
+
+    bool Channel::dropOldestEvent()
+    {
+      const auto first = _writing ? std::next(_sendQueue.begin()) : _sendQueue.begin();
+      const auto it = std::find_if(first, _sendQueue.end(),
+        [](const Message& msg) { return sock::isDroppable(msg); });
+      if (it == _sendQueue.end())
+        return false;
+      qiLogVerbose() << "Shared memory send queue full, dropping event " << it->address();
+      --_queueStats.messages;
+      _queueStats.bytes -= sock::wireSize(*it);
+      _sendQueue.erase(it);
+      ++_queueStats.dropped;
+      return true;
+    }
+
+    void Channel::popFront()
+    {
+      --_queueStats.messages;
+      _queueStats.bytes -= sock::wireSize(_sendQueue.front());
+      _sendQueue.pop_front();
+    }
+
+    std::vector<Promise<void>> Channel::takeReadyPromises()
+    {
+      std::vector<Promise<void>> promises;
+      if (!_readyPromises.empty() && (_closed || isReady()))
+        std::swap(promises, _readyPromises);
+      return promises;
+    }
+
+    void Channel::setQueueLimits(sock::SendQueueLimits limits)
+    {
+      std::vector<Promise<void>> readyPromises;
+      {
+        boost::mutex::scoped_lock lock(_sendMutex);
+        _queueLimits = limits;
+        readyPromises = takeReadyPromises();
+      }
+      for (auto& promise: readyPromises)
+        promise.setValue(nullptr);
+    }
+
+    sock::SendQueueStats Channel::queueStats() const
+    {
+      boost::mutex::scoped_lock lock(_sendMutex);
+      return _queueStats;
+    }
+
+    Future<void> Channel::ready()
+    {
+      boost::mutex::scoped_lock lock(_sendMutex);
+      if (_closed || isReady())
+        return futurize();
+      _readyPromises.emplace_back();
+      return _readyPromises.back().future();
+    }
+
+    bool Channel::writeAll(const Message& msg)
+    {
+      for (const auto& buffer: sock::makeBuffers<sock::NetworkAsio>(msg))
+      {
+        auto data = boost::asio::buffer_cast<const char*>(buffer);
+        auto size = boost::asio::buffer_size(buffer);
+        while (size > 0)
+        {
+          const auto written = _out.write(data, size);
+          data += written;
+          size -= written;
+          if (size > 0 && !_out.waitWritable(size, pollPeriod) && (_closed || _out.isClosed()))
+          {
+            // The reader reports the corruption.
+            if (_out.isCorrupted())
+              _in.close();
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+
+    void Channel::writeLoop()
+    {
+      boost::mutex::scoped_lock lock(_sendMutex);
+      while (!_closed)
+      {
+        if (_sendQueue.empty())
+        {
+          _sendCondition.wait(lock);
+          continue;
+        }
+        // The front of the queue is kept while it is written (see `close`).
+        const Message& msg = _sendQueue.front();
+        bool written = false;
+        _writing = true;
+        {
+          lock.unlock();
+          written = writeAll(msg);
+          if (written && _onSent)
+            _onSent(msg);
+          lock.lock();
+        }
+        _writing = false;
+        popFront();
+        auto readyPromises = takeReadyPromises();
+        if (!readyPromises.empty())
+        {
+          // Producers waiting for room typically send messages.
+          lock.unlock();
+          for (auto& promise: readyPromises)
+            promise.setValue(nullptr);
+          lock.lock();
+        }
+        if (!written)
+        {
+          qiLogVerbose() << "Shared memory ring closed while writing a message.";
+          break;
+        }
+      }
+    }
+
+    bool Channel::readAll(void* data, std::size_t size)
+    {
+      auto ptr = static_cast<char*>(data);
+      while (size > 0)
+      {
+        const auto count = _in.read(ptr, size);
+        ptr += count;
+        size -= count;
+        if (size > 0 && !_in.waitReadable(pollPeriod) && (_closed || _in.isClosed()))
+          return false;
+      }
+      return true;
+    }
+
+    bool Channel::isCorrupted() const
+    {
+      return _in.isCorrupted() || _out.isCorrupted();
+    }
+
+    void Channel::readLoop(MessageHandler onMessage, std::size_t maxPayload)
+    {
+      while (!_closed)
+      {
+        Message msg;
+        if (!readAll(&msg.header(), sizeof(Message::Header)))
+        {
+          if (isCorrupted())
+            onMessage(nullptr);
+          return;
+        }
+        const auto& header = msg.header();
+        if (header.magic != Message::Header::magicCookie)
+        {
+          qiLogWarning() << "Incorrect magic from shared memory (" << header.magic << ")";
+          onMessage(nullptr);
+          return;
+        }
+        const std::size_t payload = header.size;
+        if (payload > maxPayload)
+        {
+          qiLogWarning() << "Receiving message of size " << payload
+                         << " above maximum configured payload size " << maxPayload;
+          onMessage(nullptr);
+          return;
+        }
+        if (payload > 0)
+        {
+          auto messageBuffer = msg.extractBuffer();
+          void* ptr = messageBuffer.reserve(payload);
+          msg.setBuffer(std::move(messageBuffer));
+          if (!readAll(ptr, payload))
+          {
+            if (isCorrupted())
+              onMessage(nullptr);
+            return;
+          }
+        }
+        if (_closed || !onMessage(&msg))
+          return;
+      }
+    }
+
+    void Channel::startReceiving(MessageHandler onMessage, std::size_t maxPayload)
+    {
+      boost::mutex::scoped_lock lock(_sendMutex);
+      if (_closed || _reader.joinable())
+        return;
+      auto self = shared_from_this();
+      _reader = boost::thread([self, onMessage, maxPayload]{
+        self->readLoop(onMessage, maxPayload);
+      });
+    }
+
+    void Channel::close()
+    {
+      std::vector<Promise<void>> readyPromises;
+      {
+        boost::mutex::scoped_lock lock(_sendMutex);
+        if (_closed.exchange(true))
+          return;
+        // The message being written must stay valid until the writer thread
+        // is done with it.
+        const auto first = _writing ? std::next(_sendQueue.begin()) : _sendQueue.begin();
+        for (auto it = first; it != _sendQueue.end(); ++it)
+          _queueStats.bytes -= sock::wireSize(*it);
+        _queueStats.messages -= static_cast<std::size_t>(std::distance(first, _sendQueue.end()));
+        _sendQueue.erase(first, _sendQueue.end());
+        readyPromises = takeReadyPromises();
+        _sendCondition.notify_all();
+      }
+      for (auto& promise: readyPromises)
+        promise.setValue(nullptr);
+      _out.close();
+      _in.close();
+      // The threads own a reference to the channel and stop as soon as they
+      // see that it is closed. They are not joined: the caller may hold a lock
+      // that the handler of a received message is waiting for.
+      if (_writer.joinable())
+        _writer.detach();
+      if (_reader.joinable())
+        _reader.detach();
+    }
+#endif // QI_SHARED_MEMORY_TRANSPORT
+
+    Link::~Link()
+    {
+      close();
+    }
+
+    const char* const Link::segmentKey = "SharedMemoryTransport.Segment";
+    const char* const Link::attachedKey = "SharedMemoryTransport.Attached";
+    const char* const Link::switchedKey = "SharedMemoryTransport.Switched";
+
+    bool Link::isControl(const CapabilityMap& cm)
+    {
+      return cm.count(segmentKey) || cm.count(attachedKey) || cm.count(switchedKey);
+    }
+
+    bool Link::canBeUsed(const boost::optional<AnyValue>& local,
+                         const boost::optional<AnyValue>& remote)
+    {
+#if QI_SHARED_MEMORY_TRANSPORT
+      if (!local || !remote)
+        return false;
+      try
+      {
+        const auto localMachine = local->to<std::string>();
+        return !localMachine.empty() && localMachine == remote->to<std::string>();
+      }
+      catch (const std::exception&)
+      {
+        return false;
+      }
+#else
+      return false;
+#endif
+    }
+
+    Message Link::makeControl(const char* key, AnyValue value)
+    {
+      Message msg;
+      msg.setType(Message::Type_Capability);
+      msg.setService(Message::Service_Server);
+      const CapabilityMap cm{{key, std::move(value)}};
+      msg.setValue(cm, typeOf<CapabilityMap>()->signature());
+      return msg;
+    }
+
+    boost::optional<Message> Link::offer()
+    {
+#if QI_SHARED_MEMORY_TRANSPORT
+      if (_state != State::Idle)
+        return {};
+      try
+      {
+        _channel = std::make_shared<Channel>(Segment::create(ringCapacityFromEnv()),
+                                             Channel::Side::Client, _queueLimits, _onSent);
+      }
+      catch (const std::exception& e)
+      {
+        qiLogVerbose() << "Cannot offer shared memory transport: " << e.what();
+        _state = State::Refused;
+        return {};
+      }
+      _state = State::Offered;
+      return makeControl(segmentKey, AnyValue::from(_channel->segment().name()));
+#else
+      return {};
+#endif
+    }
+
+    boost::optional<Message> Link::handleControl(const CapabilityMap& cm, bool allowed,
+                                                 MessageHandler onMessage,
+                                                 std::size_t maxPayload)
+    {
+      try
+      {
+        auto it = cm.find(segmentKey);
+        if (it != cm.end())
+          return onSegment(it->second.to<std::string>(), allowed, std::move(onMessage), maxPayload);
+        it = cm.find(attachedKey);
+        if (it != cm.end())
+          return onAttached(it->second.to<bool>(), std::move(onMessage), maxPayload);
+        if (cm.count(switchedKey))
+          onSwitched(std::move(onMessage), maxPayload);
+      }
+      catch (const std::exception& e)
+      {
+        qiLogWarning() << "Ill-formed shared memory transport message: " << e.what();
+      }
+      return {};
+    }
+
+    boost::optional<Message> Link::onSegment(const std::string& name, bool allowed,
+                                             MessageHandler, std::size_t)
+    {
+#if QI_SHARED_MEMORY_TRANSPORT
+      if (!allowed || _state != State::Idle)
+        return makeControl(attachedKey, AnyValue::from(false));
+      try
+      {
+        _channel = std::make_shared<Channel>(Segment::open(name), Channel::Side::Server,
+                                             _queueLimits, _onSent);
+      }
+      catch (const std::exception& e)
+      {
+        qiLogVerbose() << "Cannot attach shared memory transport: " << e.what();
+        _state = State::Refused;
+        return makeControl(attachedKey, AnyValue::from(false));
+      }
+      qiLogVerbose() << "Attached shared memory segment " << name;
+      _state = State::Attached;
+      _sending = true;
+      return makeControl(attachedKey, AnyValue::from(true));
+#else
+      QI_UNUSED(name);
+      QI_UNUSED(allowed);
+      return makeControl(attachedKey, AnyValue::from(false));
+#endif
+    }
+
+    boost::optional<Message> Link::onAttached(bool attached, MessageHandler onMessage,
+                                              std::size_t maxPayload)
+    {
+#if QI_SHARED_MEMORY_TRANSPORT
+      if (_state != State::Offered)
+        return {};
+      // Either way, the server does not need the name anymore.
+      _channel->segment().unlink();
+      if (!attached)
+      {
+        qiLogVerbose() << "Shared memory transport refused by the remote end.";
+        _channel->close();
+        _channel.reset();
+        _state = State::Refused;
+        return {};
+      }
+      // The server sends through the segment since its reply.
+      _channel->startReceiving(std::move(onMessage), maxPayload);
+      _state = State::Attached;
+      _sending = true;
+      return makeControl(switchedKey, AnyValue::from(true));
+#else
+      QI_UNUSED(attached);
+      QI_UNUSED(onMessage);
+      QI_UNUSED(maxPayload);
+      return {};
+#endif
+    }
+
+    void Link::onSwitched(MessageHandler onMessage, std::size_t maxPayload)
+    {
+#if QI_SHARED_MEMORY_TRANSPORT
+      if (_state == State::Attached && _channel)
+        _channel->startReceiving(std::move(onMessage), maxPayload);
+#else
+      QI_UNUSED(onMessage);
+      QI_UNUSED(maxPayload);
+#endif
+    }
+
+    bool Link::send(const Message& msg)
+    {
+#if QI_SHARED_MEMORY_TRANSPORT
+      if (!_sending)
+        return false;
+      if (!_channel->send(msg))
+      {
+        qiLogVerbose() << "Message " << msg.id() << " not sent through shared memory.";
+        return false;
+      }
+      return true;
+#else
+      QI_UNUSED(msg);
+      return false;
+#endif
+    }
+
+    void Link::setQueueLimits(const sock::SendQueueLimits& limits)
+    {
+      _queueLimits = limits;
+#if QI_SHARED_MEMORY_TRANSPORT
+      if (_channel)
+        _channel->setQueueLimits(limits);
+#endif
+    }
+
+    void Link::setSentHandler(SentHandler onSent)
+    {
+      _onSent = std::move(onSent);
+    }
+
+    sock::SendQueueStats Link::queueStats() const
+    {
+#if QI_SHARED_MEMORY_TRANSPORT
+      if (_sending)
+        return _channel->queueStats();
+#endif
+      return {};
+    }
+
+    Future<void> Link::ready()
+    {
+#if QI_SHARED_MEMORY_TRANSPORT
+      if (_sending)
+        return _channel->ready();
+#endif
+      return futurize();
+    }
+
+    void Link::close()
+    {
+#if QI_SHARED_MEMORY_TRANSPORT
+      if (_channel)
+      {
+        _channel->close();
+        _channel.reset();
+      }
+#endif
+      _state = State::Idle;
+      _sending = false;
+    }
+  } // namespace shm
+} // namespace qi
@@ -0,0 +1,373 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_SHAREDMEMORY_HPP_
+#define _SRC_SHAREDMEMORY_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/predef.h>
+#include <boost/optional.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <qi/future.hpp>
+#include <qi/messaging/sock/sendqueue.hpp>
+#include "message.hpp"
+#include "streamcontext.hpp"
+
+/// @file
+/// Contains a transport of messages through a shared memory segment, for
+/// peers running on the same machine.
+///
+/// The segment contains two single-producer single-consumer byte rings, one
+/// per direction. Messages are written in a ring with the same framing as on a
+/// socket (the header followed by the payload), so that the transport can be
+/// substituted to a socket once the connection is established.
+///
+/// A reader that has nothing to read spins for a short while and then sleeps
+/// on a futex word of the ring. A writer only issues a wake-up system call if
+/// the reader is actually sleeping: in steady state, a busy stream of messages
+/// does not cost any system call.
+///
+/// The transport costs two threads per connection, that spin before sleeping:
+/// it is disabled unless the `QI_SHARED_MEMORY_TRANSPORT` environment variable
+/// is set to 1 (see `enabledFromEnv`).
+
+#if BOOST_OS_LINUX && !BOOST_OS_ANDROID
+# define QI_SHARED_MEMORY_TRANSPORT 1
+#else
+# define QI_SHARED_MEMORY_TRANSPORT 0
+#endif
+
+namespace qi
+{
+  namespace shm
+  {
+    /// Procedure<bool (Message*)>: called for each message received through
+    /// shared memory. A null pointer means the stream is corrupted. Returning
+    /// false stops the reception.
+    using MessageHandler = std::function<bool (Message*)>;
+
+    /// Procedure<void (const Message&)>: called once a message is written in
+    /// shared memory.
+    using SentHandler = std::function<void (const Message&)>;
+
+    /// Returns true if the transport is available and enabled by the
+    /// `QI_SHARED_MEMORY_TRANSPORT` environment variable.
+    bool enabledFromEnv();
+  }
+}
+
+#if QI_SHARED_MEMORY_TRANSPORT
+
+namespace qi
+{
+  namespace shm
+  {
+    /// Control block of a ring, stored in the shared segment.
+    /// The positions are monotonic byte counts: the offset in the data area is
+    /// the position modulo the capacity.
+    struct RingControl
+    {
+      alignas(64) std::atomic<std::uint64_t> head; // written by the producer
+      alignas(64) std::atomic<std::uint64_t> tail; // written by the consumer
+      alignas(64) std::atomic<std::uint32_t> dataSeq;
+      std::atomic<std::uint32_t> readerWaiting;
+      alignas(64) std::atomic<std::uint32_t> spaceSeq;
+      std::atomic<std::uint32_t> writerWaiting;
+      std::atomic<std::uint32_t> closed;
+    };
+
+    /// A single-producer single-consumer byte ring over memory it does not own.
+    ///
+    /// Reading and writing are partial: they transfer as many bytes as
+    /// possible and return that count. Waiting is done with `waitReadable` and
+    /// `waitWritable`.
+    ///
+    /// The positions are written by the peer and are not trusted: if they are
+    /// more than the capacity apart, the ring is considered corrupted and is
+    /// closed.
+    class Ring
+    {
+    public:
+      /// Precondition: `capacity` is a power of two.
+      Ring(RingControl* control, char* data, std::size_t capacity);
+
+      std::size_t capacity() const { return _capacity; }
+      std::size_t readable() const;
+      std::size_t writable() const;
+
+      std::size_t write(const void* data, std::size_t size);
+      std::size_t read(void* data, std::size_t size);
+
+      /// Waits until there is something to read, the ring is closed, or the
+      /// timeout expires. Returns true if there is something to read.
+      bool waitReadable(std::chrono::milliseconds timeout);
+
+      /// Waits until `size` bytes (or the whole capacity if it is less) can be
+      /// written, the ring is closed, or the timeout expires. Returns true if
+      /// the bytes can be written.
+      bool waitWritable(std::size_t size, std::chrono::milliseconds timeout);
+
+      /// Marks the ring as closed and wakes up both sides.
+      void close();
+      bool isClosed() const;
+
+      /// Returns true if the ring has been closed because its positions were
+      /// inconsistent.
+      bool isCorrupted() const { return _corrupted; }
+
+    private:
+      /// Returns the count of bytes between the positions, or an empty
+      /// optional after closing the ring if they are inconsistent.
+      boost::optional<std::size_t> used(std::uint64_t head, std::uint64_t tail) const;
+
+      RingControl* _control;
+      char* _data;
+      std::size_t _capacity;
+      mutable std::atomic<bool> _corrupted;
+    };
+
+    /// A shared memory segment containing one ring per direction.
+    ///
+    /// The creator of the segment is the client of the connection. Once the
+    /// server has opened it, the client unlinks its name so that no other
+    /// process can open it and the memory is released with the last mapping.
+    class Segment
+    {
+    public:
+      enum class Side
+      {
+        Client,
+        Server
+      };
+
+      /// Creates a new segment with a unique name.
+      /// Throws a `std::runtime_error` on failure.
+      static std::unique_ptr<Segment> create(std::size_t ringCapacity);
+
+      /// Opens an existing segment created by `create`. The segment must have
+      /// been created by the same user, and not be accessible by the others.
+      /// Throws a `std::runtime_error` on failure.
+      static std::unique_ptr<Segment> open(const std::string& name);
+
+      ~Segment();
+
+      const std::string& name() const { return _name; }
+
+      /// Removes the name of the segment. Existing mappings stay valid.
+      void unlink();
+
+      /// The ring on which the given side writes.
+      Ring& outgoing(Side side);
+      /// The ring from which the given side reads.
+      Ring& incoming(Side side);
+
+    private:
+      Segment(std::string name, void* address, std::size_t size, bool owner);
+
+      std::string _name;
+      void* _address;
+      std::size_t _size;
+      bool _linked;
+      std::unique_ptr<Ring> _clientToServer;
+      std::unique_ptr<Ring> _serverToClient;
+    };
+
+    /// Sends and receives messages through a segment.
+    ///
+    /// Sending writes the message directly in the ring when it is not
+    /// congested. Otherwise the message is queued and written by a dedicated
+    /// thread as the peer consumes the ring, so that `send` never blocks.
+    ///
+    /// The queue behaves as the send queue of a socket: it is ordered by
+    /// message priority and bounded by `sock::SendQueueLimits`.
+    ///
+    /// Receiving is done by a dedicated thread that calls the given handler
+    /// for each message, in order.
+    class Channel : public std::enable_shared_from_this<Channel>
+    {
+    public:
+      using Side = Segment::Side;
+
+      Channel(std::unique_ptr<Segment> segment, Side side,
+              sock::SendQueueLimits limits = sock::getSendQueueLimitsFromEnv(),
+              SentHandler onSent = {});
+      ~Channel();
+
+      Segment& segment() { return *_segment; }
+
+      /// Returns false if the channel is closed or if the message is refused
+      /// by the queue limits.
+      bool send(const Message& msg);
+
+      void setQueueLimits(sock::SendQueueLimits limits);
+      sock::SendQueueStats queueStats() const;
+
+      /// Set once the queue is below its limits.
+      Future<void> ready();
+
+      void startReceiving(MessageHandler onMessage, std::size_t maxPayload);
+
+      /// Closes the rings and stops the threads, without waiting for them.
+      /// Messages still queued are dropped.
+      void close();
+
+    private:
+      bool writeAll(const Message& msg);
+      void writeLoop();
+      void readLoop(MessageHandler onMessage, std::size_t maxPayload);
+      bool readAll(void* data, std::size_t size);
+      bool isCorrupted() const;
+
+      // The following functions must be called with `_sendMutex` locked.
+      bool admit(const Message& msg, std::size_t size);
+      bool fits(std::size_t size) const;
+      bool isReady() const;
+      bool dropOldestEvent();
+      void popFront();
+      std::vector<Promise<void>> takeReadyPromises();
+
+      std::unique_ptr<Segment> _segment;
+      Ring& _out;
+      Ring& _in;
+      std::atomic<bool> _closed;
+      mutable boost::mutex _sendMutex;
+      boost::condition_variable _sendCondition;
+      // A list, so that the message being written by the writer thread stays
+      // valid when other messages are inserted.
+      std::list<Message> _sendQueue;
+      bool _writing;
+      sock::SendQueueLimits _queueLimits;
+      sock::SendQueueStats _queueStats;
+      std::vector<Promise<void>> _readyPromises;
+      SentHandler _onSent;
+      boost::thread _writer;
+      boost::thread _reader;
+    };
+
+    /// Default capacity of each ring, can be overriden by the
+    /// `QI_SHARED_MEMORY_RING_SIZE` environment variable (in bytes, rounded up
+    /// to a power of two).
+    std::size_t ringCapacityFromEnv();
+  } // namespace shm
+} // namespace qi
+
+#endif // QI_SHARED_MEMORY_TRANSPORT
+
+namespace qi
+{
+  namespace shm
+  {
+    /// State of the switch of a connection from its stream to shared memory.
+    ///
+    /// The switch is negotiated with capability messages sent on the stream,
+    /// when both ends advertise the `SharedMemoryTransport` capability with the
+    /// same machine identifier:
+    ///
+    /// - the client creates a segment and sends its name (`offer`);
+    /// - the server opens it, replies if it succeeded, and from then on sends
+    ///   its messages through the segment;
+    /// - on success, the client starts reading from the segment, notifies the
+    ///   server that it switches and from then on sends its messages through
+    ///   the segment;
+    /// - the server starts reading from the segment on this notification.
+    ///
+    /// Each side only starts reading from the segment after the last message
+    /// its peer sent on the stream, so that message order is preserved. On any
+    /// failure, the connection keeps using its stream.
+    ///
+    /// This type is not thread-safe: its owner must synchronize the calls.
+    class Link
+    {
+    public:
+      Link() = default;
+      Link(const Link&) = delete;
+      Link& operator=(const Link&) = delete;
+      ~Link();
+
+      /// Keys of the capability messages of the negotiation.
+      static const char* const segmentKey;
+      static const char* const attachedKey;
+      static const char* const switchedKey;
+
+      /// Returns true if the capability map is a negotiation message.
+      static bool isControl(const CapabilityMap& cm);
+
+      /// Returns true if the connection described by the local and remote
+      /// values of the capability can use shared memory.
+      static bool canBeUsed(const boost::optional<AnyValue>& local,
+                            const boost::optional<AnyValue>& remote);
+
+      /// Client side: creates a segment and returns the message to send on the
+      /// stream to offer it. Returns an empty optional on failure or if an
+      /// offer has already been made.
+      boost::optional<Message> offer();
+
+      /// Handles a negotiation message received on the stream. An offer is
+      /// refused if `allowed` is false. Returns the reply to send on the
+      /// stream, if any.
+      boost::optional<Message> handleControl(const CapabilityMap& cm, bool allowed,
+                                             MessageHandler onMessage,
+                                             std::size_t maxPayload);
+
+      /// Sends the message through shared memory. Returns false if the link
+      /// is not sending, if its channel is closed or if the message is refused
+      /// by the queue limits. Once the link is sending, the messages must not
+      /// be sent on the stream anymore.
+      bool send(const Message& msg);
+
+      /// Limits of the queue of the channel, and procedure called when a
+      /// message is written. They apply to the next channels as well.
+      void setQueueLimits(const sock::SendQueueLimits& limits);
+      void setSentHandler(SentHandler onSent);
+
+      /// Metrics and readiness of the queue of the channel. The queue is
+      /// empty and ready if the link is not sending.
+      sock::SendQueueStats queueStats() const;
+      Future<void> ready();
+
+      /// Closes the segment, if any, and goes back to the initial state so that
+      /// a new connection can be switched in turn.
+      void close();
+
+      bool isSending() const { return _sending; }
+
+    private:
+      enum class State
+      {
+        Idle,
+        Offered,
+        Attached,
+        Refused
+      };
+      State _state = State::Idle;
+      bool _sending = false;
+      sock::SendQueueLimits _queueLimits = sock::getSendQueueLimitsFromEnv();
+      SentHandler _onSent;
+#if QI_SHARED_MEMORY_TRANSPORT
+      std::shared_ptr<Channel> _channel;
+#endif
+      static Message makeControl(const char* key, AnyValue value);
+      boost::optional<Message> onSegment(const std::string& name, bool allowed,
+                                         MessageHandler onMessage,
+                                         std::size_t maxPayload);
+      boost::optional<Message> onAttached(bool attached,
+                                          MessageHandler onMessage,
+                                          std::size_t maxPayload);
+      void onSwitched(MessageHandler onMessage, std::size_t maxPayload);
+    };
+  } // namespace shm
+} // namespace qi
+
+#endif // _SRC_SHAREDMEMORY_HPP_
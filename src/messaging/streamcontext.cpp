@@ -7,7 +7,10 @@
 
 #include <mutex>
 
+#include <qi/os.hpp>
+
 #include "streamcontext.hpp"
+#include "sharedmemory.hpp"
 
 #include "remoteobject_p.hpp"
 #include "boundobject.hpp"
@@ -22,6 +25,10 @@ namespace qi
     char const * const remoteCancelableCalls = "RemoteCancelableCalls";
     char const * const objectPtrUid          = "ObjectPtrUID";
     char const * const directMessageDispatch  = "DirectMessageDispatch";
+    char const * const sharedMemoryTransport  = "SharedMemoryTransport";
+    char const * const messageCompression     = "MessageCompression";
+    char const * const messageFragmentation   = "MessageFragmentation";
+    char const * const messageBatch           = "MessageBatch";
   }
 
   namespace {
@@ -171,14 +178,24 @@ namespace
 
 const CapabilityMap& StreamContext::defaultCapabilities()
 {
-  static const CapabilityMap defaultCapabilities = applyCapabilitiesFromEnv(
-    { { capabilityname::clientServerSocket    , AnyValue::from(true)  }
-    , { capabilityname::messageFlags          , AnyValue::from(true)  }
-    , { capabilityname::metaObjectCache       , AnyValue::from(false) }
-    , { capabilityname::remoteCancelableCalls , AnyValue::from(true)  }
-    , { capabilityname::objectPtrUid          , AnyValue::from(true)  }
-    , { capabilityname::directMessageDispatch , AnyValue::from(true)  }
-    });
+  static const CapabilityMap defaultCapabilities = applyCapabilitiesFromEnv([]{
+    CapabilityMap capabilities
+      { { capabilityname::clientServerSocket    , AnyValue::from(true)  }
+      , { capabilityname::messageFlags          , AnyValue::from(true)  }
+      , { capabilityname::metaObjectCache       , AnyValue::from(false) }
+      , { capabilityname::remoteCancelableCalls , AnyValue::from(true)  }
+      , { capabilityname::objectPtrUid          , AnyValue::from(true)  }
+      , { capabilityname::directMessageDispatch , AnyValue::from(true)  }
+      , { capabilityname::messageCompression    , AnyValue::from(true)  }
+      , { capabilityname::messageFragmentation  , AnyValue::from(true)  }
+      , { capabilityname::messageBatch          , AnyValue::from(true)  }
+      };
+    // The shared memory transport is opt-in: it costs two threads per
+    // connection.
+    if (shm::enabledFromEnv())
+      capabilities[capabilityname::sharedMemoryTransport] = AnyValue::from(os::getMachineId());
+    return capabilities;
+  }());
   return defaultCapabilities;
 }
 
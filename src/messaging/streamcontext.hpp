@@ -55,6 +55,20 @@ using CapabilityMap = std::map<std::string, AnyValue>;
     // which were not the destination because of the lack of capacity to identify objects
     // uniquely in the protocol.
     QI_API extern char const * const directMessageDispatch;
+
+    // Capability: the remote end can switch the connection to a shared memory
+    // transport. Its value is the identifier of the machine of the remote end:
+    // the switch only happens if both ends run on the same machine.
+    QI_API extern char const * const sharedMemoryTransport;
+    // Capability: the remote end accepts messages with a compressed payload
+    // (Message::TypeFlag_Compressed).
+    QI_API extern char const * const messageCompression;
+    // Capability: the remote end accepts large messages sent as fragments
+    // (Message::TypeFlag_Fragment).
+    QI_API extern char const * const messageFragmentation;
+    // Capability: the remote end accepts messages that carry several calls or
+    // replies (Message::TypeFlag_Batch).
+    QI_API extern char const * const messageBatch;
   }
 
 /** Store contextual data associated to one point-to-point point transport.
@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <fstream>
 #include <string>
+#include <vector>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/optional.hpp>
@@ -6,6 +9,9 @@
 #include <qi/log.hpp>
 #include <qi/messaging/sock/networkasio.hpp>
 #include <qi/messaging/sock/option.hpp>
+#include <qi/messaging/sock/receive.hpp>
+#include <qi/messaging/sock/send.hpp>
+#include <qi/messaging/sock/sslsession.hpp>
 
 #if BOOST_OS_WINDOWS
 # include <Winsock2.h> // needed by mstcpip.h
@@ -133,6 +139,96 @@ namespace qi {
 
 namespace qi { namespace sock {
 
+  std::size_t getReceiveBufferSizeFromEnv()
+  {
+    static const auto bufferSizeEnvVariable = os::getenv("QI_RECEIVE_BUFFER_SIZE");
+    static const std::size_t bufferSize = bufferSizeEnvVariable.empty()
+       ? 64 * 1024
+       : static_cast<std::size_t>(strtoul(bufferSizeEnvVariable.c_str(), 0, 0));
+    return bufferSize;
+  }
+
+  SendBatchLimits getSendBatchLimitsFromEnv()
+  {
+    static const auto maxBytesEnvVariable = os::getenv("QI_SEND_BATCH_MAX_BYTES");
+    static const auto maxBuffersEnvVariable = os::getenv("QI_SEND_BATCH_MAX_BUFFERS");
+    static const SendBatchLimits limits{
+      maxBytesEnvVariable.empty()
+        ? 256 * 1024
+        : static_cast<std::size_t>(strtoul(maxBytesEnvVariable.c_str(), 0, 0)),
+      maxBuffersEnvVariable.empty()
+        ? 64
+        : static_cast<std::size_t>(strtoul(maxBuffersEnvVariable.c_str(), 0, 0))
+    };
+    return limits;
+  }
+
+  SendQueueLimits getSendQueueLimitsFromEnv()
+  {
+    static const auto maxBytesEnvVariable = os::getenv("QI_SEND_QUEUE_MAX_BYTES");
+    static const auto maxMessagesEnvVariable = os::getenv("QI_SEND_QUEUE_MAX_MESSAGES");
+    static const auto policyEnvVariable = os::getenv("QI_SEND_QUEUE_POLICY");
+    static const SendQueueLimits limits{
+      static_cast<std::size_t>(strtoul(maxBytesEnvVariable.c_str(), 0, 0)),
+      static_cast<std::size_t>(strtoul(maxMessagesEnvVariable.c_str(), 0, 0)),
+      [] {
+        if (policyEnvVariable == "reject")
+          return SendQueuePolicy::Reject;
+        if (policyEnvVariable == "drop-oldest-event")
+          return SendQueuePolicy::DropOldestEvent;
+        if (!policyEnvVariable.empty() && policyEnvVariable != "wait")
+          qiLogWarning() << "Invalid QI_SEND_QUEUE_POLICY value: " << policyEnvVariable;
+        return SendQueuePolicy::Wait;
+      }()
+    };
+    return limits;
+  }
+
+  std::size_t getSslSessionCacheSizeFromEnv()
+  {
+    static const auto cacheSizeEnvVariable = os::getenv("QI_SSL_SESSION_CACHE_SIZE");
+    static const std::size_t cacheSize = cacheSizeEnvVariable.empty()
+       ? 256
+       : static_cast<std::size_t>(strtoul(cacheSizeEnvVariable.c_str(), 0, 0));
+    return cacheSize;
+  }
+
+  SslSessionCache& sslSessionCache()
+  {
+    static SslSessionCache cache{getSslSessionCacheSizeFromEnv()};
+    return cache;
+  }
+
+  void setupSslSessionResumption(SSL_CTX* context)
+  {
+    const auto cacheSize = getSslSessionCacheSizeFromEnv();
+    if (cacheSize == 0)
+    {
+      SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+      SSL_CTX_set_options(context, SSL_OP_NO_TICKET);
+      return;
+    }
+    static const unsigned char sessionIdContext[] = "qimessaging";
+    SSL_CTX_set_session_id_context(context, sessionIdContext, sizeof(sessionIdContext) - 1);
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(context, static_cast<long>(cacheSize));
+
+    const auto keyFile = os::getenv("QI_SSL_TICKET_KEY_FILE");
+    if (keyFile.empty())
+      return;
+    // Given no key, OpenSSL returns the length of its key.
+    const long keyLength = SSL_CTX_get_tlsext_ticket_keys(context, nullptr, 0);
+    std::vector<char> key(static_cast<std::size_t>(std::max(keyLength, 0L)));
+    std::ifstream file(keyFile.c_str(), std::ios::binary);
+    file.read(key.data(), static_cast<std::streamsize>(key.size()));
+    if (key.empty() || file.gcount() != static_cast<std::streamsize>(key.size())
+        || SSL_CTX_set_tlsext_ticket_keys(context, key.data(), keyLength) != 1)
+    {
+      qiLogWarning() << "Could not read a session ticket key of " << keyLength
+                     << " bytes from " << keyFile << ", a random key is used.";
+    }
+  }
+
   boost::optional<qi::int64_t> getSocketTimeWarnThresholdFromEnv()
   {
     static const auto thresholdEnvVariable = os::getenv("QIMESSAGING_SOCKET_DISPATCH_TIME_WARN_THRESHOLD");
@@ -3,6 +3,7 @@
 #ifndef _SRC_TCPMESSAGESOCKET_HPP_
 #define _SRC_TCPMESSAGESOCKET_HPP_
 
+#include <algorithm>
 #include <string>
 #include <functional>
 #include <memory>
@@ -18,12 +19,18 @@
 #include <ka/macroregular.hpp>
 #include "messagedispatcher.hpp"
 #include "messagesocket.hpp"
+#include "sharedmemory.hpp"
+#include "compression.hpp"
+#include "fragmentation.hpp"
+#include "batch.hpp"
 #include <qi/messaging/sock/disconnectedstate.hpp>
 #include <qi/messaging/sock/disconnectingstate.hpp>
 #include <qi/messaging/sock/connectingstate.hpp>
 #include <qi/messaging/sock/connectedstate.hpp>
 #include <qi/messaging/sock/macrolog.hpp>
 #include <qi/messaging/sock/networkasio.hpp>
+#include <qi/messaging/sock/networkasiolocal.hpp>
+#include <qi/messaging/sock/networkiouring.hpp>
 #include <qi/messaging/sock/sslcontextptr.hpp>
 
 /// @file
@@ -59,6 +66,20 @@ namespace qi {
       }
     };
 
+    /// Procedure called once a message is sent, that records how long it
+    /// waited in the send queue. Sending always continues.
+    struct RecordSendLatency
+    {
+      boost::shared_ptr<MessageLatencyTracker> _latency;
+      template<typename E, typename M>
+      bool operator()(const E& erc, const M& msg)
+      {
+        if (!erc && messageLatencyEnabled())
+          _latency->onSent(*msg);
+        return true;
+      }
+    };
+
     const int defaultTimeoutInSeconds = 30;
   } // namespace sock
 
@@ -137,7 +158,9 @@ namespace qi {
   /// ## Models
   ///
   /// For production code, the Network type used really performs network operations.
-  /// `NetworkAsio` is one such model that used Boost.Asio.
+  /// `NetworkAsio` is one such model that used Boost.Asio. `NetworkIoUring`
+  /// is another one, used by default on Linux, that transfers the data through
+  /// io_uring when enabled (see networkiouring.hpp).
   ///
   /// For unit tests, another type is used, for example `NetworkMock` that allows
   /// to cause network errors on demand.
@@ -180,10 +203,17 @@ namespace qi {
   /// If the socket has not been disconnected, it is synchronously disconnected
   /// on destruction.
   ///
+  /// When both ends run on the same machine and advertise the
+  /// `SharedMemoryTransport` capability (which must be enabled, see
+  /// `shm::enabledFromEnv`), the connection switches to a shared memory segment
+  /// once the capabilities are exchanged (see shm::Link). The underlying socket
+  /// is then only used to detect the disconnection, and the send queue limits
+  /// apply to the queue of the segment. SSL connections are never switched.
+  ///
   /// Network N,
   /// With NetSslSocket S:
   ///   S is compatible with N
-  template<typename N = sock::NetworkAsio, typename S = sock::SocketWithContext<N>>
+  template<typename N = sock::TcpNetwork, typename S = sock::SocketWithContext<N>>
   class TcpMessageSocket
     : public MessageSocket
     , public boost::enable_shared_from_this<TcpMessageSocket<N, S>>
@@ -239,6 +269,47 @@ namespace qi {
       return {};
     }
     bool ensureReading() override;
+
+    void setSendQueueLimits(const sock::SendQueueLimits& limits) override
+    {
+      boost::recursive_mutex::scoped_lock lock(_stateMutex);
+      _sendQueueLimits = limits;
+      _shmLink.setQueueLimits(limits);
+      if (getStatus() == Status::Connected)
+      {
+        asConnected(_state).setSendQueueLimits(limits);
+      }
+    }
+
+    /// The metrics are the ones of the current connection. They are reset at
+    /// each connection.
+    sock::SendQueueStats sendQueueStats() const override
+    {
+      boost::recursive_mutex::scoped_lock lock(_stateMutex);
+      if (_shmLink.isSending())
+      {
+        return _shmLink.queueStats();
+      }
+      if (getStatus() == Status::Connected)
+      {
+        return asConnected(_state).sendQueueStats();
+      }
+      return {};
+    }
+
+    Future<void> sendQueueReady() override
+    {
+      boost::recursive_mutex::scoped_lock lock(_stateMutex);
+      if (_shmLink.isSending())
+      {
+        return _shmLink.ready();
+      }
+      if (getStatus() == Status::Connected)
+      {
+        return asConnected(_state).sendQueueReady();
+      }
+      return futurize();
+    }
   private:
     /// Handler called when we transition outside the connected state.
     /// It is the responsibility of the caller to ensure the socket pointer is
@@ -266,8 +337,13 @@ namespace qi {
     };
 
     const sock::SslEnabled _ssl;
+    const bool _serverSide;
     mutable boost::recursive_mutex _stateMutex;
     sock::IoService<N>& _ioService;
+    shm::Link _shmLink; // Synchronized with _stateMutex.
+    sock::SendQueueLimits _sendQueueLimits; // Synchronized with _stateMutex.
+    fragmentation::Reassembler _reassembler;
+    batch::ReplyCollector _batchReplies;
 
     void enterDisconnectedState(const SocketPtr& socket = {},
       Promise<void> promiseDisconnected = Promise<void>{});
@@ -285,7 +361,12 @@ namespace qi {
     bool mustTreatAsServerAuthentication(const Message& msg) const;
     bool handleCapabilityMessage(const Message& msg);
     bool handleNormalMessage(Message& msg);
+    bool handleBatchMessage(const Message& msg);
     bool handleMessage(Message& msg);
+    bool sendBatchReplies(std::vector<Message> replies);
+    bool canUseSharedMemory() const;
+    void offerSharedMemory();
+    void handleSharedMemoryControl(const CapabilityMap& cm);
 
     ConnectedState& asConnected(State& s)
     {
@@ -318,12 +399,26 @@ namespace qi {
   template<typename N, typename S>
   using TcpMessageSocketPtr = boost::shared_ptr<TcpMessageSocket<N, S>>;
 
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+  /// Socket to send and receive messages over a local (Unix-domain) stream
+  /// socket, for peers on the same host. Only the Network differs from the TCP
+  /// socket: the connection states and the message layers are shared.
+  using LocalMessageSocket = TcpMessageSocket<sock::NetworkAsioLocal>;
+#endif
+
+  size_t getMaxPayloadFromEnv(size_t defaultValue = 50000000);
+
   template<typename N, typename S>
   TcpMessageSocket<N, S>::TcpMessageSocket(sock::IoService<N>& io, sock::SslEnabled ssl,
         SocketPtr socket)
     : MessageSocket()
     , _ssl(ssl)
+    , _serverSide(static_cast<bool>(socket))
     , _ioService(io)
+    , _sendQueueLimits(sock::getSendQueueLimitsFromEnv())
+    // Several large messages may be received at once, each one being rebuilt
+    // from its fragments.
+    , _reassembler(getMaxPayloadFromEnv(), getMaxPayloadFromEnv())
     , _state{DisconnectedState{}}
   {
     if (socket)
@@ -331,11 +426,22 @@ namespace qi {
       sock::setSocketOptions<N>(socket, getTcpPingTimeout(Seconds{sock::defaultTimeoutInSeconds}));
       _state = ConnectingState{io, ssl, socket, Handshake::server};
     }
+    _dispatcher.setCallTimeoutHandler([this](const MessageAddress& address) {
+      cancelTimedOutCall(address);
+    });
+    _shmLink.setQueueLimits(_sendQueueLimits);
+    auto latency = _latency;
+    _shmLink.setSentHandler([latency](const Message& msg) {
+      if (messageLatencyEnabled())
+        latency->onSent(msg);
+    });
   }
 
   template<typename N, typename S>
   TcpMessageSocket<N, S>::~TcpMessageSocket()
   {
+    // The handler must not send anything once this object is destroyed.
+    _dispatcher.setCallTimeoutHandler({});
     // We are in the destructor, so no concurrency problem.
     if (getStatus() == Status::Connected)
     {
@@ -344,8 +450,6 @@ namespace qi {
     }
   }
 
-  size_t getMaxPayloadFromEnv(size_t defaultValue = 50000000);
-
   /// Start receiving messages. Also allows to send messages.
   ///
   /// The returned value indicates if the operation succeeded.
@@ -380,6 +484,7 @@ namespace qi {
       auto self = shared_from_this();
       _state = ConnectedState(res.socket, _ssl, maxPayload, sock::HandleMessage<N, S>{self});
       auto& connected = asConnected(_state);
+      connected.setSendQueueLimits(_sendQueueLimits);
       connected.complete().then(connected.ioServiceStranded(
         OnConnectedComplete{self, Future<void>{nullptr}}
       ));
@@ -443,6 +548,7 @@ namespace qi {
         static const auto maxPayload = getMaxPayloadFromEnv();
         _state = ConnectedState(res.socket, _ssl, maxPayload, sock::HandleMessage<N, S>{self});
         auto& connected = asConnected(_state);
+        connected.setSendQueueLimits(_sendQueueLimits);
         connected.complete().then(connected.ioServiceStranded(
           OnConnectedComplete{self, connectedPromise.future()}
         ));
@@ -498,6 +604,8 @@ namespace qi {
         wasConnected = (getStatus() == Status::Connected);
         QI_LOG_DEBUG_SOCKET(socket.get()) << "Entering Disconnecting state";
         _state = disconnect;
+        _shmLink.close();
+        _reassembler.clear();
       }
       disconnect();
       auto self = shared_from_this();
@@ -542,6 +650,11 @@ namespace qi {
       cmRef = msg.value(typeOf<CapabilityMap>()->signature(), shared_from_this());
       CapabilityMap cm = cmRef.to<CapabilityMap>();
       cmRef.destroy();
+      if (shm::Link::isControl(cm))
+      {
+        handleSharedMemoryControl(cm);
+        return true;
+      }
       updateRemoteCapabilities(cm);
     }
     catch (const std::runtime_error& e)
@@ -550,12 +663,80 @@ namespace qi {
       QI_LOG_ERROR_SOCKET(this) << "Ill-formed capabilities message: " << e.what();
       return false;
     }
+    // The client initiates the switch to shared memory as soon as it knows
+    // the capabilities of the server.
+    if (!_serverSide)
+    {
+      offerSharedMemory();
+    }
     return true;
   }
 
+  template<typename N, typename S>
+  bool TcpMessageSocket<N, S>::canUseSharedMemory() const
+  {
+    return !*_ssl
+        && shm::Link::canBeUsed(localCapability(capabilityname::sharedMemoryTransport),
+                                remoteCapability(capabilityname::sharedMemoryTransport));
+  }
+
+  template<typename N, typename S>
+  void TcpMessageSocket<N, S>::offerSharedMemory()
+  {
+    boost::recursive_mutex::scoped_lock lock(_stateMutex);
+    if (getStatus() != Status::Connected || !canUseSharedMemory())
+    {
+      return;
+    }
+    if (auto offer = _shmLink.offer())
+    {
+      QI_LOG_DEBUG_SOCKET(this) << "Offering shared memory transport.";
+      asConnected(_state).send(std::move(*offer), _ssl);
+    }
+  }
+
+  template<typename N, typename S>
+  void TcpMessageSocket<N, S>::handleSharedMemoryControl(const CapabilityMap& cm)
+  {
+    static const auto maxPayload = getMaxPayloadFromEnv();
+    boost::weak_ptr<TcpMessageSocket> weakSelf = shared_from_this();
+    auto onMessage = [weakSelf](Message* msg) {
+      auto self = weakSelf.lock();
+      if (!self)
+      {
+        return false;
+      }
+      if (!msg)
+      {
+        QI_LOG_ERROR_SOCKET(self.get()) << "Corrupted shared memory stream, disconnecting.";
+        self->disconnect().async();
+        return false;
+      }
+      return self->handleMessage(*msg);
+    };
+    boost::recursive_mutex::scoped_lock lock(_stateMutex);
+    if (getStatus() != Status::Connected)
+    {
+      return;
+    }
+    // The reply, if any, must be sent on the stream: it is the last message
+    // the remote end reads from it.
+    if (auto reply = _shmLink.handleControl(cm, canUseSharedMemory(), onMessage, maxPayload))
+    {
+      asConnected(_state).send(std::move(*reply), _ssl);
+    }
+    if (_shmLink.isSending())
+    {
+      QI_LOG_DEBUG_SOCKET(this) << "Sending through shared memory.";
+    }
+  }
+
   template<typename N, typename S>
   bool TcpMessageSocket<N, S>::handleNormalMessage(Message& msg)
   {
+    if (messageLatencyEnabled())
+      _latency->onDispatch(msg);
+    capture(MessageCapture::Direction::Received, msg);
     messageReady(msg);
     socketEvent(SocketEventData(msg));
 
@@ -567,7 +748,11 @@ namespace qi {
       dispatched = directDispatchRegistry().dispatchMessage(msg, this->shared_from_this());
     }
 
-    if (!dispatched)
+    if (dispatched)
+    {
+      _dispatcher.received(msg);
+    }
+    else
     {
       _dispatcher.dispatch(msg); // Old way to dispatch, only kept for compatibility when connected
                                  // to a process not handling direct dispatch.
@@ -576,9 +761,101 @@ namespace qi {
     return true;
   }
 
+  template<typename N, typename S>
+  bool TcpMessageSocket<N, S>::handleBatchMessage(const Message& msg)
+  {
+    // Batches are only accepted once the remote end is authenticated and
+    // knows we support them, as they skip the authentication of handleMessage.
+    if (!isAuthenticated() || !sharedCapability<bool>(capabilityname::messageBatch, false))
+    {
+      QI_LOG_ERROR_SOCKET(this) << "Unexpected batch message, disconnecting.";
+      return false;
+    }
+    auto messages = batch::unpack(msg);
+    if (!messages)
+    {
+      QI_LOG_ERROR_SOCKET(this) << "Invalid batch message, disconnecting.";
+      return false;
+    }
+    // Only calls and their replies can be batched: capabilities and
+    // authentication must be sent on their own.
+    const auto refused = std::find_if(messages->begin(), messages->end(), [](const Message& inner) {
+      return inner.type() == Message::Type_Capability || inner.service() == Message::Service_Server;
+    });
+    if (refused != messages->end())
+    {
+      QI_LOG_ERROR_SOCKET(this) << "Batch message carrying a " << Message::typeToString(refused->type())
+                                << " to service " << refused->service() << ", disconnecting.";
+      return false;
+    }
+    if (msg.type() == Message::Type_Call)
+    {
+      // The replies are sent together once they are all there, or when the
+      // delay expires, so that a slow call does not hold the others.
+      const auto group = _batchReplies.expect(*messages);
+      boost::weak_ptr<TcpMessageSocket> weakSelf = this->shared_from_this();
+      qi::asyncDelay([weakSelf, group] {
+        if (auto self = weakSelf.lock())
+          self->sendBatchReplies(self->_batchReplies.release(group));
+      }, batch::replyDelayFromEnv());
+    }
+    for (auto& message: *messages)
+    {
+      if (!handleNormalMessage(message))
+        return false;
+    }
+    return true;
+  }
+
+  template<typename N, typename S>
+  bool TcpMessageSocket<N, S>::sendBatchReplies(std::vector<Message> replies)
+  {
+    if (replies.empty())
+      return true;
+    if (replies.size() == 1)
+      return sendImpl(std::move(replies.front()));
+    return sendImpl(batch::pack(replies));
+  }
+
   template<typename N, typename S>
   bool TcpMessageSocket<N, S>::handleMessage(Message& msg)
   {
+    static const auto maxPayload = getMaxPayloadFromEnv();
+    // Fragments are only accepted once the remote end is authenticated and
+    // knows we support them, as they are held until the message is complete.
+    if ((msg.flags() & Message::TypeFlag_Fragment)
+        && (!isAuthenticated() || !sharedCapability<bool>(capabilityname::messageFragmentation, false)))
+    {
+      QI_LOG_ERROR_SOCKET(this) << "Unexpected message fragment, disconnecting.";
+      return false;
+    }
+    switch (_reassembler.add(msg))
+    {
+      case fragmentation::Reassembler::Status::Complete:
+        break;
+      case fragmentation::Reassembler::Status::Incomplete:
+        return true;
+      case fragmentation::Reassembler::Status::Invalid:
+        QI_LOG_ERROR_SOCKET(this) << "Invalid message fragment, disconnecting.";
+        return false;
+    }
+    // Compressed messages are only accepted once the remote end is
+    // authenticated and knows we support them, as they are inflated.
+    if ((msg.flags() & Message::TypeFlag_Compressed)
+        && (!isAuthenticated() || !sharedCapability<bool>(capabilityname::messageCompression, false)))
+    {
+      QI_LOG_ERROR_SOCKET(this) << "Unexpected compressed message, disconnecting.";
+      return false;
+    }
+    if (!compression::decompressPayload(msg, maxPayload))
+    {
+      QI_LOG_ERROR_SOCKET(this) << "Invalid compressed message, disconnecting.";
+      return false;
+    }
+    if (msg.flags() & Message::TypeFlag_Batch)
+    {
+      return handleBatchMessage(msg);
+    }
     bool success = false;
     if (mustTreatAsServerAuthentication(msg) || msg.type() == Message::Type_Capability)
     {
@@ -601,22 +878,95 @@ namespace qi {
   template<typename N, typename S>
   bool TcpMessageSocket<N, S>::sendImpl(Message msg)
   {
+    // Replies to the calls of a batch wait for the others.
+    std::vector<Message> batchReplies;
+    if (_batchReplies.collect(msg, batchReplies))
+    {
+      return sendBatchReplies(std::move(batchReplies));
+    }
+    // The replies held must not be overtaken by the events the calls may have
+    // emitted since they returned.
+    sendBatchReplies(_batchReplies.releaseBefore(msg));
+    {
+      boost::recursive_mutex::scoped_lock lock(_stateMutex);
+      if (getStatus() != Status::Connected)
+      {
+        QI_LOG_DEBUG_SOCKET(this) << "Socket must be connected to send().";
+        return false;
+      }
+      // Once switched, the remote end reads the segment: the stream must not
+      // be used anymore.
+      if (_shmLink.isSending())
+      {
+        return _shmLink.send(msg);
+      }
+    }
+    // Compression and splitting can take a while: they are done without the
+    // lock, that is only taken to enqueue, so that they do not hold the other
+    // senders nor the state changes.
+    if (sharedCapability<bool>(capabilityname::messageCompression, false))
+    {
+      compression::compressPayload(msg, compression::thresholdFromEnv());
+    }
+    // Fragments of a large message are written between the other messages,
+    // that do not have to wait for the whole message to be written.
+    std::vector<Message> fragments;
+    if (sharedCapability<bool>(capabilityname::messageFragmentation, false))
+    {
+      fragments = fragmentation::split(msg, fragmentation::fragmentSizeFromEnv());
+      if (!fragments.empty())
+      {
+        // The message is sent once its last fragment is.
+        fragments.back().setTimestamp(msg.timestamp());
+      }
+    }
     boost::recursive_mutex::scoped_lock lock(_stateMutex);
     if (getStatus() != Status::Connected)
     {
-      QI_LOG_DEBUG_SOCKET(this) << "Socket must be connected to send().";
+      QI_LOG_DEBUG_SOCKET(this) << "Socket disconnected while preparing the message.";
+      return false;
+    }
+    // The link may have switched in the meantime. Compressed messages and
+    // fragments are read from the segment as from the stream.
+    if (_shmLink.isSending())
+    {
+      if (fragments.empty())
+      {
+        return _shmLink.send(msg);
+      }
+      for (const auto& fragment: fragments)
+      {
+        if (!_shmLink.send(fragment))
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+    if (!fragments.empty())
+    {
+      // The fragments are admitted at once: a message that is partially
+      // sent could not be rebuilt.
+      if (!asConnected(_state).sendAll(std::move(fragments), _ssl, sock::RecordSendLatency{_latency}))
+      {
+        QI_LOG_DEBUG_SOCKET(this) << "Fragmented message refused by the send queue.";
+        return false;
+      }
+      return true;
+    }
+    // NOTE: Should we stop sending if an error occurred?
+    if (!asConnected(_state).send(std::move(msg), _ssl, sock::RecordSendLatency{_latency}))
+    {
+      QI_LOG_DEBUG_SOCKET(this) << "Message refused by the send queue.";
       return false;
     }
-    // NOTE: Should we specify an `onSent` callback and stop sending if an error
-    // occurred?
-    asConnected(_state).send(std::move(msg), _ssl);
     return true;
   }
 
   /// Network N,
   /// With NetSslSocket S:
   ///   S is compatible with N
-  template <typename N = sock::NetworkAsio, typename S = sock::SocketWithContext<N>>
+  template <typename N = sock::TcpNetwork, typename S = sock::SocketWithContext<N>>
   TcpMessageSocketPtr<N, S> makeTcpMessageSocket(const std::string& protocol,
                                                  EventLoop* eventLoop = getNetworkEventLoop())
   {
@@ -0,0 +1,121 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include "timerwheel.hpp"
+
+#include <algorithm>
+
+namespace qi
+{
+  namespace
+  {
+    const std::uint64_t slotMask = TimerWheel::slotCount - 1;
+
+    // Count of ticks spanned by a slot of the given level.
+    std::uint64_t slotSpan(std::size_t level)
+    {
+      return std::uint64_t{1} << (TimerWheel::slotBits * level);
+    }
+  }
+
+  TimerWheel::TimerWheel(Duration resolution, SteadyClock::time_point start)
+    : _resolution(std::max(resolution, Duration(1)))
+    , _start(start)
+    , _tick(0)
+  {
+  }
+
+  std::uint64_t TimerWheel::tickOf(SteadyClock::time_point time, bool roundUp) const
+  {
+    if (time <= _start)
+      return 0;
+    const auto elapsed = (time - _start).count();
+    const auto resolution = _resolution.count();
+    return static_cast<std::uint64_t>(elapsed / resolution
+                                      + (roundUp && elapsed % resolution != 0 ? 1 : 0));
+  }
+
+  void TimerWheel::add(Key key, SteadyClock::time_point deadline)
+  {
+    remove(key);
+    const auto maxTick = _tick + slotSpan(levelCount) - 1;
+    const auto tick = std::min(std::max(tickOf(deadline, true), _tick + 1), maxTick);
+    insert(Node{key, tick});
+  }
+
+  bool TimerWheel::remove(Key key)
+  {
+    const auto it = _positions.find(key);
+    if (it == _positions.end())
+      return false;
+    erase(it->second);
+    _positions.erase(it);
+    return true;
+  }
+
+  void TimerWheel::insert(const Node& node)
+  {
+    const auto delta = node.tick > _tick ? node.tick - _tick : 0;
+    std::size_t level = 0;
+    while (level + 1 < levelCount && delta >= slotSpan(level + 1))
+      ++level;
+    const auto slot = static_cast<std::uint32_t>((node.tick >> (slotBits * level)) & slotMask);
+    auto& nodes = _levels[level][slot];
+    _positions[node.key] = Position{static_cast<std::uint32_t>(level), slot, nodes.size()};
+    nodes.push_back(node);
+  }
+
+  void TimerWheel::erase(const Position& position)
+  {
+    auto& nodes = _levels[position.level][position.slot];
+    if (position.index + 1 != nodes.size())
+    {
+      nodes[position.index] = nodes.back();
+      _positions[nodes[position.index].key].index = position.index;
+    }
+    nodes.pop_back();
+  }
+
+  void TimerWheel::cascade(std::size_t level)
+  {
+    Slot nodes;
+    nodes.swap(_levels[level][(_tick >> (slotBits * level)) & slotMask]);
+    for (const auto& node: nodes)
+      insert(node);
+  }
+
+  std::vector<TimerWheel::Key> TimerWheel::advance(SteadyClock::time_point now)
+  {
+    std::vector<Key> expired;
+    const auto target = tickOf(now, false);
+    while (_tick < target)
+    {
+      if (_positions.empty())
+      {
+        _tick = target;
+        break;
+      }
+      ++_tick;
+
+      // Move the deadlines of the slots that start now to the lower levels,
+      // starting from the highest level, so that they reach the first level
+      // at the latest at their tick.
+      std::size_t level = 0;
+      while (level + 1 < levelCount && (_tick & (slotSpan(level + 1) - 1)) == 0)
+        ++level;
+      for (; level > 0; --level)
+        cascade(level);
+
+      Slot nodes;
+      nodes.swap(_levels[0][_tick & slotMask]);
+      for (const auto& node: nodes)
+      {
+        _positions.erase(node.key);
+        expired.push_back(node.key);
+      }
+    }
+    return expired;
+  }
+}
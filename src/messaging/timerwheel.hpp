@@ -0,0 +1,85 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_TIMERWHEEL_HPP_
+#define _SRC_TIMERWHEEL_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <qi/api.hpp>
+#include <qi/clock.hpp>
+
+namespace qi
+{
+  /// Hierarchical timer wheel: it keeps deadlines of keys and tells which ones
+  /// expired, at a cost that does not depend on the count of deadlines.
+  ///
+  /// Time is divided in ticks of `resolution`. The wheel has `levelCount`
+  /// levels of `slotCount` slots: a slot of level L spans `slotCount^L` ticks.
+  /// A deadline is put in the lowest level that reaches it, and moved to lower
+  /// levels as time advances, until it expires from the first level. Adding
+  /// and removing a deadline are in constant time. Deadlines further than the
+  /// span of the wheel (about 46 hours with a resolution of 10 ms) are
+  /// clamped to this span.
+  ///
+  /// Deadlines expire at the first tick at or after them, so up to a
+  /// resolution late. This class is not thread-safe.
+  class QI_API TimerWheel
+  {
+  public:
+    using Key = std::uint64_t;
+
+    static const std::size_t slotBits = 6;
+    static const std::size_t slotCount = std::size_t{1} << slotBits;
+    static const std::size_t levelCount = 4;
+
+    explicit TimerWheel(Duration resolution, SteadyClock::time_point start = SteadyClock::now());
+
+    /// Sets the deadline of the key, replacing its previous one if any.
+    void add(Key key, SteadyClock::time_point deadline);
+
+    /// Removes the deadline of the key. Returns false if it has none.
+    bool remove(Key key);
+
+    /// Advances the wheel to the given time, and returns the keys whose
+    /// deadline expired. They are removed from the wheel.
+    std::vector<Key> advance(SteadyClock::time_point now);
+
+    std::size_t size() const { return _positions.size(); }
+    bool empty() const { return _positions.empty(); }
+    Duration resolution() const { return _resolution; }
+
+  private:
+    struct Node
+    {
+      Key key;
+      std::uint64_t tick;
+    };
+    using Slot = std::vector<Node>;
+    struct Position
+    {
+      std::uint32_t level;
+      std::uint32_t slot;
+      std::size_t index;
+    };
+
+    std::uint64_t tickOf(SteadyClock::time_point time, bool roundUp) const;
+    void insert(const Node& node);
+    void erase(const Position& position);
+    void cascade(std::size_t level);
+
+    Duration _resolution;
+    SteadyClock::time_point _start;
+    std::uint64_t _tick;
+    std::array<std::array<Slot, slotCount>, levelCount> _levels;
+    std::unordered_map<Key, Position> _positions;
+  };
+}
+
+#endif // _SRC_TIMERWHEEL_HPP_
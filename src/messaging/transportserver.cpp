@@ -27,6 +27,7 @@
 #include "transportserver.hpp"
 #include "messagesocket.hpp"
 #include "transportserverasio_p.hpp"
+#include "transportserverlocal_p.hpp"
 
 qiLogCategory("qimessaging.transportserver");
 
@@ -48,6 +49,12 @@ namespace qi
     {
       impl = TransportServerAsioPrivate::make(this, ctx);
     }
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    else if (url.protocol() == "unix")
+    {
+      impl = TransportServerLocalPrivate::make(this, ctx);
+    }
+#endif
     else
     {
       const char* s = "Unrecognized protocol to create the TransportServer.";
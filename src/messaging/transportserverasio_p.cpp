@@ -2,6 +2,7 @@
 **  Copyright (C) 2012 Aldebaran Robotics
 **  See COPYING for the license
 */
+#include <algorithm>
 #include <string>
 #include <cstring>
 #include <cstdlib>
@@ -19,8 +20,11 @@
 #include "tcpmessagesocket.hpp"
 #include <qi/messaging/sock/traits.hpp>
 #include <qi/messaging/sock/sslcontextptr.hpp>
+#include <qi/messaging/sock/sslsession.hpp>
 
+#include <qi/application.hpp>
 #include <qi/eventloop.hpp>
+#include <qi/os.hpp>
 
 #include "transportserverasio_p.hpp"
 
@@ -31,9 +35,51 @@ namespace qi
   const int ifsMonitoringTimeout = 5 * 1000 * 1000; // in usec
   const int64_t TransportServerAsioPrivate::AcceptDownRetryTimerUs = 60 * 1000 * 1000; // 60 seconds in usec
 
+  namespace
+  {
+#if defined(SO_REUSEPORT)
+    using ReusePort = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+    // Returns the event loop of the acceptor shard of the given index
+    // (starting at 1). These event loops are shared by all the servers of the
+    // process, and live until the application exits, as the connections they
+    // accepted may outlive the servers.
+    EventLoop* shardEventLoop(std::size_t index)
+    {
+      static boost::mutex mutex;
+      static std::vector<EventLoop*> eventLoops;
+      boost::mutex::scoped_lock lock(mutex);
+      while (eventLoops.size() < index)
+      {
+        const auto name = "EventLoopNetworkAccept" + std::to_string(eventLoops.size() + 1);
+        auto eventLoop = new EventLoop(name, 1, false);
+        eventLoops.push_back(eventLoop);
+        Application::atExit([eventLoop] { delete eventLoop; });
+      }
+      return eventLoops[index - 1];
+    }
+  }
+
+  std::size_t TransportServerAsioPrivate::acceptorCountFromEnv()
+  {
+    static const std::size_t count = [] {
+      const auto env = qi::os::getenv("QI_TRANSPORT_SERVER_ACCEPTORS");
+      const auto value = env.empty() ? 1 : static_cast<std::size_t>(strtoul(env.c_str(), 0, 0));
+#if !defined(SO_REUSEPORT)
+      if (value > 1)
+        qiLogWarning() << "SO_REUSEPORT is not supported, QI_TRANSPORT_SERVER_ACCEPTORS is ignored.";
+      return std::size_t{1};
+#else
+      return std::max(value, std::size_t{1});
+#endif
+    }();
+    return count;
+  }
+
   void _onAccept(TransportServerImplPtr p,
                  const boost::system::error_code& erc,
-                 sock::SocketWithContextPtr<sock::NetworkAsio> s
+                 sock::SocketWithContextPtr<sock::TcpNetwork> s
                  )
   {
     boost::shared_ptr<TransportServerAsioPrivate> ts = boost::dynamic_pointer_cast<TransportServerAsioPrivate>(p);
@@ -57,7 +103,7 @@ namespace qi
   }
 
   void TransportServerAsioPrivate::onAccept(const boost::system::error_code& erc,
-    sock::SocketWithContextPtr<sock::NetworkAsio> s
+    sock::SocketWithContextPtr<sock::TcpNetwork> s
     )
   {
     qiLogDebug() << this << " onAccept";
@@ -85,19 +131,148 @@ namespace qi
     }
     else
     {
-        auto socket = boost::make_shared<qi::TcpMessageSocket<>>(*asIoServicePtr(context), _ssl, s);
-        qiLogDebug() << "New socket accepted: " << socket.get();
+      newConnection(*asIoServicePtr(context), s);
+    }
+    _s = sock::makeSocketWithContextPtr<sock::TcpNetwork>(_acceptor->get_io_service(), _sslContext);
+    _acceptor->async_accept(_s->lowest_layer(),
+                           boost::bind(_onAccept, shared_from_this(), _1, _s));
+  }
+
+  void TransportServerAsioPrivate::newConnection(boost::asio::io_service& io,
+    sock::SocketWithContextPtr<sock::TcpNetwork> s)
+  {
+    auto socket = boost::make_shared<qi::TcpMessageSocket<>>(io, _ssl, s);
+    qiLogDebug() << "New socket accepted: " << socket.get();
 
-        self->newConnection(std::pair<MessageSocketPtr, Url>{
-          socket, sock::remoteEndpoint(*s, _ssl)});
+    self->newConnection(std::pair<MessageSocketPtr, Url>{
+      socket, sock::remoteEndpoint(*s, _ssl)});
 
-        if (socket.unique()) {
-            qiLogError() << "bug: socket not stored by the newConnection handler (usecount:" << socket.use_count() << ")";
+    if (socket.unique()) {
+        qiLogError() << "bug: socket not stored by the newConnection handler (usecount:" << socket.use_count() << ")";
+    }
+  }
+
+  void TransportServerAsioPrivate::onShardAccept(const AcceptorShardPtr& shard,
+    const boost::system::error_code& erc, sock::SocketWithContextPtr<sock::TcpNetwork> s)
+  {
+    qiLogDebug() << this << " onShardAccept " << shard->index;
+    boost::mutex::scoped_lock lock(_acceptCloseMutex);
+    if (!_live)
+    {
+      return;
+    }
+    if (erc)
+    {
+      qiLogDebug() << "accept error on shard " << shard->index << ": " << erc.message();
+      self->acceptError(erc.value());
+      if (isFatalAcceptError(erc.value()))
+      {
+        // The other acceptors keep accepting the connections.
+        qiLogError() << "fatal accept error on shard " << shard->index << ": " << erc.value()
+                     << ", disabling it, retrying in " << AcceptDownRetryTimerUs << "us";
+        shard->acceptor->close();
+        _shards.erase(std::remove(_shards.begin(), _shards.end(), shard), _shards.end());
+        if (context)
+        {
+          boost::weak_ptr<TransportServerAsioPrivate> weakServer = shared_from_this();
+          context->asyncDelay([weakServer] {
+            if (auto server = weakServer.lock())
+              server->restartShards();
+          }, qi::MicroSeconds(AcceptDownRetryTimerUs));
         }
+        return;
+      }
     }
-    _s = sock::makeSocketWithContextPtr<sock::NetworkAsio>(_acceptor->get_io_service(), _sslContext);
-    _acceptor->async_accept(_s->lowest_layer(),
-                           boost::bind(_onAccept, shared_from_this(), _1, _s));
+    else
+    {
+      newConnection(*asIoServicePtr(shard->eventLoop), s);
+    }
+    acceptShard(shard);
+  }
+
+  void TransportServerAsioPrivate::acceptShard(const AcceptorShardPtr& shard)
+  {
+    shard->socket = sock::makeSocketWithContextPtr<sock::TcpNetwork>(
+      *asIoServicePtr(shard->eventLoop), _sslContext);
+    auto server = shared_from_this();
+    auto socket = shard->socket;
+    shard->acceptor->async_accept(shard->socket->lowest_layer(),
+      [server, shard, socket](const boost::system::error_code& erc) {
+        server->onShardAccept(shard, erc, socket);
+      });
+  }
+
+  void TransportServerAsioPrivate::listenShards(const boost::asio::ip::tcp::endpoint& ep)
+  {
+#if defined(SO_REUSEPORT)
+    _shardEndpoint = ep;
+    // The shards are kept if the main acceptor is restarted: only the missing
+    // ones are opened, each one on its own event loop.
+    for (std::size_t index = 1; index < _acceptorCount; ++index)
+    {
+      const auto isOpen = std::any_of(_shards.begin(), _shards.end(),
+        [index](const AcceptorShardPtr& shard) { return shard->index == index; });
+      if (isOpen)
+        continue;
+      auto eventLoop = shardEventLoop(index);
+      std::unique_ptr<boost::asio::ip::tcp::acceptor> acceptor(
+        new boost::asio::ip::tcp::acceptor(*asIoServicePtr(eventLoop)));
+      boost::system::error_code ec;
+      acceptor->open(ep.protocol(), ec);
+      if (!ec)
+        fcntl(acceptor->native_handle(), F_SETFD, FD_CLOEXEC);
+      if (!ec)
+        acceptor->set_option(boost::asio::socket_base::reuse_address(true), ec);
+      if (!ec)
+        acceptor->set_option(ReusePort(true), ec);
+      if (!ec)
+        acceptor->bind(ep, ec);
+      if (!ec)
+        acceptor->listen(boost::asio::socket_base::max_connections, ec);
+      if (ec)
+      {
+        qiLogWarning() << "Cannot open acceptor shard " << index << " on " << ep << ": "
+                       << ec.message() << ", using " << _shards.size() + 1 << " acceptor(s).";
+        return;
+      }
+      auto shard = std::make_shared<AcceptorShard>(
+        AcceptorShard{index, eventLoop, std::move(acceptor), {}});
+      _shards.push_back(shard);
+      acceptShard(shard);
+    }
+#else
+    QI_UNUSED(ep);
+#endif
+  }
+
+  void TransportServerAsioPrivate::restartShards()
+  {
+    boost::mutex::scoped_lock lock(_acceptCloseMutex);
+    if (!_live)
+      return;
+    qiLogDebug() << this << " Attempting to restart acceptor shards";
+    listenShards(_shardEndpoint);
+  }
+
+  void TransportServerAsioPrivate::setAcceptorCount(std::size_t count)
+  {
+    boost::mutex::scoped_lock lock(_acceptCloseMutex);
+    _acceptorCount = std::max(count, std::size_t{1});
+  }
+
+  std::size_t TransportServerAsioPrivate::shardCount() const
+  {
+    boost::mutex::scoped_lock lock(_acceptCloseMutex);
+    return _shards.size();
+  }
+
+  std::vector<int> TransportServerAsioPrivate::shardHandles() const
+  {
+    boost::mutex::scoped_lock lock(_acceptCloseMutex);
+    std::vector<int> handles;
+    for (const auto& shard: _shards)
+      handles.push_back(static_cast<int>(shard->acceptor->native_handle()));
+    return handles;
   }
 
   void TransportServerAsioPrivate::close() {
@@ -115,6 +290,8 @@ namespace qi
     _live = false;
     if (_acceptor)
       _acceptor->close();
+    for (auto& shard: _shards)
+      shard->acceptor->close();
   }
 
   /*
@@ -235,6 +412,12 @@ namespace qi
     fcntl(_acceptor->native(), F_SETFD, FD_CLOEXEC);
 #endif
     _acceptor->set_option(option);
+#if defined(SO_REUSEPORT)
+    if (_acceptorCount > 1)
+    {
+      _acceptor->set_option(ReusePort(true));
+    }
+#endif
     try
     {
       _acceptor->bind(ep);
@@ -296,11 +479,18 @@ namespace qi
         | boost::asio::ssl::context::no_sslv2);
       _sslContext->use_certificate_chain_file(self->_identityCertificate.c_str());
       _sslContext->use_private_key_file(self->_identityKey.c_str(), boost::asio::ssl::context::pem);
+      sock::setupSslSessionResumption(_sslContext->native_handle());
     }
 
-    _s = sock::makeSocketWithContextPtr<sock::NetworkAsio>(_acceptor->get_io_service(), _sslContext);
+    _s = sock::makeSocketWithContextPtr<sock::TcpNetwork>(_acceptor->get_io_service(), _sslContext);
     _acceptor->async_accept(_s->lowest_layer(),
       boost::bind(_onAccept, shared_from_this(), _1, _s));
+    {
+      // The shards bind to the effective port.
+      boost::mutex::scoped_lock lock(_acceptCloseMutex);
+      if (_live)
+        listenShards(ip::tcp::endpoint(ep.address(), _port));
+    }
     _connectionPromise.setValue(0);
     return _connectionPromise.future();
   }
@@ -332,11 +522,12 @@ namespace qi
     , _self(self)
     , _acceptor(new boost::asio::ip::tcp::acceptor(*asIoServicePtr(ctx)))
     , _live(true)
-    , _sslContext(sock::makeSslContextPtr<sock::NetworkAsio>(*asIoServicePtr(ctx),
-                                                             sock::SslContext<sock::NetworkAsio>::sslv23))
+    , _sslContext(sock::makeSslContextPtr<sock::TcpNetwork>(*asIoServicePtr(ctx),
+                                                             sock::SslContext<sock::TcpNetwork>::sslv23))
     , _s()
     , _ssl(false)
     , _port(0)
+    , _acceptorCount(acceptorCountFromEnv())
   {
   }
 
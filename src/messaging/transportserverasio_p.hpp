@@ -11,10 +11,12 @@
 # include <boost/asio/ssl.hpp>
 #include <boost/thread/synchronized_value.hpp>
 #include <atomic>
+#include <memory>
+#include <vector>
 
 # include <qi/api.hpp>
 # include <qi/url.hpp>
-# include <qi/messaging/sock/networkasio.hpp>
+# include <qi/messaging/sock/networkiouring.hpp>
 # include <qi/messaging/sock/traits.hpp>
 # include <qi/messaging/sock/socketptr.hpp>
 # include "transportserver.hpp"
@@ -41,11 +43,11 @@ namespace qi
     TransportServer* _self;
     boost::asio::ip::tcp::acceptor* _acceptor;
     void onAccept(const boost::system::error_code& erc,
-      sock::SocketWithContextPtr<sock::NetworkAsio> s);
+      sock::SocketWithContextPtr<sock::TcpNetwork> s);
     TransportServerAsioPrivate();
     std::atomic<bool> _live;
-    sock::SslContextPtr<sock::NetworkAsio> _sslContext;
-    sock::SocketWithContextPtr<sock::NetworkAsio> _s;
+    sock::SslContextPtr<sock::TcpNetwork> _sslContext;
+    sock::SocketWithContextPtr<sock::TcpNetwork> _s;
     bool _ssl;
     unsigned short _port;
     boost::synchronized_value<qi::Future<void>> _asyncEndpoints;
@@ -55,12 +57,52 @@ namespace qi
     // Typically, the TransportServer this class has a pointer to closes implementations
     // in its destructor. Without protection, this class can end up using a
     // dangling pointer on the TransportServer.
-    boost::mutex _acceptCloseMutex;
+    mutable boost::mutex _acceptCloseMutex;
 
     static const int64_t AcceptDownRetryTimerUs;
 
+    /// Count of acceptors listening on the same endpoint, can be set by the
+    /// `QI_TRANSPORT_SERVER_ACCEPTORS` environment variable. The default is 1.
+    static std::size_t acceptorCountFromEnv();
+
+    /// Sets the count of acceptors of the next calls to `listen`, which is
+    /// `acceptorCountFromEnv()` by default.
+    void setAcceptorCount(std::size_t count);
+
+    /// Count of additional acceptors currently accepting connections.
+    std::size_t shardCount() const;
+
+    /// Native handles of the additional acceptors.
+    std::vector<int> shardHandles() const;
+
   private:
+    /// An additional acceptor, listening on the same endpoint as the main one
+    /// thanks to SO_REUSEPORT. It runs on its own network event loop, as do
+    /// the connections it accepts, so that accepting connections and their
+    /// TLS handshakes are spread across threads.
+    ///
+    /// A shard whose accept fails fatally is removed, and opened again after
+    /// the same delay as the main acceptor.
+    struct AcceptorShard
+    {
+      std::size_t index;
+      EventLoop* eventLoop;
+      std::unique_ptr<boost::asio::ip::tcp::acceptor> acceptor;
+      sock::SocketWithContextPtr<sock::TcpNetwork> socket;
+    };
+    using AcceptorShardPtr = std::shared_ptr<AcceptorShard>;
+    // Synchronized with _acceptCloseMutex once listening.
+    std::vector<AcceptorShardPtr> _shards;
+    std::size_t _acceptorCount;
+    boost::asio::ip::tcp::endpoint _shardEndpoint;
+
     void restartAcceptor();
+    void listenShards(const boost::asio::ip::tcp::endpoint& ep);
+    void restartShards();
+    void acceptShard(const AcceptorShardPtr& shard);
+    void onShardAccept(const AcceptorShardPtr& shard, const boost::system::error_code& erc,
+      sock::SocketWithContextPtr<sock::TcpNetwork> s);
+    void newConnection(boost::asio::io_service& io, sock::SocketWithContextPtr<sock::TcpNetwork> s);
   };
 }
 
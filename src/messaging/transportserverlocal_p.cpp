@@ -0,0 +1,163 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+#include <boost/asio.hpp>
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <qi/log.hpp>
+#include "messagesocket.hpp"
+#include "tcpmessagesocket.hpp"
+#include "transportserverlocal_p.hpp"
+
+qiLogCategory("qimessaging.transportserver");
+
+namespace qi
+{
+  namespace
+  {
+    /// Removes the socket file at `path` if no server accepts connections on it.
+    /// Returns false if the file is still in use.
+    bool removeStaleSocketFile(boost::asio::io_service& io, const std::string& path)
+    {
+      boost::system::error_code erc;
+      if (!boost::filesystem::exists(path, erc))
+        return true;
+      {
+        boost::asio::local::stream_protocol::socket probe(io);
+        probe.connect(boost::asio::local::stream_protocol::endpoint(path), erc);
+        if (!erc)
+          return false;
+      }
+      qiLogVerbose() << "Removing stale socket file " << path;
+      boost::filesystem::remove(path, erc);
+      return true;
+    }
+  }
+
+  TransportServerLocalPrivate::TransportServerLocalPrivate(TransportServer* self, EventLoop* ctx)
+    : TransportServerImpl(self, ctx)
+    , _live(true)
+    , _acceptor(*asIoServicePtr(ctx))
+    , _context(sock::makeSslContextPtr<N>(sock::SslContext<N>::sslv23))
+  {
+  }
+
+  boost::shared_ptr<TransportServerLocalPrivate> TransportServerLocalPrivate::make(
+      TransportServer* self,
+      EventLoop* ctx)
+  {
+    return boost::shared_ptr<TransportServerLocalPrivate>{new TransportServerLocalPrivate(self, ctx)};
+  }
+
+  TransportServerLocalPrivate::~TransportServerLocalPrivate()
+  {
+  }
+
+  qi::Future<void> TransportServerLocalPrivate::listen(const qi::Url& url)
+  {
+    _listenUrl = url;
+    _path = url.host();
+    if (_path.empty())
+    {
+      const char* s = "Listen error: no socket path.";
+      qiLogError() << s;
+      return qi::makeFutureError<void>(s);
+    }
+
+    auto& io = *asIoServicePtr(context);
+    if (!removeStaleSocketFile(io, _path))
+    {
+      const std::string s = "Listen error: a server is already listening on " + _path;
+      qiLogError() << s;
+      return qi::makeFutureError<void>(s);
+    }
+
+    boost::system::error_code ec;
+    const sock::NetworkAsioLocal::protocol_type::endpoint ep(_path);
+    _acceptor.open(ep.protocol(), ec);
+    if (!ec)
+      _acceptor.bind(ep, ec);
+    if (!ec)
+      _acceptor.listen(boost::asio::socket_base::max_connections, ec);
+    if (ec)
+    {
+      std::stringstream ss;
+      ss << "failed to listen on " << _path << ": " << ec.message();
+      qiLogError("qimessaging.server.listen") << ss.str();
+      return qi::makeFutureError<void>(ss.str());
+    }
+#ifndef _WIN32
+    fcntl(_acceptor.native_handle(), F_SETFD, FD_CLOEXEC);
+#endif
+
+    {
+      boost::mutex::scoped_lock l(_endpointsMutex);
+      _endpoints.push_back(Url{"unix://" + _path});
+      qiLogInfo() << "TransportServer will listen on: " << _endpoints.back().str();
+    }
+
+    startAccept();
+    _connectionPromise.setValue(0);
+    return _connectionPromise.future();
+  }
+
+  void TransportServerLocalPrivate::startAccept()
+  {
+    _s = sock::makeSocketWithContextPtr<N>(*asIoServicePtr(context), _context);
+    auto server = shared_from_this();
+    auto s = _s;
+    _acceptor.async_accept(_s->lowest_layer(), [=](const boost::system::error_code& erc) {
+      server->onAccept(erc, s);
+    });
+  }
+
+  void TransportServerLocalPrivate::onAccept(const boost::system::error_code& erc,
+                                             sock::SocketWithContextPtr<N> s)
+  {
+    qiLogDebug() << this << " onAccept";
+    boost::mutex::scoped_lock lock(_acceptCloseMutex);
+    if (!_live)
+      return;
+    if (erc)
+    {
+      qiLogDebug() << "accept error " << erc.message();
+      self->acceptError(erc.value());
+      // Unlike TCP, there is no network interface that could come back: an
+      // error on a local acceptor means it is unusable.
+      if (erc == boost::asio::error::operation_aborted
+          || erc == boost::asio::error::bad_descriptor)
+        return;
+    }
+    else
+    {
+      auto socket = boost::make_shared<LocalMessageSocket>(*asIoServicePtr(context),
+                                                           sock::SslEnabled{false}, s);
+      qiLogDebug() << "New local socket accepted: " << socket.get();
+      self->newConnection(std::pair<MessageSocketPtr, Url>{
+        socket, sock::remoteEndpoint(*s, false)});
+
+      if (socket.unique())
+        qiLogError() << "bug: socket not stored by the newConnection handler (usecount:" << socket.use_count() << ")";
+    }
+    startAccept();
+  }
+
+  void TransportServerLocalPrivate::close()
+  {
+    qiLogDebug() << this << " close";
+    boost::mutex::scoped_lock l(_acceptCloseMutex);
+    if (!_live.exchange(false))
+      return;
+    boost::system::error_code erc;
+    const bool wasOpen = _acceptor.is_open();
+    _acceptor.close(erc);
+    if (wasOpen && !_path.empty())
+      boost::filesystem::remove(_path, erc);
+  }
+}
+
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
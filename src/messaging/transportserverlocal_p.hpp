@@ -0,0 +1,68 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_TRANSPORTSERVERLOCAL_P_HPP_
+#define _SRC_TRANSPORTSERVERLOCAL_P_HPP_
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <qi/url.hpp>
+#include <qi/messaging/sock/networkasiolocal.hpp>
+#include <qi/messaging/sock/socketptr.hpp>
+#include "transportserver.hpp"
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+namespace qi
+{
+  /// Accepts connections on a local (Unix-domain) stream socket.
+  ///
+  /// The listen URL has the form `unix:///path/to/socket`. The socket file is
+  /// created when listening and removed when closing. A socket file left by a
+  /// dead process is replaced, but listening fails if another server is still
+  /// accepting connections on it.
+  class TransportServerLocalPrivate
+    : public TransportServerImpl
+    , public boost::enable_shared_from_this<TransportServerLocalPrivate>
+  {
+    using N = sock::NetworkAsioLocal;
+
+    TransportServerLocalPrivate(TransportServer* self, EventLoop* ctx);
+
+  public:
+    static boost::shared_ptr<TransportServerLocalPrivate> make(
+        TransportServer* self,
+        EventLoop* ctx);
+
+    ~TransportServerLocalPrivate() override;
+
+    qi::Future<void> listen(const qi::Url& listenUrl) override;
+    void close() override;
+    void onAccept(const boost::system::error_code& erc,
+                  sock::SocketWithContextPtr<N> s);
+
+  private:
+    void startAccept();
+
+    std::atomic<bool> _live;
+    sock::Acceptor<N> _acceptor;
+    sock::SslContextPtr<N> _context;
+    sock::SocketWithContextPtr<N> _s;
+    Url _listenUrl;
+    std::string _path;
+
+    // The server must avoid being closed while accepting a connection.
+    // See TransportServerAsioPrivate.
+    boost::mutex _acceptCloseMutex;
+  };
+}
+
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+#endif  // _SRC_TRANSPORTSERVERLOCAL_P_HPP_
@@ -6,10 +6,12 @@
 #include <sstream>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/range/algorithm/find_if.hpp>
 
 #include <qi/log.hpp>
 #include <qi/numeric.hpp>
+#include <qi/os.hpp>
 
 #include "messagesocket.hpp"
 #include "transportsocketcache.hpp"
@@ -19,7 +21,8 @@ qiLogCategory("qimessaging.transportsocketcache");
 namespace qi
 {
 TransportSocketCache::TransportSocketCache()
-  : _dying(false)
+  : _poolSizes(poolSizesFromEnv())
+  , _dying(false)
 {
 }
 
@@ -62,11 +65,13 @@ void TransportSocketCache::close()
   {
     ConnectionMap map;
     std::list<MessageSocketPtr> pending;
+    std::map<PoolKey, Pool> pools;
     {
       boost::mutex::scoped_lock lock(_socketMutex);
       _dying = true;
       std::swap(map, _connections);
       std::swap(pending, _allPendingConnections);
+      std::swap(pools, _pools);
     }
     for (auto& pairMachineIdConnection: map)
     {
@@ -93,6 +98,15 @@ void TransportSocketCache::close()
     {
       socket->disconnect();
     }
+    for (auto& pairKeyPool: pools)
+    {
+      auto& pool = pairKeyPool.second;
+      for (std::size_t i = 0; i < pool.sockets.size(); ++i)
+      {
+        pool.sockets[i]->disconnect();
+        pool.sockets[i]->disconnected.disconnect(pool.disconnectionTrackings[i]);
+      }
+    }
   }
 
   /// Release all disconnect promises to avoid deadlocks.
@@ -107,19 +121,53 @@ bool isLocalHost(const std::string& host)
   return boost::algorithm::starts_with(host, "127.") || host == "localhost";
 }
 
-static UrlVector localhost_only(const UrlVector& input)
+static bool isLocalSocket(const Url& url)
+{
+  return url.protocol() == "unix";
+}
+
+/// Predicate<Url> P
+template<typename P>
+static UrlVector filter(const UrlVector& input, P pred)
 {
   UrlVector result;
   result.reserve(input.size());
   for (const auto& url: input)
   {
-    if (isLocalHost(url.host()))
+    if (pred(url))
       result.push_back(url);
   }
   return result;
 }
 
+static UrlVector localhost_only(const UrlVector& input)
+{
+  return filter(input, [](const Url& url) { return isLocalHost(url.host()); });
+}
+
+static UrlVector local_socket_only(const UrlVector& input)
+{
+  return filter(input, &isLocalSocket);
+}
+
+static UrlVector without_local_socket(const UrlVector& input)
+{
+  return filter(input, [](const Url& url) { return !isLocalSocket(url); });
+}
+
 Future<MessageSocketPtr> TransportSocketCache::socket(const ServiceInfo& servInfo, const std::string& url)
+{
+  const auto size = poolSize(servInfo.name());
+  auto primary = primarySocket(servInfo, url);
+  if (size <= 1)
+    return primary;
+  const auto machineId = servInfo.machineId();
+  return primary.andThen(track([=](const MessageSocketPtr& socket) {
+    return pooledSocket(machineId, socket, size);
+  }, this)).unwrap();
+}
+
+Future<MessageSocketPtr> TransportSocketCache::primarySocket(const ServiceInfo& servInfo, const std::string& url)
 {
   const std::string& machineId = servInfo.machineId();
   ConnectionAttemptPtr couple = boost::make_shared<ConnectionAttempt>();
@@ -127,14 +175,20 @@ Future<MessageSocketPtr> TransportSocketCache::socket(const ServiceInfo& servInf
   bool local = machineId == os::getMachineId();
   UrlVector connectionCandidates;
 
-  // If the connection is local, we're mainly interested in localhost endpoint
+  // If the connection is local, we're mainly interested in local socket
+  // endpoints, and then in localhost endpoints.
   if (local)
-    connectionCandidates = localhost_only(servInfo.endpoints());
+  {
+    connectionCandidates = local_socket_only(servInfo.endpoints());
+    if (connectionCandidates.empty())
+      connectionCandidates = localhost_only(servInfo.endpoints());
+  }
 
   // If the connection isn't local or if the service doesn't expose local endpoints,
-  // try and connect to whatever is available.
+  // try and connect to whatever is available, except local sockets of a remote
+  // machine.
   if (connectionCandidates.size() == 0)
-    connectionCandidates = servInfo.endpoints();
+    connectionCandidates = local ? servInfo.endpoints() : without_local_socket(servInfo.endpoints());
 
   couple->endpoint = MessageSocketPtr();
   couple->state = State_Pending;
@@ -187,6 +241,191 @@ Future<MessageSocketPtr> TransportSocketCache::socket(const ServiceInfo& servInf
   return couple->promise.future();
 }
 
+/// Remove infos of the given socket and set the associated promise.
+///
+/// Container<DisconnectInfo> C
+template<typename C>
+static void updateDisconnectInfos(C& disconnectInfos, const MessageSocketPtr& socket)
+{
+  // TODO: Replace `using` by `auto` in lambda when C++14 is available.
+  using Value = typename C::value_type;
+  const auto it = boost::find_if(disconnectInfos, [&](const Value& d) {
+    return d.socket == socket;
+  });
+  if (it == disconnectInfos.end())
+  {
+    // We should not fall into this if statement, but due to the racy nature of
+    // the disconnection, it does indeed occur. Fixing this would be
+    // a significant rearchitecture, and we choose for now to lower the log
+    // level because there does not seem to be any other side effect besides the
+    // warning.
+    qiLogVerbose() << "Disconnected socket not found in disconnect infos.";
+    return;
+  }
+  auto promise = (*it).promiseSocketRemoved;
+  disconnectInfos.erase(it);
+  promise.setValue(0);
+}
+
+Future<MessageSocketPtr> TransportSocketCache::pooledSocket(const std::string& machineId,
+                                                            MessageSocketPtr primary,
+                                                            unsigned int size)
+{
+  // Sockets accepted by a server have no url to connect other sockets to.
+  const Url url = primary->url();
+  if (!url.isValid())
+    return Future<MessageSocketPtr>(primary);
+
+  boost::mutex::scoped_lock lock(_socketMutex);
+  if (_dying)
+    return makeFutureError<MessageSocketPtr>("TransportSocketCache is closed.");
+
+  const PoolKey key{machineId, url};
+  const auto poolIt = _pools.find(key);
+  if (poolIt == _pools.end())
+  {
+    // The first socket of the pool is given first.
+    _pools[key].next = 1;
+    return Future<MessageSocketPtr>(primary);
+  }
+  auto& pool = poolIt->second;
+  if (1 + pool.sockets.size() + pool.pendingCount < size)
+  {
+    ++pool.pendingCount;
+    MessageSocketPtr socket = makeMessageSocket(url.protocol());
+    _allPendingConnections.push_back(socket);
+    Promise<MessageSocketPtr> promise;
+    qiLogDebug() << "Adding socket " << socket.get() << " to the pool of [" << machineId << "][" << url.str() << "]";
+    Future<void> sockFuture = socket->connect(url);
+    sockFuture.then(std::bind(&TransportSocketCache::onPoolSocketConnectionAttempt, this,
+                              std::placeholders::_1, socket, promise, primary, key));
+    return promise.future();
+  }
+
+  // The pool is full: take the socket with the least queued bytes, starting
+  // from the one after the last socket taken.
+  const auto count = pool.sockets.size() + 1;
+  const auto socketAt = [&](std::size_t index) {
+    return index == 0 ? primary : pool.sockets[index - 1];
+  };
+  auto best = pool.next % count;
+  auto bestBytes = socketAt(best)->sendQueueStats().bytes;
+  for (std::size_t i = 1; i < count && bestBytes != 0; ++i)
+  {
+    const auto index = (pool.next + i) % count;
+    const auto bytes = socketAt(index)->sendQueueStats().bytes;
+    if (bytes < bestBytes)
+    {
+      best = index;
+      bestBytes = bytes;
+    }
+  }
+  pool.next = best + 1;
+  return Future<MessageSocketPtr>(socketAt(best));
+}
+
+void TransportSocketCache::onPoolSocketConnectionAttempt(Future<void> fut,
+                                                         MessageSocketPtr socket,
+                                                         Promise<MessageSocketPtr> prom,
+                                                         MessageSocketPtr primary,
+                                                         const PoolKey& key)
+{
+  boost::mutex::scoped_lock lock(_socketMutex);
+  _allPendingConnections.remove(socket);
+  if (_dying)
+  {
+    qiLogDebug() << "PoolConnectionAttempt: TransportSocketCache is closed";
+    if (!fut.hasError())
+      socket->disconnect();
+    prom.setError("TransportSocketCache is closed.");
+    return;
+  }
+
+  auto& pool = _pools[key];
+  --pool.pendingCount;
+  if (fut.hasError())
+  {
+    // The pool is an optimization: fall back to its first socket.
+    qiLogVerbose() << "Could not add a socket to the pool of " << key.second.str() << ": " << fut.error();
+    prom.setValue(primary);
+    return;
+  }
+  pool.disconnectionTrackings.push_back(socket->disconnected.connect(
+      track([=](const std::string&) { onPoolSocketDisconnected(socket, key); }, this)));
+  pool.sockets.push_back(socket);
+  prom.setValue(socket);
+}
+
+void TransportSocketCache::onPoolSocketDisconnected(MessageSocketPtr socket, const PoolKey& key)
+{
+  boost::mutex::scoped_lock lock(_socketMutex);
+  auto poolIt = _pools.find(key);
+  if (poolIt == _pools.end())
+    return;
+  auto& pool = poolIt->second;
+  const auto it = std::find(pool.sockets.begin(), pool.sockets.end(), socket);
+  if (it != pool.sockets.end())
+  {
+    pool.disconnectionTrackings.erase(pool.disconnectionTrackings.begin() + (it - pool.sockets.begin()));
+    pool.sockets.erase(it);
+  }
+  auto syncDisconnectInfos = _disconnectInfos.synchronize();
+  updateDisconnectInfos(*syncDisconnectInfos, socket);
+}
+
+void TransportSocketCache::setPoolSize(const std::string& serviceName, unsigned int size)
+{
+  boost::mutex::scoped_lock lock(_poolSizesMutex);
+  if (size == 0)
+    _poolSizes.serviceSizes.erase(serviceName);
+  else
+    _poolSizes.serviceSizes[serviceName] = size;
+}
+
+void TransportSocketCache::setDefaultPoolSize(unsigned int size)
+{
+  boost::mutex::scoped_lock lock(_poolSizesMutex);
+  _poolSizes.defaultSize = std::max(size, 1u);
+}
+
+unsigned int TransportSocketCache::poolSize(const std::string& serviceName) const
+{
+  boost::mutex::scoped_lock lock(_poolSizesMutex);
+  const auto it = _poolSizes.serviceSizes.find(serviceName);
+  return it == _poolSizes.serviceSizes.end() ? _poolSizes.defaultSize : it->second;
+}
+
+TransportSocketCache::PoolSizes TransportSocketCache::poolSizesFromEnv()
+{
+  PoolSizes sizes;
+  const std::string env = qi::os::getenv("QI_TRANSPORT_SOCKET_POOL");
+  std::vector<std::string> entries;
+  boost::algorithm::split(entries, env, boost::algorithm::is_any_of(","));
+  for (auto& entry: entries)
+  {
+    boost::algorithm::trim(entry);
+    if (entry.empty())
+      continue;
+    const auto separator = entry.rfind('=');
+    try
+    {
+      if (separator == std::string::npos)
+      {
+        sizes.defaultSize = std::max(boost::lexical_cast<unsigned int>(entry), 1u);
+        continue;
+      }
+      const auto size = boost::lexical_cast<unsigned int>(entry.substr(separator + 1));
+      if (size != 0)
+        sizes.serviceSizes[entry.substr(0, separator)] = size;
+    }
+    catch (const boost::bad_lexical_cast&)
+    {
+      qiLogWarning() << "Invalid QI_TRANSPORT_SOCKET_POOL entry: " << entry;
+    }
+  }
+  return sizes;
+}
+
 FutureSync<void> TransportSocketCache::disconnect(MessageSocketPtr socket)
 {
   Promise<void> promiseSocketRemoved;
@@ -357,32 +596,6 @@ void TransportSocketCache::checkClear(ConnectionAttemptPtr attempt, const std::s
   }
 }
 
-/// Remove infos of the given socket and set the associated promise.
-///
-/// Container<DisconnectInfo> C
-template<typename C>
-static void updateDisconnectInfos(C& disconnectInfos, const MessageSocketPtr& socket)
-{
-  // TODO: Replace `using` by `auto` in lambda when C++14 is available.
-  using Value = typename C::value_type;
-  const auto it = boost::find_if(disconnectInfos, [&](const Value& d) {
-    return d.socket == socket;
-  });
-  if (it == disconnectInfos.end())
-  {
-    // We should not fall into this if statement, but due to the racy nature of
-    // the disconnection, it does indeed occur. Fixing this would be
-    // a significant rearchitecture, and we choose for now to lower the log
-    // level because there does not seem to be any other side effect besides the
-    // warning.
-    qiLogVerbose() << "Disconnected socket not found in disconnect infos.";
-    return;
-  }
-  auto promise = (*it).promiseSocketRemoved;
-  disconnectInfos.erase(it);
-  promise.setValue(0);
-}
-
 void TransportSocketCache::onSocketDisconnected(Url url, const ServiceInfo& info)
 {
   // remove from the available connections
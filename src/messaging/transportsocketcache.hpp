@@ -8,7 +8,9 @@
 #define _SRC_TRANSPORTSOCKETCACHE2_HPP_
 
 #include <string>
+#include <map>
 #include <queue>
+#include <vector>
 
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/synchronized_value.hpp>
@@ -33,6 +35,21 @@ namespace qi
   * -> if the connection is pending wait for the result
   * -> if the socket do not exist, create it, and try to connect it
   * -> if the socket is disconnected try to reconnect it
+  *
+  * A pool of several sockets to the same endpoint can be used for some
+  * services (see `setPoolSize`). The socket connected as described above is
+  * then the first socket of the pool, the others are connected to its url on
+  * demand. Each request is given a socket of the pool: a new one while the
+  * pool is not full, then the one with the least queued bytes. The socket
+  * given to a request is used by the remote object of the service for its
+  * whole life, so the calls to an object are still sent in order, on a single
+  * socket.
+  *
+  * A session requests a socket once per service, so a pool spreads the
+  * services of an endpoint over several sockets, not the calls to a single
+  * service: all the calls to a service, and to the objects it returns, share
+  * the socket its remote object was given. Spreading them would require the
+  * server to order the calls received on different sockets.
   */
 
   class TransportSocketCache : public Trackable<TransportSocketCache>
@@ -56,7 +73,32 @@ namespace qi
     /// The returned future is set when the socket has been disconnected and
     /// effectively removed from the cache.
     FutureSync<void> disconnect(MessageSocketPtr socket);
+
+    /// Sets the count of sockets used to connect to the endpoint of the given
+    /// service, which are shared with the other pooled services of this
+    /// endpoint. A size of 0 restores the default size.
+    void setPoolSize(const std::string& serviceName, unsigned int size);
+
+    /// Sets the count of sockets used to connect to the endpoint of services
+    /// that have no specific size. It is 1, meaning no pool, by default.
+    void setDefaultPoolSize(unsigned int size);
+
+    /// Count of sockets used to connect to the endpoint of the given service.
+    unsigned int poolSize(const std::string& serviceName) const;
+
+    /// Pool sizes, as set by the `QI_TRANSPORT_SOCKET_POOL` environment
+    /// variable. Its value is a comma-separated list of `serviceName=size`
+    /// entries, and of an optional `size` entry setting the default size.
+    /// For example: `QI_TRANSPORT_SOCKET_POOL=Perception=4,Storage=2`.
+    struct PoolSizes
+    {
+      unsigned int defaultSize = 1;
+      std::map<std::string, unsigned int> serviceSizes;
+    };
+    static PoolSizes poolSizesFromEnv();
   private:
+    using PoolKey = std::pair<std::string, Url>;
+
     enum State
     {
       State_Pending,
@@ -68,6 +110,11 @@ namespace qi
     void onSocketConnectionAttempt(Future<void> fut, Promise<MessageSocketPtr> prom, MessageSocketPtr socket, const ServiceInfo& info, uint32_t currentUrlIdx, UrlVectorPtr urls);
     void onSocketParallelConnectionAttempt(Future<void> fut, MessageSocketPtr socket, Url url, const ServiceInfo& info);
     void onSocketDisconnected(Url url, const ServiceInfo& info);
+    Future<MessageSocketPtr> primarySocket(const ServiceInfo& servInfo, const std::string& sdUrl);
+    Future<MessageSocketPtr> pooledSocket(const std::string& machineId, MessageSocketPtr primary, unsigned int size);
+    void onPoolSocketConnectionAttempt(Future<void> fut, MessageSocketPtr socket, Promise<MessageSocketPtr> prom,
+                                       MessageSocketPtr primary, const PoolKey& key);
+    void onPoolSocketDisconnected(MessageSocketPtr socket, const PoolKey& key);
 
 
     boost::mutex _socketMutex;
@@ -93,6 +140,23 @@ namespace qi
     using MachineId = std::string;
     using ConnectionMap = std::map<MachineId, std::map<Url, ConnectionAttemptPtr>>;
     ConnectionMap _connections;
+
+    /// The sockets of a pool, except its first one.
+    struct Pool
+    {
+      std::vector<MessageSocketPtr> sockets;
+      std::vector<SignalLink> disconnectionTrackings;
+      /// Count of sockets being connected.
+      std::size_t pendingCount = 0;
+      /// Index of the socket from which the next lookup of the least loaded
+      /// socket starts, so that equally loaded sockets are used in turn.
+      std::size_t next = 0;
+    };
+    /// The pools are identified by the machine and the url their sockets are
+    /// connected to.
+    std::map<PoolKey, Pool> _pools;
+    mutable boost::mutex _poolSizesMutex;
+    PoolSizes _poolSizes;
     std::list<MessageSocketPtr> _allPendingConnections;
     boost::synchronized_value<std::vector<DisconnectInfo>> _disconnectInfos;
     bool _dying;
@@ -10,6 +10,13 @@ qiLogCategory("qi.url");
 
 namespace qi {
 
+  namespace
+  {
+    // The host of a local socket url is the path of the socket, that may
+    // contain colons, and it has no port.
+    const char* const localProtocol = "unix";
+  }
+
   class UrlPrivate {
   public:
     UrlPrivate();
@@ -21,6 +28,7 @@ namespace qi {
     UrlPrivate(const char* url);
 
     void updateUrl();
+    void dropPortIfLocal();
     const std::string& str() const;
     bool isValid() const;
 
@@ -112,6 +120,7 @@ namespace qi {
   void Url::setProtocol(const std::string &protocol) {
     _p->protocol = protocol;
     _p->components |= UrlPrivate::SCHEME;
+    _p->dropPortIfLocal();
     _p->updateUrl();
   }
 
@@ -140,6 +149,7 @@ namespace qi {
   void Url::setPort(unsigned short port) {
     _p->port = port;
     _p->components |= UrlPrivate::PORT;
+    _p->dropPortIfLocal();
     _p->updateUrl();
   }
 
@@ -216,6 +226,7 @@ namespace qi {
       port = defaultPort;
       components |= PORT;
     }
+    dropPortIfLocal();
     updateUrl();
   }
 
@@ -227,6 +238,8 @@ namespace qi {
     , components(0)
   {
     if (!(split_me(url) & SCHEME)) {
+      if (defaultProtocol == localProtocol)
+        split_me(defaultProtocol + "://" + url);
       protocol = defaultProtocol;
       components |= SCHEME;
     }
@@ -242,6 +255,8 @@ namespace qi {
   {
     int result = split_me(url);
     if (!(result & SCHEME)) {
+      if (defaultProtocol == localProtocol)
+        result = split_me(defaultProtocol + "://" + url);
       protocol = defaultProtocol;
       components |= SCHEME;
     }
@@ -249,6 +264,7 @@ namespace qi {
       port = defaultPort;
       components |= PORT;
     }
+    dropPortIfLocal();
     updateUrl();
   }
 
@@ -263,7 +279,18 @@ namespace qi {
       url += std::string(":") + boost::lexical_cast<std::string>(port);
   }
 
+  void UrlPrivate::dropPortIfLocal()
+  {
+    if (protocol != localProtocol)
+      return;
+    port = 0;
+    components &= ~PORT;
+  }
+
   bool UrlPrivate::isValid() const {
+    // Local sockets are designated by a path, the port is meaningless.
+    if (protocol == localProtocol)
+      return (components & (SCHEME | HOST)) == (SCHEME | HOST);
     return components == (SCHEME | HOST | PORT);
   }
 
@@ -296,6 +323,15 @@ namespace qi {
       place = 0;
 
     _url = _url.substr(place);
+    if (_scheme == localProtocol) {
+      // The rest is the path of the socket, colons included.
+      if (!_url.empty())
+        components |= HOST;
+      port = 0;
+      host = _url;
+      protocol = _scheme;
+      return components;
+    }
     place = _url.find(":");
     _host = _url.substr(0, place);
     if (!_host.empty())
@@ -17,8 +17,13 @@
 #include <qi/types.hpp>
 #include <qi/numeric.hpp>
 #include <ka/scoped.hpp>
+#include <algorithm>
 #include <vector>
 #include <cstring>
+#include <limits>
+#include <boost/container/flat_map.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
 
 qiLogCategory("qitype.binarycoder");
 
@@ -410,6 +415,119 @@ namespace qi {
 
   namespace detail {
 
+    namespace
+    {
+      /// Calls `f` with the vector if `listType` is the type of a
+      /// `std::vector<T>`.
+      template <typename T, typename F>
+      bool visitVectorOf(TypeInterface* listType, void* storage, const F& f)
+      {
+        if (listType->info() != TypeInfo(typeid(std::vector<T>)))
+          return false;
+        f(*static_cast<std::vector<T>*>(storage));
+        return true;
+      }
+
+      /// Calls `f` with the vector and returns true if `list` is a
+      /// `std::vector` of integers or floating points. The elements of such
+      /// vectors are sent as they are in memory, so they are copied at once
+      /// instead of being visited one by one.
+      template <typename F>
+      bool visitScalarVector(AnyReference list, const F& f)
+      {
+        const auto listType = list.type();
+        const auto elementType = static_cast<ListTypeInterface*>(listType)->elementType();
+        void* const storage = list.rawValue();
+        switch (elementType->kind())
+        {
+        case TypeKind_Float:
+          return visitVectorOf<float>(listType, storage, f)
+              || visitVectorOf<double>(listType, storage, f);
+        case TypeKind_Int:
+          // Integers of the same size may be distinct types.
+          switch (static_cast<IntTypeInterface*>(elementType)->size())
+          {
+          case 1:
+            return visitVectorOf<char>(listType, storage, f)
+                || visitVectorOf<signed char>(listType, storage, f)
+                || visitVectorOf<unsigned char>(listType, storage, f);
+          case 2:
+            return visitVectorOf<short>(listType, storage, f)
+                || visitVectorOf<unsigned short>(listType, storage, f);
+          case 4:
+            return visitVectorOf<int>(listType, storage, f)
+                || visitVectorOf<unsigned int>(listType, storage, f)
+                || (sizeof(long) == 4
+                    && (visitVectorOf<long>(listType, storage, f)
+                        || visitVectorOf<unsigned long>(listType, storage, f)));
+          case 8:
+            return (sizeof(long) == 8
+                    && (visitVectorOf<long>(listType, storage, f)
+                        || visitVectorOf<unsigned long>(listType, storage, f)))
+                || visitVectorOf<long long>(listType, storage, f)
+                || visitVectorOf<unsigned long long>(listType, storage, f);
+          default: // bool
+            return false;
+          }
+        default:
+          return false;
+        }
+      }
+
+      struct WriteScalarVector
+      {
+        BinaryEncoder& out;
+        const Signature& elementSignature;
+
+        template <typename T>
+        void operator()(const std::vector<T>& value) const
+        {
+          out.beginList(numericConvert<std::uint32_t>(value.size()), elementSignature);
+          out.write(reinterpret_cast<const char*>(value.data()), value.size() * sizeof(T));
+          out.endList();
+        }
+      };
+
+      /// Appends the elements to the vector, as the visitor does.
+      struct ReadScalarVector
+      {
+        BinaryDecoder& in;
+
+        template <typename T>
+        void operator()(std::vector<T>& value) const
+        {
+          std::uint32_t sz = 0;
+          in.read(sz);
+          if (in.status() != BinaryDecoder::Status::Ok || !sz)
+            return;
+          // The data may not be aligned for T.
+          const auto data = sz <= std::numeric_limits<std::size_t>::max() / sizeof(T)
+                                ? in.readRaw(sz * sizeof(T))
+                                : nullptr;
+          if (!data)
+          {
+            qiLogError() << "Read past end";
+            in.setStatus(BinaryDecoder::Status::ReadPastEnd);
+            return;
+          }
+          const auto offset = value.size();
+          value.resize(offset + sz);
+          std::memcpy(value.data() + offset, data, sz * sizeof(T));
+        }
+      };
+
+      struct AddScalarVectorSize
+      {
+        std::size_t& size;
+
+        template <typename T>
+        void operator()(const std::vector<T>& value) const
+        {
+          size += sizeof(std::uint32_t) + value.size() * sizeof(T);
+        }
+      };
+    }
+
     class SerializeTypeVisitor
     {
     public:
@@ -473,8 +591,12 @@ namespace qi {
 
       void visitList(AnyIterator it, AnyIterator end)
       {
+        const Signature elementSignature =
+            static_cast<ListTypeInterface*>(value.type())->elementType()->signature();
+        if (visitScalarVector(value, WriteScalarVector{out, elementSignature}))
+          return;
         out.beginList(numericConvert<std::uint32_t>(value.size()),
-                      static_cast<ListTypeInterface*>(value.type())->elementType()->signature());
+                      elementSignature);
         for (; it != end; ++it)
           serialize(*it, out, serializeObjectCb, streamContext);
         out.endList();
@@ -589,6 +711,177 @@ namespace qi {
       StreamContext* streamContext;
     };
 
+    std::size_t encodedSize(AnyReference value);
+
+    /// Computes the number of bytes that the SerializeTypeVisitor writes in the
+    /// buffer, without the sub-buffers of the raw values which are not copied.
+    /// Objects are not counted, their encoding depends on the stream.
+    class EncodedSizeTypeVisitor
+    {
+    public:
+      explicit EncodedSizeTypeVisitor(AnyReference value)
+        : value(value)
+        , size(0)
+      {}
+
+      void visitUnknown(AnyReference)
+      {
+      }
+
+      void visitVoid()
+      {
+      }
+
+      void visitInt(int64_t, bool, int byteSize)
+      {
+        // Booleans have a size of 0.
+        size += byteSize ? byteSize : 1;
+      }
+
+      void visitFloat(double, int byteSize)
+      {
+        size += byteSize;
+      }
+
+      void visitString(char*, size_t len)
+      {
+        size += sizeof(std::uint32_t) + len;
+      }
+
+      void visitList(AnyIterator it, AnyIterator end)
+      {
+        if (visitScalarVector(value, AddScalarVectorSize{size}))
+          return;
+        size += sizeof(std::uint32_t);
+        for (; it != end; ++it)
+          size += encodedSize(*it);
+      }
+
+      void visitVarArgs(AnyIterator it, AnyIterator end)
+      {
+        visitList(it, end);
+      }
+
+      void visitMap(AnyIterator it, AnyIterator end)
+      {
+        size += sizeof(std::uint32_t);
+        for (; it != end; ++it)
+        {
+          AnyReference v = *it;
+          size += encodedSize(v[0]) + encodedSize(v[1]);
+        }
+      }
+
+      void visitObject(GenericObject)
+      {
+      }
+
+      void visitAnyObject(AnyObject&)
+      {
+      }
+
+      void visitPointer(AnyReference)
+      {
+      }
+
+      void visitTuple(const std::string&, const AnyReferenceVector& vals, const std::vector<std::string>&)
+      {
+        for (const auto& val: vals)
+          size += encodedSize(val);
+      }
+
+      void visitDynamic(AnyReference pointee)
+      {
+        const Signature sig = pointee.signature();
+        size += sizeof(std::uint32_t) + sig.toString().size();
+        if (sig.isValid())
+          size += encodedSize(pointee);
+      }
+
+      void visitRaw(AnyReference)
+      {
+        size += sizeof(std::uint32_t);
+      }
+
+      void visitIterator(AnyReference)
+      {
+      }
+
+      void visitOptional(AnyReference opt)
+      {
+        size += 1;
+        if (opt.optionalHasValue())
+          size += encodedSize(opt.content());
+      }
+
+      AnyReference value;
+      std::size_t size;
+    };
+
+    std::size_t encodedSize(AnyReference value)
+    {
+      EncodedSizeTypeVisitor visitor(value);
+      qi::typeDispatch(visitor, value);
+      return visitor.size;
+    }
+
+    const int estimateDepth = 4;
+    const std::size_t maxEstimate = 16 * 1024 * 1024;
+
+    /// Estimates the number of bytes that the SerializeTypeVisitor writes,
+    /// without visiting every element: the elements of a container are assumed
+    /// to be as big as its first one, and the values nested deeper than `depth`
+    /// are not counted. Strings and vectors of scalars are counted exactly.
+    std::size_t estimatedEncodedSize(AnyReference value, int depth)
+    {
+      if (depth == 0)
+        return 0;
+      switch (value.kind())
+      {
+        case TypeKind_List:
+        case TypeKind_VarArgs:
+        {
+          std::size_t size = 0;
+          if (visitScalarVector(value, AddScalarVectorSize{size}))
+            return size;
+          const auto count = value.size();
+          size = sizeof(std::uint32_t);
+          if (count != 0)
+            size += count * estimatedEncodedSize(*value.begin(), depth - 1);
+          return size;
+        }
+        case TypeKind_Map:
+        {
+          const auto count = value.size();
+          std::size_t size = sizeof(std::uint32_t);
+          if (count != 0)
+          {
+            AnyReference first = *value.begin();
+            size += count * (estimatedEncodedSize(first[0], depth - 1)
+                             + estimatedEncodedSize(first[1], depth - 1));
+          }
+          return size;
+        }
+        case TypeKind_Tuple:
+        {
+          std::size_t size = 0;
+          for (const auto& field: value.asTupleValuePtr())
+            size += estimatedEncodedSize(field, depth - 1);
+          return size;
+        }
+        case TypeKind_Dynamic:
+        {
+          const auto content = value.content();
+          return sizeof(std::uint32_t) + (content.type() ? estimatedEncodedSize(content, depth - 1) : 0);
+        }
+        case TypeKind_Optional:
+          return 1 + (value.optionalHasValue() ? estimatedEncodedSize(value.content(), depth - 1) : 0);
+        default:
+          // Scalars, strings and raw values are counted with a single dispatch.
+          return encodedSize(value);
+      }
+    }
+
     class DeserializeTypeVisitor
     {
       /*
@@ -687,6 +980,8 @@ namespace qi {
 
       void visitList(AnyIterator, AnyIterator)
       {
+        if (visitScalarVector(result, ReadScalarVector{in}))
+          return;
         TypeInterface* elementType = static_cast<ListTypeInterface*>(result.type())->elementType();
         std::uint32_t sz = 0;
         in.read(sz);
@@ -885,9 +1180,81 @@ namespace qi {
       }
     }
 
+    namespace
+    {
+      using StaticBinaryCodecMap = boost::container::flat_map<TypeInterface*, StaticBinaryCodecFunctions>;
+      using StaticBinaryCodecMapPtr = boost::shared_ptr<const StaticBinaryCodecMap>;
+
+      // Types are registered once, when they are first used, but their codec
+      // is looked up for each value: the map is copied on write.
+      struct StaticBinaryCodecRegistry
+      {
+        boost::mutex mutex;
+        StaticBinaryCodecMapPtr codecs = boost::make_shared<const StaticBinaryCodecMap>();
+      };
+
+      StaticBinaryCodecRegistry& staticBinaryCodecRegistry()
+      {
+        static StaticBinaryCodecRegistry registry;
+        return registry;
+      }
+    }
+
+    void registerStaticBinaryCodec(TypeInterface* type, StaticBinaryCodecFunctions functions)
+    {
+      auto& registry = staticBinaryCodecRegistry();
+      boost::mutex::scoped_lock lock(registry.mutex);
+      auto codecs = boost::make_shared<StaticBinaryCodecMap>(*registry.codecs);
+      (*codecs)[type] = functions;
+      boost::atomic_store(&registry.codecs, StaticBinaryCodecMapPtr(std::move(codecs)));
+    }
+
+    StaticBinaryCodecFunctions staticBinaryCodec(TypeInterface* type)
+    {
+      if (!type)
+        return StaticBinaryCodecFunctions{nullptr, nullptr, nullptr};
+      const auto codecs = boost::atomic_load(&staticBinaryCodecRegistry().codecs);
+      const auto it = codecs->find(type);
+      if (it == codecs->end())
+        return StaticBinaryCodecFunctions{nullptr, nullptr, nullptr};
+      return it->second;
+    }
+
+    void throwStaticDecodingError()
+    {
+      std::stringstream ss;
+      ss << "ISerialization error " << BinaryDecoder::statusToStr(BinaryDecoder::Status::ReadPastEnd);
+      qiLogError() << ss.str();
+      throw std::runtime_error(ss.str());
+    }
   } // namespace detail
 
+  std::size_t encodedBinarySize(const qi::AutoAnyReference &gvp) {
+    const auto codec = detail::staticBinaryCodec(gvp.type());
+    if (codec.size)
+      return codec.size(gvp.rawValue());
+    return detail::encodedSize(gvp);
+  }
+
   void encodeBinary(qi::Buffer *buf, const qi::AutoAnyReference &gvp, SerializeObjectCallback onObject, StreamContext* sctx) {
+    const auto codec = detail::staticBinaryCodec(gvp.type());
+    if (codec.encode)
+    {
+      // Allocated at once, instead of growing while the value is written.
+      buf->reserveCapacity(codec.size(gvp.rawValue()));
+      if (!codec.encode(*buf, gvp.rawValue()))
+      {
+        std::stringstream ss;
+        ss << "OSerialization error " << BinaryEncoder::statusToStr(BinaryEncoder::Status::WriteError);
+        qiLogError() << ss.str();
+        throw std::runtime_error(ss.str());
+      }
+      return;
+    }
+    // An estimate is enough to avoid most of the reallocations, and costs much
+    // less than visiting the value twice.
+    buf->reserveCapacity(std::min(detail::estimatedEncodedSize(gvp, detail::estimateDepth),
+                                  detail::maxEstimate));
     BinaryEncoder be(*buf);
     detail::SerializeTypeVisitor stv(be, onObject, gvp, sctx);
     qi::typeDispatch(stv, gvp);
@@ -901,6 +1268,13 @@ namespace qi {
 
   AnyReference decodeBinary(qi::BufferReader *buf, qi::AnyReference gvp,
     DeserializeObjectCallback onObject, StreamContext* sctx) {
+    const auto codec = detail::staticBinaryCodec(gvp.type());
+    if (codec.decode)
+    {
+      if (!codec.decode(*buf, gvp.rawValue()))
+        detail::throwStaticDecodingError();
+      return gvp;
+    }
     BinaryDecoder in(buf);
     detail::DeserializeTypeVisitor dtv(in, onObject, sctx);
     dtv.result = gvp;
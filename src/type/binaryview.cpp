@@ -0,0 +1,454 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <qi/binaryview.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <boost/make_shared.hpp>
+#include <boost/optional.hpp>
+#include <qi/log.hpp>
+#include "serializationplan.hpp"
+
+qiLogCategory("qitype.binaryview");
+
+namespace qi
+{
+  namespace
+  {
+    BOOST_NORETURN void throwViewError(const Signature& signature, const char* what)
+    {
+      std::stringstream ss;
+      ss << "Binary view of signature " << signature.toString() << ": " << what;
+      throw std::runtime_error(ss.str());
+    }
+
+    /// Size of the encoding of the values of the signature, if it does not
+    /// depend on the value.
+    boost::optional<std::size_t> fixedSize(const Signature& signature)
+    {
+      switch (signature.type())
+      {
+      case Signature::Type_Void:
+        return std::size_t(0);
+      case Signature::Type_Bool:
+      case Signature::Type_Int8:
+      case Signature::Type_UInt8:
+        return std::size_t(1);
+      case Signature::Type_Int16:
+      case Signature::Type_UInt16:
+        return std::size_t(2);
+      case Signature::Type_Int32:
+      case Signature::Type_UInt32:
+      case Signature::Type_Float:
+        return std::size_t(4);
+      case Signature::Type_Int64:
+      case Signature::Type_UInt64:
+      case Signature::Type_Double:
+        return std::size_t(8);
+      case Signature::Type_Tuple:
+      {
+        std::size_t size = 0;
+        for (const auto& field: signature.children())
+        {
+          const auto fieldSize = fixedSize(field);
+          if (!fieldSize)
+            return {};
+          size += *fieldSize;
+        }
+        return size;
+      }
+      default:
+        return {};
+      }
+    }
+
+    bool readCount(BufferReader& in, std::uint32_t& count)
+    {
+      return in.read(&count, sizeof(count)) == sizeof(count);
+    }
+
+    bool seekElements(BufferReader& in, std::uint32_t count, std::size_t elementSize)
+    {
+      if (elementSize && count > std::numeric_limits<std::size_t>::max() / elementSize)
+        return false;
+      return in.seek(count * elementSize);
+    }
+
+    /// Reads the signature of the content of a dynamic value, which is
+    /// invalid if the value is void.
+    bool readDynamicSignature(BufferReader& in, Signature& signature)
+    {
+      std::uint32_t size = 0;
+      if (!readCount(in, size))
+        return false;
+      if (!size)
+      {
+        signature = Signature();
+        return true;
+      }
+      const auto data = static_cast<const char*>(in.read(size));
+      if (!data)
+        return false;
+      try
+      {
+        signature = Signature(std::string(data, size));
+      }
+      catch (const std::exception& e)
+      {
+        qiLogVerbose() << "Invalid signature in a dynamic value: " << e.what();
+        return false;
+      }
+      return signature.isValid();
+    }
+
+    /// Moves the reader after the value of the signature, without decoding
+    /// it. Returns false if the data is ill-formed or if the value cannot be
+    /// skipped.
+    bool skip(BufferReader& in, const Signature& signature)
+    {
+      if (const auto size = fixedSize(signature))
+        return in.seek(*size);
+      switch (signature.type())
+      {
+      case Signature::Type_String:
+      {
+        std::uint32_t size = 0;
+        return readCount(in, size) && in.seek(size);
+      }
+      case Signature::Type_List:
+      case Signature::Type_VarArgs:
+      {
+        std::uint32_t count = 0;
+        if (!readCount(in, count))
+          return false;
+        const auto& element = signature.children().at(0);
+        if (const auto elementSize = fixedSize(element))
+          return seekElements(in, count, *elementSize);
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+          if (!skip(in, element))
+            return false;
+        }
+        return true;
+      }
+      case Signature::Type_Map:
+      {
+        std::uint32_t count = 0;
+        if (!readCount(in, count))
+          return false;
+        const auto& key = signature.children().at(0);
+        const auto& element = signature.children().at(1);
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+          if (!skip(in, key) || !skip(in, element))
+            return false;
+        }
+        return true;
+      }
+      case Signature::Type_Tuple:
+        for (const auto& field: signature.children())
+        {
+          if (!skip(in, field))
+            return false;
+        }
+        return true;
+      case Signature::Type_Dynamic:
+      {
+        Signature content;
+        return readDynamicSignature(in, content) && (!content.isValid() || skip(in, content));
+      }
+      case Signature::Type_Optional:
+      {
+        unsigned char hasValue = 0;
+        return in.read(&hasValue, 1) == 1 && (!hasValue || skip(in, signature.children().at(0)));
+      }
+      case Signature::Type_Raw:
+      {
+        if (in.hasSubBuffer())
+        {
+          in.subBuffer();
+          return true;
+        }
+        std::uint32_t size = 0;
+        return readCount(in, size) && in.seek(size);
+      }
+      default:
+        // Objects are not skipped: their encoding depends on the capabilities
+        // of the stream.
+        return false;
+      }
+    }
+  }
+
+  BinaryView::BinaryView()
+    : _offset(0)
+  {
+  }
+
+  BinaryView::BinaryView(Buffer buffer, const Signature& signature)
+    : _buffer(boost::make_shared<const Buffer>(std::move(buffer)))
+    , _signature(signature)
+    , _offset(0)
+  {
+  }
+
+  BinaryView::BinaryView(BufferPtr buffer, const Signature& signature, std::size_t offset)
+    : _buffer(std::move(buffer))
+    , _signature(signature)
+    , _offset(offset)
+  {
+  }
+
+  bool BinaryView::isValid() const
+  {
+    return _buffer && _signature.isValid() && _offset <= _buffer->size();
+  }
+
+  const Signature& BinaryView::signature() const
+  {
+    return _signature;
+  }
+
+  const BinaryView::BufferPtr& BinaryView::buffer() const
+  {
+    return _buffer;
+  }
+
+  std::size_t BinaryView::offset() const
+  {
+    return _offset;
+  }
+
+  std::size_t BinaryView::size() const
+  {
+    if (!isValid())
+      throwViewError(_signature, "invalid view");
+    switch (_signature.type())
+    {
+    case Signature::Type_List:
+    case Signature::Type_VarArgs:
+    case Signature::Type_Map:
+    {
+      BufferReader in(*_buffer, _offset);
+      std::uint32_t count = 0;
+      if (!readCount(in, count))
+        throwViewError(_signature, "read past end");
+      return count;
+    }
+    case Signature::Type_Tuple:
+      return _signature.children().size();
+    default:
+      throwViewError(_signature, "size of a value that is not a container");
+    }
+  }
+
+  BinaryView BinaryView::element(std::size_t index) const
+  {
+    if (index >= size())
+      throwViewError(_signature, "index out of range");
+    BufferReader in(*_buffer, _offset);
+    switch (_signature.type())
+    {
+    case Signature::Type_List:
+    case Signature::Type_VarArgs:
+    {
+      const auto& element = _signature.children().at(0);
+      in.seek(sizeof(std::uint32_t));
+      if (const auto elementSize = fixedSize(element))
+      {
+        // Checked when the view of the element is used.
+        return BinaryView(_buffer, element, in.position() + index * *elementSize);
+      }
+      for (std::size_t i = 0; i < index; ++i)
+      {
+        if (!skip(in, element))
+          throwViewError(_signature, "cannot locate the element");
+      }
+      return BinaryView(_buffer, element, in.position());
+    }
+    case Signature::Type_Map:
+    {
+      const auto& key = _signature.children().at(0);
+      const auto& element = _signature.children().at(1);
+      in.seek(sizeof(std::uint32_t));
+      for (std::size_t i = 0; i < index; ++i)
+      {
+        if (!skip(in, key) || !skip(in, element))
+          throwViewError(_signature, "cannot locate the element");
+      }
+      if (!skip(in, key))
+        throwViewError(_signature, "cannot locate the element");
+      return BinaryView(_buffer, element, in.position());
+    }
+    default: // Tuple
+    {
+      const auto& fields = _signature.children();
+      for (std::size_t i = 0; i < index; ++i)
+      {
+        if (!skip(in, fields[i]))
+          throwViewError(_signature, "cannot locate the field");
+      }
+      return BinaryView(_buffer, fields[index], in.position());
+    }
+    }
+  }
+
+  BinaryView BinaryView::elementKey(std::size_t index) const
+  {
+    if (_signature.type() != Signature::Type_Map)
+      throwViewError(_signature, "key of a value that is not a map");
+    if (index >= size())
+      throwViewError(_signature, "index out of range");
+    const auto& key = _signature.children().at(0);
+    const auto& element = _signature.children().at(1);
+    BufferReader in(*_buffer, _offset);
+    in.seek(sizeof(std::uint32_t));
+    for (std::size_t i = 0; i < index; ++i)
+    {
+      if (!skip(in, key) || !skip(in, element))
+        throwViewError(_signature, "cannot locate the element");
+    }
+    return BinaryView(_buffer, key, in.position());
+  }
+
+  std::vector<BinaryView> BinaryView::elements() const
+  {
+    const auto type = _signature.type();
+    if (type != Signature::Type_List && type != Signature::Type_VarArgs && type != Signature::Type_Tuple)
+      throwViewError(_signature, "elements of a value that is not a list or a tuple");
+    const auto count = size();
+    BufferReader in(*_buffer, _offset);
+    if (type != Signature::Type_Tuple)
+      in.seek(sizeof(std::uint32_t));
+    std::vector<BinaryView> elements;
+    elements.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const auto& element = _signature.children().at(type == Signature::Type_Tuple ? i : 0);
+      elements.push_back(BinaryView(_buffer, element, in.position()));
+      if (i + 1 < count && !skip(in, element))
+        throwViewError(_signature, "cannot locate the elements");
+    }
+    return elements;
+  }
+
+  std::vector<std::pair<BinaryView, BinaryView>> BinaryView::mapElements() const
+  {
+    if (_signature.type() != Signature::Type_Map)
+      throwViewError(_signature, "map elements of a value that is not a map");
+    const auto count = size();
+    const auto& key = _signature.children().at(0);
+    const auto& element = _signature.children().at(1);
+    BufferReader in(*_buffer, _offset);
+    in.seek(sizeof(std::uint32_t));
+    std::vector<std::pair<BinaryView, BinaryView>> elements;
+    elements.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      BinaryView keyView(_buffer, key, in.position());
+      if (!skip(in, key))
+        throwViewError(_signature, "cannot locate the elements");
+      elements.emplace_back(std::move(keyView), BinaryView(_buffer, element, in.position()));
+      if (i + 1 < count && !skip(in, element))
+        throwViewError(_signature, "cannot locate the elements");
+    }
+    return elements;
+  }
+
+  BinaryView BinaryView::content() const
+  {
+    if (!isValid())
+      throwViewError(_signature, "invalid view");
+    BufferReader in(*_buffer, _offset);
+    switch (_signature.type())
+    {
+    case Signature::Type_Dynamic:
+    {
+      Signature content;
+      if (!readDynamicSignature(in, content))
+        throwViewError(_signature, "ill-formed dynamic value");
+      if (!content.isValid())
+        return BinaryView();
+      return BinaryView(_buffer, content, in.position());
+    }
+    case Signature::Type_Optional:
+      if (!optionalHasValue())
+        return BinaryView();
+      return BinaryView(_buffer, _signature.children().at(0), _offset + 1);
+    default:
+      throwViewError(_signature, "content of a value that is not dynamic nor optional");
+    }
+  }
+
+  bool BinaryView::optionalHasValue() const
+  {
+    if (!isValid() || _signature.type() != Signature::Type_Optional)
+      throwViewError(_signature, "value that is not an optional");
+    BufferReader in(*_buffer, _offset);
+    unsigned char hasValue = 0;
+    if (in.read(&hasValue, 1) != 1)
+      throwViewError(_signature, "read past end");
+    return hasValue != 0;
+  }
+
+  std::pair<const char*, std::size_t> BinaryView::asString() const
+  {
+    if (!isValid() || _signature.type() != Signature::Type_String)
+      throwViewError(_signature, "value that is not a string");
+    BufferReader in(*_buffer, _offset);
+    std::uint32_t size = 0;
+    if (!readCount(in, size))
+      throwViewError(_signature, "read past end");
+    const auto data = static_cast<const char*>(in.read(size));
+    if (!data)
+      throwViewError(_signature, "read past end");
+    return std::make_pair(data, std::size_t(size));
+  }
+
+  std::pair<const char*, std::size_t> BinaryView::asRaw() const
+  {
+    if (!isValid() || _signature.type() != Signature::Type_Raw)
+      throwViewError(_signature, "value that is not raw");
+    BufferReader in(*_buffer, _offset);
+    if (in.hasSubBuffer())
+    {
+      const Buffer& raw = in.subBuffer();
+      return std::make_pair(static_cast<const char*>(raw.data()), raw.size());
+    }
+    std::uint32_t size = 0;
+    if (!readCount(in, size))
+      throwViewError(_signature, "read past end");
+    const auto data = static_cast<const char*>(in.read(size));
+    if (!data)
+      throwViewError(_signature, "read past end");
+    return std::make_pair(data, std::size_t(size));
+  }
+
+  AnyValue BinaryView::toValue() const
+  {
+    if (!isValid())
+      return AnyValue();
+    const auto type = detail::typeOfSignature(_signature);
+    if (!type)
+      throwViewError(_signature, "no type to decode the value");
+    AnyReference value(type);
+    try
+    {
+      BufferReader in(*_buffer, _offset);
+      decodeBinary(&in, value);
+    }
+    catch (const std::exception& e)
+    {
+      qiLogVerbose() << "Cannot decode the value of signature " << _signature.toString() << ": "
+                     << e.what();
+      value.destroy();
+      throw;
+    }
+    return AnyValue(value, false, true);
+  }
+}
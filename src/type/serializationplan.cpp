@@ -0,0 +1,205 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include "serializationplan.hpp"
+
+#include <array>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <boost/make_shared.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <qi/log.hpp>
+
+qiLogCategory("qitype.serializationplan");
+
+namespace qi
+{
+  namespace detail
+  {
+    namespace
+    {
+      std::size_t combineHash(std::size_t seed, std::size_t hash)
+      {
+        return seed ^ (hash + 0x9E3779B9u + (seed << 6) + (seed >> 2));
+      }
+
+      /// Map filled once per key and then mostly read, by many threads: it is
+      /// split in shards, each with a lock that readers share.
+      ///
+      /// The keys contain signatures that come from the remote ends, so the
+      /// map is bounded: a full shard is emptied before a new key is added.
+      /// The values are cheap to compute again, and the types they refer to
+      /// are never destroyed.
+      template <typename Key, typename Value, typename Hash>
+      class PlanCache
+      {
+      public:
+        template <typename Compute>
+        Value get(const Key& key, Compute compute)
+        {
+          const auto hash = Hash{}(key);
+          auto& shard = _shards[(hash ^ (hash >> 16)) % shardCount];
+          {
+            boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+            const auto it = shard.plans.find(key);
+            if (it != shard.plans.end())
+              return it->second;
+          }
+          // Computed without the lock: computing a plan may need other plans.
+          auto value = compute();
+          boost::unique_lock<boost::shared_mutex> lock(shard.mutex);
+          if (shard.plans.size() >= maxShardSize && shard.plans.count(key) == 0)
+          {
+            qiLogVerbose() << "Serialization plan cache shard full, emptying it";
+            shard.plans.clear();
+          }
+          return shard.plans.emplace(key, std::move(value)).first->second;
+        }
+
+      private:
+        static const std::size_t shardCount = 16;
+        static const std::size_t maxShardSize = 256;
+
+        struct Shard
+        {
+          boost::shared_mutex mutex;
+          std::unordered_map<Key, Value, Hash> plans;
+        };
+        std::array<Shard, shardCount> _shards;
+      };
+
+      using TypeAndSignature = std::pair<TypeInterface*, std::string>;
+
+      struct TypeAndSignatureHash
+      {
+        std::size_t operator()(const TypeAndSignature& key) const
+        {
+          return combineHash(std::hash<TypeInterface*>{}(key.first),
+                             std::hash<std::string>{}(key.second));
+        }
+      };
+
+      using TypesAndSignature = std::pair<std::vector<TypeInterface*>, std::string>;
+
+      struct TypesAndSignatureHash
+      {
+        std::size_t operator()(const TypesAndSignature& key) const
+        {
+          auto hash = std::hash<std::string>{}(key.second);
+          for (const auto type: key.first)
+            hash = combineHash(hash, std::hash<TypeInterface*>{}(type));
+          return hash;
+        }
+      };
+
+      using SignatureHash = std::hash<std::string>;
+
+      PlanCache<TypeAndSignature, SerializationPlan, TypeAndSignatureHash>& valuePlans()
+      {
+        static PlanCache<TypeAndSignature, SerializationPlan, TypeAndSignatureHash> plans;
+        return plans;
+      }
+
+      PlanCache<TypesAndSignature, ArgumentsSerializationPlanPtr, TypesAndSignatureHash>& argumentsPlans()
+      {
+        static PlanCache<TypesAndSignature, ArgumentsSerializationPlanPtr, TypesAndSignatureHash> plans;
+        return plans;
+      }
+
+      // Types are never destroyed, but a tuple signature may resolve to a
+      // struct registered after it was first resolved: the values are then
+      // still deserialized as tuples, that convert to the struct.
+      PlanCache<std::string, TypeInterface*, SignatureHash>& signatureTypes()
+      {
+        static PlanCache<std::string, TypeInterface*, SignatureHash> types;
+        return types;
+      }
+
+      ArgumentsSerializationPlan computeArgumentsPlan(const std::vector<AnyReference>& arguments,
+                                                      const Signature& target)
+      {
+        using Kind = ArgumentsSerializationPlan::Kind;
+        ArgumentsSerializationPlan plan;
+        const Signature argumentsSignature = makeTupleSignature(arguments, false);
+        if (target == argumentsSignature)
+          return plan;
+        if (target == "m")
+        {
+          plan.kind = Kind::Dynamic;
+          return plan;
+        }
+        plan.kind = Kind::Error;
+        // This check does not makes sense for this transport layer who does
+        // not care, but it checks a general rule that is true for all the
+        // messages we use and it can help catch many mistakes.
+        if (target.type() != Signature::Type_Tuple)
+        {
+          plan.error = "Expected a tuple, got " + target.toString();
+          return plan;
+        }
+        const SignatureVector& sources = argumentsSignature.children();
+        const SignatureVector& targets = target.children();
+        if (sources.size() != targets.size())
+        {
+          plan.error = "remote call: signature size mismatch";
+          return plan;
+        }
+        plan.targets.resize(sources.size(), nullptr);
+        for (std::size_t i = 0; i < sources.size(); ++i)
+        {
+          if (sources[i] == targets[i])
+            continue;
+          plan.targets[i] = typeOfSignature(targets[i]);
+          if (!plan.targets[i])
+          {
+            plan.error = "remote call: Failed to obtain a type from signature " + targets[i].toString();
+            plan.targets.clear();
+            return plan;
+          }
+        }
+        plan.kind = Kind::Convert;
+        return plan;
+      }
+    }
+
+    SerializationPlan serializationPlan(TypeInterface* type, const Signature& target)
+    {
+      return valuePlans().get(TypeAndSignature(type, target.toString()), [&] {
+        SerializationPlan plan;
+        if (type->signature() == target)
+          return plan;
+        plan.convert = true;
+        plan.target = typeOfSignature(target);
+        return plan;
+      });
+    }
+
+    ArgumentsSerializationPlanPtr argumentsSerializationPlan(const std::vector<AnyReference>& arguments,
+                                                             const Signature& target)
+    {
+      TypesAndSignature key;
+      key.first.reserve(arguments.size());
+      for (const auto& argument: arguments)
+        key.first.push_back(argument.type());
+      key.second = target.toString();
+      return argumentsPlans().get(key, [&] {
+        return boost::make_shared<const ArgumentsSerializationPlan>(
+            computeArgumentsPlan(arguments, target));
+      });
+    }
+
+    TypeInterface* typeOfSignature(const Signature& signature)
+    {
+      return signatureTypes().get(signature.toString(), [&] {
+        const auto type = TypeInterface::fromSignature(signature);
+        if (!type)
+          qiLogVerbose() << "No type for signature " << signature.toString();
+        return type;
+      });
+    }
+  } // namespace detail
+} // namespace qi
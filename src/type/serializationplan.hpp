@@ -0,0 +1,78 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_SERIALIZATIONPLAN_HPP_
+#define _SRC_SERIALIZATIONPLAN_HPP_
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <qi/api.hpp>
+#include <qi/anyvalue.hpp>
+#include <qi/signature.hpp>
+
+/// @file
+/// Contains the serialization plans: what has to be done to serialize the
+/// values of some types for a target signature, or to deserialize a
+/// signature. They only depend on the types and the signature, so they are
+/// computed the first time a pair is met and then cached, instead of computing
+/// the signatures of the types and the types of the signatures for each
+/// message. The caches are bounded, since the signatures may come from the
+/// remote ends.
+
+namespace qi
+{
+  namespace detail
+  {
+    /// How to serialize a value for a target signature.
+    struct SerializationPlan
+    {
+      /// True if the value must be converted to `target` before being
+      /// serialized, false if it is serialized as it is.
+      bool convert = false;
+      /// Type of the target signature, null if there is none. Only set when
+      /// the value must be converted.
+      TypeInterface* target = nullptr;
+    };
+
+    /// How to serialize a list of arguments for a target signature.
+    struct ArgumentsSerializationPlan
+    {
+      enum class Kind
+      {
+        /// The arguments are serialized as they are.
+        AsIs,
+        /// The arguments are serialized in a dynamic value.
+        Dynamic,
+        /// Some arguments are converted, see `targets`.
+        Convert,
+        /// The arguments cannot be serialized for the signature, see `error`.
+        Error,
+      };
+
+      Kind kind = Kind::AsIs;
+      /// For each argument, the type it must be converted to, or null if it
+      /// is serialized as it is.
+      std::vector<TypeInterface*> targets;
+      std::string error;
+    };
+    using ArgumentsSerializationPlanPtr = boost::shared_ptr<const ArgumentsSerializationPlan>;
+
+    /// Returns the plan to serialize the values of `type` for `target`.
+    QI_API SerializationPlan serializationPlan(TypeInterface* type, const Signature& target);
+
+    /// Returns the plan to serialize the arguments for `target`. It only
+    /// depends on their types.
+    QI_API ArgumentsSerializationPlanPtr argumentsSerializationPlan(
+        const std::vector<AnyReference>& arguments, const Signature& target);
+
+    /// Returns the type of the values of the signature, as
+    /// `TypeInterface::fromSignature` does, or null if there is none.
+    QI_API TypeInterface* typeOfSignature(const Signature& signature);
+  } // namespace detail
+} // namespace qi
+
+#endif // _SRC_SERIALIZATIONPLAN_HPP_
@@ -0,0 +1,215 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+// Replays a capture of messages (see QI_MESSAGE_CAPTURE) against a server,
+// and reports the throughput and the latency of the calls.
+//
+// Each stream of the capture is replayed through its own socket, at the
+// original pace divided by the speed factor (0 to send as fast as possible).
+// The messages that are replayed are the ones the capturing process sent, or
+// the ones it received if it was the server (see `--direction`).
+
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
+#include <qi/application.hpp>
+#include <qi/log.hpp>
+#include <qi/url.hpp>
+#include "src/messaging/messagecapture.hpp"
+#include "src/messaging/messagelatency.hpp"
+#include "src/messaging/messagesocket.hpp"
+
+qiLogCategory("qimessaging.messagereplay");
+
+namespace po = boost::program_options;
+
+namespace
+{
+  struct Replay
+  {
+    std::mutex mutex;
+    std::map<std::pair<std::uint32_t, unsigned int>, qi::SteadyClock::time_point> pendingCalls;
+    qi::LatencyHistogram latency;
+    std::uint64_t errors = 0;
+
+    void onReply(std::uint32_t stream, const qi::Message& msg)
+    {
+      if (msg.type() != qi::Message::Type_Reply && msg.type() != qi::Message::Type_Error
+          && msg.type() != qi::Message::Type_Canceled)
+        return;
+      const auto now = qi::SteadyClock::now();
+      std::lock_guard<std::mutex> lock{mutex};
+      const auto it = pendingCalls.find({stream, msg.id()});
+      if (it == pendingCalls.end())
+        return;
+      latency.record(now - it->second);
+      if (msg.type() != qi::Message::Type_Reply)
+        ++errors;
+      pendingCalls.erase(it);
+    }
+
+    std::size_t pendingCount()
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      return pendingCalls.size();
+    }
+  };
+}
+
+int main(int argc, char** argv)
+{
+  qi::Application app(argc, argv);
+
+  std::string capturePath;
+  std::string url;
+  std::string direction;
+  double speed = 1.;
+  double timeout = 10.;
+  po::options_description desc("messagereplay options");
+  desc.add_options()
+      ("help,h", "Print this help message and exit")
+      ("capture,c", po::value<std::string>(&capturePath)->required(), "Capture file to replay")
+      ("url,u", po::value<std::string>(&url)->required(), "Url of the server to replay the capture to")
+      ("speed,s", po::value<double>(&speed)->default_value(1.),
+       "Speed factor of the replay, 0 to send the messages as fast as possible")
+      ("direction,d", po::value<std::string>(&direction)->default_value("sent"),
+       "Messages to replay: 'sent' or 'received' by the capturing process")
+      ("timeout,t", po::value<double>(&timeout)->default_value(10.),
+       "Seconds to wait for the pending replies once all messages are sent");
+
+  po::variables_map vm;
+  try
+  {
+    po::store(po::command_line_parser(qi::Application::arguments()).options(desc).run(), vm);
+    if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return 0;
+    }
+    po::notify(vm);
+  }
+  catch (const po::error& e)
+  {
+    std::cerr << e.what() << std::endl << desc << std::endl;
+    return 1;
+  }
+  if (direction != "sent" && direction != "received")
+  {
+    std::cerr << "Invalid direction: " << direction << std::endl;
+    return 1;
+  }
+  const auto replayedDirection = direction == "sent" ? qi::MessageCapture::Direction::Sent
+                                                     : qi::MessageCapture::Direction::Received;
+
+  std::vector<qi::MessageCapture::Record> records;
+  try
+  {
+    qi::MessageCaptureReader reader(capturePath);
+    while (auto record = reader.next())
+    {
+      if (record->direction == replayedDirection)
+        records.push_back(std::move(*record));
+    }
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "Cannot read the capture: " << e.what() << std::endl;
+    return 1;
+  }
+  if (records.empty())
+  {
+    std::cerr << "No message to replay." << std::endl;
+    return 1;
+  }
+
+  const qi::Url serverUrl(url);
+  Replay replay;
+  std::map<std::uint32_t, qi::MessageSocketPtr> sockets;
+  for (const auto& record: records)
+  {
+    auto& socket = sockets[record.stream];
+    if (socket)
+      continue;
+    socket = qi::makeMessageSocket(serverUrl.protocol());
+    if (!socket)
+    {
+      std::cerr << "Unsupported protocol: " << serverUrl.protocol() << std::endl;
+      return 1;
+    }
+    const auto stream = record.stream;
+    socket->messageReady.connect([&replay, stream](const qi::Message& msg) {
+      replay.onReply(stream, msg);
+    });
+    qi::Future<void> connecting = socket->connect(serverUrl);
+    if (connecting.hasError())
+    {
+      std::cerr << "Cannot connect to " << url << ": " << connecting.error() << std::endl;
+      return 1;
+    }
+  }
+
+  std::uint64_t bytes = 0;
+  std::uint64_t refused = 0;
+  const auto firstTime = records.front().time;
+  const auto start = qi::SteadyClock::now();
+  for (auto& record: records)
+  {
+    if (speed > 0.)
+    {
+      const auto due = start + boost::chrono::duration_cast<qi::Duration>(
+                                 (record.time - firstTime) / speed);
+      const auto now = qi::SteadyClock::now();
+      if (due > now)
+        boost::this_thread::sleep_for(due - now);
+    }
+    const auto isCall = record.message.type() == qi::Message::Type_Call;
+    if (isCall)
+    {
+      std::lock_guard<std::mutex> lock{replay.mutex};
+      replay.pendingCalls[{record.stream, record.message.id()}] = qi::SteadyClock::now();
+    }
+    bytes += sizeof(qi::Message::Header) + record.message.header().size;
+    if (!sockets[record.stream]->send(record.message))
+    {
+      ++refused;
+      if (isCall)
+      {
+        std::lock_guard<std::mutex> lock{replay.mutex};
+        replay.pendingCalls.erase({record.stream, record.message.id()});
+      }
+    }
+  }
+  const auto sendDuration = qi::SteadyClock::now() - start;
+
+  const auto deadline = qi::SteadyClock::now()
+      + boost::chrono::duration_cast<qi::Duration>(qi::DurationType<double, boost::ratio<1>>(timeout));
+  while (replay.pendingCount() > 0 && qi::SteadyClock::now() < deadline)
+    boost::this_thread::sleep_for(qi::MilliSeconds(10));
+  const auto totalDuration = qi::SteadyClock::now() - start;
+
+  for (auto& socket: sockets)
+    socket.second->disconnect();
+
+  const auto seconds = [](qi::Duration d) {
+    return boost::chrono::duration_cast<qi::DurationType<double, boost::ratio<1>>>(d).count();
+  };
+  const auto latency = replay.latency.snapshot();
+  std::cout << "streams: " << sockets.size() << '\n'
+            << "messages: " << records.size() << " (" << refused << " refused)\n"
+            << "bytes: " << bytes << '\n'
+            << "send duration: " << seconds(sendDuration) << " s\n"
+            << "throughput: " << records.size() / seconds(sendDuration) << " msg/s, "
+            << bytes / seconds(sendDuration) << " B/s\n"
+            << "replies: " << latency.count << " (" << replay.errors << " errors, "
+            << replay.pendingCount() << " missing after " << seconds(totalDuration) << " s)\n"
+            << "call latency (us): mean=" << latency.meanUs()
+            << " p50=" << latency.percentileUs(50)
+            << " p99=" << latency.percentileUs(99)
+            << " max=" << latency.maxUs << std::endl;
+  return 0;
+}
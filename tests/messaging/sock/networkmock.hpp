@@ -25,6 +25,11 @@ namespace mock
   /// Models in the simplest possible way the Network concept.
   struct Network
   {
+    /// The mock read operations transfer whole buffers: messages are received
+    /// with a read per header and per payload. Partial reads are still provided
+    /// to test the read-ahead reception explicitly.
+    static constexpr bool read_ahead = false;
+
     struct socket_option_no_delay_type
     {
       bool value;
@@ -293,6 +298,12 @@ namespace mock
       SocketFunctions<NetSslSocket>::_async_read_socket(s, b, h);
     }
 
+    template<typename NetTransferHandler, typename NetSslSocket>
+    static void async_read_some(NetSslSocket& s, _mutable_buffer_sequence b, NetTransferHandler h)
+    {
+      SocketFunctions<NetSslSocket>::_async_read_socket(s, b, h);
+    }
+
     template<typename NetSslSocket, typename NetTransferHandler>
     static void async_write(NetSslSocket& s, const std::vector<_const_buffer_sequence>& b, NetTransferHandler h)
     {
@@ -308,6 +319,12 @@ namespace mock
       _async_read_next_layer(s, b, h);
     }
 
+    template<typename NetTransferHandler>
+    static void async_read_some(ssl_socket_type::next_layer_type& s, _mutable_buffer_sequence b, NetTransferHandler h)
+    {
+      _async_read_next_layer(s, b, h);
+    }
+
     using _anyAsyncWriterNextLayer = std::function<void (ssl_socket_type::next_layer_type&, const std::vector<_const_buffer_sequence>&, _anyTransferHandler)>;
     static _anyAsyncWriterNextLayer _async_write_next_layer;
 
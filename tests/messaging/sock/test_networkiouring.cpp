@@ -0,0 +1,134 @@
+#include <numeric>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <boost/asio/deadline_timer.hpp>
+#include <qi/messaging/sock/networkiouring.hpp>
+
+#if QI_IO_URING
+
+// These tests pass whether the transfers go through io_uring or not. Run them
+// with QI_NETWORK_IO_URING=1 to test io_uring.
+
+namespace
+{
+  using tcp = boost::asio::ip::tcp;
+
+  struct NetIoUring : testing::Test
+  {
+    NetIoUring()
+      : acceptor(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+      , server(io)
+      , client(io)
+    {
+      acceptor.async_accept(server, [](const boost::system::error_code& erc) {
+        ASSERT_FALSE(erc) << erc.message();
+      });
+      client.connect(acceptor.local_endpoint());
+      run();
+    }
+
+    void run()
+    {
+      io.run();
+      io.reset();
+    }
+
+    boost::asio::io_service io;
+    tcp::acceptor acceptor;
+    tcp::socket server;
+    tcp::socket client;
+  };
+}
+
+TEST_F(NetIoUring, WriteAndReadAll)
+{
+  using N = qi::sock::NetworkIoUring;
+  std::vector<char> first(3 * 1024 * 1024);
+  std::iota(first.begin(), first.end(), 0);
+  std::vector<char> second(5000, 'b');
+  const std::vector<boost::asio::const_buffer> buffers{
+    boost::asio::buffer(first), boost::asio::buffer(second)};
+  std::vector<char> received(first.size() + second.size());
+
+  boost::system::error_code writeError, readError;
+  std::size_t written = 0, read = 0;
+  N::async_write(client, buffers, [&](const boost::system::error_code& erc, std::size_t size) {
+    writeError = erc;
+    written = size;
+  });
+  N::async_read(server, boost::asio::buffer(received), [&](const boost::system::error_code& erc, std::size_t size) {
+    readError = erc;
+    read = size;
+  });
+  run();
+
+  EXPECT_FALSE(writeError) << writeError.message();
+  EXPECT_FALSE(readError) << readError.message();
+  EXPECT_EQ(received.size(), written);
+  ASSERT_EQ(received.size(), read);
+  EXPECT_TRUE(std::equal(first.begin(), first.end(), received.begin()));
+  EXPECT_TRUE(std::equal(second.begin(), second.end(), received.begin() + first.size()));
+}
+
+TEST_F(NetIoUring, ReadSomeWaitsForData)
+{
+  using N = qi::sock::NetworkIoUring;
+  char received[100];
+  boost::system::error_code readError;
+  std::size_t read = 0;
+  N::async_read_some(server, boost::asio::buffer(received), [&](const boost::system::error_code& erc, std::size_t size) {
+    readError = erc;
+    read = size;
+  });
+  std::thread writer([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds{50});
+    boost::asio::write(client, boost::asio::buffer("hello", 5));
+  });
+  run();
+  writer.join();
+  EXPECT_FALSE(readError) << readError.message();
+  ASSERT_EQ(5u, read);
+  EXPECT_EQ(std::string("hello"), std::string(received, read));
+}
+
+TEST_F(NetIoUring, ShutdownEndsPendingRead)
+{
+  using N = qi::sock::NetworkIoUring;
+  char received[100];
+  boost::system::error_code readError;
+  N::async_read(server, boost::asio::buffer(received), [&](const boost::system::error_code& erc, std::size_t) {
+    readError = erc;
+  });
+  std::thread closer([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds{50});
+    client.shutdown(tcp::socket::shutdown_both);
+  });
+  run();
+  closer.join();
+  EXPECT_EQ(boost::asio::error::eof, readError);
+}
+
+TEST_F(NetIoUring, WriteOnClosedSocketIsAborted)
+{
+  using N = qi::sock::NetworkIoUring;
+  // More than the socket buffers hold, so that the write is still pending
+  // when the socket is closed.
+  std::vector<char> data(32 * 1024 * 1024, 'a');
+  std::vector<char> received(data.size());
+  boost::system::error_code writeError;
+  N::async_write(client, boost::asio::buffer(data), [&](const boost::system::error_code& erc, std::size_t) {
+    writeError = erc;
+  });
+  boost::asio::deadline_timer timer(io, boost::posix_time::milliseconds(50));
+  timer.async_wait([&](const boost::system::error_code&) {
+    client.close();
+    // Reading lets the pending transfer end: the rest of the data must not
+    // be written on the descriptor.
+    N::async_read(server, boost::asio::buffer(received), [](const boost::system::error_code&, std::size_t) {});
+  });
+  run();
+  EXPECT_EQ(boost::asio::error::operation_aborted, writeError);
+}
+
+#endif // QI_IO_URING
@@ -525,3 +525,189 @@ TEST(NetReceiveMessage, Asio)
 
   close<N>(clientSideSocket);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+/// NetReceiveMessageBuffered tests:
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  /// Appends the wire representation of a message with the given payload.
+  void appendMessage(std::vector<unsigned char>& stream, qi::uint32_t id,
+                     const std::vector<unsigned char>& payload)
+  {
+    qi::Message::Header header;
+    header.id = id;
+    header.size = static_cast<qi::uint32_t>(payload.size());
+    auto p = reinterpret_cast<const unsigned char*>(&header);
+    stream.insert(stream.end(), p, p + sizeof(header));
+    stream.insert(stream.end(), payload.begin(), payload.end());
+  }
+
+  /// Each call to the read handler transfers the next chunk of the stream,
+  /// then an error is returned.
+  struct AsyncReadNextLayerChunks
+  {
+    std::vector<unsigned char> _stream;
+    std::vector<std::size_t> _chunkSizes;
+    std::vector<std::size_t> _bufferSizes;
+    std::size_t _offset = 0;
+    void operator()(mock::N::ssl_socket_type::next_layer_type&, mock::N::_mutable_buffer_sequence buf,
+                    mock::N::_anyTransferHandler h)
+    {
+      const auto call = _bufferSizes.size();
+      _bufferSizes.push_back(static_cast<std::size_t>(buf.end - buf.begin));
+      if (call >= _chunkSizes.size())
+      {
+        h(mock::N::error_code_type{mock::N::error_code_type::unknown}, 0u);
+        return;
+      }
+      const auto size = _chunkSizes[call];
+      assert(static_cast<std::size_t>(buf.end - buf.begin) >= size);
+      std::copy(_stream.begin() + _offset, _stream.begin() + _offset + size, buf.begin);
+      _offset += size;
+      h(mock::N::error_code_type{}, size);
+    }
+  };
+
+  struct ReceivedMessages
+  {
+    std::vector<qi::Message> messages;
+    boost::optional<mock::N::error_code_type> error;
+  };
+
+  ReceivedMessages receiveAllBuffered(AsyncReadNextLayerChunks& chunks)
+  {
+    using namespace qi;
+    using namespace qi::sock;
+    using N = mock::Network;
+    auto _ = ka::scoped_set_and_restore(N::_async_read_next_layer, std::ref(chunks));
+    SslContext<N> context;
+    auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+    ReceivedMessages received;
+    ReceiveMessageBuffered<N> receive;
+    receive(socket, SslEnabled{false}, 10000, [&](ErrorCode<N> e, const Message* msg) {
+      if (e)
+      {
+        received.error = e;
+        return false;
+      }
+      received.messages.push_back(*msg);
+      return true;
+    });
+    return received;
+  }
+
+  std::vector<unsigned char> makePayload(std::size_t size, unsigned char first)
+  {
+    std::vector<unsigned char> payload(size);
+    std::iota(payload.begin(), payload.end(), first);
+    return payload;
+  }
+
+  bool hasPayload(const qi::Message& msg, const std::vector<unsigned char>& payload)
+  {
+    auto data = static_cast<const unsigned char*>(msg.buffer().data());
+    return msg.buffer().size() == payload.size()
+        && std::equal(payload.begin(), payload.end(), data);
+  }
+}
+
+TEST(NetReceiveMessageBuffered, SeveralMessagesInOneRead)
+{
+  const auto p0 = makePayload(4, 0);
+  const auto p1 = makePayload(0, 0);
+  const auto p2 = makePayload(12, 100);
+  AsyncReadNextLayerChunks chunks;
+  appendMessage(chunks._stream, 1, p0);
+  appendMessage(chunks._stream, 2, p1);
+  appendMessage(chunks._stream, 3, p2);
+  chunks._chunkSizes = {chunks._stream.size()};
+
+  const auto received = receiveAllBuffered(chunks);
+  ASSERT_EQ(3u, received.messages.size());
+  EXPECT_EQ(1u, received.messages[0].id());
+  EXPECT_TRUE(hasPayload(received.messages[0], p0));
+  EXPECT_EQ(2u, received.messages[1].id());
+  EXPECT_TRUE(hasPayload(received.messages[1], p1));
+  EXPECT_EQ(3u, received.messages[2].id());
+  EXPECT_TRUE(hasPayload(received.messages[2], p2));
+  ASSERT_TRUE(received.error);
+  // One read for the three messages, one for the error.
+  EXPECT_EQ(2u, chunks._bufferSizes.size());
+}
+
+TEST(NetReceiveMessageBuffered, HeaderSplitAcrossReads)
+{
+  const auto p0 = makePayload(8, 3);
+  AsyncReadNextLayerChunks chunks;
+  appendMessage(chunks._stream, 42, p0);
+  chunks._chunkSizes = {10, chunks._stream.size() - 10};
+
+  const auto received = receiveAllBuffered(chunks);
+  ASSERT_EQ(1u, received.messages.size());
+  EXPECT_EQ(42u, received.messages[0].id());
+  EXPECT_TRUE(hasPayload(received.messages[0], p0));
+}
+
+TEST(NetReceiveMessageBuffered, PayloadEndIsReadDirectlyIntoTheMessage)
+{
+  const auto p0 = makePayload(1000, 7);
+  const auto p1 = makePayload(5, 1);
+  AsyncReadNextLayerChunks chunks;
+  appendMessage(chunks._stream, 1, p0);
+  appendMessage(chunks._stream, 2, p1);
+  const std::size_t firstChunk = sizeof(qi::Message::Header) + 10;
+  const std::size_t payloadEnd = p0.size() - 10;
+  chunks._chunkSizes = {firstChunk, payloadEnd, chunks._stream.size() - firstChunk - payloadEnd};
+
+  const auto received = receiveAllBuffered(chunks);
+  ASSERT_EQ(2u, received.messages.size());
+  EXPECT_TRUE(hasPayload(received.messages[0], p0));
+  EXPECT_TRUE(hasPayload(received.messages[1], p1));
+  // The second read is exactly the missing part of the first payload.
+  ASSERT_LE(2u, chunks._bufferSizes.size());
+  EXPECT_EQ(payloadEnd, chunks._bufferSizes[1]);
+}
+
+// In steady state, the memory of the payload of the received message is the
+// same from a message to the next one: receiving does not allocate.
+TEST(NetReceiveMessageBuffered, PayloadMemoryIsReusedBetweenMessages)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+
+  AsyncReadNextLayerChunks chunks;
+  for (unsigned int id = 1; id <= 4; ++id)
+    appendMessage(chunks._stream, id, makePayload(2000 - 100 * id, 0));
+  chunks._chunkSizes = {chunks._stream.size()};
+
+  auto _ = ka::scoped_set_and_restore(N::_async_read_next_layer, std::ref(chunks));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  std::vector<const void*> payloads;
+  ReceiveMessageBuffered<N> receive;
+  receive(socket, SslEnabled{false}, 10000, [&](ErrorCode<N> e, const Message* msg) {
+    if (e)
+      return false;
+    payloads.push_back(msg->buffer().data());
+    return true;
+  });
+  ASSERT_EQ(4u, payloads.size());
+  EXPECT_EQ(payloads[0], payloads[1]);
+  EXPECT_EQ(payloads[0], payloads[2]);
+  EXPECT_EQ(payloads[0], payloads[3]);
+}
+
+TEST(NetReceiveMessageBuffered, FailsOnBadMessageCookie)
+{
+  AsyncReadNextLayerChunks chunks;
+  appendMessage(chunks._stream, 1, makePayload(4, 0));
+  chunks._stream[0] ^= 0xFF;
+  chunks._chunkSizes = {chunks._stream.size()};
+
+  const auto received = receiveAllBuffered(chunks);
+  EXPECT_TRUE(received.messages.empty());
+  ASSERT_TRUE(received.error);
+  EXPECT_EQ(qi::sock::fault<qi::sock::ErrorCode<mock::N>>(), *received.error);
+}
@@ -275,6 +275,355 @@ TYPED_TEST(NetSendMessageEnqueue, MultipleSendsFromMultipleThreads)
   std::this_thread::sleep_for(defaultPostPauseInMs);
 }
 
+namespace
+{
+  // Records the count of buffers of each write and keeps its continuation, so
+  // that the test decides when the write completes.
+  struct RecordWrites
+  {
+    std::vector<std::size_t> bufferCounts;
+    std::vector<mock::N::_anyTransferHandler> continuations;
+
+    void operator()(qi::sock::SslSocket<mock::N>::next_layer_type&,
+                    const std::vector<mock::N::_const_buffer_sequence>& buffers,
+                    mock::N::_anyTransferHandler writeCont)
+    {
+      bufferCounts.push_back(buffers.size());
+      continuations.push_back(writeCont);
+    }
+
+    void completeNext()
+    {
+      auto cont = continuations.front();
+      continuations.erase(continuations.begin());
+      cont(qi::sock::success<qi::sock::ErrorCode<mock::N>>(), 0u);
+    }
+  };
+}
+
+TEST(NetSendMessageEnqueue, QueuedMessagesAreGatheredInOneWrite)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  RecordWrites writes;
+  auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  using I = std::list<Message>::const_iterator;
+  std::vector<unsigned int> sentIds;
+  auto onSent = [&](ErrorCode<N> erc, I it) {
+    EXPECT_EQ(success<ErrorCode<N>>(), erc);
+    sentIds.push_back(it->id());
+    return true;
+  };
+  SendMessageEnqueue<N, SslSocketPtr<N>> send{socket, SendBatchLimits{1024 * 1024, 64}};
+  for (unsigned int id = 1; id <= 5; ++id)
+  {
+    Message msg;
+    msg.setId(id);
+    send(std::move(msg), SslEnabled{false}, onSent);
+  }
+  // The first message is written alone, the others are queued meanwhile.
+  ASSERT_EQ(1u, writes.continuations.size());
+  EXPECT_EQ(bufferCount(Message{}), writes.bufferCounts[0]);
+  writes.completeNext();
+  EXPECT_EQ(std::vector<unsigned int>({1}), sentIds);
+
+  // The four queued messages are written at once, and each one is notified.
+  ASSERT_EQ(1u, writes.continuations.size());
+  EXPECT_EQ(4 * bufferCount(Message{}), writes.bufferCounts[1]);
+  writes.completeNext();
+  EXPECT_EQ(std::vector<unsigned int>({1, 2, 3, 4, 5}), sentIds);
+  EXPECT_TRUE(writes.continuations.empty());
+}
+
+TEST(NetSendMessageEnqueue, GatheredWriteRespectsLimits)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  RecordWrites writes;
+  auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  using I = std::list<Message>::const_iterator;
+  unsigned int sentCount = 0;
+  auto onSent = [&](ErrorCode<N>, I) {
+    ++sentCount;
+    return true;
+  };
+  const auto maxBuffers = 2 * bufferCount(Message{});
+  SendMessageEnqueue<N, SslSocketPtr<N>> send{socket, SendBatchLimits{1024 * 1024, maxBuffers}};
+  for (int i = 0; i < 6; ++i)
+    send(Message{}, SslEnabled{false}, onSent);
+
+  // 1 message, then 2 per write.
+  for (std::size_t expectedSent: {1u, 3u, 5u, 6u})
+  {
+    ASSERT_EQ(1u, writes.continuations.size());
+    EXPECT_LE(writes.bufferCounts.back(), maxBuffers);
+    writes.completeNext();
+    EXPECT_EQ(expectedSent, sentCount);
+  }
+  EXPECT_TRUE(writes.continuations.empty());
+}
+
+TEST(NetSendMessageEnqueue, GatheredWriteStopsIfAnyMessageSaysSo)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  RecordWrites writes;
+  auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  using I = std::list<Message>::const_iterator;
+  std::vector<unsigned int> sentIds;
+  auto onSent = [&](ErrorCode<N>, I it) {
+    sentIds.push_back(it->id());
+    return it->id() != 2;
+  };
+  SendMessageEnqueue<N, SslSocketPtr<N>> send{socket, SendBatchLimits{1024 * 1024, 64}};
+  for (unsigned int id = 1; id <= 3; ++id)
+  {
+    Message msg;
+    msg.setId(id);
+    send(std::move(msg), SslEnabled{false}, onSent);
+  }
+  writes.completeNext();
+  writes.completeNext();
+  // All the written messages are notified, but the processing stops.
+  EXPECT_EQ(std::vector<unsigned int>({1, 2, 3}), sentIds);
+  EXPECT_TRUE(writes.continuations.empty());
+
+  // Sending a new message restarts the processing.
+  Message msg;
+  msg.setId(4);
+  send(std::move(msg), SslEnabled{false}, onSent);
+  ASSERT_EQ(1u, writes.continuations.size());
+  writes.completeNext();
+  EXPECT_EQ(std::vector<unsigned int>({1, 2, 3, 4}), sentIds);
+}
+
+TEST(NetSendMessageEnqueue, QueuedMessagesAreSentByPriority)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  RecordWrites writes;
+  auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  using I = std::list<Message>::const_iterator;
+  std::vector<unsigned int> sentIds;
+  auto onSent = [&](ErrorCode<N>, I it) {
+    sentIds.push_back(it->id());
+    return true;
+  };
+  // One message per write, to observe the order.
+  SendMessageEnqueue<N, SslSocketPtr<N>> send{socket, SendBatchLimits{0, 0}};
+  auto sendWithPriority = [&](unsigned int id, Message::Priority priority) {
+    Message msg;
+    msg.setId(id);
+    msg.setObject(id); // Messages of distinct objects can be reordered.
+    msg.setPriority(priority);
+    send(std::move(msg), SslEnabled{false}, onSent);
+  };
+  // The first message is being written, so it is not overtaken.
+  sendWithPriority(1, Message::Priority_Bulk);
+  sendWithPriority(2, Message::Priority_Bulk);
+  sendWithPriority(3, Message::Priority_Normal);
+  sendWithPriority(4, Message::Priority_High);
+  sendWithPriority(5, Message::Priority_Normal);
+  sendWithPriority(6, Message::Priority_High);
+  while (!writes.continuations.empty())
+    writes.completeNext();
+  EXPECT_EQ(std::vector<unsigned int>({1, 4, 6, 3, 5, 2}), sentIds);
+}
+
+TEST(NetSendMessageEnqueue, DependentMessagesKeepTheirOrder)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  RecordWrites writes;
+  auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  using I = std::list<Message>::const_iterator;
+  std::vector<unsigned int> sentIds;
+  auto onSent = [&](ErrorCode<N>, I it) {
+    sentIds.push_back(it->id());
+    return true;
+  };
+  SendMessageEnqueue<N, SslSocketPtr<N>> send{socket, SendBatchLimits{0, 0}};
+  auto sendMessage = [&](unsigned int id, Message::Type type, unsigned int object,
+                         Message::Priority priority) {
+    Message msg(type, MessageAddress{id, 1, object, 100});
+    msg.setPriority(priority);
+    send(std::move(msg), SslEnabled{false}, onSent);
+  };
+  sendMessage(1, Message::Type_Call, 1, Message::Priority_Bulk); // being written
+  // A cancellation does not overtake its call.
+  sendMessage(2, Message::Type_Call, 2, Message::Priority_Bulk);
+  sendMessage(3, Message::Type_Cancel, 2, Message::Priority_High);
+  // A reply does not overtake an event, but overtakes other replies.
+  sendMessage(4, Message::Type_Event, 3, Message::Priority_Normal);
+  sendMessage(5, Message::Type_Reply, 4, Message::Priority_Bulk);
+  sendMessage(6, Message::Type_Reply, 5, Message::Priority_High);
+  // Capabilities are barriers.
+  sendMessage(7, Message::Type_Capability, 0, Message::Priority_Normal);
+  sendMessage(8, Message::Type_Call, 6, Message::Priority_High);
+  while (!writes.continuations.empty())
+    writes.completeNext();
+  EXPECT_EQ(std::vector<unsigned int>({1, 2, 3, 4, 6, 5, 7, 8}), sentIds);
+}
+
+TEST(NetSendMessageEnqueue, SendQueueRejectsMessagesAboveLimits)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  RecordWrites writes;
+  auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  SendMessageEnqueue<N, SslSocketPtr<N>> send{socket, SendBatchLimits{1024 * 1024, 64},
+                                               SendQueueLimits{0, 2, SendQueuePolicy::Reject}};
+  auto admitAndSend = [&](Message msg) {
+    if (!send.admit(msg))
+      return false;
+    send(std::move(msg), SslEnabled{false});
+    return true;
+  };
+  EXPECT_TRUE(admitAndSend(Message{}));
+  EXPECT_TRUE(admitAndSend(Message{}));
+  EXPECT_FALSE(admitAndSend(Message{}));
+  auto stats = send.queueStats();
+  EXPECT_EQ(2u, stats.messages);
+  EXPECT_EQ(2 * wireSize(Message{}), stats.bytes);
+  EXPECT_EQ(1u, stats.rejected);
+
+  // Writing the first message frees some room.
+  writes.completeNext();
+  EXPECT_TRUE(admitAndSend(Message{}));
+  writes.completeNext();
+  stats = send.queueStats();
+  EXPECT_EQ(0u, stats.messages);
+  EXPECT_EQ(0u, stats.bytes);
+  EXPECT_EQ(2u, stats.peakMessages);
+}
+
+TEST(NetSendMessageEnqueue, SendQueueAdmitsFragmentsAtOnce)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  RecordWrites writes;
+  auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  SendMessageEnqueue<N, SslSocketPtr<N>> send{socket, SendBatchLimits{1024 * 1024, 64},
+                                               SendQueueLimits{0, 3, SendQueuePolicy::Reject}};
+  ASSERT_TRUE(send.admit(Message{}));
+  send(Message{}, SslEnabled{false});
+
+  // The fragments do not all fit: none of them is admitted.
+  const std::vector<Message> fragments(3);
+  EXPECT_FALSE(send.admit(fragments));
+  auto stats = send.queueStats();
+  EXPECT_EQ(1u, stats.messages);
+  EXPECT_EQ(1u, stats.rejected);
+
+  // An empty queue accepts them all.
+  writes.completeNext();
+  ASSERT_TRUE(send.admit(fragments));
+  for (const auto& fragment: fragments)
+    send(fragment, SslEnabled{false});
+  stats = send.queueStats();
+  EXPECT_EQ(3u, stats.messages);
+  EXPECT_EQ(3 * wireSize(Message{}), stats.bytes);
+  // The first fragment is written alone, the others together.
+  writes.completeNext();
+  writes.completeNext();
+  EXPECT_EQ(0u, send.queueStats().messages);
+}
+
+TEST(NetSendMessageEnqueue, SendQueueDropsOldestEvent)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  RecordWrites writes;
+  auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  using I = std::list<Message>::const_iterator;
+  std::vector<unsigned int> sentIds;
+  auto onSent = [&](ErrorCode<N>, I it) {
+    sentIds.push_back(it->id());
+    return true;
+  };
+  SendMessageEnqueue<N, SslSocketPtr<N>> send{socket, SendBatchLimits{1024 * 1024, 64},
+                                               SendQueueLimits{0, 3, SendQueuePolicy::DropOldestEvent}};
+  auto admitAndSend = [&](unsigned int id, Message::Type type) {
+    Message msg;
+    msg.setId(id);
+    msg.setType(type);
+    if (!send.admit(msg))
+      return false;
+    send(std::move(msg), SslEnabled{false}, onSent);
+    return true;
+  };
+  // The first event is being written, so it cannot be dropped.
+  EXPECT_TRUE(admitAndSend(1, Message::Type_Event));
+  EXPECT_TRUE(admitAndSend(2, Message::Type_Event));
+  EXPECT_TRUE(admitAndSend(3, Message::Type_Call));
+  EXPECT_TRUE(admitAndSend(4, Message::Type_Call));
+  // No event is left to drop: an event is dropped itself, a call is queued.
+  EXPECT_FALSE(admitAndSend(5, Message::Type_Event));
+  EXPECT_TRUE(admitAndSend(6, Message::Type_Reply));
+
+  writes.completeNext();
+  writes.completeNext();
+  EXPECT_EQ(std::vector<unsigned int>({1, 3, 4, 6}), sentIds);
+  const auto stats = send.queueStats();
+  EXPECT_EQ(2u, stats.dropped);
+  EXPECT_EQ(0u, stats.rejected);
+  EXPECT_EQ(4u, stats.peakMessages);
+}
+
+TEST(NetSendMessageEnqueue, SendQueueReadyIsSetWhenRoomIsFreed)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  RecordWrites writes;
+  auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  const auto size = wireSize(Message{});
+  SendMessageEnqueue<N, SslSocketPtr<N>> send{socket, SendBatchLimits{1024 * 1024, 64},
+                                               SendQueueLimits{2 * size, 0, SendQueuePolicy::Wait}};
+  EXPECT_TRUE(send.ready().isFinished());
+  for (int i = 0; i < 3; ++i)
+  {
+    // The policy never refuses messages.
+    ASSERT_TRUE(send.admit(Message{}));
+    send(Message{}, SslEnabled{false});
+  }
+  auto ready = send.ready();
+  EXPECT_FALSE(ready.isFinished());
+  // Two messages are left: the queue is still full.
+  writes.completeNext();
+  EXPECT_FALSE(ready.isFinished());
+  writes.completeNext();
+  ASSERT_TRUE(ready.isFinished());
+  EXPECT_TRUE(ready.hasValue());
+  EXPECT_EQ(3 * size, send.queueStats().peakBytes);
+}
+
 // Multiple threads send messages with the same send object.
 // The socket is not connected so the send fails but it's not important here.
 // See test_tcpmessagesocket for a similar test on the real socket.
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include <qi/path.hpp>
+#include <qi/messaging/sock/networkasio.hpp>
+#include <qi/messaging/sock/sslsession.hpp>
+
+namespace
+{
+  qi::sock::SslSessionPtr newSession()
+  {
+    return qi::sock::makeSslSessionPtr(SSL_SESSION_new());
+  }
+}
+
+TEST(NetSslSessionCache, GetReturnsTheLastSessionSet)
+{
+  qi::sock::SslSessionCache cache{4};
+  EXPECT_FALSE(cache.get("tcps://10.0.0.1:9559"));
+  const auto first = newSession();
+  const auto second = newSession();
+  cache.set("tcps://10.0.0.1:9559", first);
+  EXPECT_EQ(first, cache.get("tcps://10.0.0.1:9559"));
+  cache.set("tcps://10.0.0.1:9559", second);
+  EXPECT_EQ(second, cache.get("tcps://10.0.0.1:9559"));
+  EXPECT_EQ(1u, cache.size());
+  cache.remove("tcps://10.0.0.1:9559");
+  EXPECT_FALSE(cache.get("tcps://10.0.0.1:9559"));
+}
+
+TEST(NetSslSessionCache, LeastRecentlyUsedSessionIsEvicted)
+{
+  qi::sock::SslSessionCache cache{2};
+  cache.set("a", newSession());
+  cache.set("b", newSession());
+  EXPECT_TRUE(cache.get("a"));
+  cache.set("c", newSession());
+  EXPECT_EQ(2u, cache.size());
+  EXPECT_TRUE(cache.get("a"));
+  EXPECT_FALSE(cache.get("b"));
+  EXPECT_TRUE(cache.get("c"));
+
+  cache.setCapacity(1);
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_TRUE(cache.get("c"));
+}
+
+TEST(NetSslSessionCache, ZeroCapacityDisablesTheCache)
+{
+  qi::sock::SslSessionCache cache{0};
+  cache.set("a", newSession());
+  EXPECT_EQ(0u, cache.size());
+  EXPECT_FALSE(cache.get("a"));
+}
+
+TEST(NetSslSessionCache, CachedSessionIsOfferedByClientSocket)
+{
+  auto& cache = qi::sock::sslSessionCache();
+  if (cache.capacity() == 0)
+    return;
+  const std::string key = "tcps://127.0.0.1:12345";
+  const auto session = newSession();
+  cache.set(key, session);
+
+  boost::asio::io_service io;
+  boost::asio::ssl::context context{boost::asio::ssl::context::sslv23};
+  boost::asio::ssl::stream<boost::asio::ip::tcp::socket> socket{io, context};
+  qi::sock::prepareSslSessionResumption(socket, key);
+  EXPECT_EQ(session.get(), SSL_get_session(socket.native_handle()));
+  EXPECT_FALSE(qi::sock::sslSessionReused(socket));
+  cache.remove(key);
+}
+
+// Two successive connections of clients to the same server: the second one
+// resumes the session received by the first one.
+TEST(NetSslSessionCache, SecondHandshakeResumesTheSession)
+{
+  using namespace boost::asio;
+  using SslSocket = ssl::stream<ip::tcp::socket>;
+  auto& cache = qi::sock::sslSessionCache();
+  if (cache.capacity() == 0)
+    return;
+
+  ssl::context serverContext{ssl::context::sslv23};
+  serverContext.use_certificate_chain_file(qi::path::findData("qi", "server.crt"));
+  serverContext.use_private_key_file(qi::path::findData("qi", "server.key"), ssl::context::pem);
+  qi::sock::setupSslSessionResumption(serverContext.native_handle());
+
+  io_service io;
+  ip::tcp::acceptor acceptor{io, ip::tcp::endpoint{ip::address_v4::loopback(), 0}};
+  const auto endpoint = acceptor.local_endpoint();
+  const std::string key = "tcps://127.0.0.1:" + std::to_string(endpoint.port());
+  cache.remove(key);
+
+  // Returns true if the handshake of the client resumed a session.
+  const auto connect = [&] {
+    ssl::context clientContext{ssl::context::sslv23};
+    SslSocket server{io, serverContext};
+    SslSocket client{io, clientContext};
+    qi::sock::prepareSslSessionResumption(client, key);
+    boost::system::error_code serverError, clientError;
+    const char byte = 'x';
+    char received = 0;
+    acceptor.async_accept(server.lowest_layer(), [&](const boost::system::error_code& erc) {
+      if ((serverError = erc))
+        return;
+      server.async_handshake(SslSocket::server, [&](const boost::system::error_code& erc) {
+        if ((serverError = erc))
+          return;
+        async_write(server, buffer(&byte, 1), [&](const boost::system::error_code& erc, std::size_t) {
+          serverError = erc;
+        });
+      });
+    });
+    client.lowest_layer().async_connect(endpoint, [&](const boost::system::error_code& erc) {
+      if ((clientError = erc))
+        return;
+      client.async_handshake(SslSocket::client, [&](const boost::system::error_code& erc) {
+        if ((clientError = erc))
+          return;
+        // With TLS 1.3, the session is received after the handshake.
+        async_read(client, buffer(&received, 1), [&](const boost::system::error_code& erc, std::size_t) {
+          clientError = erc;
+        });
+      });
+    });
+    io.run();
+    io.reset();
+    EXPECT_FALSE(serverError) << serverError.message();
+    EXPECT_FALSE(clientError) << clientError.message();
+    EXPECT_EQ(byte, received);
+    // The connection is not shut down cleanly, as when a socket is lost.
+    return qi::sock::sslSessionReused(client);
+  };
+
+  EXPECT_FALSE(connect());
+  EXPECT_TRUE(cache.get(key));
+  EXPECT_TRUE(connect());
+  cache.remove(key);
+}
@@ -0,0 +1,199 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "src/messaging/batch.hpp"
+
+namespace
+{
+  qi::Message makeMessage(qi::Message::Type type, const std::string& payload,
+                          const std::string& subPayload = {})
+  {
+    qi::Message msg;
+    msg.setType(type);
+    msg.setService(42);
+    msg.setObject(1);
+    qi::Buffer buffer;
+    buffer.write(payload.data(), payload.size());
+    if (!subPayload.empty())
+    {
+      qi::Buffer sub;
+      sub.write(subPayload.data(), subPayload.size());
+      buffer.addSubBuffer(sub);
+    }
+    msg.setBuffer(std::move(buffer));
+    return msg;
+  }
+
+  qi::Message replyTo(const qi::Message& call)
+  {
+    qi::Message reply = makeMessage(qi::Message::Type_Reply, "reply");
+    reply.setId(call.id());
+    return reply;
+  }
+
+  std::string wirePayload(const qi::Message& msg)
+  {
+    std::string wire;
+    const auto& buffer = msg.buffer();
+    const auto data = static_cast<const char*>(buffer.data());
+    std::size_t begin = 0;
+    for (const auto& sub: buffer.subBuffers())
+    {
+      const auto end = sub.first + sizeof(qi::Buffer::size_type);
+      wire.append(data + begin, end - begin);
+      begin = end;
+      wire.append(static_cast<const char*>(sub.second.data()), sub.second.size());
+    }
+    wire.append(data + begin, buffer.size() - begin);
+    return wire;
+  }
+}
+
+TEST(Batch, UnpackReturnsThePackedMessages)
+{
+  std::vector<qi::Message> calls{
+    makeMessage(qi::Message::Type_Call, "first"),
+    makeMessage(qi::Message::Type_Call, "", ""),
+    makeMessage(qi::Message::Type_Call, "third", "with a sub-buffer"),
+  };
+  const auto batch = qi::batch::pack(calls);
+  EXPECT_EQ(qi::Message::Type_Call, batch.type());
+  EXPECT_TRUE(batch.flags() & qi::Message::TypeFlag_Batch);
+
+  const auto unpacked = qi::batch::unpack(batch);
+  ASSERT_TRUE(unpacked);
+  ASSERT_EQ(calls.size(), unpacked->size());
+  for (std::size_t i = 0; i < calls.size(); ++i)
+  {
+    const auto& msg = (*unpacked)[i];
+    EXPECT_EQ(calls[i].id(), msg.id());
+    EXPECT_EQ(calls[i].type(), msg.type());
+    EXPECT_EQ(calls[i].service(), msg.service());
+    EXPECT_EQ(wirePayload(calls[i]), wirePayload(msg));
+    EXPECT_EQ(msg.buffer().size(), msg.header().size);
+  }
+}
+
+TEST(Batch, IllFormedBatchesAreRejected)
+{
+  const auto batch = qi::batch::pack({makeMessage(qi::Message::Type_Call, "first"),
+                                      makeMessage(qi::Message::Type_Call, "second")});
+  const auto& buffer = batch.buffer();
+  const auto data = static_cast<const char*>(buffer.data());
+
+  const auto withPayload = [&](const std::string& payload) {
+    qi::Message msg = batch;
+    qi::Buffer modified;
+    modified.write(payload.data(), payload.size());
+    msg.setBuffer(std::move(modified));
+    return msg;
+  };
+  const std::string payload(data, buffer.size());
+  // Truncated.
+  EXPECT_FALSE(qi::batch::unpack(withPayload(payload.substr(0, payload.size() - 1))));
+  EXPECT_FALSE(qi::batch::unpack(withPayload(payload.substr(0, 2))));
+  // Trailing bytes.
+  EXPECT_FALSE(qi::batch::unpack(withPayload(payload + "x")));
+  // Too many messages announced.
+  std::string tooMany = payload;
+  tooMany[0] = 3;
+  EXPECT_FALSE(qi::batch::unpack(withPayload(tooMany)));
+  // Bad magic of the first message.
+  std::string badMagic = payload;
+  badMagic[4] ^= 0x1;
+  EXPECT_FALSE(qi::batch::unpack(withPayload(badMagic)));
+}
+
+TEST(Batch, NestedBatchesAreRejected)
+{
+  const auto inner = qi::batch::pack({makeMessage(qi::Message::Type_Call, "a"),
+                                      makeMessage(qi::Message::Type_Call, "b")});
+  auto innerAsCall = makeMessage(qi::Message::Type_Call, "");
+  innerAsCall.setBuffer(inner.buffer());
+  const auto outer = qi::batch::pack({innerAsCall});
+  std::string payload(static_cast<const char*>(outer.buffer().data()), outer.buffer().size());
+  // Sets the flags of the carried message: the last byte of its header before
+  // the service, after the count of messages.
+  payload[4 + 15] = static_cast<char>(qi::Message::TypeFlag_Batch);
+  qi::Message tampered = outer;
+  qi::Buffer buffer;
+  buffer.write(payload.data(), payload.size());
+  tampered.setBuffer(std::move(buffer));
+  EXPECT_FALSE(qi::batch::unpack(tampered));
+}
+
+TEST(BatchReplyCollector, GathersTheRepliesOfAGroup)
+{
+  qi::batch::ReplyCollector collector;
+  const std::vector<qi::Message> calls{makeMessage(qi::Message::Type_Call, "a"),
+                                       makeMessage(qi::Message::Type_Post, "b"),
+                                       makeMessage(qi::Message::Type_Call, "c")};
+  collector.expect(calls);
+  EXPECT_EQ(2u, collector.pendingCount());
+
+  std::vector<qi::Message> complete;
+  auto unrelated = makeMessage(qi::Message::Type_Reply, "other");
+  EXPECT_FALSE(collector.collect(unrelated, complete));
+
+  auto first = replyTo(calls[2]);
+  EXPECT_TRUE(collector.collect(first, complete));
+  EXPECT_TRUE(complete.empty());
+
+  auto second = replyTo(calls[0]);
+  second.setType(qi::Message::Type_Error);
+  EXPECT_TRUE(collector.collect(second, complete));
+  ASSERT_EQ(2u, complete.size());
+  EXPECT_EQ(calls[2].id(), complete[0].id());
+  EXPECT_EQ(calls[0].id(), complete[1].id());
+  EXPECT_EQ(0u, collector.pendingCount());
+}
+
+TEST(BatchReplyCollector, HeldRepliesAreReleasedBeforeOtherMessages)
+{
+  qi::batch::ReplyCollector collector;
+  const std::vector<qi::Message> calls{makeMessage(qi::Message::Type_Call, "a"),
+                                       makeMessage(qi::Message::Type_Call, "b")};
+  collector.expect(calls);
+
+  std::vector<qi::Message> complete;
+  auto first = replyTo(calls[0]);
+  EXPECT_TRUE(collector.collect(first, complete));
+  EXPECT_TRUE(collector.releaseBefore(replyTo(calls[1])).empty());
+
+  const auto released = collector.releaseBefore(makeMessage(qi::Message::Type_Event, "event"));
+  ASSERT_EQ(1u, released.size());
+  EXPECT_EQ(calls[0].id(), released[0].id());
+  EXPECT_TRUE(collector.releaseBefore(makeMessage(qi::Message::Type_Event, "event")).empty());
+
+  // The group is forgotten: the last reply is sent on its own.
+  auto last = replyTo(calls[1]);
+  EXPECT_FALSE(collector.collect(last, complete));
+  EXPECT_TRUE(complete.empty());
+}
+
+TEST(BatchReplyCollector, LateRepliesAreNotCollected)
+{
+  qi::batch::ReplyCollector collector;
+  const std::vector<qi::Message> calls{makeMessage(qi::Message::Type_Call, "a"),
+                                       makeMessage(qi::Message::Type_Call, "b")};
+  const auto group = collector.expect(calls);
+
+  std::vector<qi::Message> complete;
+  auto first = replyTo(calls[0]);
+  EXPECT_TRUE(collector.collect(first, complete));
+  const auto released = collector.release(group);
+  ASSERT_EQ(1u, released.size());
+  EXPECT_EQ(calls[0].id(), released[0].id());
+  EXPECT_TRUE(collector.release(group).empty());
+
+  auto late = replyTo(calls[1]);
+  EXPECT_FALSE(collector.collect(late, complete));
+  EXPECT_TRUE(complete.empty());
+  EXPECT_EQ(0u, collector.pendingCount());
+}
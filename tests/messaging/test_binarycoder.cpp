@@ -9,6 +9,7 @@
 #include <map>
 #include <qi/buffer.hpp>
 #include <qi/binarycodec.hpp>
+#include <qi/binaryview.hpp>
 #include <qi/session.hpp>
 #include <limits.h>
 
@@ -540,6 +541,263 @@ TEST(TestBind, SerializeCustomComplex)
   ASSERT_EQ(comp, compout);
 }
 
+namespace
+{
+  template <typename T>
+  void writeRaw(std::string& out, T value)
+  {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  Complex smallComplex()
+  {
+    Complex comp;
+    comp.points.push_back(point(1, 2));
+    comp.foo = 1.5f;
+    comp.baz = "ab";
+    comp.stuff.push_back(std::vector<int>(1, 7));
+    return comp;
+  }
+}
+
+TEST(TestBind, StaticCodecWritesTheWireFormat)
+{
+  EXPECT_TRUE(qi::detail::staticBinaryCodec(qi::typeOf<Complex>()).encode);
+  EXPECT_FALSE(qi::detail::staticBinaryCodec(qi::typeOf<std::vector<qi::AnyValue> >()).encode);
+
+  qi::Buffer buf;
+  qi::encodeBinary(&buf, smallComplex());
+
+  std::string expected;
+  writeRaw<qi::uint32_t>(expected, 1);
+  writeRaw<int>(expected, 1);
+  writeRaw<int>(expected, 2);
+  writeRaw<float>(expected, 1.5f);
+  writeRaw<qi::uint32_t>(expected, 2);
+  expected += "ab";
+  writeRaw<qi::uint32_t>(expected, 1);
+  writeRaw<qi::uint32_t>(expected, 1);
+  writeRaw<int>(expected, 7);
+  EXPECT_EQ(expected, std::string(static_cast<const char*>(buf.data()), buf.size()));
+}
+
+TEST(TestBind, StaticCodecFailsOnTruncatedData)
+{
+  qi::Buffer buf;
+  qi::encodeBinary(&buf, smallComplex());
+  qi::Buffer truncated;
+  truncated.write(buf.data(), buf.size() - 1);
+
+  qi::BufferReader bufr(truncated);
+  Complex compout;
+  EXPECT_THROW(qi::decodeBinary(&bufr, &compout), std::runtime_error);
+}
+
+struct Scan
+{
+  std::vector<std::vector<float> > ranges;
+  std::vector<unsigned char> image;
+  std::vector<int> ids;
+};
+// Registered without a static codec: it is encoded by the type visitors.
+QI_TYPE_STRUCT_REGISTER(Scan, ranges, image, ids);
+
+TEST(TestBind, ScalarVectorsKeepTheWireFormat)
+{
+  Scan scan;
+  scan.ranges.push_back(std::vector<float>{1.5f, -2.f});
+  scan.ranges.push_back(std::vector<float>());
+  scan.ranges.push_back(std::vector<float>{3.25f});
+  scan.image = {0, 255, 7};
+  scan.ids = {-1, 42};
+
+  std::string expected;
+  writeRaw<qi::uint32_t>(expected, 3);
+  writeRaw<qi::uint32_t>(expected, 2);
+  writeRaw<float>(expected, 1.5f);
+  writeRaw<float>(expected, -2.f);
+  writeRaw<qi::uint32_t>(expected, 0);
+  writeRaw<qi::uint32_t>(expected, 1);
+  writeRaw<float>(expected, 3.25f);
+  writeRaw<qi::uint32_t>(expected, 3);
+  writeRaw<unsigned char>(expected, 0);
+  writeRaw<unsigned char>(expected, 255);
+  writeRaw<unsigned char>(expected, 7);
+  writeRaw<qi::uint32_t>(expected, 2);
+  writeRaw<int>(expected, -1);
+  writeRaw<int>(expected, 42);
+
+  // Through the type visitors.
+  EXPECT_FALSE(qi::detail::staticBinaryCodec(qi::typeOf<Scan>()).encode);
+  qi::Buffer buf;
+  qi::encodeBinary(&buf, scan);
+  EXPECT_EQ(expected, std::string(static_cast<const char*>(buf.data()), buf.size()));
+
+  qi::BufferReader bufr(buf);
+  Scan scanout;
+  qi::decodeBinary(&bufr, &scanout);
+  EXPECT_EQ(scan.ranges, scanout.ranges);
+  EXPECT_EQ(scan.image, scanout.image);
+  EXPECT_EQ(scan.ids, scanout.ids);
+
+  // Through the static codecs.
+  qi::Buffer staticBuf;
+  qi::encodeBinary(&staticBuf, scan.ranges);
+  qi::encodeBinary(&staticBuf, scan.image);
+  qi::encodeBinary(&staticBuf, scan.ids);
+  EXPECT_EQ(expected, std::string(static_cast<const char*>(staticBuf.data()), staticBuf.size()));
+
+  qi::BufferReader staticBufr(staticBuf);
+  std::vector<std::vector<float> > ranges;
+  qi::decodeBinary(&staticBufr, &ranges);
+  EXPECT_EQ(scan.ranges, ranges);
+
+  qi::Buffer truncated;
+  truncated.write(buf.data(), buf.size() - 1);
+  qi::BufferReader truncatedr(truncated);
+  EXPECT_THROW(qi::decodeBinary(&truncatedr, &scanout), std::runtime_error);
+}
+
+namespace
+{
+  template <typename T>
+  void expectEncodedSize(const T& value)
+  {
+    qi::Buffer buf;
+    qi::encodeBinary(&buf, value);
+    EXPECT_EQ(buf.size(), qi::encodedBinarySize(value));
+  }
+}
+
+TEST(TestBind, EncodedSizeIsExact)
+{
+  // Static codecs.
+  expectEncodedSize(smallComplex());
+  expectEncodedSize(std::vector<std::vector<float> >(3, std::vector<float>(5)));
+  expectEncodedSize(boost::make_optional(std::string("abc")));
+
+  // Type visitors.
+  Scan scan;
+  scan.ranges.push_back(std::vector<float>{1.5f, -2.f});
+  scan.image = {1, 2, 3};
+  expectEncodedSize(scan);
+  expectEncodedSize(qi::AnyValue::from(scan));
+  expectEncodedSize(qi::AnyValue());
+  std::vector<qi::AnyValue> values;
+  values.push_back(qi::AnyValue::from(42));
+  values.push_back(qi::AnyValue::from(std::map<std::string, double>{{"a", 1.}}));
+  values.push_back(qi::AnyValue::from(boost::optional<int>()));
+  expectEncodedSize(values);
+
+  // Only the size of a raw buffer is written in the buffer.
+  qi::Buffer raw;
+  raw.write("raw", 3);
+  expectEncodedSize(raw);
+}
+
+TEST(TestBind, EncodingReservesTheBufferOnce)
+{
+  const std::vector<std::string> strings(1000, std::string(100, 'x'));
+  qi::Buffer buf;
+  buf.write("head", 4);
+  ASSERT_TRUE(buf.reserveCapacity(qi::encodedBinarySize(strings)));
+  const void* data = buf.data();
+  qi::encodeBinary(&buf, strings);
+  EXPECT_EQ(data, buf.data());
+  EXPECT_EQ(4 + qi::encodedBinarySize(strings), buf.size());
+}
+
+namespace
+{
+  bool isIn(const qi::Buffer& buffer, const char* data)
+  {
+    const auto begin = static_cast<const char*>(buffer.data());
+    return data >= begin && data < begin + buffer.size();
+  }
+}
+
+TEST(BinaryView, ReadsTheValueInPlace)
+{
+  using Weights = std::map<std::string, float>;
+  Weights weights;
+  weights["a"] = 0.5f;
+  weights["b"] = 2.f;
+  qi::Buffer raw;
+  raw.write("raw", 3);
+
+  qi::Buffer buf;
+  qi::encodeBinary(&buf, std::string("hello"));
+  qi::encodeBinary(&buf, std::vector<int>{1, 2, 3});
+  qi::encodeBinary(&buf, weights);
+  qi::encodeBinary(&buf, qi::AnyValue::from(std::string("dynamic")));
+  qi::encodeBinary(&buf, boost::make_optional(42));
+  qi::encodeBinary(&buf, raw);
+
+  const qi::BinaryView view(std::move(buf), "(s[i]{sf}m+ir)");
+  ASSERT_EQ(6u, view.size());
+  const auto& data = *view.buffer();
+
+  const auto hello = view[0].asString();
+  EXPECT_EQ("hello", std::string(hello.first, hello.second));
+  EXPECT_TRUE(isIn(data, hello.first));
+
+  ASSERT_EQ(3u, view[1].size());
+  EXPECT_EQ(3, view[1][2].to<int>());
+  EXPECT_EQ((std::vector<int>{1, 2, 3}), view[1].to<std::vector<int> >());
+  EXPECT_EQ((std::vector<int>{1, 2, 3}), view[1].toValue().to<std::vector<int> >());
+
+  const auto map = view[2].mapElements();
+  ASSERT_EQ(2u, map.size());
+  const auto key = view[2].elementKey(1).asString();
+  EXPECT_EQ("b", std::string(key.first, key.second));
+  EXPECT_EQ(2.f, view[2][1].to<float>());
+  EXPECT_EQ(0.5f, map[0].second.to<float>());
+  EXPECT_EQ(weights, view[2].to<Weights>());
+
+  const auto dynamic = view[3].content();
+  EXPECT_EQ(qi::Signature("s"), dynamic.signature());
+  EXPECT_EQ("dynamic", dynamic.to<std::string>());
+
+  EXPECT_TRUE(view[4].optionalHasValue());
+  EXPECT_EQ(42, view[4].content().to<int>());
+
+  const auto rawData = view[5].asRaw();
+  EXPECT_EQ("raw", std::string(rawData.first, rawData.second));
+  EXPECT_EQ(data.subBuffers().at(0).second.data(), rawData.first);
+
+  const auto elements = view.elements();
+  ASSERT_EQ(6u, elements.size());
+  EXPECT_EQ(view[5].offset(), elements[5].offset());
+}
+
+TEST(BinaryView, ElementsKeepTheBufferAlive)
+{
+  qi::BinaryView element;
+  {
+    qi::Buffer buf;
+    qi::encodeBinary(&buf, std::vector<std::string>{"a", "bc"});
+    element = qi::BinaryView(std::move(buf), "[s]")[1];
+  }
+  const auto bc = element.asString();
+  EXPECT_EQ("bc", std::string(bc.first, bc.second));
+}
+
+TEST(BinaryView, FailsOnIllFormedData)
+{
+  qi::Buffer buf;
+  qi::encodeBinary(&buf, std::vector<std::string>{"a", "bc"});
+  qi::Buffer truncated;
+  truncated.write(buf.data(), buf.size() - 1);
+
+  const qi::BinaryView view(std::move(truncated), "[s]");
+  EXPECT_EQ(2u, view.size());
+  EXPECT_THROW(view[1].asString(), std::runtime_error);
+  EXPECT_THROW(view[2], std::runtime_error);
+  EXPECT_THROW(view.content(), std::runtime_error);
+  EXPECT_THROW(view.to<std::vector<std::string> >(), std::runtime_error);
+  EXPECT_FALSE(qi::BinaryView().isValid());
+}
+
 //compilation of weird case. C++ typesystem Hell.
 TEST(TestBind, TestShPtr) {
   boost::shared_ptr<int> sh1;
@@ -19,6 +19,7 @@
 #include <qi/type/dynamicobjectbuilder.hpp>
 #include <qi/type/objecttypebuilder.hpp>
 #include <qi/session.hpp>
+#include <qi/messaging/callbatch.hpp>
 #include <qi/testutils/testutils.hpp>
 #include <testsession/testsessionpair.hpp>
 #include "src/messaging/message.hpp"
@@ -1695,3 +1696,61 @@ TEST(TestCall, callAdvertisedAnyFunctionReturningAFuture)
   auto future = anyObject.metaCall("cancellableAsyncFuture", qi::GenericFunctionParameters{});
   EXPECT_TRUE(test::isStillRunning(future, test::willDoNothing(), qi::MilliSeconds{100}));
 }
+
+TEST(TestCall, CallBatchCallsAreAnswered)
+{
+  TestSessionPair sessions;
+  qi::DynamicObjectBuilder ob;
+  ob.advertiseMethod("twice", [](int value) { return 2 * value; });
+  ASSERT_TRUE(test::finishesWithValue(sessions.server()->registerService("Batched", ob.object())));
+  auto service = sessions.client()->service("Batched").value();
+
+  std::vector<qi::Future<int>> results;
+  {
+    qi::CallBatch batch;
+    for (int i = 0; i < 10; ++i)
+      results.push_back(service.async<int>("twice", i));
+  }
+  for (int i = 0; i < 10; ++i)
+  {
+    ASSERT_TRUE(test::finishesWithValue(results[i]));
+    EXPECT_EQ(2 * i, results[i].value());
+  }
+}
+
+// The replies to the calls of a batch are held until the others are there, but
+// the events emitted once a call returned must not overtake its reply.
+TEST(TestCall, EventsDoNotOvertakeTheRepliesOfACallBatch)
+{
+  TestSessionPair sessions;
+  qi::DynamicObjectBuilder ob;
+  ob.advertiseSignal<int>("notified");
+  qi::AnyObject object;
+  ob.advertiseMethod("notify", [&object](int value) {
+    qi::asyncDelay([&object, value] { object.post("notified", value); }, qi::MilliSeconds{1});
+    return value;
+  });
+  ob.advertiseMethod("slow", [] {
+    std::this_thread::sleep_for(std::chrono::milliseconds{200});
+    return 0;
+  });
+  object = ob.object();
+  ASSERT_TRUE(test::finishesWithValue(sessions.server()->registerService("Batched", object)));
+  auto service = sessions.client()->service("Batched").value();
+
+  qi::Future<int> notify;
+  qi::Promise<bool> replyFirst;
+  ASSERT_TRUE(test::finishesWithValue(service.connect("notified", [&](int) {
+    replyFirst.setValue(notify.isFinished());
+  })));
+  qi::Future<int> slow;
+  {
+    qi::CallBatch batch;
+    notify = service.async<int>("notify", 42);
+    slow = service.async<int>("slow");
+  }
+  ASSERT_TRUE(test::finishesWithValue(replyFirst.future()));
+  EXPECT_TRUE(replyFirst.future().value());
+  EXPECT_EQ(42, notify.value());
+  ASSERT_TRUE(test::finishesWithValue(slow));
+}
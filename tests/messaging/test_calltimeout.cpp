@@ -0,0 +1,58 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <gtest/gtest.h>
+#include <qi/messaging/calltimeout.hpp>
+
+namespace
+{
+  struct CallTimeoutTest : testing::Test
+  {
+    void SetUp() override
+    {
+      previousDefault = qi::defaultCallTimeout();
+      qi::setDefaultCallTimeout(qi::Duration::zero());
+    }
+
+    void TearDown() override
+    {
+      qi::resetMethodCallTimeout("Service", "method");
+      qi::setDefaultCallTimeout(previousDefault);
+    }
+
+    qi::Duration previousDefault;
+  };
+}
+
+TEST_F(CallTimeoutTest, NoTimeoutByDefault)
+{
+  EXPECT_FALSE(qi::callTimeout("Service", "method"));
+}
+
+TEST_F(CallTimeoutTest, MethodTimeoutOverridesDefault)
+{
+  qi::setDefaultCallTimeout(qi::Seconds(10));
+  qi::setMethodCallTimeout("Service", "method", qi::Seconds(2));
+  EXPECT_EQ(qi::Duration(qi::Seconds(2)), qi::callTimeout("Service", "method").value());
+  EXPECT_EQ(qi::Duration(qi::Seconds(10)), qi::callTimeout("Service", "other").value());
+
+  qi::setMethodCallTimeout("Service", "method", qi::Duration::zero());
+  EXPECT_FALSE(qi::callTimeout("Service", "method"));
+}
+
+TEST_F(CallTimeoutTest, ScopeOverridesMethodTimeout)
+{
+  qi::setMethodCallTimeout("Service", "method", qi::Seconds(2));
+  {
+    qi::CallTimeoutScope scope{qi::MilliSeconds(500)};
+    EXPECT_EQ(qi::Duration(qi::MilliSeconds(500)), qi::callTimeout("Service", "method").value());
+    {
+      qi::CallTimeoutScope noTimeout{qi::Duration::zero()};
+      EXPECT_FALSE(qi::callTimeout("Service", "method"));
+    }
+    EXPECT_EQ(qi::Duration(qi::MilliSeconds(500)), qi::callTimeout("Service", "method").value());
+  }
+  EXPECT_EQ(qi::Duration(qi::Seconds(2)), qi::callTimeout("Service", "method").value());
+}
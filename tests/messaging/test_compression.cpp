@@ -0,0 +1,196 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <cstring>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+#include <qi/anyvalue.hpp>
+#include "src/messaging/compression.hpp"
+
+namespace
+{
+  // Repetitive data, as a list of similar structures would be.
+  std::vector<char> makeCompressible(std::size_t size)
+  {
+    std::vector<char> data(size);
+    for (std::size_t i = 0; i < size; ++i)
+      data[i] = static_cast<char>((i % 16 < 8) ? i / 16 : 'x');
+    return data;
+  }
+
+  std::vector<char> makeRandom(std::size_t size)
+  {
+    std::mt19937 gen{42};
+    std::uniform_int_distribution<int> byte{0, 255};
+    std::vector<char> data(size);
+    for (auto& c: data)
+      c = static_cast<char>(byte(gen));
+    return data;
+  }
+
+  std::vector<char> roundTrip(const std::vector<char>& data)
+  {
+    std::vector<char> compressed(data.size() + data.size() / 255 + 16);
+    const auto size = qi::compression::compressBlock(data.data(), data.size(),
+                                                     compressed.data(), compressed.size());
+    EXPECT_NE(0u, size);
+    std::vector<char> decompressed(data.size());
+    EXPECT_TRUE(qi::compression::decompressBlock(compressed.data(), size,
+                                                 decompressed.data(), decompressed.size()));
+    return decompressed;
+  }
+
+  qi::Message makeMessage(const std::vector<char>& payload)
+  {
+    qi::Message msg;
+    qi::Buffer buffer;
+    buffer.write(payload.data(), payload.size());
+    msg.setBuffer(std::move(buffer));
+    return msg;
+  }
+
+  std::vector<char> payloadOf(const qi::Message& msg)
+  {
+    const auto data = static_cast<const char*>(msg.buffer().data());
+    return std::vector<char>(data, data + msg.buffer().size());
+  }
+}
+
+TEST(Compression, BlockRoundTrip)
+{
+  for (std::size_t size: {0u, 1u, 12u, 13u, 100u, 70000u, 1000000u})
+  {
+    const auto compressible = makeCompressible(size);
+    EXPECT_EQ(compressible, roundTrip(compressible)) << "size: " << size;
+    const auto random = makeRandom(size);
+    EXPECT_EQ(random, roundTrip(random)) << "size: " << size;
+  }
+}
+
+TEST(Compression, BlockShrinksRepetitiveData)
+{
+  const auto data = makeCompressible(100000);
+  std::vector<char> compressed(data.size());
+  const auto size = qi::compression::compressBlock(data.data(), data.size(),
+                                                   compressed.data(), compressed.size());
+  EXPECT_NE(0u, size);
+  EXPECT_LT(size, data.size() / 4);
+}
+
+TEST(Compression, BlockFailsIfOutputIsTooSmall)
+{
+  const auto data = makeRandom(1000);
+  std::vector<char> compressed(data.size() / 2);
+  EXPECT_EQ(0u, qi::compression::compressBlock(data.data(), data.size(),
+                                               compressed.data(), compressed.size()));
+}
+
+TEST(Compression, DecompressRejectsCorruptedData)
+{
+  const auto data = makeCompressible(10000);
+  std::vector<char> compressed(data.size());
+  const auto size = qi::compression::compressBlock(data.data(), data.size(),
+                                                   compressed.data(), compressed.size());
+  ASSERT_NE(0u, size);
+  std::vector<char> decompressed(data.size());
+
+  // Truncated input.
+  EXPECT_FALSE(qi::compression::decompressBlock(compressed.data(), size - 1,
+                                                decompressed.data(), decompressed.size()));
+  // Wrong output size.
+  EXPECT_FALSE(qi::compression::decompressBlock(compressed.data(), size,
+                                                decompressed.data(), decompressed.size() - 1));
+  // Offset beyond the beginning of the output.
+  const char badOffset[] = { 0x10, 'a', 0x10, 0x00, 0x00 };
+  EXPECT_FALSE(qi::compression::decompressBlock(badOffset, sizeof(badOffset),
+                                                decompressed.data(), decompressed.size()));
+}
+
+TEST(Compression, PayloadRoundTrip)
+{
+  const auto payload = makeCompressible(200000);
+  auto msg = makeMessage(payload);
+  ASSERT_TRUE(qi::compression::compressPayload(msg, 1024));
+  EXPECT_TRUE(msg.flags() & qi::Message::TypeFlag_Compressed);
+  EXPECT_LT(msg.header().size, payload.size());
+  EXPECT_EQ(msg.buffer().totalSize(), msg.header().size);
+
+  ASSERT_TRUE(qi::compression::decompressPayload(msg, payload.size()));
+  EXPECT_FALSE(msg.flags() & qi::Message::TypeFlag_Compressed);
+  EXPECT_EQ(payload.size(), msg.header().size);
+  EXPECT_EQ(payload, payloadOf(msg));
+}
+
+TEST(Compression, PayloadKeepsOtherFlags)
+{
+  auto msg = makeMessage(makeCompressible(10000));
+  msg.addFlags(qi::Message::TypeFlag_DynamicPayload);
+  ASSERT_TRUE(qi::compression::compressPayload(msg, 1024));
+  ASSERT_TRUE(qi::compression::decompressPayload(msg, 10000));
+  const unsigned int originalFlags = qi::Message::TypeFlag_DynamicPayload;
+  EXPECT_EQ(originalFlags, msg.flags());
+}
+
+TEST(Compression, PayloadIsNotCompressedBelowThreshold)
+{
+  const auto payload = makeCompressible(1000);
+  auto msg = makeMessage(payload);
+  EXPECT_FALSE(qi::compression::compressPayload(msg, 1001));
+  EXPECT_FALSE(qi::compression::compressPayload(msg, 0));
+  EXPECT_EQ(0u, msg.flags());
+  EXPECT_EQ(payload, payloadOf(msg));
+}
+
+TEST(Compression, PayloadIsNotCompressedIfItDoesNotShrink)
+{
+  const auto payload = makeRandom(100000);
+  auto msg = makeMessage(payload);
+  EXPECT_FALSE(qi::compression::compressPayload(msg, 1024));
+  EXPECT_EQ(0u, msg.flags());
+  EXPECT_EQ(payload, payloadOf(msg));
+}
+
+TEST(Compression, PayloadWithSubBuffersIsDecompressedInWireForm)
+{
+  const auto head = makeCompressible(5000);
+  const auto sub = makeCompressible(7000);
+  const auto tail = makeCompressible(3000);
+
+  qi::Buffer buffer;
+  buffer.write(head.data(), head.size());
+  qi::Buffer subBuffer;
+  subBuffer.write(sub.data(), sub.size());
+  buffer.addSubBuffer(subBuffer);
+  buffer.write(tail.data(), tail.size());
+  qi::Message msg;
+  msg.setBuffer(buffer);
+
+  // The sub-buffer is inlined after its size, as it is sent on the network.
+  std::vector<char> expected(head);
+  const auto sizeData = static_cast<const char*>(buffer.data()) + head.size();
+  expected.insert(expected.end(), sizeData, sizeData + sizeof(qi::Buffer::size_type));
+  expected.insert(expected.end(), sub.begin(), sub.end());
+  expected.insert(expected.end(), tail.begin(), tail.end());
+
+  ASSERT_TRUE(qi::compression::compressPayload(msg, 1024));
+  ASSERT_TRUE(qi::compression::decompressPayload(msg, expected.size()));
+  EXPECT_EQ(expected, payloadOf(msg));
+}
+
+TEST(Compression, DecompressPayloadRespectsMaxPayload)
+{
+  auto msg = makeMessage(makeCompressible(100000));
+  ASSERT_TRUE(qi::compression::compressPayload(msg, 1024));
+  EXPECT_FALSE(qi::compression::decompressPayload(msg, 99999));
+}
+
+TEST(Compression, DecompressPayloadIgnoresUncompressedMessages)
+{
+  const auto payload = makeCompressible(1000);
+  auto msg = makeMessage(payload);
+  EXPECT_TRUE(qi::compression::decompressPayload(msg, 10));
+  EXPECT_EQ(payload, payloadOf(msg));
+}
@@ -0,0 +1,163 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <vector>
+#include <gtest/gtest.h>
+#include "src/messaging/fragmentation.hpp"
+
+namespace
+{
+  std::vector<char> makePayload(std::size_t size, char seed = 0)
+  {
+    std::vector<char> data(size);
+    for (std::size_t i = 0; i < size; ++i)
+      data[i] = static_cast<char>(seed + i * 7);
+    return data;
+  }
+
+  qi::Message makeMessage(const std::vector<char>& payload,
+                          qi::Message::Type type = qi::Message::Type_Call)
+  {
+    qi::Message msg(type, qi::MessageAddress{42, 1, 2, 100});
+    qi::Buffer buffer;
+    buffer.write(payload.data(), payload.size());
+    msg.setBuffer(std::move(buffer));
+    return msg;
+  }
+
+  std::vector<char> payloadOf(const qi::Message& msg)
+  {
+    const auto data = static_cast<const char*>(msg.buffer().data());
+    return std::vector<char>(data, data + msg.buffer().size());
+  }
+
+  const std::size_t maxPayload = 1024 * 1024;
+}
+
+TEST(Fragmentation, SmallMessageIsNotSplit)
+{
+  const auto msg = makeMessage(makePayload(1000));
+  EXPECT_TRUE(qi::fragmentation::split(msg, 1000).empty());
+  EXPECT_TRUE(qi::fragmentation::split(msg, 0).empty());
+}
+
+TEST(Fragmentation, SplitAndReassemble)
+{
+  const auto payload = makePayload(10000);
+  auto msg = makeMessage(payload, qi::Message::Type_Reply);
+  msg.addFlags(qi::Message::TypeFlag_DynamicPayload);
+  auto fragments = qi::fragmentation::split(msg, 3000);
+  ASSERT_EQ(4u, fragments.size());
+  for (const auto& fragment: fragments)
+  {
+    EXPECT_EQ(msg.address(), fragment.address());
+    EXPECT_EQ(msg.type(), fragment.type());
+    EXPECT_TRUE(fragment.flags() & qi::Message::TypeFlag_Fragment);
+    EXPECT_EQ(qi::Message::Priority_Bulk, fragment.priority());
+    EXPECT_EQ(fragment.buffer().totalSize(), fragment.header().size);
+  }
+
+  using Status = qi::fragmentation::Reassembler::Status;
+  qi::fragmentation::Reassembler reassembler(maxPayload, maxPayload);
+  for (std::size_t i = 0; i + 1 < fragments.size(); ++i)
+    EXPECT_EQ(Status::Incomplete, reassembler.add(fragments[i]));
+  EXPECT_NE(0u, reassembler.pendingBytes());
+  auto& last = fragments.back();
+  ASSERT_EQ(Status::Complete, reassembler.add(last));
+  EXPECT_EQ(0u, reassembler.pendingBytes());
+  EXPECT_EQ(msg.address(), last.address());
+  const unsigned int originalFlags = qi::Message::TypeFlag_DynamicPayload;
+  EXPECT_EQ(originalFlags, last.flags());
+  EXPECT_EQ(payload.size(), last.header().size);
+  EXPECT_EQ(payload, payloadOf(last));
+}
+
+TEST(Fragmentation, InterleavedMessagesAreReassembled)
+{
+  const auto payloadA = makePayload(5000, 1);
+  const auto payloadB = makePayload(7000, 2);
+  auto msgA = makeMessage(payloadA, qi::Message::Type_Call);
+  // A reply has the id of a call: the type tells them apart.
+  auto msgB = makeMessage(payloadB, qi::Message::Type_Reply);
+  auto fragmentsA = qi::fragmentation::split(msgA, 2000);
+  auto fragmentsB = qi::fragmentation::split(msgB, 2000);
+  ASSERT_EQ(3u, fragmentsA.size());
+  ASSERT_EQ(4u, fragmentsB.size());
+
+  using Status = qi::fragmentation::Reassembler::Status;
+  qi::fragmentation::Reassembler reassembler(maxPayload, maxPayload);
+  auto plain = makeMessage(makePayload(10));
+  EXPECT_EQ(Status::Incomplete, reassembler.add(fragmentsA[0]));
+  EXPECT_EQ(Status::Incomplete, reassembler.add(fragmentsB[0]));
+  EXPECT_EQ(Status::Complete, reassembler.add(plain));
+  EXPECT_EQ(Status::Incomplete, reassembler.add(fragmentsB[1]));
+  EXPECT_EQ(Status::Incomplete, reassembler.add(fragmentsA[1]));
+  EXPECT_EQ(Status::Incomplete, reassembler.add(fragmentsB[2]));
+  ASSERT_EQ(Status::Complete, reassembler.add(fragmentsA[2]));
+  EXPECT_EQ(payloadA, payloadOf(fragmentsA[2]));
+  ASSERT_EQ(Status::Complete, reassembler.add(fragmentsB[3]));
+  EXPECT_EQ(payloadB, payloadOf(fragmentsB[3]));
+}
+
+TEST(Fragmentation, SubBuffersAreSplitInWireForm)
+{
+  const auto head = makePayload(3000, 1);
+  const auto sub = makePayload(4000, 2);
+  const auto tail = makePayload(2000, 3);
+  qi::Buffer buffer;
+  buffer.write(head.data(), head.size());
+  qi::Buffer subBuffer;
+  subBuffer.write(sub.data(), sub.size());
+  buffer.addSubBuffer(subBuffer);
+  buffer.write(tail.data(), tail.size());
+  qi::Message msg(qi::Message::Type_Call, qi::MessageAddress{42, 1, 2, 100});
+  msg.setBuffer(buffer);
+
+  std::vector<char> expected(head);
+  const auto sizeData = static_cast<const char*>(buffer.data()) + head.size();
+  expected.insert(expected.end(), sizeData, sizeData + sizeof(qi::Buffer::size_type));
+  expected.insert(expected.end(), sub.begin(), sub.end());
+  expected.insert(expected.end(), tail.begin(), tail.end());
+
+  auto fragments = qi::fragmentation::split(msg, 1500);
+  qi::fragmentation::Reassembler reassembler(maxPayload, maxPayload);
+  for (auto& fragment: fragments)
+    reassembler.add(fragment);
+  EXPECT_EQ(expected, payloadOf(fragments.back()));
+}
+
+TEST(Fragmentation, ReassemblerEnforcesLimits)
+{
+  using Status = qi::fragmentation::Reassembler::Status;
+  auto fragments = qi::fragmentation::split(makeMessage(makePayload(10000)), 3000);
+
+  // The whole message is too big.
+  qi::fragmentation::Reassembler small(9999, maxPayload);
+  EXPECT_EQ(Status::Invalid, small.add(fragments[0]));
+
+  // Too many bytes are pending.
+  qi::fragmentation::Reassembler fewPending(maxPayload, 5000);
+  EXPECT_EQ(Status::Incomplete, fewPending.add(fragments[0]));
+  EXPECT_EQ(Status::Invalid, fewPending.add(fragments[1]));
+  EXPECT_EQ(0u, fewPending.pendingBytes());
+
+  // A truncated first fragment.
+  qi::Message truncated(qi::Message::Type_Call, qi::MessageAddress{43, 1, 2, 100});
+  truncated.addFlags(qi::Message::TypeFlag_Fragment);
+  qi::fragmentation::Reassembler reassembler(maxPayload, maxPayload);
+  EXPECT_EQ(Status::Invalid, reassembler.add(truncated));
+}
+
+TEST(Fragmentation, ClearForgetsPartialMessages)
+{
+  using Status = qi::fragmentation::Reassembler::Status;
+  auto fragments = qi::fragmentation::split(makeMessage(makePayload(10000)), 3000);
+  qi::fragmentation::Reassembler reassembler(maxPayload, maxPayload);
+  EXPECT_EQ(Status::Incomplete, reassembler.add(fragments[0]));
+  reassembler.clear();
+  EXPECT_EQ(0u, reassembler.pendingBytes());
+  // The next fragment is taken for a first one, which it is not.
+  EXPECT_NE(Status::Complete, reassembler.add(fragments[1]));
+}
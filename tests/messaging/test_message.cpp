@@ -1,5 +1,6 @@
 #include <string>
 #include <algorithm>
+#include <vector>
 #include <gtest/gtest.h>
 #include <qi/application.hpp>
 #include "src/messaging/message.hpp"
@@ -60,3 +61,51 @@ TEST(TestMessage, CopiesAreDistinct)
   ASSERT_NE(buf.totalSize(), bb.totalSize());
 
 }
+
+TEST(TestMessage, DefaultPriority)
+{
+  using namespace qi;
+  const MessageAddress address{509, 2, 3, 105};
+  EXPECT_EQ(Message::Priority_Normal, Message(Message::Type_Call, address).priority());
+  EXPECT_EQ(Message::Priority_Normal, Message(Message::Type_Event, address).priority());
+  EXPECT_EQ(Message::Priority_Normal, Message(Message::Type_Cancel, address).priority());
+  EXPECT_EQ(Message::Priority_Normal, Message(Message::Type_Capability, address).priority());
+  EXPECT_EQ(Message::Priority_High, Message(Message::Type_Canceled, address).priority());
+
+  Message reply(Message::Type_Reply, address);
+  EXPECT_EQ(Message::Priority_High, reply.priority());
+  std::vector<char> payload(Message::smallReplySize + 1);
+  Buffer buf;
+  buf.write(payload.data(), payload.size());
+  reply.setBuffer(buf);
+  EXPECT_EQ(Message::Priority_Normal, reply.priority());
+
+  reply.setPriority(Message::Priority_Bulk);
+  EXPECT_EQ(Message::Priority_Bulk, reply.priority());
+}
+
+TEST(TestMessage, OnlyIndependentMessagesCanOvertake)
+{
+  using namespace qi;
+  const MessageAddress address{509, 2, 3, 105};
+  const MessageAddress otherCall{510, 2, 3, 105};
+  const MessageAddress otherObject{511, 2, 4, 105};
+
+  // The messages of an object keep their order.
+  const Message call(Message::Type_Call, address);
+  EXPECT_FALSE(Message(Message::Type_Cancel, address).canOvertake(call));
+  EXPECT_FALSE(Message(Message::Type_Call, otherCall).canOvertake(call));
+  EXPECT_TRUE(Message(Message::Type_Call, otherObject).canOvertake(call));
+
+  // Replies to distinct calls are independent, but not replies and events.
+  const Message reply(Message::Type_Reply, address);
+  EXPECT_TRUE(Message(Message::Type_Reply, otherCall).canOvertake(reply));
+  EXPECT_TRUE(Message(Message::Type_Error, otherObject).canOvertake(reply));
+  EXPECT_FALSE(Message(Message::Type_Reply, otherObject)
+                 .canOvertake(Message(Message::Type_Event, address)));
+
+  // Capabilities are never reordered.
+  const Message capability(Message::Type_Capability, otherObject);
+  EXPECT_FALSE(capability.canOvertake(call));
+  EXPECT_FALSE(Message(Message::Type_Reply, address).canOvertake(capability));
+}
@@ -0,0 +1,158 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <gtest/gtest.h>
+#include <boost/make_shared.hpp>
+#include <qi/os.hpp>
+#include "src/messaging/messagecapture.hpp"
+
+namespace
+{
+  qi::Message makeMessage(const std::string& payload,
+                          qi::Message::Type type = qi::Message::Type_Call)
+  {
+    qi::Message msg(type, qi::MessageAddress{7, 1, 2, 100});
+    qi::Buffer buffer;
+    buffer.write(payload.data(), payload.size());
+    msg.setBuffer(std::move(buffer));
+    return msg;
+  }
+
+  std::string payloadOf(const qi::Message& msg)
+  {
+    return std::string(static_cast<const char*>(msg.buffer().data()), msg.buffer().size());
+  }
+
+  std::string capturePath()
+  {
+    return qi::os::mktmpdir("test_messagecapture") + "/capture.qicap";
+  }
+}
+
+TEST(MessageCapture, RecordsAreReadInOrder)
+{
+  const auto path = capturePath();
+  {
+    qi::MessageCapture capture(path);
+    capture.record(1, qi::MessageCapture::Direction::Sent, makeMessage("call"));
+    capture.record(2, qi::MessageCapture::Direction::Received,
+                   makeMessage("reply", qi::Message::Type_Reply));
+    EXPECT_EQ(2u, capture.recordCount());
+  }
+
+  qi::MessageCaptureReader reader(path);
+  auto first = reader.next();
+  ASSERT_TRUE(first);
+  EXPECT_EQ(1u, first->stream);
+  EXPECT_EQ(qi::MessageCapture::Direction::Sent, first->direction);
+  EXPECT_EQ(qi::Message::Type_Call, first->message.type());
+  EXPECT_EQ(7u, first->message.id());
+  EXPECT_EQ(100u, first->message.action());
+  EXPECT_EQ("call", payloadOf(first->message));
+
+  auto second = reader.next();
+  ASSERT_TRUE(second);
+  EXPECT_EQ(2u, second->stream);
+  EXPECT_EQ(qi::MessageCapture::Direction::Received, second->direction);
+  EXPECT_EQ("reply", payloadOf(second->message));
+  EXPECT_LE(first->time, second->time);
+
+  EXPECT_FALSE(reader.next());
+}
+
+TEST(MessageCapture, SubBuffersAreInlinedAsOnTheNetwork)
+{
+  const auto path = capturePath();
+  qi::Buffer sub;
+  sub.write("sub", 3);
+  qi::Buffer buffer;
+  buffer.write("ab", 2);
+  buffer.addSubBuffer(sub);
+  buffer.write("cd", 2);
+  qi::Message msg(qi::Message::Type_Call, qi::MessageAddress{7, 1, 2, 100});
+  msg.setBuffer(buffer);
+  {
+    qi::MessageCapture capture(path);
+    capture.record(1, qi::MessageCapture::Direction::Sent, msg);
+  }
+
+  qi::MessageCaptureReader reader(path);
+  auto record = reader.next();
+  ASSERT_TRUE(record);
+  EXPECT_EQ(msg.header().size, record->message.header().size);
+  const auto payload = payloadOf(record->message);
+  ASSERT_EQ(2 + sizeof(qi::Buffer::size_type) + 3 + 2, payload.size());
+  EXPECT_EQ("ab", payload.substr(0, 2));
+  EXPECT_EQ("sub", payload.substr(2 + sizeof(qi::Buffer::size_type), 3));
+  EXPECT_EQ("cd", payload.substr(payload.size() - 2));
+}
+
+TEST(MessageCapture, TruncatedRecordThrows)
+{
+  const auto path = capturePath();
+  {
+    qi::MessageCapture capture(path);
+    capture.record(1, qi::MessageCapture::Direction::Sent, makeMessage("some payload"));
+  }
+  {
+    std::ifstream in(path, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(content.data(), content.size() - 3);
+  }
+  qi::MessageCaptureReader reader(path);
+  EXPECT_THROW(reader.next(), std::runtime_error);
+}
+
+TEST(MessageCapture, OversizedPayloadThrows)
+{
+  const auto path = capturePath();
+  {
+    qi::MessageCapture capture(path);
+    capture.record(1, qi::MessageCapture::Direction::Sent, makeMessage("some payload"));
+  }
+  {
+    // Overwrite the payload size of the record header, which follows the
+    // file header (magic, version) and the record time, stream and direction.
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    const std::uint32_t size = 0xFFFFFFF0u;
+    file.seekp(8 + 4 + 8 + 4 + 1 + offsetof(qi::Message::Header, size));
+    file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  }
+  qi::MessageCaptureReader reader(path);
+  EXPECT_THROW(reader.next(), std::runtime_error);
+}
+
+TEST(MessageCapture, OtherFilesAreRejected)
+{
+  const auto path = capturePath();
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << "not a capture file";
+  }
+  EXPECT_THROW(qi::MessageCaptureReader{path}, std::runtime_error);
+}
+
+TEST(MessageCapture, GlobalCaptureCanBeReplaced)
+{
+  const auto previous = qi::messageCapture();
+  const auto capture = boost::make_shared<qi::MessageCapture>(capturePath());
+  qi::setMessageCapture(capture);
+  EXPECT_TRUE(qi::messageCaptureEnabled());
+  EXPECT_EQ(capture, qi::messageCapture());
+  qi::setMessageCapture(nullptr);
+  EXPECT_FALSE(qi::messageCaptureEnabled());
+  qi::setMessageCapture(previous);
+}
+
+TEST(MessageCapture, StreamsAreUnique)
+{
+  EXPECT_NE(qi::newMessageCaptureStream(), qi::newMessageCaptureStream());
+}
@@ -0,0 +1,163 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "src/messaging/messagedispatcher.hpp"
+
+namespace
+{
+  qi::Message makeMessage(qi::Message::Type type, unsigned int id,
+                          unsigned int service = 1, unsigned int object = 2)
+  {
+    return qi::Message(type, qi::MessageAddress{id, service, object, 100});
+  }
+}
+
+TEST(MessageDispatcher, DispatchesToTargetAndAllObjects)
+{
+  qi::MessageDispatcher dispatcher;
+  std::atomic<int> targetCount{0};
+  std::atomic<int> allCount{0};
+  dispatcher.messagePendingConnect(1, 2, [&](const qi::Message&) { ++targetCount; });
+  dispatcher.messagePendingConnect(1, qi::MessageDispatcher::ALL_OBJECTS,
+                                   [&](const qi::Message&) { ++allCount; });
+
+  dispatcher.dispatch(makeMessage(qi::Message::Type_Reply, 1));
+  dispatcher.dispatch(makeMessage(qi::Message::Type_Reply, 2, 1, 3));
+  dispatcher.dispatch(makeMessage(qi::Message::Type_Reply, 3, 4, 2));
+
+  EXPECT_EQ(1, targetCount.load());
+  EXPECT_EQ(2, allCount.load());
+}
+
+TEST(MessageDispatcher, DisconnectedListenerIsNotCalled)
+{
+  qi::MessageDispatcher dispatcher;
+  std::atomic<int> count{0};
+  const auto link = dispatcher.messagePendingConnect(1, 2, [&](const qi::Message&) { ++count; });
+  dispatcher.messagePendingDisconnect(1, 2, link);
+  dispatcher.dispatch(makeMessage(qi::Message::Type_Reply, 1));
+  EXPECT_EQ(0, count.load());
+  EXPECT_TRUE(dispatcher.signalMap()->empty());
+}
+
+TEST(MessageDispatcher, RepliesEndPendingCalls)
+{
+  qi::MessageDispatcher dispatcher;
+  for (unsigned int id = 1; id <= 100; ++id)
+    dispatcher.sent(makeMessage(qi::Message::Type_Call, id));
+  dispatcher.sent(makeMessage(qi::Message::Type_Post, 101));
+  EXPECT_EQ(100u, dispatcher.pendingMessageCount());
+
+  for (unsigned int id = 1; id <= 50; ++id)
+    dispatcher.dispatch(makeMessage(qi::Message::Type_Reply, id));
+  EXPECT_EQ(50u, dispatcher.pendingMessageCount());
+}
+
+TEST(MessageDispatcher, CleaningPendingCallsDispatchesErrors)
+{
+  qi::MessageDispatcher dispatcher;
+  std::atomic<int> errorCount{0};
+  dispatcher.messagePendingConnect(1, 2, [&](const qi::Message& msg) {
+    if (msg.type() == qi::Message::Type_Error)
+      ++errorCount;
+  });
+  for (unsigned int id = 1; id <= 20; ++id)
+    dispatcher.sent(makeMessage(qi::Message::Type_Call, id));
+
+  dispatcher.cleanPendingMessages();
+  EXPECT_EQ(20, errorCount.load());
+  EXPECT_EQ(0u, dispatcher.pendingMessageCount());
+}
+
+TEST(MessageDispatcher, CallsSentWhileCleaningAreCleaned)
+{
+  qi::MessageDispatcher dispatcher;
+  std::atomic<int> errorCount{0};
+  dispatcher.messagePendingConnect(1, 2, [&](const qi::Message& msg) {
+    if (msg.type() != qi::Message::Type_Error)
+      return;
+    // The first errors send calls, to the same shard and to another one.
+    if (++errorCount == 1)
+    {
+      dispatcher.sent(makeMessage(qi::Message::Type_Call, msg.id() + 16));
+      dispatcher.sent(makeMessage(qi::Message::Type_Call, msg.id() + 1));
+    }
+  });
+  dispatcher.sent(makeMessage(qi::Message::Type_Call, 1));
+
+  dispatcher.cleanPendingMessages();
+  EXPECT_EQ(3, errorCount.load());
+  EXPECT_EQ(0u, dispatcher.pendingMessageCount());
+}
+
+TEST(MessageDispatcher, DispatchesWhileListenersChange)
+{
+  qi::MessageDispatcher dispatcher;
+  std::atomic<int> count{0};
+  dispatcher.messagePendingConnect(1, 2, [&](const qi::Message&) { ++count; });
+
+  std::atomic<bool> stop{false};
+  std::thread registering([&] {
+    unsigned int object = 10;
+    while (!stop)
+    {
+      const auto link = dispatcher.messagePendingConnect(1, object, [](const qi::Message&) {});
+      dispatcher.messagePendingDisconnect(1, object, link);
+      ++object;
+    }
+  });
+  for (unsigned int id = 1; id <= 1000; ++id)
+    dispatcher.dispatch(makeMessage(qi::Message::Type_Event, id));
+  stop = true;
+  registering.join();
+  EXPECT_EQ(1000, count.load());
+}
+
+TEST(MessageDispatcher, CallsTimeOutAtTheirDeadline)
+{
+  qi::MessageDispatcher dispatcher;
+  std::vector<qi::Message> errors;
+  std::vector<qi::MessageAddress> timedOut;
+  dispatcher.messagePendingConnect(1, 2, [&](const qi::Message& msg) {
+    if (msg.type() == qi::Message::Type_Error)
+      errors.push_back(msg);
+  });
+  dispatcher.setCallTimeoutHandler([&](const qi::MessageAddress& address) {
+    timedOut.push_back(address);
+  });
+
+  auto call = makeMessage(qi::Message::Type_Call, 1);
+  call.setCallTimeout(qi::Duration(qi::Seconds(60)));
+  dispatcher.sent(call);
+  auto answered = makeMessage(qi::Message::Type_Call, 2);
+  answered.setCallTimeout(qi::Duration(qi::Seconds(60)));
+  dispatcher.sent(answered);
+  dispatcher.received(makeMessage(qi::Message::Type_Reply, 2));
+
+  const auto now = qi::SteadyClock::now();
+  dispatcher.expireCalls(now);
+  EXPECT_TRUE(errors.empty());
+
+  dispatcher.expireCalls(now + qi::Seconds(61));
+  ASSERT_EQ(1u, errors.size());
+  EXPECT_EQ(1u, errors.front().id());
+  ASSERT_EQ(1u, timedOut.size());
+  EXPECT_EQ(1u, timedOut.front().messageId);
+  EXPECT_EQ(0u, dispatcher.pendingMessageCount());
+}
+
+TEST(MessageDispatcher, FailedSendIsNotPending)
+{
+  qi::MessageDispatcher dispatcher;
+  auto call = makeMessage(qi::Message::Type_Call, 1);
+  call.setCallTimeout(qi::Duration(qi::Seconds(60)));
+  dispatcher.sent(call);
+  dispatcher.sendFailed(call);
+  EXPECT_EQ(0u, dispatcher.pendingMessageCount());
+}
@@ -0,0 +1,127 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <sstream>
+#include <gtest/gtest.h>
+#include "src/messaging/messagelatency.hpp"
+
+namespace
+{
+  qi::Message makeMessage(qi::Message::Type type, unsigned int id)
+  {
+    return qi::Message(type, qi::MessageAddress{id, 1, 2, 100});
+  }
+
+  struct MessageLatencyTest : testing::Test
+  {
+    void SetUp() override
+    {
+      qi::messageLatencyRegistry().reset();
+    }
+
+    void TearDown() override
+    {
+      qi::messageLatencyRegistry().reset();
+    }
+  };
+}
+
+TEST(LatencyHistogram, EmptyHistogramReportsZero)
+{
+  qi::LatencyHistogram histogram;
+  const auto snapshot = histogram.snapshot();
+  EXPECT_EQ(0u, snapshot.count);
+  EXPECT_EQ(0., snapshot.meanUs());
+  EXPECT_EQ(0u, snapshot.percentileUs(50));
+}
+
+TEST(LatencyHistogram, PercentilesAreBucketBounds)
+{
+  qi::LatencyHistogram histogram;
+  for (int i = 0; i < 98; ++i)
+    histogram.record(qi::MicroSeconds{10});
+  histogram.record(qi::MicroSeconds{1000});
+  histogram.record(qi::MicroSeconds{5000});
+
+  const auto snapshot = histogram.snapshot();
+  EXPECT_EQ(100u, snapshot.count);
+  EXPECT_EQ(5000u, snapshot.maxUs);
+  EXPECT_DOUBLE_EQ((98 * 10 + 1000 + 5000) / 100., snapshot.meanUs());
+  // 10us falls in [8, 16[, 1000us in [512, 1024[.
+  EXPECT_EQ(16u, snapshot.percentileUs(50));
+  EXPECT_EQ(1024u, snapshot.percentileUs(99));
+  EXPECT_EQ(5000u, snapshot.percentileUs(100));
+}
+
+TEST(LatencyHistogram, ResetForgetsRecords)
+{
+  qi::LatencyHistogram histogram;
+  histogram.record(qi::MilliSeconds{3});
+  histogram.reset();
+  EXPECT_EQ(0u, histogram.snapshot().count);
+  EXPECT_EQ(0u, histogram.snapshot().maxUs);
+}
+
+TEST_F(MessageLatencyTest, ReplyEndsTheRoundTripOfItsCall)
+{
+  qi::MessageLatencyTracker tracker;
+  auto call = makeMessage(qi::Message::Type_Call, 7);
+  tracker.onSend(call);
+  EXPECT_NE(qi::SteadyClock::time_point{}, call.timestamp());
+  tracker.onSent(call);
+
+  auto reply = makeMessage(qi::Message::Type_Reply, 7);
+  reply.setTimestamp(qi::SteadyClock::now());
+  tracker.onDispatch(reply);
+
+  const auto& latency = tracker.latency();
+  EXPECT_EQ(1u, latency.snapshot(qi::LatencyStage::Send).count);
+  EXPECT_EQ(1u, latency.snapshot(qi::LatencyStage::Receive).count);
+  EXPECT_EQ(1u, latency.snapshot(qi::LatencyStage::RoundTrip).count);
+  EXPECT_EQ(0u, latency.snapshot(qi::LatencyStage::Callee).count);
+
+  // A second reply with the same id does not match any call.
+  tracker.onDispatch(reply);
+  EXPECT_EQ(1u, latency.snapshot(qi::LatencyStage::RoundTrip).count);
+}
+
+TEST_F(MessageLatencyTest, ReplySentEndsTheCalleeTimeOfItsCall)
+{
+  qi::MessageLatencyTracker tracker;
+  tracker.onDispatch(makeMessage(qi::Message::Type_Call, 3));
+  auto error = makeMessage(qi::Message::Type_Error, 3);
+  tracker.onSend(error);
+  EXPECT_EQ(1u, tracker.latency().snapshot(qi::LatencyStage::Callee).count);
+  EXPECT_EQ(0u, tracker.latency().snapshot(qi::LatencyStage::RoundTrip).count);
+}
+
+TEST_F(MessageLatencyTest, RegistryExportsStagesPerMethod)
+{
+  qi::MessageLatencyTracker tracker;
+  tracker.onDispatch(makeMessage(qi::Message::Type_Call, 3));
+  auto reply = makeMessage(qi::Message::Type_Reply, 3);
+  tracker.onSend(reply);
+
+  const auto snapshot = qi::messageLatencyRegistry().snapshot();
+  ASSERT_EQ(1u, snapshot.size());
+  const auto& key = snapshot.begin()->first;
+  EXPECT_EQ(1u, key.service);
+  EXPECT_EQ(2u, key.object);
+  EXPECT_EQ(100u, key.action);
+
+  std::ostringstream out;
+  qi::messageLatencyRegistry().exportText(out);
+  const auto text = out.str();
+  EXPECT_NE(std::string::npos, text.find("service=1 object=2 action=100 stage=Callee count=1"));
+  EXPECT_EQ(std::string::npos, text.find("stage=Send"));
+}
+
+TEST(MessageLatency, CanBeEnabledAtRuntime)
+{
+  const auto enabled = qi::messageLatencyEnabled();
+  qi::setMessageLatencyEnabled(!enabled);
+  EXPECT_EQ(!enabled, qi::messageLatencyEnabled());
+  qi::setMessageLatencyEnabled(enabled);
+}
@@ -0,0 +1,81 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <gtest/gtest.h>
+#include <qi/future.hpp>
+#include <qi/os.hpp>
+#include "src/messaging/objectdispatchqueues.hpp"
+
+namespace
+{
+  const auto timeout = qi::Seconds(5);
+}
+
+TEST(ObjectDispatchQueues, HandlesTheMessagesOfAServiceInOrder)
+{
+  qi::ObjectDispatchQueues queues;
+  std::mutex mutex;
+  std::vector<int> handled;
+  qi::Promise<void> done;
+  const int count = 1000;
+  for (int i = 0; i < count; ++i)
+  {
+    queues.post(1, [&, i] {
+      std::lock_guard<std::mutex> lock{mutex};
+      handled.push_back(i);
+      if (i == count - 1)
+        done.setValue(nullptr);
+    });
+  }
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, done.future().wait(timeout));
+  std::lock_guard<std::mutex> lock{mutex};
+  ASSERT_EQ(static_cast<std::size_t>(count), handled.size());
+  for (int i = 0; i < count; ++i)
+    EXPECT_EQ(i, handled[i]);
+  EXPECT_EQ(1u, queues.size());
+}
+
+TEST(ObjectDispatchQueues, ServicesDoNotWaitForEachOther)
+{
+  qi::ObjectDispatchQueues queues;
+  qi::Promise<void> unblock;
+  qi::Promise<void> firstDone;
+  // The first service waits for a message of the second one: it would never
+  // be handled if the services shared a queue.
+  queues.post(1, [&] {
+    if (unblock.future().wait(timeout) == qi::FutureState_FinishedWithValue)
+      firstDone.setValue(nullptr);
+  });
+  queues.post(2, [&] { unblock.setValue(nullptr); });
+  EXPECT_EQ(qi::FutureState_FinishedWithValue, firstDone.future().wait(timeout));
+  EXPECT_EQ(2u, queues.size());
+}
+
+TEST(ObjectDispatchQueues, JoinDropsThePendingMessages)
+{
+  qi::ObjectDispatchQueues queues;
+  std::atomic<int> handled{0};
+  qi::Promise<void> running;
+  // The first message runs until the join has started, so the second one is
+  // still pending when it does.
+  queues.post(1, [&] {
+    running.setValue(nullptr);
+    const auto deadline = qi::SteadyClock::now() + timeout;
+    while (queues.size() != 0 && qi::SteadyClock::now() < deadline)
+      qi::os::msleep(1);
+    ++handled;
+  });
+  queues.post(1, [&] { ++handled; });
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, running.future().wait(timeout));
+  queues.join();
+  EXPECT_EQ(1, handled.load());
+
+  queues.post(1, [&] { ++handled; });
+  EXPECT_EQ(0u, queues.size());
+  EXPECT_EQ(1, handled.load());
+}
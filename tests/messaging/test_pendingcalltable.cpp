@@ -0,0 +1,153 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <gtest/gtest.h>
+#include "src/messaging/pendingcalltable.hpp"
+
+namespace
+{
+  // Puts all the keys of a shard in the same few slots, to exercise probing.
+  struct CollidingHash
+  {
+    std::size_t operator()(unsigned int key) const
+    {
+      return (key % 3) << qi::PendingCallTable<unsigned int, int>::shardBits;
+    }
+  };
+}
+
+TEST(PendingCallTable, InsertFindTake)
+{
+  qi::PendingCallTable<unsigned int, std::string> table;
+  EXPECT_TRUE(table.insert(1, "one"));
+  EXPECT_TRUE(table.insert(2, "two"));
+  EXPECT_FALSE(table.insert(1, "uno"));
+  EXPECT_EQ(2u, table.size());
+
+  EXPECT_EQ(std::string("one"), table.find(1).value_or(""));
+  EXPECT_FALSE(table.find(3));
+
+  EXPECT_EQ(std::string("two"), table.take(2).value_or(""));
+  EXPECT_FALSE(table.take(2));
+  EXPECT_FALSE(table.erase(2));
+  EXPECT_TRUE(table.erase(1));
+  EXPECT_TRUE(table.empty());
+}
+
+TEST(PendingCallTable, SetReplacesTheValue)
+{
+  qi::PendingCallTable<unsigned int, std::string> table;
+  table.set(1, "one");
+  table.set(1, "uno");
+  EXPECT_EQ(1u, table.size());
+  EXPECT_EQ(std::string("uno"), table.find(1).value_or(""));
+}
+
+TEST(PendingCallTable, EraseKeepsCollidingKeysReachable)
+{
+  qi::PendingCallTable<unsigned int, unsigned int, CollidingHash> table;
+  for (unsigned int key = 0; key < 100; ++key)
+    ASSERT_TRUE(table.insert(key, key * 2));
+  for (unsigned int key = 0; key < 100; key += 3)
+    ASSERT_TRUE(table.erase(key));
+  for (unsigned int key = 0; key < 100; ++key)
+  {
+    if (key % 3 == 0)
+      EXPECT_FALSE(table.find(key));
+    else
+      EXPECT_EQ(key * 2, table.find(key).value_or(0));
+  }
+}
+
+TEST(PendingCallTable, EraseIfAndTakeAll)
+{
+  qi::PendingCallTable<unsigned int, unsigned int> table;
+  for (unsigned int key = 0; key < 1000; ++key)
+    table.insert(key, key);
+  EXPECT_EQ(500u, table.eraseIf([](unsigned int key, unsigned int) { return key % 2 == 0; }));
+  EXPECT_EQ(500u, table.size());
+
+  auto entries = table.takeAll();
+  EXPECT_TRUE(table.empty());
+  ASSERT_EQ(500u, entries.size());
+  for (const auto& entry: entries)
+  {
+    EXPECT_EQ(1u, entry.first % 2);
+    EXPECT_EQ(entry.first, entry.second);
+  }
+  EXPECT_TRUE(table.insert(1, 1));
+}
+
+TEST(PendingCallTable, BehavesLikeAMap)
+{
+  std::mt19937 random(42);
+  std::uniform_int_distribution<unsigned int> keys(0, 2000);
+  qi::PendingCallTable<unsigned int, unsigned int, CollidingHash> table;
+  std::map<unsigned int, unsigned int> reference;
+  for (int i = 0; i < 20000; ++i)
+  {
+    const auto key = keys(random);
+    switch (random() % 3)
+    {
+    case 0:
+      EXPECT_EQ(reference.emplace(key, i).second, table.insert(key, i));
+      break;
+    case 1:
+    {
+      const auto it = reference.find(key);
+      const auto taken = table.take(key);
+      ASSERT_EQ(it != reference.end(), static_cast<bool>(taken));
+      if (taken)
+      {
+        EXPECT_EQ(it->second, *taken);
+        reference.erase(it);
+      }
+      break;
+    }
+    default:
+    {
+      const auto it = reference.find(key);
+      const auto found = table.find(key);
+      ASSERT_EQ(it != reference.end(), static_cast<bool>(found));
+      if (found)
+      {
+        EXPECT_EQ(it->second, *found);
+      }
+    }
+    }
+  }
+  EXPECT_EQ(reference.size(), table.size());
+}
+
+TEST(PendingCallTable, ConcurrentCalls)
+{
+  const unsigned int threadCount = 4;
+  const unsigned int callCount = 20000;
+  qi::PendingCallTable<unsigned int, unsigned int> table;
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t < threadCount; ++t)
+  {
+    threads.emplace_back([&table, t, threadCount, callCount] {
+      // Like message ids: interleaved between the threads.
+      for (unsigned int i = 0; i < callCount; ++i)
+      {
+        const auto id = i * threadCount + t;
+        ASSERT_TRUE(table.insert(id, id));
+        if (i >= 8)
+        {
+          const auto previous = id - 8 * threadCount;
+          ASSERT_EQ(previous, table.take(previous).value_or(0u - 1));
+        }
+      }
+    });
+  }
+  for (auto& thread: threads)
+    thread.join();
+  EXPECT_EQ(threadCount * 8, table.size());
+}
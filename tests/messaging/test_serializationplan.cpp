@@ -0,0 +1,75 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <qi/anyvalue.hpp>
+#include "src/type/serializationplan.hpp"
+
+using Kind = qi::detail::ArgumentsSerializationPlan::Kind;
+
+TEST(SerializationPlan, ValuesOfTheTargetSignatureAreSerializedAsTheyAre)
+{
+  const auto plan = qi::detail::serializationPlan(qi::typeOf<std::vector<int>>(), "[i]");
+  EXPECT_FALSE(plan.convert);
+}
+
+TEST(SerializationPlan, OtherValuesAreConverted)
+{
+  const auto plan = qi::detail::serializationPlan(qi::typeOf<int>(), "l");
+  EXPECT_TRUE(plan.convert);
+  EXPECT_EQ(qi::detail::typeOfSignature("l"), plan.target);
+  EXPECT_TRUE(plan.target);
+}
+
+TEST(SerializationPlan, TypesOfSignaturesAreTheOnesOfTheTypeSystem)
+{
+  const auto type = qi::detail::typeOfSignature("[s]");
+  EXPECT_EQ(qi::TypeInterface::fromSignature("[s]"), type);
+  EXPECT_EQ(type, qi::detail::typeOfSignature("[s]"));
+}
+
+TEST(SerializationPlan, ArgumentsAreConvertedOneByOne)
+{
+  int i = 42;
+  std::string s = "foo";
+  const std::vector<qi::AnyReference> args{qi::AnyReference::from(i), qi::AnyReference::from(s)};
+
+  EXPECT_EQ(Kind::AsIs, qi::detail::argumentsSerializationPlan(args, "(is)")->kind);
+  EXPECT_EQ(Kind::Dynamic, qi::detail::argumentsSerializationPlan(args, "m")->kind);
+
+  const auto plan = qi::detail::argumentsSerializationPlan(args, "(ls)");
+  ASSERT_EQ(Kind::Convert, plan->kind);
+  ASSERT_EQ(2u, plan->targets.size());
+  EXPECT_EQ(qi::detail::typeOfSignature("l"), plan->targets[0]);
+  EXPECT_EQ(nullptr, plan->targets[1]);
+  EXPECT_EQ(plan, qi::detail::argumentsSerializationPlan(args, "(ls)"));
+}
+
+TEST(SerializationPlan, MismatchingArgumentsAreErrors)
+{
+  int i = 42;
+  const std::vector<qi::AnyReference> args{qi::AnyReference::from(i)};
+
+  const auto notATuple = qi::detail::argumentsSerializationPlan(args, "i");
+  EXPECT_EQ(Kind::Error, notATuple->kind);
+  EXPECT_FALSE(notATuple->error.empty());
+  EXPECT_EQ(Kind::Error, qi::detail::argumentsSerializationPlan(args, "(ii)")->kind);
+}
+
+TEST(SerializationPlan, PlansAreStillRightWhenManySignaturesWereMet)
+{
+  // More signatures than the caches keep, as a remote end may send.
+  for (int i = 0; i < 5000; ++i)
+  {
+    const auto signature = "(i)<Struct" + std::to_string(i) + ",field>";
+    qi::detail::serializationPlan(qi::typeOf<int>(), signature);
+  }
+  const auto plan = qi::detail::serializationPlan(qi::typeOf<int>(), "l");
+  EXPECT_TRUE(plan.convert);
+  EXPECT_EQ(qi::TypeInterface::fromSignature("l"), plan.target);
+  EXPECT_EQ(qi::TypeInterface::fromSignature("[s]"), qi::detail::typeOfSignature("[s]"));
+}
@@ -0,0 +1,331 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <gtest/gtest.h>
+#include <numeric>
+#include <boost/thread/synchronized_value.hpp>
+#include <qi/future.hpp>
+#include <qi/os.hpp>
+#include "src/messaging/sharedmemory.hpp"
+
+#if QI_SHARED_MEMORY_TRANSPORT
+
+static const qi::MilliSeconds defaultTimeout{ 2000 };
+
+namespace
+{
+  const std::size_t ringCapacity = 64 * 1024;
+
+  qi::Message makeMessage(unsigned int id, std::size_t payloadSize)
+  {
+    qi::Message msg;
+    msg.setId(id);
+    msg.setType(qi::Message::Type_Call);
+    std::vector<char> payload(payloadSize);
+    std::iota(payload.begin(), payload.end(), static_cast<char>(id));
+    qi::Buffer buffer;
+    buffer.write(payload.data(), payload.size());
+    msg.setBuffer(std::move(buffer));
+    return msg;
+  }
+
+  bool samePayload(const qi::Message& a, const qi::Message& b)
+  {
+    const auto& bufA = a.buffer();
+    const auto& bufB = b.buffer();
+    return bufA.size() == bufB.size()
+        && std::equal(static_cast<const char*>(bufA.data()),
+                      static_cast<const char*>(bufA.data()) + bufA.size(),
+                      static_cast<const char*>(bufB.data()));
+  }
+}
+
+TEST(SharedMemoryRing, ReadWriteWrapsAround)
+{
+  auto segment = qi::shm::Segment::create(ringCapacity);
+  auto& out = segment->outgoing(qi::shm::Segment::Side::Client);
+  auto& in = segment->incoming(qi::shm::Segment::Side::Server);
+
+  std::vector<char> data(ringCapacity / 3 * 2);
+  std::iota(data.begin(), data.end(), 0);
+  std::vector<char> received(data.size());
+  for (int i = 0; i < 3; ++i)
+  {
+    ASSERT_EQ(data.size(), out.write(data.data(), data.size()));
+    EXPECT_EQ(ringCapacity - data.size(), out.writable());
+    ASSERT_EQ(data.size(), in.read(received.data(), received.size()));
+    EXPECT_EQ(data, received);
+  }
+  EXPECT_EQ(0u, in.readable());
+}
+
+TEST(SharedMemoryRing, WriteIsPartialWhenFull)
+{
+  auto segment = qi::shm::Segment::create(ringCapacity);
+  auto& out = segment->outgoing(qi::shm::Segment::Side::Server);
+  std::vector<char> data(ringCapacity + 100);
+  EXPECT_EQ(ringCapacity, out.write(data.data(), data.size()));
+  EXPECT_EQ(0u, out.write(data.data(), data.size()));
+  EXPECT_FALSE(out.waitWritable(1, std::chrono::milliseconds{10}));
+}
+
+TEST(SharedMemoryRing, CloseWakesUpReader)
+{
+  auto segment = qi::shm::Segment::create(ringCapacity);
+  auto& in = segment->incoming(qi::shm::Segment::Side::Client);
+  auto waiting = qi::async([&]{ return in.waitReadable(std::chrono::milliseconds{60000}); });
+  qi::os::msleep(50);
+  segment->outgoing(qi::shm::Segment::Side::Server).close();
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, waiting.wait(defaultTimeout));
+  EXPECT_FALSE(waiting.value());
+}
+
+TEST(SharedMemoryRing, InconsistentPositionsCloseTheRing)
+{
+  qi::shm::RingControl control{};
+  std::vector<char> data(ringCapacity);
+  qi::shm::Ring ring(&control, data.data(), ringCapacity);
+  control.head.store(ringCapacity + 1);
+  char buffer[16];
+  EXPECT_EQ(0u, ring.readable());
+  EXPECT_EQ(0u, ring.read(buffer, sizeof(buffer)));
+  EXPECT_TRUE(ring.isCorrupted());
+  EXPECT_TRUE(ring.isClosed());
+  EXPECT_FALSE(ring.waitReadable(std::chrono::milliseconds{10}));
+}
+
+TEST(SharedMemoryRing, TailAheadOfHeadClosesTheRing)
+{
+  qi::shm::RingControl control{};
+  std::vector<char> data(ringCapacity);
+  qi::shm::Ring ring(&control, data.data(), ringCapacity);
+  control.tail.store(10);
+  const char buffer[16] = {};
+  EXPECT_EQ(0u, ring.writable());
+  EXPECT_EQ(0u, ring.write(buffer, sizeof(buffer)));
+  EXPECT_TRUE(ring.isCorrupted());
+  EXPECT_TRUE(ring.isClosed());
+}
+
+TEST(SharedMemorySegment, OpenByName)
+{
+  auto created = qi::shm::Segment::create(ringCapacity);
+  auto opened = qi::shm::Segment::open(created->name());
+  const char data[] = "hello";
+  created->outgoing(qi::shm::Segment::Side::Client).write(data, sizeof(data));
+  char received[sizeof(data)] = {};
+  EXPECT_EQ(sizeof(data), opened->incoming(qi::shm::Segment::Side::Server).read(received, sizeof(received)));
+  EXPECT_STREQ(data, received);
+}
+
+TEST(SharedMemorySegment, OpenFailsAfterUnlink)
+{
+  auto created = qi::shm::Segment::create(ringCapacity);
+  created->unlink();
+  EXPECT_ANY_THROW(qi::shm::Segment::open(created->name()));
+}
+
+TEST(SharedMemorySegment, OpenRefusesOtherNames)
+{
+  auto created = qi::shm::Segment::create(ringCapacity);
+  EXPECT_ANY_THROW(qi::shm::Segment::open(created->name().substr(1)));
+  EXPECT_ANY_THROW(qi::shm::Segment::open("/qi-shm-"));
+  EXPECT_ANY_THROW(qi::shm::Segment::open("/qi-shm-../other"));
+  EXPECT_ANY_THROW(qi::shm::Segment::open("/other"));
+}
+
+TEST(SharedMemoryChannel, MessagesAreReceivedInOrder)
+{
+  auto created = qi::shm::Segment::create(ringCapacity);
+  auto name = created->name();
+  auto client = std::make_shared<qi::shm::Channel>(std::move(created), qi::shm::Segment::Side::Client);
+  auto server = std::make_shared<qi::shm::Channel>(qi::shm::Segment::open(name),
+                                                   qi::shm::Segment::Side::Server);
+
+  // Some messages are bigger than the ring, so that they are written as the
+  // reader consumes them.
+  std::vector<qi::Message> sent;
+  for (unsigned int i = 0; i < 20; ++i)
+    sent.push_back(makeMessage(i, (i % 4 == 0) ? 3 * ringCapacity : 100 * i));
+
+  qi::Promise<void> allReceived;
+  boost::synchronized_value<std::vector<qi::Message>> received;
+  server->startReceiving([&](qi::Message* msg) {
+    if (!msg)
+    {
+      allReceived.setError("corrupted stream");
+      return false;
+    }
+    auto syncReceived = received.synchronize();
+    syncReceived->push_back(*msg);
+    if (syncReceived->size() == sent.size())
+      allReceived.setValue(nullptr);
+    return true;
+  }, 50000000);
+
+  for (const auto& msg: sent)
+    ASSERT_TRUE(client->send(msg));
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, allReceived.future().wait(defaultTimeout));
+
+  auto syncReceived = received.synchronize();
+  for (std::size_t i = 0; i < sent.size(); ++i)
+  {
+    EXPECT_EQ(sent[i].id(), (*syncReceived)[i].id());
+    EXPECT_TRUE(samePayload(sent[i], (*syncReceived)[i]));
+  }
+  client->close();
+  server->close();
+}
+
+TEST(SharedMemoryChannel, SendFailsAfterClose)
+{
+  auto client = std::make_shared<qi::shm::Channel>(qi::shm::Segment::create(ringCapacity),
+                                                   qi::shm::Segment::Side::Client);
+  client->close();
+  EXPECT_FALSE(client->send(makeMessage(1, 10)));
+}
+
+TEST(SharedMemoryChannel, QueueLimitsApply)
+{
+  const qi::sock::SendQueueLimits limits{0, 1, qi::sock::SendQueuePolicy::Reject};
+  auto client = std::make_shared<qi::shm::Channel>(qi::shm::Segment::create(ringCapacity),
+                                                   qi::shm::Segment::Side::Client, limits);
+  // Nobody reads: the first message fills the ring and stays in the queue.
+  ASSERT_TRUE(client->send(makeMessage(1, 2 * ringCapacity)));
+  EXPECT_FALSE(client->send(makeMessage(2, 10)));
+  const auto stats = client->queueStats();
+  EXPECT_EQ(1u, stats.messages);
+  EXPECT_EQ(1u, stats.rejected);
+  EXPECT_FALSE(client->ready().isFinished());
+  client->close();
+}
+
+TEST(SharedMemoryChannel, HigherPriorityMessagesAreWrittenFirst)
+{
+  auto created = qi::shm::Segment::create(ringCapacity);
+  auto name = created->name();
+  auto client = std::make_shared<qi::shm::Channel>(std::move(created), qi::shm::Segment::Side::Client);
+  auto server = std::make_shared<qi::shm::Channel>(qi::shm::Segment::open(name),
+                                                   qi::shm::Segment::Side::Server);
+
+  // The first message blocks the ring until the server reads, the others are
+  // queued behind it.
+  auto large = makeMessage(1, 2 * ringCapacity);
+  auto bulk = makeMessage(2, 1000);
+  bulk.setPriority(qi::Message::Priority_Bulk);
+  auto call = makeMessage(3, 10);
+  call.setObject(2);
+  ASSERT_LT(bulk.priority(), call.priority());
+  ASSERT_TRUE(client->send(large));
+  ASSERT_TRUE(client->send(bulk));
+  ASSERT_TRUE(client->send(call));
+
+  qi::Promise<void> allReceived;
+  boost::synchronized_value<std::vector<unsigned int>> received;
+  server->startReceiving([&](qi::Message* msg) {
+    if (!msg)
+    {
+      allReceived.setError("corrupted stream");
+      return false;
+    }
+    auto syncReceived = received.synchronize();
+    syncReceived->push_back(msg->id());
+    if (syncReceived->size() == 3)
+      allReceived.setValue(nullptr);
+    return true;
+  }, 50000000);
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, allReceived.future().wait(defaultTimeout));
+  EXPECT_EQ((std::vector<unsigned int>{1, 3, 2}), *received.synchronize());
+  client->close();
+  server->close();
+}
+
+TEST(SharedMemoryLink, CanBeUsedOnlyOnSameMachine)
+{
+  using qi::AnyValue;
+  const auto machine = AnyValue::from(qi::os::getMachineId());
+  EXPECT_TRUE(qi::shm::Link::canBeUsed(machine, machine));
+  EXPECT_FALSE(qi::shm::Link::canBeUsed(machine, AnyValue::from(std::string("other"))));
+  EXPECT_FALSE(qi::shm::Link::canBeUsed(machine, boost::none));
+  EXPECT_FALSE(qi::shm::Link::canBeUsed(boost::none, machine));
+  EXPECT_FALSE(qi::shm::Link::canBeUsed(machine, AnyValue::from(true)));
+}
+
+namespace
+{
+  qi::CapabilityMap controlMap(const qi::Message& msg)
+  {
+    auto ref = msg.value(qi::typeOf<qi::CapabilityMap>()->signature(), qi::MessageSocketPtr{});
+    auto cm = ref.to<qi::CapabilityMap>();
+    ref.destroy();
+    return cm;
+  }
+}
+
+TEST(SharedMemoryLink, NegotiationSwitchesBothSides)
+{
+  qi::shm::Link client;
+  qi::shm::Link server;
+
+  qi::Promise<qi::Message> clientReceived;
+  qi::Promise<qi::Message> serverReceived;
+  auto onClientMessage = [&](qi::Message* msg) { clientReceived.setValue(*msg); return true; };
+  auto onServerMessage = [&](qi::Message* msg) { serverReceived.setValue(*msg); return true; };
+
+  auto offer = client.offer();
+  ASSERT_TRUE(offer);
+  EXPECT_EQ(qi::Message::Type_Capability, offer->type());
+  EXPECT_FALSE(client.offer()); // Only one offer at a time.
+
+  auto attached = server.handleControl(controlMap(*offer), true, onServerMessage, 1000);
+  ASSERT_TRUE(attached);
+  EXPECT_TRUE(server.isSending());
+  EXPECT_FALSE(client.isSending());
+
+  auto switched = client.handleControl(controlMap(*attached), true, onClientMessage, 1000);
+  ASSERT_TRUE(switched);
+  EXPECT_TRUE(client.isSending());
+
+  EXPECT_FALSE(server.handleControl(controlMap(*switched), true, onServerMessage, 1000));
+
+  const auto toServer = makeMessage(1, 50);
+  EXPECT_TRUE(client.send(toServer));
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, serverReceived.future().wait(defaultTimeout));
+  EXPECT_TRUE(samePayload(toServer, serverReceived.future().value()));
+
+  const auto toClient = makeMessage(2, 60);
+  EXPECT_TRUE(server.send(toClient));
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, clientReceived.future().wait(defaultTimeout));
+  EXPECT_TRUE(samePayload(toClient, clientReceived.future().value()));
+
+  // The stream must not be used once switched: sending fails if the
+  // segment is closed.
+  server.close();
+  EXPECT_TRUE(client.isSending());
+  EXPECT_FALSE(client.send(toServer));
+
+  client.close();
+  EXPECT_FALSE(client.send(toServer));
+}
+
+TEST(SharedMemoryLink, RefusedOfferKeepsTheStream)
+{
+  qi::shm::Link client;
+  qi::shm::Link server;
+  auto ignore = [](qi::Message*) { return true; };
+
+  auto offer = client.offer();
+  ASSERT_TRUE(offer);
+  auto refused = server.handleControl(controlMap(*offer), false, ignore, 1000);
+  ASSERT_TRUE(refused);
+  EXPECT_FALSE(server.isSending());
+
+  EXPECT_FALSE(client.handleControl(controlMap(*refused), true, ignore, 1000));
+  EXPECT_FALSE(client.isSending());
+  EXPECT_FALSE(client.send(makeMessage(1, 10)));
+  EXPECT_FALSE(client.offer()); // No new offer on this connection.
+}
+
+#endif // QI_SHARED_MEMORY_TRANSPORT
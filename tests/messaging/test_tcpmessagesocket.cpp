@@ -1,14 +1,19 @@
 #include <chrono>
 #include <numeric>
 #include <random>
+#include <thread>
 #include <gtest/gtest.h>
 #include "sock/networkmock.hpp"
 #include "sock/networkcommon.hpp"
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <qi/messaging/sock/accept.hpp>
+#include "src/messaging/batch.hpp"
+#include "src/messaging/compression.hpp"
+#include "src/messaging/fragmentation.hpp"
 #include "src/messaging/tcpmessagesocket.hpp"
 #include "src/messaging/transportserver.hpp"
+#include "src/messaging/transportserverasio_p.hpp"
 #include "tests/qi/testutils/testutils.hpp"
 #include "ka/scoped.hpp"
 
@@ -389,6 +394,67 @@ TYPED_TEST(NetMessageSocket, ReceiveOneMessageAsio)
   ASSERT_EQ(FutureState_FinishedWithValue, promiseReceivedMessage.future().wait(defaultTimeout));
 }
 
+// Batches skip the authentication of the messages they carry: they are
+// refused from a remote end that is not authenticated.
+// Sends `msg` to a server side socket whose remote end did not authenticate,
+// and expects the socket to disconnect without delivering any message.
+template<typename Fixture>
+void expectUnauthenticatedMessageDisconnects(Fixture& fixture, const qi::Message& msg)
+{
+  using namespace qi;
+  using namespace qi::sock;
+
+  TransportServer server;
+  const auto listenRes = fixture.listen(server);
+  auto& promiseServerSideSocket = listenRes.promiseConnectedSocket;
+
+  auto clientSideSocket = makeMessageSocket(fixture.scheme());
+  const auto _ = ka::scoped([=]{ clientSideSocket->disconnect().wait(defaultTimeout); });
+  ASSERT_EQ(FutureState_FinishedWithValue,
+            clientSideSocket->connect(listenRes.url).wait(defaultTimeout));
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseServerSideSocket.future().wait(defaultTimeout));
+  auto serverSideSocket = promiseServerSideSocket.future().value();
+
+  Promise<void> promiseDisconnected;
+  serverSideSocket->disconnected.connect([=](const std::string&) mutable {
+    promiseDisconnected.setValue(nullptr);
+  });
+  Promise<void> promiseReceivedMessage;
+  serverSideSocket->messageReady.connect([=](const Message&) mutable {
+    promiseReceivedMessage.setValue(nullptr);
+  });
+  ASSERT_TRUE(serverSideSocket->ensureReading());
+
+  ASSERT_TRUE(clientSideSocket->send(msg));
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseDisconnected.future().wait(defaultTimeout));
+  ASSERT_TRUE(promiseReceivedMessage.future().isRunning());
+}
+
+TYPED_TEST(NetMessageSocket, BatchFromUnauthenticatedRemoteDisconnects)
+{
+  const qi::Message call = makeMessage(qi::MessageAddress{1234, 5, 9876, 107});
+  expectUnauthenticatedMessageDisconnects(*this, qi::batch::pack({call, call}));
+}
+
+TYPED_TEST(NetMessageSocket, FragmentFromUnauthenticatedRemoteDisconnects)
+{
+  const qi::Message call = makeMessage(qi::MessageAddress{1234, 5, 9876, 107});
+  const auto fragments = qi::fragmentation::split(call, 1024);
+  ASSERT_LT(1u, fragments.size());
+  expectUnauthenticatedMessageDisconnects(*this, fragments.front());
+}
+
+TYPED_TEST(NetMessageSocket, CompressedMessageFromUnauthenticatedRemoteDisconnects)
+{
+  qi::Message call{qi::Message::Type_Call, qi::MessageAddress{1234, 5, 9876, 107}};
+  const std::vector<int> zeros(10000, 0);
+  qi::Buffer buffer;
+  buffer.write(zeros.data(), zeros.size() * sizeof(zeros[0]));
+  call.setBuffer(std::move(buffer));
+  ASSERT_TRUE(qi::compression::compressPayload(call, 1));
+  expectUnauthenticatedMessageDisconnects(*this, call);
+}
+
 TYPED_TEST(NetMessageSocketAsio, ReceiveManyMessages)
 {
   using namespace qi;
@@ -739,3 +805,49 @@ TEST(NetMessageSocketAsio, DistantCrashWhileConnected)
   Future<void> fut = socket->disconnect();
   ASSERT_EQ(FutureState_FinishedWithValue, fut.wait(defaultTimeout));
 }
+
+#if defined(SO_REUSEPORT)
+// An acceptor shard whose accept fails fatally is removed, and the remaining
+// acceptors keep accepting the connections.
+TEST(TransportServerAsio, FailingAcceptShardIsRemoved)
+{
+  using namespace qi;
+  using namespace qi::sock;
+
+  TransportServer server;
+  std::atomic<int> connectionCount{0};
+  server.newConnection.connect([&](const std::pair<MessageSocketPtr, Url>&) {
+    ++connectionCount;
+  });
+  auto impl = TransportServerAsioPrivate::make(&server, getNetworkEventLoop());
+  const auto _ = ka::scoped([=]{ impl->close(); });
+  impl->setAcceptorCount(3);
+  ASSERT_EQ(FutureState_FinishedWithValue,
+            impl->listen(Url{"tcp://127.0.0.1:0"}).wait(defaultTimeout));
+  ASSERT_EQ(2u, impl->shardCount());
+
+  // Shutting down a listening socket makes its pending accept fail fatally.
+  ASSERT_EQ(0, ::shutdown(impl->shardHandles().front(), SHUT_RD));
+  const auto deadline = SteadyClock::now() + defaultTimeout;
+  while (impl->shardCount() != 1u && SteadyClock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  ASSERT_EQ(1u, impl->shardCount());
+
+  const int clientCount = 8;
+  const Url url{"tcp://127.0.0.1:" + std::to_string(impl->_port)};
+  std::vector<MessageSocketPtr> clients;
+  const auto __ = ka::scoped([&]{
+    for (auto& client: clients)
+      client->disconnect().wait(defaultTimeout);
+  });
+  for (int i = 0; i < clientCount; ++i)
+  {
+    clients.push_back(makeMessageSocket("tcp"));
+    ASSERT_EQ(FutureState_FinishedWithValue,
+              clients.back()->connect(url).wait(defaultTimeout));
+  }
+  while (connectionCount.load() != clientCount && SteadyClock::now() < deadline + defaultTimeout)
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  ASSERT_EQ(clientCount, connectionCount.load());
+}
+#endif
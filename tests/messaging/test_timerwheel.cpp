@@ -0,0 +1,112 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <gtest/gtest.h>
+#include "src/messaging/timerwheel.hpp"
+
+namespace
+{
+  const qi::Duration resolution = qi::MilliSeconds(10);
+  const qi::SteadyClock::time_point start{};
+
+  qi::SteadyClock::time_point at(qi::Duration d)
+  {
+    return start + d;
+  }
+}
+
+TEST(TimerWheel, DeadlineExpiresAtItsTick)
+{
+  qi::TimerWheel wheel(resolution, start);
+  wheel.add(1, at(qi::MilliSeconds(25)));
+  EXPECT_EQ(1u, wheel.size());
+  EXPECT_TRUE(wheel.advance(at(qi::MilliSeconds(20))).empty());
+  EXPECT_EQ(std::vector<qi::TimerWheel::Key>{1}, wheel.advance(at(qi::MilliSeconds(30))));
+  EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheel, PastDeadlineExpiresAtNextTick)
+{
+  qi::TimerWheel wheel(resolution, start);
+  wheel.advance(at(qi::Seconds(1)));
+  wheel.add(1, at(qi::MilliSeconds(5)));
+  EXPECT_TRUE(wheel.advance(at(qi::Seconds(1))).empty());
+  EXPECT_EQ(1u, wheel.advance(at(qi::Seconds(1) + resolution)).size());
+}
+
+TEST(TimerWheel, RemovedDeadlineDoesNotExpire)
+{
+  qi::TimerWheel wheel(resolution, start);
+  wheel.add(1, at(qi::MilliSeconds(50)));
+  wheel.add(2, at(qi::MilliSeconds(50)));
+  EXPECT_TRUE(wheel.remove(1));
+  EXPECT_FALSE(wheel.remove(1));
+  EXPECT_EQ(std::vector<qi::TimerWheel::Key>{2}, wheel.advance(at(qi::Seconds(1))));
+}
+
+TEST(TimerWheel, AddingAgainReplacesTheDeadline)
+{
+  qi::TimerWheel wheel(resolution, start);
+  wheel.add(1, at(qi::MilliSeconds(50)));
+  wheel.add(1, at(qi::Seconds(2)));
+  EXPECT_EQ(1u, wheel.size());
+  EXPECT_TRUE(wheel.advance(at(qi::Seconds(1))).empty());
+  EXPECT_EQ(1u, wheel.advance(at(qi::Seconds(2))).size());
+}
+
+TEST(TimerWheel, FarDeadlinesCascadeToTheirTick)
+{
+  qi::TimerWheel wheel(resolution, start);
+  // Beyond the span of the first three levels.
+  const auto far = qi::Hours(2) + qi::MilliSeconds(130);
+  wheel.add(1, at(far));
+  EXPECT_TRUE(wheel.advance(at(far - resolution)).empty());
+  EXPECT_EQ(1u, wheel.advance(at(far)).size());
+}
+
+TEST(TimerWheel, ExpiresLikeASortedList)
+{
+  std::mt19937 random(42);
+  std::uniform_int_distribution<int> delays(0, 200000);
+  qi::TimerWheel wheel(resolution, start);
+  std::map<qi::TimerWheel::Key, qi::SteadyClock::time_point> deadlines;
+
+  qi::SteadyClock::time_point now = start;
+  for (qi::TimerWheel::Key key = 0; key < 5000; ++key)
+  {
+    const auto previous = now;
+    now += qi::MilliSeconds(delays(random) % 20);
+    for (auto expired: wheel.advance(now))
+    {
+      const auto it = deadlines.find(expired);
+      ASSERT_NE(deadlines.end(), it);
+      EXPECT_LE(it->second, now);
+      EXPECT_GT(it->second, previous - resolution);
+      deadlines.erase(it);
+    }
+    if (key % 100 == 0)
+    {
+      for (const auto& deadline: deadlines)
+        EXPECT_GT(deadline.second, now - resolution);
+    }
+
+    const auto deadline = now + qi::MilliSeconds(delays(random));
+    wheel.add(key, deadline);
+    deadlines[key] = deadline;
+    if (key % 7 == 0)
+    {
+      const auto removed = deadlines.begin()->first;
+      EXPECT_TRUE(wheel.remove(removed));
+      deadlines.erase(removed);
+    }
+  }
+  EXPECT_EQ(deadlines.size(), wheel.size());
+  const auto expired = wheel.advance(now + qi::Seconds(201));
+  EXPECT_EQ(deadlines.size(), expired.size());
+  EXPECT_TRUE(wheel.empty());
+}
@@ -6,6 +6,7 @@
 **
 */
 
+#include <set>
 #include <vector>
 #include <algorithm>
 #include <iterator>
@@ -171,6 +172,135 @@ TEST_F(TestTransportSocketCache, SameMachinePublicIp)
   client->disconnect();
 }
 
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+TEST_F(TestTransportSocketCache, SameMachinePrefersLocalSocket)
+{
+  const auto dir = qi::os::mktmpdir("test_transportsocketcache");
+  const qi::Url localUrl{"unix://" + dir + "/service.sock"};
+
+  server_.listen("tcp://127.0.0.1:0").wait();
+  ASSERT_FALSE(server_.listen(localUrl).hasError());
+  const qi::UrlVector endpoints = server_.endpoints();
+  ASSERT_NE(endpoints.end(), std::find(endpoints.begin(), endpoints.end(), localUrl));
+
+  qi::ServiceInfo info;
+  info.setMachineId(qi::os::getMachineId());
+  info.setEndpoints(endpoints);
+  qi::MessageSocketPtr sock = cache_.socket(info, "").value();
+  ASSERT_TRUE(sock->isConnected());
+  EXPECT_EQ("unix", sock->url().protocol());
+  sock->disconnect();
+}
+
+TEST_F(TestTransportSocketCache, DifferentMachineIgnoresLocalSocket)
+{
+  const auto dir = qi::os::mktmpdir("test_transportsocketcache");
+  const qi::Url localUrl{"unix://" + dir + "/service.sock"};
+
+  server_.listen("tcp://0.0.0.0:0").wait();
+  ASSERT_FALSE(server_.listen(localUrl).hasError());
+
+  qi::ServiceInfo info;
+  info.setMachineId("some other machine");
+  info.setEndpoints(server_.endpoints());
+  qi::MessageSocketPtr sock = cache_.socket(info, "").value();
+  ASSERT_TRUE(sock->isConnected());
+  EXPECT_EQ("tcp", sock->url().protocol());
+  sock->disconnect();
+}
+#endif
+
+TEST_F(TestTransportSocketCache, PoolSocketsAreGivenInTurn)
+{
+  server_.listen("tcp://127.0.0.1:0").wait();
+  cache_.setPoolSize("Pooled", 3);
+  EXPECT_EQ(3u, cache_.poolSize("Pooled"));
+  EXPECT_EQ(1u, cache_.poolSize("NotPooled"));
+
+  qi::ServiceInfo info;
+  info.setName("Pooled");
+  info.setMachineId(qi::os::getMachineId());
+  info.setEndpoints(server_.endpoints());
+
+  std::vector<qi::MessageSocketPtr> sockets;
+  for (int i = 0; i < 3; ++i)
+    sockets.push_back(cache_.socket(info, "").value());
+  for (const auto& socket: sockets)
+    ASSERT_TRUE(socket->isConnected());
+  EXPECT_NE(sockets[0], sockets[1]);
+  EXPECT_NE(sockets[0], sockets[2]);
+  EXPECT_NE(sockets[1], sockets[2]);
+
+  // The pool is full: its sockets are given again.
+  const auto socket = cache_.socket(info, "").value();
+  EXPECT_NE(sockets.end(), std::find(sockets.begin(), sockets.end(), socket));
+
+  // Other services use the first socket of the pool only.
+  qi::ServiceInfo otherInfo = info;
+  otherInfo.setName("NotPooled");
+  EXPECT_EQ(sockets[0], cache_.socket(otherInfo, "").value());
+  EXPECT_EQ(sockets[0], cache_.socket(otherInfo, "").value());
+}
+
+// A session requests a socket once per service: the pool spreads the
+// services of an endpoint, while each service keeps a single socket.
+TEST_F(TestTransportSocketCache, PoolSpreadsTheServicesOfAnEndpoint)
+{
+  server_.listen("tcp://127.0.0.1:0").wait();
+  const std::vector<std::string> names{"Perception", "Storage", "Motion"};
+  for (const auto& name: names)
+    cache_.setPoolSize(name, 3);
+
+  std::set<qi::MessageSocketPtr> sockets;
+  for (const auto& name: names)
+  {
+    qi::ServiceInfo info;
+    info.setName(name);
+    info.setMachineId(qi::os::getMachineId());
+    info.setEndpoints(server_.endpoints());
+    const auto socket = cache_.socket(info, "").value();
+    ASSERT_TRUE(socket->isConnected());
+    sockets.insert(socket);
+  }
+  EXPECT_EQ(names.size(), sockets.size());
+}
+
+TEST_F(TestTransportSocketCache, DisconnectedPoolSocketIsReplaced)
+{
+  server_.listen("tcp://127.0.0.1:0").wait();
+  cache_.setPoolSize("Pooled", 2);
+
+  qi::ServiceInfo info;
+  info.setName("Pooled");
+  info.setMachineId(qi::os::getMachineId());
+  info.setEndpoints(server_.endpoints());
+
+  const auto first = cache_.socket(info, "").value();
+  const auto second = cache_.socket(info, "").value();
+  ASSERT_NE(first, second);
+  cache_.disconnect(second).wait();
+
+  const auto third = cache_.socket(info, "").value();
+  EXPECT_NE(first, third);
+  EXPECT_NE(second, third);
+  EXPECT_TRUE(third->isConnected());
+}
+
+TEST(TestTransportSocketCachePoolSizes, ParsedFromEnv)
+{
+  const std::string initialEnvValue = qi::os::getenv("QI_TRANSPORT_SOCKET_POOL");
+  const auto _ = ka::scoped([&]{ qi::os::setenv("QI_TRANSPORT_SOCKET_POOL", initialEnvValue.c_str()); });
+
+  qi::os::setenv("QI_TRANSPORT_SOCKET_POOL", "Perception=4, Storage=2,3,Invalid=x,Zero=0");
+  const auto sizes = qi::TransportSocketCache::poolSizesFromEnv();
+  EXPECT_EQ(3u, sizes.defaultSize);
+  const std::map<std::string, unsigned int> expected{{"Perception", 4}, {"Storage", 2}};
+  EXPECT_EQ(expected, sizes.serviceSizes);
+
+  qi::os::setenv("QI_TRANSPORT_SOCKET_POOL", "");
+  EXPECT_EQ(1u, qi::TransportSocketCache::poolSizesFromEnv().defaultSize);
+}
+
 TEST(TestCall, IPV6Accepted)
 {
   // todo: enable whenever qi::Url properly supports ipv6
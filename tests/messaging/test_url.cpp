@@ -154,6 +154,50 @@ TEST(TestURL, ValidUrl)
   EXPECT_EQ("tcp://example.com:5", url.str());
 }
 
+TEST(TestURL, LocalSocketUrl)
+{
+  qi::Url url("unix:///tmp/qi.sock");
+
+  EXPECT_EQ("unix", url.protocol());
+  EXPECT_EQ("/tmp/qi.sock", url.host());
+  EXPECT_FALSE(url.hasPort());
+  EXPECT_TRUE(url.isValid());
+  EXPECT_EQ("unix:///tmp/qi.sock", url.str());
+
+  url = qi::Url("unix:///tmp/qi.sock", "tcp", 9559);
+
+  EXPECT_EQ("unix", url.protocol());
+  EXPECT_EQ("/tmp/qi.sock", url.host());
+  EXPECT_TRUE(url.isValid());
+
+  url = "unix://";
+  EXPECT_FALSE(url.isValid());
+}
+
+TEST(TestURL, LocalSocketPathWithColons)
+{
+  qi::Url url("unix:///tmp/qi:9559.sock");
+  EXPECT_EQ("/tmp/qi:9559.sock", url.host());
+  EXPECT_FALSE(url.hasPort());
+  EXPECT_TRUE(url.isValid());
+  EXPECT_EQ("unix:///tmp/qi:9559.sock", url.str());
+
+  url = qi::Url("unix:///tmp/qi:sock", "tcp", 9559);
+  EXPECT_EQ("/tmp/qi:sock", url.host());
+  EXPECT_FALSE(url.hasPort());
+  EXPECT_EQ("unix:///tmp/qi:sock", url.str());
+
+  url = qi::Url("/tmp/qi:sock", "unix", 9559);
+  EXPECT_EQ("/tmp/qi:sock", url.host());
+  EXPECT_FALSE(url.hasPort());
+  EXPECT_EQ("unix:///tmp/qi:sock", url.str());
+
+  url = qi::specifyUrl(qi::Url("unix:///tmp/qi.sock"), qi::Url("tcp://127.0.0.1:9559"));
+  EXPECT_EQ("/tmp/qi.sock", url.host());
+  EXPECT_FALSE(url.hasPort());
+  EXPECT_EQ("unix:///tmp/qi.sock", url.str());
+}
+
 TEST(TestURL, CopyUrl)
 {
   qi::Url url("tcp://example.com:5");